@@ -1,6 +1,8 @@
 # SPDX-License-Identifier: MIT
 # This file is derrived from esp32_camera component of ESPHome
 
+import re
+
 import esphome.codegen as cg
 import esphome.config_validation as cv
 from esphome import automation
@@ -8,7 +10,12 @@ from esphome import pins
 from esphome.const import (
     CONF_FREQUENCY,
     CONF_ID,
+    CONF_INTERVAL,
+    CONF_MODE,
+    CONF_PRIORITY,
     CONF_RESOLUTION,
+    CONF_THRESHOLD,
+    CONF_TIMEOUT,
     CONF_TRIGGER_ID,
 )
 from esphome.core import CORE, TimePeriod
@@ -23,7 +30,11 @@ DEPENDENCIES = ["esp32", "camera"]
 
 AUTO_LOAD = ["camera", "psram"]
 
+# usb_stream drives a single UVC device, so there is one usb_webcam per node
+# (no MULTI_CONF). Its state is per instance all the same.
+
 usb_webcam_ns = cg.esphome_ns.namespace("usb_webcam")
+CameraRequester = cg.esphome_ns.namespace("camera").enum("CameraRequester")
 USBWebCam = usb_webcam_ns.class_("USBWebCam", cg.PollingComponent, cg.EntityBase)
 USBWebCamStreamStartTrigger = usb_webcam_ns.class_(
     "USBWebCamStreamStartTrigger",
@@ -33,62 +44,336 @@ USBWebCamStreamStopTrigger = usb_webcam_ns.class_(
     "USBWebCamStreamStopTrigger",
     automation.Trigger.template(),
 )
-USBWebCamFrameSize = usb_webcam_ns.enum("USBWebCamFrameSize")
+USBWebCamMotionTrigger = usb_webcam_ns.class_(
+    "USBWebCamMotionTrigger",
+    automation.Trigger.template(),
+)
+FrameRingSnapshotPtr = cg.std_shared_ptr.template(
+    usb_webcam_ns.class_("FrameRingSnapshot")
+)
+USBWebCamPrerollTrigger = usb_webcam_ns.class_(
+    "USBWebCamPrerollTrigger",
+    automation.Trigger.template(FrameRingSnapshotPtr),
+)
+USBWebCamCapturePrerollAction = usb_webcam_ns.class_(
+    "USBWebCamCapturePrerollAction", automation.Action
+)
+USBWebCamStartRecordingAction = usb_webcam_ns.class_(
+    "USBWebCamStartRecordingAction", automation.Action
+)
+USBWebCamStopRecordingAction = usb_webcam_ns.class_(
+    "USBWebCamStopRecordingAction", automation.Action
+)
+
+CONF_USB_WEBCAM_ID = "usb_webcam_id"
 FRAME_SIZES = {
-    "160X120": USBWebCamFrameSize.USB_WEBCAM_SIZE_160X120,
-    "QQVGA": USBWebCamFrameSize.USB_WEBCAM_SIZE_160X120,
-    "176X144": USBWebCamFrameSize.USB_WEBCAM_SIZE_176X144,
-    "QCIF": USBWebCamFrameSize.USB_WEBCAM_SIZE_176X144,
-    "240X176": USBWebCamFrameSize.USB_WEBCAM_SIZE_240X176,
-    "HQVGA": USBWebCamFrameSize.USB_WEBCAM_SIZE_240X176,
-    "320X240": USBWebCamFrameSize.USB_WEBCAM_SIZE_320X240,
-    "QVGA": USBWebCamFrameSize.USB_WEBCAM_SIZE_320X240,
-    "400X296": USBWebCamFrameSize.USB_WEBCAM_SIZE_400X296,
-    "CIF": USBWebCamFrameSize.USB_WEBCAM_SIZE_400X296,
-    "640X480": USBWebCamFrameSize.USB_WEBCAM_SIZE_640X480,
-    "VGA": USBWebCamFrameSize.USB_WEBCAM_SIZE_640X480,
-    "800X600": USBWebCamFrameSize.USB_WEBCAM_SIZE_800X600,
-    "SVGA": USBWebCamFrameSize.USB_WEBCAM_SIZE_800X600,
-    "1024X768": USBWebCamFrameSize.USB_WEBCAM_SIZE_1024X768,
-    "XGA": USBWebCamFrameSize.USB_WEBCAM_SIZE_1024X768,
-    "1280X1024": USBWebCamFrameSize.USB_WEBCAM_SIZE_1280X1024,
-    "SXGA": USBWebCamFrameSize.USB_WEBCAM_SIZE_1280X1024,
-    "1600X1200": USBWebCamFrameSize.USB_WEBCAM_SIZE_1600X1200,
-    "UXGA": USBWebCamFrameSize.USB_WEBCAM_SIZE_1600X1200,
-    "1920X1080": USBWebCamFrameSize.USB_WEBCAM_SIZE_1920X1080,
-    "FHD": USBWebCamFrameSize.USB_WEBCAM_SIZE_1920X1080,
-    "720X1280": USBWebCamFrameSize.USB_WEBCAM_SIZE_720X1280,
-    "PHD": USBWebCamFrameSize.USB_WEBCAM_SIZE_720X1280,
-    "864X1536": USBWebCamFrameSize.USB_WEBCAM_SIZE_864X1536,
-    "P3MP": USBWebCamFrameSize.USB_WEBCAM_SIZE_864X1536,
-    "2048X1536": USBWebCamFrameSize.USB_WEBCAM_SIZE_2048X1536,
-    "QXGA": USBWebCamFrameSize.USB_WEBCAM_SIZE_2048X1536,
-    "2560X1440": USBWebCamFrameSize.USB_WEBCAM_SIZE_2560X1440,
-    "QHD": USBWebCamFrameSize.USB_WEBCAM_SIZE_2560X1440,
-    "2560X1600": USBWebCamFrameSize.USB_WEBCAM_SIZE_2560X1600,
-    "WQXGA": USBWebCamFrameSize.USB_WEBCAM_SIZE_2560X1600,
-    "1080X1920": USBWebCamFrameSize.USB_WEBCAM_SIZE_1080X1920,
-    "PFHD": USBWebCamFrameSize.USB_WEBCAM_SIZE_1080X1920,
-    "2560X1920": USBWebCamFrameSize.USB_WEBCAM_SIZE_2560X1920,
-    "QSXGA": USBWebCamFrameSize.USB_WEBCAM_SIZE_2560X1920,
+    "160X120": (160, 120),
+    "QQVGA": (160, 120),
+    "176X144": (176, 144),
+    "QCIF": (176, 144),
+    "240X176": (240, 176),
+    "HQVGA": (240, 176),
+    "320X240": (320, 240),
+    "QVGA": (320, 240),
+    "400X296": (400, 296),
+    "CIF": (400, 296),
+    "640X480": (640, 480),
+    "VGA": (640, 480),
+    "800X600": (800, 600),
+    "SVGA": (800, 600),
+    "1024X768": (1024, 768),
+    "XGA": (1024, 768),
+    "1280X1024": (1280, 1024),
+    "SXGA": (1280, 1024),
+    "1600X1200": (1600, 1200),
+    "UXGA": (1600, 1200),
+    "1920X1080": (1920, 1080),
+    "FHD": (1920, 1080),
+    "720X1280": (720, 1280),
+    "PHD": (720, 1280),
+    "864X1536": (864, 1536),
+    "P3MP": (864, 1536),
+    "2048X1536": (2048, 1536),
+    "QXGA": (2048, 1536),
+    "2560X1440": (2560, 1440),
+    "QHD": (2560, 1440),
+    "2560X1600": (2560, 1600),
+    "WQXGA": (2560, 1600),
+    "1080X1920": (1080, 1920),
+    "PFHD": (1080, 1920),
+    "2560X1920": (2560, 1920),
+    "QSXGA": (2560, 1920),
 }
 
+USBWebCamResolutionMatch = usb_webcam_ns.enum("USBWebCamResolutionMatch")
+RESOLUTION_MATCHES = {
+    "EXACT": USBWebCamResolutionMatch.USB_WEBCAM_MATCH_EXACT,
+    "NEAREST_BELOW": USBWebCamResolutionMatch.USB_WEBCAM_MATCH_NEAREST_BELOW,
+    "BANDWIDTH": USBWebCamResolutionMatch.USB_WEBCAM_MATCH_BANDWIDTH,
+}
+
+
+def validate_resolution(value):
+    value = cv.string(value).upper()
+    if value in FRAME_SIZES:
+        return FRAME_SIZES[value]
+    match = re.match(r"^(\d+)X(\d+)$", value)
+    if match is None:
+        raise cv.Invalid(
+            f"Unknown resolution {value}, use WIDTHxHEIGHT or one of {', '.join(FRAME_SIZES)}"
+        )
+    return (
+        cv.int_range(min=1, max=65535)(int(match.group(1))),
+        cv.int_range(min=1, max=65535)(int(match.group(2))),
+    )
+
+
+FramePoolPolicy = usb_webcam_ns.enum("FramePoolPolicy")
+FRAME_BUFFER_POLICIES = {
+    "DROP_OLDEST": FramePoolPolicy.FRAME_POOL_DROP_OLDEST,
+    "DROP_NEWEST": FramePoolPolicy.FRAME_POOL_DROP_NEWEST,
+}
+
+USBWebCamFrameValidation = usb_webcam_ns.enum("USBWebCamFrameValidation")
+FRAME_VALIDATIONS = {
+    "NONE": USBWebCamFrameValidation.USB_WEBCAM_VALIDATION_NONE,
+    "BASIC": USBWebCamFrameValidation.USB_WEBCAM_VALIDATION_BASIC,
+    "STRICT": USBWebCamFrameValidation.USB_WEBCAM_VALIDATION_STRICT,
+}
+
+USBWebCamTransferMode = usb_webcam_ns.enum("USBWebCamTransferMode")
+TRANSFER_MODES = {
+    "AUTO": USBWebCamTransferMode.USB_WEBCAM_TRANSFER_AUTO,
+    "ISOC": USBWebCamTransferMode.USB_WEBCAM_TRANSFER_ISOC,
+    "BULK": USBWebCamTransferMode.USB_WEBCAM_TRANSFER_BULK,
+}
+
+
+def validate_hex_bytes(value):
+    value = re.sub(r"[\s:,]|0x", "", cv.string(value))
+    if len(value) % 2 != 0 or re.fullmatch(r"[0-9a-fA-F]*", value) is None:
+        raise cv.Invalid("Expected hex bytes, e.g. '09 02 ...'")
+    return list(bytes.fromhex(value))
+
+
+# image
+CONF_RESOLUTION_MATCH = "resolution_match"
+
+# usb transfer
+CONF_TRANSFER = "transfer"
+CONF_INTERFACE = "interface"
+CONF_ALT_SETTING = "alt_setting"
+CONF_ENDPOINT = "endpoint"
+CONF_MAX_PACKET_SIZE = "max_packet_size"
+CONF_URBS = "urbs"
+CONF_PACKETS_PER_URB = "packets_per_urb"
+CONF_CONFIG_DESCRIPTOR = "config_descriptor"
+
 # frames
 CONF_MAX_FRAMERATE = "max_framerate"
 CONF_IDLE_FRAMERATE = "idle_framerate"
+CONF_API_MAX_FRAMERATE = "api_max_framerate"
+CONF_WEB_MAX_FRAMERATE = "web_max_framerate"
+
+# downscaled output
+CONF_API_SCALE = "api_scale"
+CONF_SCALE_QUALITY = "scale_quality"
+SCALES = {"1/1": 0, "1/2": 1, "1/4": 2, "1/8": 3}
+
+# duplicate frames
+CONF_SKIP_DUPLICATE_FRAMES = "skip_duplicate_frames"
+CONF_DUPLICATE_THRESHOLD = "duplicate_threshold"
+SKIP_DUPLICATE_FRAMES = {
+    "NONE": [],
+    "API": [CameraRequester.API_REQUESTER],
+    "WEB": [CameraRequester.WEB_REQUESTER],
+    "ALL": [CameraRequester.API_REQUESTER, CameraRequester.WEB_REQUESTER],
+}
 CONF_DROP_FRAME_SIZE = "drop_frame_size"
+CONF_FRAME_VALIDATION = "frame_validation"
+CONF_FRAME_BUFFER_SIZE = "frame_buffer_size"
+CONF_FRAME_BUFFER_COUNT = "frame_buffer_count"
+CONF_FRAME_BUFFER_POLICY = "frame_buffer_policy"
+
+# motion detection
+CONF_MOTION = "motion"
+CONF_MIN_AREA = "min_area"
+CONF_BACKGROUND_FRAMES = "background_frames"
+CONF_GATE_STREAMS = "gate_streams"
+BACKGROUND_FRAMES = {2: 1, 4: 2, 8: 3, 16: 4, 32: 5, 64: 6}
+
+# pre-roll
+CONF_PREROLL = "preroll"
+CONF_SIZE = "size"
+CONF_FRAMERATE = "framerate"
+
+# recording
+CONF_RECORDING = "recording"
+CONF_PATH = "path"
+CONF_SEGMENT_SIZE = "segment_size"
+CONF_BUFFER_SIZE = "buffer_size"
+CONF_BLOCK_SIZE = "block_size"
+CONF_AUTOSTART = "autostart"
+
+# reconnect
+CONF_STALL_TIMEOUT = "stall_timeout"
+
+# power save
+CONF_POWER_SAVE = "power_save"
+CONF_SUSPEND_AFTER = "suspend_after"
+CONF_WARMUP_FRAMES = "warmup_frames"
+
+# tasks
+CONF_TASKS = "tasks"
+CONF_USB = "usb"
+CONF_FRAMES = "frames"
+CONF_WORKER = "worker"
+CONF_RECORDER = "recorder"
+CONF_CORE = "core"
+CONF_STACK_SIZE = "stack_size"
+CONF_REPORT_INTERVAL = "report_interval"
 
 # stream trigger
 CONF_ON_STREAM_START = "on_stream_start"
 CONF_ON_STREAM_STOP = "on_stream_stop"
+CONF_ON_MOTION = "on_motion"
+CONF_ON_PREROLL = "on_preroll"
+
+PREROLL_SCHEMA = cv.Schema(
+    {
+        # bytes of PSRAM holding the most recent frames
+        cv.Required(CONF_SIZE): cv.int_range(min=64 * 1024, max=16 * 1024 * 1024),
+        cv.Optional(CONF_FRAMERATE, default="2 fps"): cv.All(
+            cv.framerate, cv.Range(min=0, min_included=False, max=60)
+        ),
+    }
+)
+
+def _validate_recording(config):
+    if config[CONF_BLOCK_SIZE] % 512 != 0:
+        raise cv.Invalid(
+            f"{CONF_BLOCK_SIZE} must be a multiple of the 512 byte sector",
+            path=[CONF_BLOCK_SIZE],
+        )
+    # one block written, one kept back to close a segment, at least one filling
+    if not 3 <= config[CONF_BUFFER_SIZE] // config[CONF_BLOCK_SIZE] <= 64:
+        raise cv.Invalid(
+            f"{CONF_BUFFER_SIZE} must hold 3 to 64 blocks of {CONF_BLOCK_SIZE}",
+            path=[CONF_BUFFER_SIZE],
+        )
+    return config
+
+RECORDING_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            # directory on a mounted filesystem, e.g. an SD card
+            cv.Required(CONF_PATH): cv.string_strict,
+            cv.Optional(CONF_FRAMERATE, default="5 fps"): cv.All(
+                cv.framerate, cv.Range(min=0, min_included=False, max=60)
+            ),
+            cv.Optional(CONF_SEGMENT_SIZE, default=64 * 1024 * 1024): cv.int_range(
+                min=1024 * 1024, max=2 * 1024 * 1024 * 1024 - 1
+            ),
+            # write-behind buffer in PSRAM, written out in blocks
+            cv.Optional(CONF_BUFFER_SIZE, default=512 * 1024): cv.int_range(
+                min=12 * 1024, max=16 * 1024 * 1024
+            ),
+            cv.Optional(CONF_BLOCK_SIZE, default=32 * 1024): cv.int_range(
+                min=4096, max=1024 * 1024
+            ),
+            cv.Optional(CONF_AUTOSTART, default=False): cv.boolean,
+        }
+    ),
+    _validate_recording,
+)
+
+POWER_SAVE_SCHEMA = cv.Schema(
+    {
+        # nothing requested this long suspends the stream
+        cv.Optional(CONF_SUSPEND_AFTER, default="5s"): cv.All(
+            cv.positive_time_period_milliseconds,
+            cv.Range(min=TimePeriod(milliseconds=100)),
+        ),
+        # discarded after resuming while auto exposure settles
+        cv.Optional(CONF_WARMUP_FRAMES, default=3): cv.int_range(min=0, max=30),
+    }
+)
+
+def task_schema(priority, stack_size, core=None):
+    # usb_stream tasks keep the sdkconfig default core unless one is given
+    core_key = (
+        cv.Optional(CONF_CORE) if core is None else cv.Optional(CONF_CORE, default=core)
+    )
+    return cv.Schema(
+        {
+            core_key: cv.int_range(min=0, max=1),
+            cv.Optional(CONF_PRIORITY, default=priority): cv.int_range(
+                min=0, max=24
+            ),
+            cv.Optional(CONF_STACK_SIZE, default=stack_size): cv.int_range(
+                min=2048, max=32768
+            ),
+        }
+    )
+
+TASKS_SCHEMA = cv.Schema(
+    {
+        # usb_stream, USB transfers
+        cv.Optional(CONF_USB, default={}): task_schema(2, 3072),
+        # usb_stream, frame assembly and the frame callback
+        cv.Optional(CONF_FRAMES, default={}): task_schema(0, 3072),
+        # downscaling, motion and duplicate checks
+        cv.Optional(CONF_WORKER, default={}): task_schema(1, 4096, core=0),
+        # writes recorded frames to storage
+        cv.Optional(CONF_RECORDER, default={}): task_schema(1, 4096, core=0),
+        # log stack head room and CPU share of the pipeline tasks
+        cv.Optional(CONF_REPORT_INTERVAL): cv.positive_time_period_milliseconds,
+    }
+)
+
+MOTION_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_INTERVAL, default="200ms"): cv.All(
+            cv.positive_time_period_milliseconds,
+            cv.Range(min=TimePeriod(milliseconds=1)),
+        ),
+        # per 8x8 block, on the 0..255 luma scale
+        cv.Optional(CONF_THRESHOLD, default=12): cv.int_range(min=1, max=255),
+        cv.Optional(CONF_MIN_AREA, default="2%"): cv.percentage,
+        # how many checks the background takes to follow a change
+        cv.Optional(CONF_BACKGROUND_FRAMES, default=16): cv.one_of(
+            *BACKGROUND_FRAMES, int=True
+        ),
+        cv.Optional(CONF_TIMEOUT, default="5s"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_GATE_STREAMS, default=False): cv.boolean,
+    }
+)
+
+TRANSFER_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_MODE, default="AUTO"): cv.enum(TRANSFER_MODES, upper=True),
+        # used as is without a descriptor
+        cv.Optional(CONF_INTERFACE, default=1): cv.uint8_t,
+        cv.Optional(CONF_ALT_SETTING, default=1): cv.uint8_t,
+        cv.Optional(CONF_ENDPOINT, default=0x83): cv.hex_uint8_t,
+        # upper limit when choosing from the descriptor
+        cv.Optional(CONF_MAX_PACKET_SIZE, default=512): cv.int_range(min=8, max=1023),
+        cv.Optional(CONF_URBS): cv.int_range(min=1, max=8),  # 2 bulk, 3 isochronous
+        cv.Optional(CONF_PACKETS_PER_URB, default=4): cv.int_range(min=1, max=32),
+        # raw configuration descriptor of the camera
+        cv.Optional(CONF_CONFIG_DESCRIPTOR): validate_hex_bytes,
+    }
+)
 
 CONFIG_SCHEMA = cv.ENTITY_BASE_SCHEMA.extend(
     {
         cv.GenerateID(): cv.declare_id(USBWebCam),
         # image
-        cv.Optional(CONF_RESOLUTION, default="640X480"): cv.enum(
-            FRAME_SIZES, upper=True
+        cv.Optional(CONF_RESOLUTION, default="640X480"): validate_resolution,
+        cv.Optional(CONF_RESOLUTION_MATCH, default="NEAREST_BELOW"): cv.enum(
+            RESOLUTION_MATCHES, upper=True
         ),
+        cv.Optional(CONF_TRANSFER, default={}): TRANSFER_SCHEMA,
         # framerates
         cv.Optional(CONF_MAX_FRAMERATE, default="5 fps"): cv.All(
             cv.framerate, cv.Range(min=0, min_included=False, max=60)
@@ -96,9 +381,45 @@ CONFIG_SCHEMA = cv.ENTITY_BASE_SCHEMA.extend(
         cv.Optional(CONF_IDLE_FRAMERATE, default="0.1 fps"): cv.All(
             cv.framerate, cv.Range(min=0, max=1)
         ),
-        cv.Optional(CONF_DROP_FRAME_SIZE, default="7000"): cv.All(
+        # per consumer, at most max_framerate
+        cv.Optional(CONF_API_MAX_FRAMERATE): cv.All(
+            cv.framerate, cv.Range(min=0, min_included=False, max=60)
+        ),
+        cv.Optional(CONF_WEB_MAX_FRAMERATE): cv.All(
+            cv.framerate, cv.Range(min=0, min_included=False, max=60)
+        ),
+        # thumbnails for Home Assistant, scaled on the second core
+        cv.Optional(CONF_API_SCALE, default="1/1"): cv.one_of(*SCALES),
+        cv.Optional(CONF_SCALE_QUALITY, default=80): cv.int_range(min=1, max=100),
+        # hold back stream frames that look like the last one sent
+        cv.Optional(CONF_SKIP_DUPLICATE_FRAMES, default="NONE"): cv.one_of(
+            *SKIP_DUPLICATE_FRAMES, upper=True
+        ),
+        cv.Optional(CONF_DUPLICATE_THRESHOLD, default=4): cv.int_range(min=0, max=254),
+        cv.Optional(CONF_MOTION): MOTION_SCHEMA,
+        cv.Optional(CONF_PREROLL): PREROLL_SCHEMA,
+        cv.Optional(CONF_RECORDING): RECORDING_SCHEMA,
+        cv.Optional(CONF_POWER_SAVE): POWER_SAVE_SCHEMA,
+        cv.Optional(CONF_TASKS, default={}): TASKS_SCHEMA,
+        cv.Optional(CONF_DROP_FRAME_SIZE, default="0"): cv.All(
             cv.int_range(min=0, max=100000)
         ),
+        cv.Optional(CONF_FRAME_VALIDATION, default="BASIC"): cv.enum(
+            FRAME_VALIDATIONS, upper=True
+        ),
+        cv.Optional(CONF_FRAME_BUFFER_SIZE, default="AUTO"): cv.Any(
+            cv.one_of("AUTO", upper=True),
+            cv.int_range(min=8 * 1024, max=2 * 1024 * 1024),
+        ),
+        cv.Optional(CONF_FRAME_BUFFER_COUNT, default=3): cv.int_range(min=1, max=8),
+        cv.Optional(CONF_FRAME_BUFFER_POLICY, default="DROP_OLDEST"): cv.enum(
+            FRAME_BUFFER_POLICIES, upper=True
+        ),
+        # a connected camera sending no frames this long gets its stream restarted
+        cv.Optional(CONF_STALL_TIMEOUT, default="5s"): cv.All(
+            cv.positive_time_period_milliseconds,
+            cv.Range(min=TimePeriod(seconds=1)),
+        ),
         cv.Optional(CONF_ON_STREAM_START): automation.validate_automation(
             {
                 cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(
@@ -113,11 +434,38 @@ CONFIG_SCHEMA = cv.ENTITY_BASE_SCHEMA.extend(
                 ),
             }
         ),
+        cv.Optional(CONF_ON_MOTION): automation.validate_automation(
+            {
+                cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(USBWebCamMotionTrigger),
+            }
+        ),
+        cv.Optional(CONF_ON_PREROLL): automation.validate_automation(
+            {
+                cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(USBWebCamPrerollTrigger),
+            }
+        ),
     }
 ).extend(cv.COMPONENT_SCHEMA)
 
 def _final_validate(config):
-    return
+    for key in (CONF_API_MAX_FRAMERATE, CONF_WEB_MAX_FRAMERATE):
+        if key in config and config[key] > config[CONF_MAX_FRAMERATE]:
+            raise cv.Invalid(f"{key} can't be above {CONF_MAX_FRAMERATE}", path=[key])
+    if CONF_ON_MOTION in config and CONF_MOTION not in config:
+        raise cv.Invalid(
+            f"{CONF_ON_MOTION} needs a {CONF_MOTION} block", path=[CONF_ON_MOTION]
+        )
+    if CONF_ON_PREROLL in config and CONF_PREROLL not in config:
+        raise cv.Invalid(
+            f"{CONF_ON_PREROLL} needs a {CONF_PREROLL} block", path=[CONF_ON_PREROLL]
+        )
+
+    for key in (CONF_MOTION, CONF_PREROLL):
+        if CONF_POWER_SAVE in config and key in config:
+            raise cv.Invalid(
+                f"{CONF_POWER_SAVE} can't suspend the stream {key} needs",
+                path=[CONF_POWER_SAVE],
+            )
 
 FINAL_VALIDATE_SCHEMA = _final_validate
 
@@ -132,8 +480,90 @@ async def to_code(config):
         cg.add(var.set_idle_update_interval(0))
     else:
         cg.add(var.set_idle_update_interval(1000 / config[CONF_IDLE_FRAMERATE]))
+    for key, requester in (
+        (CONF_API_MAX_FRAMERATE, CameraRequester.API_REQUESTER),
+        (CONF_WEB_MAX_FRAMERATE, CameraRequester.WEB_REQUESTER),
+    ):
+        if key in config:
+            cg.add(var.set_requester_update_interval(requester, 1000 / config[key]))
+    if SCALES[config[CONF_API_SCALE]] != 0:
+        cg.add(
+            var.set_requester_scale(
+                CameraRequester.API_REQUESTER, SCALES[config[CONF_API_SCALE]]
+            )
+        )
+        cg.add(var.set_scale_quality(config[CONF_SCALE_QUALITY]))
+    for requester in SKIP_DUPLICATE_FRAMES[config[CONF_SKIP_DUPLICATE_FRAMES]]:
+        cg.add(var.set_requester_skip_duplicates(requester, True))
+    if SKIP_DUPLICATE_FRAMES[config[CONF_SKIP_DUPLICATE_FRAMES]]:
+        cg.add(var.set_duplicate_threshold(config[CONF_DUPLICATE_THRESHOLD]))
+    if CONF_PREROLL in config:
+        preroll = config[CONF_PREROLL]
+        cg.add(var.set_preroll_size(preroll[CONF_SIZE]))
+        cg.add(var.set_preroll_interval(1000 / preroll[CONF_FRAMERATE]))
+    if CONF_MOTION in config:
+        motion = config[CONF_MOTION]
+        cg.add(var.set_motion_interval(motion[CONF_INTERVAL]))
+        cg.add(var.set_motion_threshold(motion[CONF_THRESHOLD]))
+        cg.add(var.set_motion_min_area(round(motion[CONF_MIN_AREA] * 1000)))
+        cg.add(
+            var.set_motion_background_shift(
+                BACKGROUND_FRAMES[motion[CONF_BACKGROUND_FRAMES]]
+            )
+        )
+        cg.add(var.set_motion_timeout(motion[CONF_TIMEOUT]))
+        cg.add(var.set_motion_gate(motion[CONF_GATE_STREAMS]))
+    tasks = config[CONF_TASKS]
+    worker = tasks[CONF_WORKER]
+    cg.add(
+        var.set_worker_task(
+            worker[CONF_CORE], worker[CONF_PRIORITY], worker[CONF_STACK_SIZE]
+        )
+    )
+    recorder = tasks[CONF_RECORDER]
+    cg.add(
+        var.set_recorder_task(
+            recorder[CONF_CORE], recorder[CONF_PRIORITY], recorder[CONF_STACK_SIZE]
+        )
+    )
+    if CONF_REPORT_INTERVAL in tasks:
+        cg.add(var.set_task_report_interval(tasks[CONF_REPORT_INTERVAL]))
+    if CONF_RECORDING in config:
+        recording = config[CONF_RECORDING]
+        cg.add(var.set_recording_path(recording[CONF_PATH].rstrip("/")))
+        cg.add(var.set_recording_interval(1000 / recording[CONF_FRAMERATE]))
+        cg.add(var.set_recording_segment_size(recording[CONF_SEGMENT_SIZE]))
+        cg.add(
+            var.set_recording_buffer(
+                recording[CONF_BUFFER_SIZE], recording[CONF_BLOCK_SIZE]
+            )
+        )
+        cg.add(var.set_recording_autostart(recording[CONF_AUTOSTART]))
     cg.add(var.set_drop_size(config[CONF_DROP_FRAME_SIZE]))
-    cg.add(var.set_frame_size(config[CONF_RESOLUTION]))
+    cg.add(var.set_frame_validation(config[CONF_FRAME_VALIDATION]))
+    if config[CONF_FRAME_BUFFER_SIZE] != "AUTO":
+        cg.add(var.set_frame_buffer_size(config[CONF_FRAME_BUFFER_SIZE]))
+    cg.add(var.set_frame_buffer_count(config[CONF_FRAME_BUFFER_COUNT]))
+    cg.add(var.set_frame_buffer_policy(config[CONF_FRAME_BUFFER_POLICY]))
+    cg.add(var.set_stall_timeout(config[CONF_STALL_TIMEOUT]))
+    if CONF_POWER_SAVE in config:
+        power_save = config[CONF_POWER_SAVE]
+        cg.add(var.set_suspend_after(power_save[CONF_SUSPEND_AFTER]))
+        cg.add(var.set_warmup_frames(power_save[CONF_WARMUP_FRAMES]))
+    cg.add(var.set_frame_size(*config[CONF_RESOLUTION]))
+    cg.add(var.set_resolution_match(config[CONF_RESOLUTION_MATCH]))
+    transfer = config[CONF_TRANSFER]
+    cg.add(var.set_transfer_mode(transfer[CONF_MODE]))
+    cg.add(
+        var.set_transfer(
+            transfer[CONF_INTERFACE],
+            transfer[CONF_ALT_SETTING],
+            transfer[CONF_ENDPOINT],
+            transfer[CONF_MAX_PACKET_SIZE],
+        )
+    )
+    if CONF_CONFIG_DESCRIPTOR in transfer:
+        cg.add(var.set_config_descriptor(transfer[CONF_CONFIG_DESCRIPTOR]))
 
     cg.add_define("USE_USB_WEBCAM")
 
@@ -161,9 +591,8 @@ async def to_code(config):
         "CONFIG_UVC_GET_CONFIG_DESC": True,
         "CONFIG_UVC_PRINT_DESC": True,
         "CONFIG_USB_PRE_ALLOC_CTRL_TRANSFER_URB": True,
-        "CONFIG_USB_PROC_TASK_PRIORITY": 2,
-        #"CONFIG_USB_PROC_TASK_CORE": 1,
-        "CONFIG_USB_PROC_TASK_STACK_SIZE": 3072,
+        "CONFIG_USB_PROC_TASK_PRIORITY": tasks[CONF_USB][CONF_PRIORITY],
+        "CONFIG_USB_PROC_TASK_STACK_SIZE": tasks[CONF_USB][CONF_STACK_SIZE],
         "CONFIG_USB_WAITING_AFTER_CONN_MS": 50,
         "CONFIG_USB_ENUM_FAILED_RETRY": True,
         "CONFIG_USB_ENUM_FAILED_RETRY_COUNT": 10,
@@ -171,20 +600,30 @@ async def to_code(config):
         #
         # UVC Stream Config
         #
-        "CONFIG_SAMPLE_PROC_TASK_PRIORITY": 0,
-        #"CONFIG_SAMPLE_PROC_TASK_CORE": 0,
-        "CONFIG_SAMPLE_PROC_TASK_STACK_SIZE": 3072,
+        "CONFIG_SAMPLE_PROC_TASK_PRIORITY": tasks[CONF_FRAMES][CONF_PRIORITY],
+        "CONFIG_SAMPLE_PROC_TASK_STACK_SIZE": tasks[CONF_FRAMES][CONF_STACK_SIZE],
         "CONFIG_UVC_PRINT_PROBE_RESULT": True,
         "CONFIG_UVC_CHECK_BULK_JPEG_HEADER": True,
-        "CONFIG_UVC_DROP_OVERFLOW_FRAME": True,
+        "CONFIG_UVC_DROP_OVERFLOW_FRAME": False, # counted and dropped in camera_frame_cb
         "CONFIG_UVC_DROP_NO_EOF_FRAME": True,
-        "CONFIG_NUM_BULK_STREAM_URBS": 2,
+        "CONFIG_NUM_BULK_STREAM_URBS": transfer.get(CONF_URBS, 2),
         "CONFIG_NUM_BULK_BYTES_PER_URB": 2048,
-        "CONFIG_NUM_ISOC_UVC_URBS": 3,
-        "CONFIG_NUM_PACKETS_PER_URB": 4,
+        "CONFIG_NUM_ISOC_UVC_URBS": transfer.get(CONF_URBS, 3),
+        "CONFIG_NUM_PACKETS_PER_URB": transfer[CONF_PACKETS_PER_URB],
         # end of UVC Stream Config
     }.items():
         add_idf_sdkconfig_option(d, v)
+    if CONF_CORE in tasks[CONF_USB]:
+        add_idf_sdkconfig_option("CONFIG_USB_PROC_TASK_CORE", tasks[CONF_USB][CONF_CORE])
+    if CONF_CORE in tasks[CONF_FRAMES]:
+        add_idf_sdkconfig_option(
+            "CONFIG_SAMPLE_PROC_TASK_CORE", tasks[CONF_FRAMES][CONF_CORE]
+        )
+    if CONF_REPORT_INTERVAL in tasks:
+        # per task CPU time, counted in esp_timer us
+        add_idf_sdkconfig_option("CONFIG_FREERTOS_USE_TRACE_FACILITY", True)
+        add_idf_sdkconfig_option("CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS", True)
+        add_idf_sdkconfig_option("CONFIG_FREERTOS_RUN_TIME_STATS_USING_ESP_TIMER", True)
 
     for conf in config.get(CONF_ON_STREAM_START, []):
         trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
@@ -193,3 +632,52 @@ async def to_code(config):
     for conf in config.get(CONF_ON_STREAM_STOP, []):
         trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
         await automation.build_automation(trigger, [], conf)
+
+    for conf in config.get(CONF_ON_MOTION, []):
+        trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+        await automation.build_automation(trigger, [], conf)
+
+    for conf in config.get(CONF_ON_PREROLL, []):
+        trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+        await automation.build_automation(
+            trigger, [(FrameRingSnapshotPtr, "frames")], conf
+        )
+
+
+@automation.register_action(
+    "usb_webcam.capture_preroll",
+    USBWebCamCapturePrerollAction,
+    automation.maybe_simple_id(
+        {
+            cv.GenerateID(): cv.use_id(USBWebCam),
+        }
+    ),
+)
+async def capture_preroll_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    return var
+
+
+@automation.register_action(
+    "usb_webcam.start_recording",
+    USBWebCamStartRecordingAction,
+    automation.maybe_simple_id(
+        {
+            cv.GenerateID(): cv.use_id(USBWebCam),
+        }
+    ),
+)
+@automation.register_action(
+    "usb_webcam.stop_recording",
+    USBWebCamStopRecordingAction,
+    automation.maybe_simple_id(
+        {
+            cv.GenerateID(): cv.use_id(USBWebCam),
+        }
+    ),
+)
+async def recording_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    return var
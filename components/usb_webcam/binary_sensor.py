@@ -0,0 +1,25 @@
+# SPDX-License-Identifier: GPL-3.0-only
+
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components import binary_sensor
+from esphome.const import DEVICE_CLASS_MOTION
+
+from . import CONF_USB_WEBCAM_ID, USBWebCam
+
+DEPENDENCIES = ["usb_webcam"]
+
+# state of the motion detection configured in the camera's motion block
+CONFIG_SCHEMA = binary_sensor.binary_sensor_schema(
+    device_class=DEVICE_CLASS_MOTION
+).extend(
+    {
+        cv.GenerateID(CONF_USB_WEBCAM_ID): cv.use_id(USBWebCam),
+    }
+)
+
+
+async def to_code(config):
+    parent = await cg.get_variable(config[CONF_USB_WEBCAM_ID])
+    var = await binary_sensor.new_binary_sensor(config)
+    cg.add(parent.set_motion_binary_sensor(var))
@@ -0,0 +1,162 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "frame_pool.h"
+
+#include <cstring>
+
+namespace esphome::usb_webcam {
+
+/* orders wrap around, compare them as a sequence */
+static inline bool is_older(uint32_t a, uint32_t b) { return (int32_t) (a - b) < 0; }
+
+void FramePool::set_slot_count(size_t count) {
+  if (count < 1)
+    count = 1;
+  if (count > FRAME_POOL_MAX_SLOTS)
+    count = FRAME_POOL_MAX_SLOTS;
+  this->slot_count_ = count;
+}
+
+void FramePool::init(uint8_t *arena, size_t slot_size) {
+  this->slot_size_ = slot_size;
+  for (size_t i = 0; i < this->slot_count_; i++) {
+    Slot &slot = this->slots_[i];
+    memset(&slot.fb, 0, sizeof(camera_fb_t));
+    slot.fb.buf = arena + i * slot_size;
+    slot.order.store(0, std::memory_order_relaxed);
+    slot.state.store(SLOT_FREE, std::memory_order_release);
+  }
+}
+
+/* ---------------- producer side ---------------- */
+int FramePool::claim_slot_(bool *overwritten) {
+  while (true) {
+    for (size_t i = 0; i < this->slot_count_; i++) {
+      uint8_t expected = SLOT_FREE;
+      if (this->slots_[i].state.compare_exchange_strong(expected, SLOT_WRITING, std::memory_order_acquire)) {
+        *overwritten = false;
+        return i;
+      }
+    }
+    if (this->policy_ == FRAME_POOL_DROP_NEWEST)
+      return -1;
+
+    // every slot is taken: reclaim the oldest frame the consumer did not pick up yet
+    int oldest = -1;
+    for (size_t i = 0; i < this->slot_count_; i++) {
+      if (this->slots_[i].state.load(std::memory_order_relaxed) != SLOT_READY)
+        continue;
+      if (oldest < 0 || is_older(this->slots_[i].order.load(std::memory_order_relaxed),
+                                 this->slots_[oldest].order.load(std::memory_order_relaxed)))
+        oldest = i;
+    }
+    if (oldest < 0)
+      return -1;  // consumer holds everything
+    uint8_t expected = SLOT_READY;
+    if (this->slots_[oldest].state.compare_exchange_strong(expected, SLOT_WRITING, std::memory_order_acquire)) {
+      *overwritten = true;
+      return oldest;
+    }
+    // consumer took or freed it meanwhile, look again
+  }
+}
+
+bool FramePool::push(const uint8_t *data, size_t len, size_t width, size_t height, uint32_t sequence,
+                     int64_t sof_us, int64_t eof_us) {
+  if (len > this->slot_size_) {
+    this->oversized_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  bool overwritten = false;
+  int index = -1;
+  if (!this->ready_.full())  // consumer is not draining, the frame would never be seen
+    index = this->claim_slot_(&overwritten);
+  if (index < 0) {
+    this->overruns_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  if (overwritten)
+    this->overruns_.fetch_add(1, std::memory_order_relaxed);
+
+  Slot &slot = this->slots_[index];
+  const uint32_t order = this->next_order_++;
+  memcpy(slot.fb.buf, data, len);
+  slot.fb.len = len;
+  slot.fb.width = width;
+  slot.fb.height = height;
+  slot.fb.format = PIXFORMAT_JPEG;
+  slot.fb.timestamp.tv_sec = eof_us / 1000000;
+  slot.fb.timestamp.tv_usec = eof_us % 1000000;
+  slot.fb.sof_us = sof_us;
+  slot.fb.eof_us = eof_us;
+  slot.fb.sequence = sequence;
+  slot.order.store(order, std::memory_order_relaxed);
+  slot.state.store(SLOT_READY, std::memory_order_release);
+  this->ready_.push(FrameDescriptor{(uint8_t) index, order});  // only the producer adds, cannot be full here
+  this->pushed_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+/* ---------------- consumer side ---------------- */
+/* take the slot if it still carries the frame the descriptor refers to;
+ * the producer may have reclaimed and refilled it in the meantime */
+bool FramePool::hold_if_current_(int index, uint32_t order) {
+  Slot &slot = this->slots_[index];
+  uint8_t expected = SLOT_READY;
+  if (!slot.state.compare_exchange_strong(expected, SLOT_HELD, std::memory_order_acq_rel))
+    return false;
+  if (slot.order.load(std::memory_order_relaxed) != order) {
+    slot.state.store(SLOT_READY, std::memory_order_release);
+    return false;
+  }
+  return true;
+}
+
+bool FramePool::collect() {
+  FrameDescriptor desc;
+  while (this->ready_.pop(&desc)) {
+    // frames older than the newest published one will never be delivered, free them
+    if (this->pending_ >= 0 && this->hold_if_current_(this->pending_, this->pending_order_)) {
+      this->slots_[this->pending_].state.store(SLOT_FREE, std::memory_order_release);
+      this->stale_.fetch_add(1, std::memory_order_relaxed);
+    }
+    this->pending_ = desc.slot;
+    this->pending_order_ = desc.order;
+  }
+  return this->pending_ >= 0;
+}
+
+camera_fb_t *FramePool::acquire() {
+  if (!this->collect())
+    return nullptr;
+  const int index = this->pending_;
+  this->pending_ = -1;
+  if (!this->hold_if_current_(index, this->pending_order_))
+    return nullptr;  // producer reclaimed it under drop-oldest
+  return &this->slots_[index].fb;
+}
+
+void FramePool::flush() {
+  if (this->collect() && this->hold_if_current_(this->pending_, this->pending_order_)) {
+    this->slots_[this->pending_].state.store(SLOT_FREE, std::memory_order_release);
+    this->stale_.fetch_add(1, std::memory_order_relaxed);
+  }
+  this->pending_ = -1;
+}
+
+int FramePool::find_slot_(const camera_fb_t *fb) const {
+  for (size_t i = 0; i < this->slot_count_; i++) {
+    if (&this->slots_[i].fb == fb)
+      return i;
+  }
+  return -1;
+}
+
+void FramePool::release(camera_fb_t *fb) {
+  int index = this->find_slot_(fb);
+  if (index < 0)
+    return;
+  this->slots_[index].state.store(SLOT_FREE, std::memory_order_release);
+}
+
+}  // namespace esphome::usb_webcam
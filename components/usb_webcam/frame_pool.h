@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <sys/time.h>
+
+#include "spsc_ring.h"
+
+namespace esphome::usb_webcam {
+
+typedef enum {
+    PIXFORMAT_RGB565,    // 2BPP/RGB565
+    PIXFORMAT_YUV422,    // 2BPP/YUV422
+    PIXFORMAT_GRAYSCALE, // 1BPP/GRAYSCALE
+    PIXFORMAT_JPEG,      // JPEG/COMPRESSED
+    PIXFORMAT_RGB888,    // 3BPP/RGB888
+    PIXFORMAT_RAW,       // RAW
+    PIXFORMAT_RGB444,    // 3BP2P/RGB444
+    PIXFORMAT_RGB555,    // 3BP2P/RGB555
+} pixformat_t;
+
+typedef struct {
+    uint8_t * buf;              // Pointer to the pixel data
+    size_t len;                 // Length of the buffer in bytes
+    size_t width;               // Width of the buffer in pixels
+    size_t height;              // Height of the buffer in pixels
+    pixformat_t format;         // Format of the pixel data
+    struct timeval timestamp;   // Time since boot the frame was completed, same clock as eof_us
+    int64_t sof_us;             // esp_timer time of the first packet, estimated from size and endpoint bandwidth
+    int64_t eof_us;             // esp_timer time the frame was completed by usb_stream
+    uint32_t sequence;          // increases by one per frame the camera sent, gaps are frames lost
+} camera_fb_t;
+
+enum FramePoolPolicy {
+  FRAME_POOL_DROP_OLDEST,  // overwrite the oldest frame nobody picked up yet
+  FRAME_POOL_DROP_NEWEST,  // discard the incoming frame
+};
+
+static const size_t FRAME_POOL_MAX_SLOTS = 8;
+
+/* ---------------- FramePool class ----------------
+ * Fixed set of preallocated frame slots shared by a single producer
+ * (usb_stream sample task) and a single consumer (component loop).
+ * The producer copies each finished frame into a free slot, publishes
+ * a descriptor on a lock-free ring and returns immediately; it never
+ * waits for the consumer. Slot ownership is tracked with one atomic
+ * state per slot, so no locks or RTOS primitives are involved. */
+class FramePool {
+ public:
+  /* configuration, before init() */
+  void set_slot_count(size_t count);
+  size_t get_slot_count() const { return this->slot_count_; }
+  void set_policy(FramePoolPolicy policy) { this->policy_ = policy; }
+  FramePoolPolicy get_policy() const { return this->policy_; }
+
+  /* arena must hold get_slot_count() * slot_size bytes and outlive the pool */
+  void init(uint8_t *arena, size_t slot_size);
+  size_t get_slot_size() const { return this->slot_size_; }
+
+  /* producer side */
+  bool push(const uint8_t *data, size_t len, size_t width, size_t height, uint32_t sequence, int64_t sof_us,
+            int64_t eof_us);
+
+  /* consumer side */
+  bool collect();
+  camera_fb_t *acquire();
+  void release(camera_fb_t *fb);
+  /* drop the frame waiting to be picked up, e.g. one from before a disconnect */
+  void flush();
+
+  /* counters */
+  uint32_t get_pushed() const { return this->pushed_.load(std::memory_order_relaxed); }
+  uint32_t get_overruns() const { return this->overruns_.load(std::memory_order_relaxed); }
+  uint32_t get_oversized() const { return this->oversized_.load(std::memory_order_relaxed); }
+  uint32_t get_stale() const { return this->stale_.load(std::memory_order_relaxed); }
+
+ protected:
+  enum SlotState : uint8_t {
+    SLOT_FREE,     // owned by nobody, producer may claim it
+    SLOT_WRITING,  // producer is copying a frame into it
+    SLOT_READY,    // holds a complete frame, not yet acquired
+    SLOT_HELD,     // acquired by the consumer
+  };
+  struct Slot {
+    camera_fb_t fb;
+    std::atomic<uint32_t> order;
+    std::atomic<uint8_t> state;
+  };
+  struct FrameDescriptor {
+    uint8_t slot;
+    uint32_t order;
+  };
+
+  int claim_slot_(bool *overwritten);
+  bool hold_if_current_(int index, uint32_t order);
+  int find_slot_(const camera_fb_t *fb) const;
+
+  std::array<Slot, FRAME_POOL_MAX_SLOTS> slots_{};
+  size_t slot_count_{3};
+  size_t slot_size_{0};
+  FramePoolPolicy policy_{FRAME_POOL_DROP_OLDEST};
+  uint32_t next_order_{0};
+  SPSCRing<FrameDescriptor, 2 * FRAME_POOL_MAX_SLOTS> ready_;
+  int pending_{-1};  // newest collected frame, consumer only
+  uint32_t pending_order_{0};
+
+  std::atomic<uint32_t> pushed_{0};
+  std::atomic<uint32_t> overruns_{0};
+  std::atomic<uint32_t> oversized_{0};
+  std::atomic<uint32_t> stale_{0};
+};
+
+}  // namespace esphome::usb_webcam
@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "frame_ring.h"
+
+#include <cstring>
+
+namespace esphome::usb_webcam {
+
+static inline bool overlaps(size_t a, size_t a_len, size_t b, size_t b_len) { return a < b + b_len && b < a + a_len; }
+
+FrameRingSnapshot::~FrameRingSnapshot() { this->ring_->pins_.fetch_sub(1, std::memory_order_release); }
+
+void FrameRing::init(uint8_t *arena, size_t size) {
+  this->arena_ = arena;
+  this->size_ = arena != nullptr ? size : 0;
+  this->head_ = 0;
+  this->first_ = 0;
+  this->count_ = 0;
+  this->used_ = 0;
+}
+
+bool FrameRing::is_pinned_(const Entry &entry) const {
+  return this->pins_.load(std::memory_order_acquire) != 0 &&
+         (int32_t) (entry.sequence - this->pinned_sequence_) <= 0;
+}
+
+bool FrameRing::append(const camera_fb_t &fb) {
+  if (fb.len == 0 || fb.len > this->size_) {
+    this->dropped_++;
+    return false;
+  }
+  // a frame that doesn't fit before the end starts over at 0, the tail it skips goes with it
+  size_t pos = this->head_;
+  size_t skipped = 0;
+  if (pos + fb.len > this->size_) {
+    skipped = this->size_ - pos;
+    pos = 0;
+  }
+
+  // laid out in order, so the frames in the way are always the oldest ones
+  while (this->count_ != 0) {
+    const Entry &oldest = this->entries_[this->first_];
+    const size_t offset = oldest.fb.buf - this->arena_;
+    if (this->count_ < FRAME_RING_MAX_FRAMES && !overlaps(offset, oldest.fb.len, pos, fb.len) &&
+        (skipped == 0 || !overlaps(offset, oldest.fb.len, this->head_, skipped)))
+      break;
+    if (this->is_pinned_(oldest)) {
+      this->dropped_++;
+      return false;
+    }
+    this->used_ -= oldest.fb.len;
+    this->first_ = (this->first_ + 1) % FRAME_RING_MAX_FRAMES;
+    this->count_--;
+  }
+
+  Entry &entry = this->entries_[(this->first_ + this->count_) % FRAME_RING_MAX_FRAMES];
+  entry.fb = fb;
+  entry.fb.buf = this->arena_ + pos;
+  entry.sequence = this->next_sequence_++;
+  memcpy(entry.fb.buf, fb.buf, fb.len);
+  this->head_ = pos + fb.len;
+  this->count_++;
+  this->used_ += fb.len;
+  return true;
+}
+
+std::shared_ptr<FrameRingSnapshot> FrameRing::snapshot() {
+  if (this->count_ == 0)
+    return nullptr;
+  auto snapshot = std::make_shared<FrameRingSnapshot>(this);
+  snapshot->frames_.reserve(this->count_);
+  for (size_t i = 0; i < this->count_; i++)
+    snapshot->frames_.push_back(this->entries_[(this->first_ + i) % FRAME_RING_MAX_FRAMES].fb);
+  // the newest frame of a snapshot is never older than the ones already pinned
+  this->pinned_sequence_ = this->entries_[(this->first_ + this->count_ - 1) % FRAME_RING_MAX_FRAMES].sequence;
+  this->pins_.fetch_add(1, std::memory_order_acq_rel);
+  return snapshot;
+}
+
+}  // namespace esphome::usb_webcam
@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "frame_pool.h"
+
+namespace esphome::usb_webcam {
+
+static const size_t FRAME_RING_MAX_FRAMES = 64;
+
+class FrameRing;
+
+/* The frames of a FrameRing at the time it was taken, oldest first. The
+ * buffers point into the ring's arena, which keeps them in place until the
+ * last reference to the snapshot is dropped. */
+class FrameRingSnapshot {
+ public:
+  explicit FrameRingSnapshot(FrameRing *ring) : ring_(ring) {}
+  ~FrameRingSnapshot();
+  size_t size() const { return this->frames_.size(); }
+  const camera_fb_t &get_frame(size_t index) const { return this->frames_[index]; }
+
+ protected:
+  friend class FrameRing;
+  FrameRing *ring_;
+  std::vector<camera_fb_t> frames_;
+};
+
+/* ---------------- FrameRing class ----------------
+ * The most recent frames, bounded by bytes rather than count, in a single
+ * arena allocated once. Frames are laid out back to back and wrap around
+ * like a byte ring, so slots take exactly the frame size and the oldest
+ * frames make room for new ones without compaction or heap traffic.
+ * Owned by the component loop; snapshots may be released from any task. */
+class FrameRing {
+ public:
+  /* arena must outlive the ring */
+  void init(uint8_t *arena, size_t size);
+  bool is_enabled() const { return this->arena_ != nullptr; }
+  size_t get_size() const { return this->size_; }
+
+  /* copy a frame in, evicting the oldest ones as needed; fails if the
+   * frame is larger than the arena or its room is held by a snapshot */
+  bool append(const camera_fb_t &fb);
+  std::shared_ptr<FrameRingSnapshot> snapshot();
+
+  size_t get_count() const { return this->count_; }
+  size_t get_used() const { return this->used_; }
+  uint32_t get_dropped() const { return this->dropped_; }
+
+ protected:
+  friend class FrameRingSnapshot;
+  struct Entry {
+    camera_fb_t fb;  // buf points into the arena
+    uint32_t sequence;
+  };
+
+  bool is_pinned_(const Entry &entry) const;
+
+  uint8_t *arena_{nullptr};
+  size_t size_{0};
+  size_t head_{0};  // where the next frame goes, unless it has to wrap
+  Entry entries_[FRAME_RING_MAX_FRAMES];
+  size_t first_{0};  // oldest entry
+  size_t count_{0};
+  size_t used_{0};
+  uint32_t next_sequence_{0};
+  uint32_t dropped_{0};
+  std::atomic<uint8_t> pins_{0};  // live snapshots
+  uint32_t pinned_sequence_{0};   // newest frame any live snapshot holds
+};
+
+}  // namespace esphome::usb_webcam
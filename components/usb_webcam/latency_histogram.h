@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome::usb_webcam {
+
+/* ---------------- LatencyHistogram class ----------------
+ * Log2-bucketed histogram of durations in microseconds. Bucket i counts
+ * samples below 2^i us, the last bucket collects everything longer.
+ * Recording is a single relaxed atomic increment, safe from any task. */
+class LatencyHistogram {
+ public:
+  static const size_t BUCKETS = 24;  // up to ~8 s
+
+  void record(uint32_t us) {
+    size_t bucket = 0;
+    while (bucket < BUCKETS - 1 && (us >> bucket) != 0)
+      bucket++;
+    this->buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  uint32_t count() const {
+    uint32_t total = 0;
+    for (const auto &bucket : this->buckets_)
+      total += bucket.load(std::memory_order_relaxed);
+    return total;
+  }
+
+  /* upper bound in us of the bucket holding the given percentile (0..100), 0 if empty */
+  uint32_t percentile(uint32_t pct) const {
+    const uint32_t total = this->count();
+    if (total == 0)
+      return 0;
+    const uint64_t rank = ((uint64_t) total * pct + 99) / 100;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+      seen += this->buckets_[i].load(std::memory_order_relaxed);
+      if (seen >= rank && seen != 0)
+        return 1UL << i;
+    }
+    return 1UL << (BUCKETS - 1);
+  }
+
+  uint32_t bucket(size_t index) const { return this->buckets_[index].load(std::memory_order_relaxed); }
+
+  void reset() {
+    for (auto &bucket : this->buckets_)
+      bucket.store(0, std::memory_order_relaxed);
+  }
+
+ protected:
+  std::array<std::atomic<uint32_t>, BUCKETS> buckets_{};
+};
+
+}  // namespace esphome::usb_webcam
@@ -0,0 +1,216 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "mjpeg.h"
+
+#include <cstring>
+
+namespace esphome::usb_webcam {
+
+/* cameras may pad frames after EOI, don't look further back than this */
+static const size_t JPEG_MAX_TAIL_PADDING = 1024;
+
+static inline uint16_t read_be16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+static inline bool is_rst(uint8_t marker) { return marker >= 0xD0 && marker <= 0xD7; }
+static inline bool is_sof(uint8_t marker) {
+  // C4 (DHT), C8 (JPG) and CC (DAC) share the range but are not frame headers
+  return marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+}
+
+const char *jpeg_check_result_to_string(JpegCheckResult result) {
+  switch (result) {
+    case JPEG_OK:
+      return "ok";
+    case JPEG_NO_SOI:
+      return "no SOI";
+    case JPEG_BAD_SEGMENT:
+      return "bad segment";
+    case JPEG_TRUNCATED:
+      return "truncated header";
+    case JPEG_NO_SOF:
+      return "no SOF";
+    case JPEG_NO_SOS:
+      return "no SOS";
+    case JPEG_NO_EOI:
+      return "no EOI";
+    case JPEG_BAD_RESTART:
+      return "bad restart marker";
+    default:
+      return "unknown";
+  }
+}
+
+static JpegCheckResult check_tail(const uint8_t *data, size_t len, size_t scan_start) {
+  size_t end = len;
+  const size_t limit = len > JPEG_MAX_TAIL_PADDING ? len - JPEG_MAX_TAIL_PADDING : 0;
+  while (end > limit && end > scan_start && data[end - 1] == 0x00)
+    end--;
+  if (end < scan_start + 2 || data[end - 2] != 0xFF || data[end - 1] != 0xD9)
+    return JPEG_NO_EOI;
+  return JPEG_OK;
+}
+
+/* walk entropy-coded data from pos; stops at EOI, or on another header marker leaving pos on its 0xFF */
+static JpegCheckResult scan_entropy(const uint8_t *data, size_t len, size_t *pos, bool *eoi) {
+  uint8_t expected_rst = 0;
+  size_t p = *pos;
+  while (true) {
+    const uint8_t *ff = (const uint8_t *) memchr(data + p, 0xFF, len - p);
+    if (ff == nullptr)
+      return JPEG_NO_EOI;
+    const size_t marker_start = ff - data;
+    p = marker_start + 1;
+    while (p < len && data[p] == 0xFF)
+      p++;
+    if (p >= len)
+      return JPEG_NO_EOI;
+    const uint8_t marker = data[p++];
+    if (marker == 0x00)
+      continue;  // stuffed 0xFF data byte
+    if (is_rst(marker)) {
+      if (marker - 0xD0 != expected_rst)
+        return JPEG_BAD_RESTART;
+      expected_rst = (expected_rst + 1) & 0x07;
+      continue;
+    }
+    if (marker == 0xD9) {
+      *pos = p;
+      *eoi = true;
+      return JPEG_OK;
+    }
+    if (marker == 0xDA || marker == 0xC4 || marker == 0xDB || marker == 0xDD || marker == 0xDC ||
+        (marker >= 0xE0 && marker <= 0xEF) || marker == 0xFE) {
+      *pos = marker_start;  // tables or next scan of a multi-scan image
+      return JPEG_OK;
+    }
+    return JPEG_BAD_RESTART;
+  }
+}
+
+JpegCheckResult check_jpeg(const uint8_t *data, size_t len, USBWebCamFrameValidation level) {
+  if (len < 4 || data[0] != 0xFF || data[1] != 0xD8)
+    return JPEG_NO_SOI;
+
+  bool has_sof = false;
+  size_t pos = 2;
+  while (true) {
+    if (pos >= len)
+      return JPEG_TRUNCATED;
+    if (data[pos] != 0xFF)
+      return JPEG_BAD_SEGMENT;
+    while (pos < len && data[pos] == 0xFF)
+      pos++;
+    if (pos >= len)
+      return JPEG_TRUNCATED;
+    const uint8_t marker = data[pos++];
+    if (marker == 0x00 || is_rst(marker))
+      return JPEG_BAD_SEGMENT;
+    if (marker == 0xD9)
+      return JPEG_NO_SOS;
+    if (marker == 0x01)
+      continue;  // TEM, no payload
+
+    if (pos + 2 > len)
+      return JPEG_TRUNCATED;
+    const uint16_t seg_len = read_be16(data + pos);
+    if (seg_len < 2)
+      return JPEG_BAD_SEGMENT;
+    if (pos + seg_len > len)
+      return JPEG_TRUNCATED;
+
+    if (is_sof(marker)) {
+      if (seg_len < 8 || read_be16(data + pos + 3) == 0 || read_be16(data + pos + 5) == 0)
+        return JPEG_NO_SOF;
+      has_sof = true;
+    }
+    pos += seg_len;
+    if (marker != 0xDA)
+      continue;
+
+    // start of scan
+    if (!has_sof)
+      return JPEG_NO_SOF;
+    if (level != USB_WEBCAM_VALIDATION_STRICT)
+      return check_tail(data, len, pos);
+    bool eoi = false;
+    JpegCheckResult result = scan_entropy(data, len, &pos, &eoi);
+    if (result != JPEG_OK || eoi)
+      return result;
+  }
+}
+
+const uint8_t JPEG_STANDARD_DHT[] = {
+    // DHT, length
+    0xFF, 0xC4, 0x01, 0xA2,
+    // luminance DC
+    0x00, 0x00, 0x01, 0x05, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+    0x07, 0x08, 0x09, 0x0A, 0x0B,
+    // luminance AC
+    0x10, 0x00, 0x02, 0x01, 0x03, 0x03, 0x02, 0x04, 0x03, 0x05, 0x05, 0x04,
+    0x04, 0x00, 0x00, 0x01, 0x7D, 0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05,
+    0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14,
+    0x32, 0x81, 0x91, 0xA1, 0x08, 0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1,
+    0xF0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16, 0x17, 0x18, 0x19,
+    0x1A, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38,
+    0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4A, 0x53, 0x54,
+    0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x83, 0x84,
+    0x85, 0x86, 0x87, 0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97,
+    0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8, 0xA9, 0xAA,
+    0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4,
+    0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7,
+    0xD8, 0xD9, 0xDA, 0xE1, 0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9,
+    0xEA, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA,
+    // chrominance DC
+    0x01, 0x00, 0x03, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+    0x07, 0x08, 0x09, 0x0A, 0x0B,
+    // chrominance AC
+    0x11, 0x00, 0x02, 0x01, 0x02, 0x04, 0x04, 0x03, 0x04, 0x07, 0x05, 0x04,
+    0x04, 0x00, 0x01, 0x02, 0x77, 0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05,
+    0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32,
+    0x81, 0x08, 0x14, 0x42, 0x91, 0xA1, 0xB1, 0xC1, 0x09, 0x23, 0x33, 0x52,
+    0xF0, 0x15, 0x62, 0x72, 0xD1, 0x0A, 0x16, 0x24, 0x34, 0xE1, 0x25, 0xF1,
+    0x17, 0x18, 0x19, 0x1A, 0x26, 0x27, 0x28, 0x29, 0x2A, 0x35, 0x36, 0x37,
+    0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4A, 0x53,
+    0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67,
+    0x68, 0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x82,
+    0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95,
+    0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8,
+    0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2,
+    0xC3, 0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5,
+    0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8,
+    0xE9, 0xEA, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA,
+};
+const size_t JPEG_STANDARD_DHT_SIZE = sizeof(JPEG_STANDARD_DHT);
+
+size_t jpeg_dht_insert_offset(const uint8_t *data, size_t len) {
+  if (len < 4 || data[0] != 0xFF || data[1] != 0xD8)
+    return 0;
+  size_t pos = 2;
+  while (pos + 4 <= len) {
+    if (data[pos] != 0xFF)
+      return 0;
+    const size_t marker_start = pos;
+    while (pos < len && data[pos] == 0xFF)
+      pos++;
+    if (pos + 3 > len)
+      return 0;
+    const uint8_t marker = data[pos++];
+    if (marker == 0xC4)
+      return 0;
+    if (marker == 0xDA)
+      return marker_start;
+    if (marker == 0xD9 || marker == 0x00 || is_rst(marker))
+      return 0;
+    if (marker == 0x01)
+      continue;
+    const uint16_t seg_len = read_be16(data + pos);
+    if (seg_len < 2)
+      return 0;
+    pos += seg_len;
+  }
+  return 0;
+}
+
+}  // namespace esphome::usb_webcam
@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome::usb_webcam {
+
+enum USBWebCamFrameValidation {
+  USB_WEBCAM_VALIDATION_NONE,
+  USB_WEBCAM_VALIDATION_BASIC,   // header segments and end of image, cost independent of frame size
+  USB_WEBCAM_VALIDATION_STRICT,  // also walks the entropy-coded data checking markers and restart order
+};
+
+enum JpegCheckResult {
+  JPEG_OK,
+  JPEG_NO_SOI,          // does not start with a start of image marker
+  JPEG_BAD_SEGMENT,     // garbage where a marker or segment length is expected
+  JPEG_TRUNCATED,       // a header segment runs past the end of the frame
+  JPEG_NO_SOF,          // no frame header, or one with zero dimensions
+  JPEG_NO_SOS,          // headers end without a start of scan
+  JPEG_NO_EOI,          // missing end of image, the frame was cut short
+  JPEG_BAD_RESTART,     // restart markers out of sequence or stray markers in scan data
+  JPEG_CHECK_RESULTS,
+};
+
+const char *jpeg_check_result_to_string(JpegCheckResult result);
+
+/* Single-pass structural check of a baseline/progressive JPEG as sent by
+ * UVC MJPEG cameras. Never reads outside data[0..len). */
+JpegCheckResult check_jpeg(const uint8_t *data, size_t len, USBWebCamFrameValidation level);
+
+/* DHT segment with the Huffman tables of ITU T.81 annex K.3, which UVC
+ * MJPEG payloads imply when they leave the DHT segment out */
+extern const uint8_t JPEG_STANDARD_DHT[];
+extern const size_t JPEG_STANDARD_DHT_SIZE;
+
+/* Offset of the SOS marker if the frame reaches it without a DHT segment,
+ * i.e. where JPEG_STANDARD_DHT has to go for the frame to decode on its own.
+ * Returns 0 if the frame has its tables or its headers can't be walked. */
+size_t jpeg_dht_insert_offset(const uint8_t *data, size_t len);
+
+}  // namespace esphome::usb_webcam
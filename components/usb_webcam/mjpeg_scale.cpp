@@ -0,0 +1,726 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "mjpeg_scale.h"
+#include "mjpeg.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+namespace esphome::usb_webcam {
+
+/* natural index of each zigzag position */
+static const uint8_t ZIGZAG[64] = {
+    0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,  12, 19, 26, 33, 40, 48,
+    41, 34, 27, 20, 13, 6,  7,  14, 21, 28, 35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23,
+    30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+/* ITU T.81 annex K.1 quantization tables, natural order */
+static const uint8_t STD_QUANT[2][64] = {
+    {
+        16, 11, 10, 16, 24,  40,  51,  61,  12, 12, 14, 19, 26,  58,  60,  55,
+        14, 13, 16, 24, 40,  57,  69,  56,  14, 17, 22, 29, 51,  87,  80,  62,
+        18, 22, 37, 56, 68,  109, 103, 77,  24, 35, 55, 64, 81,  104, 113, 92,
+        49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99,
+    },
+    {
+        17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+        24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+    },
+};
+
+/* fixed point cosine tables with the 1/2 and C(u) factors folded in:
+ * IDCT_k[x][u] for the k-point inverse transforms, FDCT[u][x] for the encoder */
+static const int COS_BITS = 13;
+static int32_t s_idct4[4][4];
+static int32_t s_idct2[2][2];
+static int32_t s_fdct[8][8];
+static std::once_flag s_tables_once;
+
+static void build_tables() {
+  const double scale = 1 << COS_BITS;
+  for (int x = 0; x < 8; x++) {
+    for (int u = 0; u < 8; u++) {
+      const double c = u == 0 ? M_SQRT1_2 : 1.0;
+      s_fdct[u][x] = lround(0.5 * c * cos((2 * x + 1) * u * M_PI / 16) * scale);
+      if (x < 4 && u < 4)
+        s_idct4[x][u] = lround(0.5 * c * cos((2 * x + 1) * u * M_PI / 8) * scale);
+      if (x < 2 && u < 2)
+        s_idct2[x][u] = lround(0.5 * c * cos((2 * x + 1) * u * M_PI / 4) * scale);
+    }
+  }
+}
+
+static inline uint16_t read_be16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+static inline uint8_t clamp_pixel(int32_t v) { return v < 0 ? 0 : (v > 255 ? 255 : v); }
+static inline int32_t clamp_abs(int32_t v, int32_t limit) { return v < -limit ? -limit : (v > limit ? limit : v); }
+
+/* dequantized coefficients of 8-bit samples stay within +-2^11, the margin
+ * keeps the fixed point kernels in 32 bits even on corrupt data */
+static const int32_t COEF_LIMIT = 4095;
+
+/* ---------------- Huffman tables ---------------- */
+/* returns false for code lengths that don't fit a prefix code, as libjpeg's
+ * "Bogus Huffman table" check */
+static bool build_decode(const uint8_t *bits, const uint8_t *values, JpegHuffmanDecode *table) {
+  memset(table->lookup, 0, sizeof(table->lookup));
+  int32_t code = 0;
+  int k = 0;
+  for (int length = 1; length <= 16; length++) {
+    table->valoffset[length] = k - code;
+    for (int i = 0; i < bits[length - 1]; i++, k++, code++) {
+      if (code >= (1 << length))
+        return false;
+      table->values[k] = values[k];
+      if (length <= JpegHuffmanDecode::LOOKAHEAD) {
+        const int shift = JpegHuffmanDecode::LOOKAHEAD - length;
+        for (int fill = 0; fill < (1 << shift); fill++)
+          table->lookup[(code << shift) | fill] = (length << 8) | values[k];
+      }
+    }
+    if (code >= (1 << length))
+      return false;
+    table->maxcode[length] = bits[length - 1] != 0 ? code - 1 : -1;
+    code <<= 1;
+  }
+  table->maxcode[17] = INT32_MAX;
+  table->count = k;
+  return true;
+}
+
+static void build_encode(const uint8_t *bits, const uint8_t *values, JpegHuffmanEncode *table) {
+  memset(table->size, 0, sizeof(table->size));
+  uint16_t code = 0;
+  int k = 0;
+  for (int length = 1; length <= 16; length++) {
+    for (int i = 0; i < bits[length - 1]; i++, k++, code++) {
+      table->code[values[k]] = code;
+      table->size[values[k]] = length;
+    }
+    code <<= 1;
+  }
+}
+
+/* walk the tables of a DHT payload; returns false if it is malformed or the
+ * callback rejects a table */
+template<typename F> static bool for_each_dht(const uint8_t *p, size_t len, F &&callback) {
+  size_t pos = 0;
+  while (pos < len) {
+    if (pos + 17 > len)
+      return false;
+    const uint8_t tc_th = p[pos];
+    const uint8_t *bits = p + pos + 1;
+    size_t count = 0;
+    for (int i = 0; i < 16; i++)
+      count += bits[i];
+    if (count > 256 || pos + 17 + count > len || (tc_th >> 4) > 1 || (tc_th & 0x0F) > 1)
+      return false;
+    if (!callback(tc_th >> 4, tc_th & 0x0F, bits, p + pos + 17))
+      return false;
+    pos += 17 + count;
+  }
+  return true;
+}
+
+/* ---------------- bit reader ---------------- */
+struct BitReader {
+  const uint8_t *data;
+  size_t len;
+  size_t pos;
+  uint32_t buf{0};  // MSB aligned
+  int bits{0};
+  bool marker{false};  // stopped at a marker, feeding zeros
+
+  void fill() {
+    while (this->bits <= 24) {
+      uint8_t byte = 0;
+      if (!this->marker && this->pos < this->len) {
+        byte = this->data[this->pos];
+        if (byte == 0xFF) {
+          if (this->pos + 1 < this->len && this->data[this->pos + 1] == 0x00) {
+            this->pos += 2;
+          } else {
+            this->marker = true;
+            byte = 0;
+          }
+        } else {
+          this->pos++;
+        }
+      }
+      this->buf |= (uint32_t) byte << (24 - this->bits);
+      this->bits += 8;
+    }
+  }
+  uint32_t peek(int n) const { return this->buf >> (32 - n); }
+  void skip(int n) {
+    this->buf <<= n;
+    this->bits -= n;
+  }
+  int32_t receive_extend(int n) {
+    if (n == 0)
+      return 0;
+    this->fill();
+    const int32_t v = this->peek(n);
+    this->skip(n);
+    return v < (1 << (n - 1)) ? v - (1 << n) + 1 : v;
+  }
+  int decode(const JpegHuffmanDecode &table) {
+    this->fill();
+    const uint16_t entry = table.lookup[this->peek(JpegHuffmanDecode::LOOKAHEAD)];
+    if (entry != 0) {
+      this->skip(entry >> 8);
+      return entry & 0xFF;
+    }
+    for (int length = JpegHuffmanDecode::LOOKAHEAD + 1; length <= 16; length++) {
+      const int32_t code = this->peek(length);
+      if (code <= table.maxcode[length]) {
+        const int32_t index = code + table.valoffset[length];
+        if (index < 0 || index >= table.count)
+          return -1;
+        this->skip(length);
+        return table.values[index];
+      }
+    }
+    return -1;
+  }
+  /* drop the partial byte and step over the next RSTn marker */
+  bool restart() {
+    this->buf = 0;
+    this->bits = 0;
+    this->marker = false;
+    while (this->pos + 1 < this->len) {
+      if (this->data[this->pos] == 0xFF && this->data[this->pos + 1] >= 0xD0 && this->data[this->pos + 1] <= 0xD7) {
+        this->pos += 2;
+        return true;
+      }
+      this->pos++;
+    }
+    return false;
+  }
+};
+
+/* ---------------- bit writer ---------------- */
+struct BitWriter {
+  uint8_t *out;
+  size_t size;
+  size_t pos{0};
+  uint32_t buf{0};
+  int bits{0};
+
+  void byte(uint8_t b) {
+    if (this->pos < this->size)
+      this->out[this->pos] = b;
+    this->pos++;
+  }
+  void put(uint32_t value, int n) {
+    this->buf = (this->buf << n) | (value & ((1U << n) - 1));
+    this->bits += n;
+    while (this->bits >= 8) {
+      const uint8_t b = this->buf >> (this->bits - 8);
+      this->byte(b);
+      if (b == 0xFF)
+        this->byte(0x00);
+      this->bits -= 8;
+    }
+    this->buf &= (1U << this->bits) - 1;
+  }
+  void flush() {
+    if (this->bits != 0)
+      this->put(0x7F, 8 - this->bits);
+  }
+  bool overflow() const { return this->pos > this->size; }
+};
+
+/* ---------------- block kernels ---------------- */
+/* k x k inverse transform of the low-frequency corner, 1/(8/k) scale of the full IDCT */
+static void idct_scaled(const int32_t *coef, uint8_t k, uint8_t *dst, uint32_t stride) {
+  if (k == 1) {
+    dst[0] = clamp_pixel(((coef[0] + 4) >> 3) + 128);
+    return;
+  }
+  const int32_t *table = k == 4 ? &s_idct4[0][0] : &s_idct2[0][0];
+  int32_t tmp[16];
+  // rows: keep 3 fractional bits for the second pass
+  for (int v = 0; v < k; v++) {
+    for (int x = 0; x < k; x++) {
+      int32_t sum = 0;
+      for (int u = 0; u < k; u++)
+        sum += table[x * k + u] * coef[v * k + u];
+      tmp[v * k + x] = (sum + (1 << (COS_BITS - 4))) >> (COS_BITS - 3);
+    }
+  }
+  for (int y = 0; y < k; y++) {
+    for (int x = 0; x < k; x++) {
+      int32_t sum = 0;
+      for (int v = 0; v < k; v++)
+        sum += table[y * k + v] * tmp[v * k + x];
+      dst[y * stride + x] = clamp_pixel(((sum + (1 << (COS_BITS + 2))) >> (COS_BITS + 3)) + 128);
+    }
+  }
+}
+
+/* 8x8 forward transform and quantization, result in zigzag order */
+static void fdct_quantize(const uint8_t *src, uint32_t stride, const uint8_t *quant, int16_t *out) {
+  int32_t tmp[64];
+  for (int y = 0; y < 8; y++) {
+    for (int u = 0; u < 8; u++) {
+      int32_t sum = 0;
+      for (int x = 0; x < 8; x++)
+        sum += s_fdct[u][x] * (src[y * stride + x] - 128);
+      tmp[y * 8 + u] = (sum + (1 << (COS_BITS - 3))) >> (COS_BITS - 2);
+    }
+  }
+  for (int i = 0; i < 64; i++) {
+    const int n = ZIGZAG[i];
+    const int v = n >> 3;
+    const int u = n & 7;
+    int32_t sum = 0;
+    for (int y = 0; y < 8; y++)
+      sum += s_fdct[v][y] * tmp[y * 8 + u];
+    const int32_t coef = (sum + (1 << (COS_BITS + 1))) >> (COS_BITS + 2);
+    const int32_t q = quant[n];
+    const int32_t value = coef >= 0 ? (coef + q / 2) / q : -((-coef + q / 2) / q);
+    out[i] = clamp_abs(value, i == 0 ? 2047 : 1023);  // largest DC and AC magnitude categories
+  }
+}
+
+static inline int bit_length(int32_t v) {
+  v = v < 0 ? -v : v;
+  int n = 0;
+  while (v != 0) {
+    n++;
+    v >>= 1;
+  }
+  return n;
+}
+
+static void encode_block(BitWriter &writer, const int16_t *zz, int *pred, const JpegHuffmanEncode &dc,
+                         const JpegHuffmanEncode &ac) {
+  const int32_t diff = zz[0] - *pred;
+  *pred = zz[0];
+  int n = bit_length(diff);
+  writer.put(dc.code[n], dc.size[n]);
+  if (n != 0)
+    writer.put(diff < 0 ? diff - 1 : diff, n);
+
+  int run = 0;
+  for (int i = 1; i < 64; i++) {
+    const int32_t v = zz[i];
+    if (v == 0) {
+      run++;
+      continue;
+    }
+    while (run >= 16) {
+      writer.put(ac.code[0xF0], ac.size[0xF0]);
+      run -= 16;
+    }
+    n = bit_length(v);
+    const uint8_t symbol = (run << 4) | n;
+    writer.put(ac.code[symbol], ac.size[symbol]);
+    writer.put(v < 0 ? v - 1 : v, n);
+    run = 0;
+  }
+  if (run != 0)
+    writer.put(ac.code[0x00], ac.size[0x00]);
+}
+
+/* ---------------- JpegDownscaler ---------------- */
+JpegDownscaler::JpegDownscaler() : alloc_(malloc), free_(free) {
+  std::call_once(s_tables_once, build_tables);
+  for_each_dht(JPEG_STANDARD_DHT + 4, JPEG_STANDARD_DHT_SIZE - 4,
+               [this](uint8_t tc, uint8_t th, const uint8_t *bits, const uint8_t *values) {
+                 build_encode(bits, values, tc == 0 ? &this->dc_encode_[th] : &this->ac_encode_[th]);
+                 return true;
+               });
+  this->set_quality(80);
+}
+
+JpegDownscaler::~JpegDownscaler() {
+  if (this->planes_ != nullptr)
+    this->free_(this->planes_);
+}
+
+void JpegDownscaler::set_allocator(AllocFn alloc, FreeFn free) {
+  if (this->planes_ != nullptr) {
+    this->free_(this->planes_);
+    this->planes_ = nullptr;
+    this->planes_size_ = 0;
+  }
+  this->alloc_ = alloc;
+  this->free_ = free;
+}
+
+/* IJG quality scaling of the annex K tables */
+void JpegDownscaler::set_quality(uint8_t quality) {
+  if (quality < 1)
+    quality = 1;
+  if (quality > 100)
+    quality = 100;
+  this->quality_ = quality;
+  const int scale = quality < 50 ? 5000 / quality : 200 - 2 * quality;
+  for (int t = 0; t < 2; t++) {
+    for (int i = 0; i < 64; i++) {
+      const int q = (STD_QUANT[t][i] * scale + 50) / 100;
+      this->quant_[t][i] = q < 1 ? 1 : (q > 255 ? 255 : q);
+    }
+  }
+}
+
+bool JpegDownscaler::parse_headers_(const uint8_t *data, size_t len, size_t *scan_start) {
+  if (len < 4 || data[0] != 0xFF || data[1] != 0xD8)
+    return false;
+  // frames without DHT use the standard tables
+  for_each_dht(JPEG_STANDARD_DHT + 4, JPEG_STANDARD_DHT_SIZE - 4,
+               [this](uint8_t tc, uint8_t th, const uint8_t *bits, const uint8_t *values) {
+                 return build_decode(bits, values, tc == 0 ? &this->dc_[th] : &this->ac_[th]);
+               });
+  this->num_components_ = 0;
+  this->restart_interval_ = 0;
+
+  size_t pos = 2;
+  while (pos + 4 <= len) {
+    if (data[pos] != 0xFF)
+      return false;
+    const uint8_t marker = data[pos + 1];
+    if (marker == 0xFF) {
+      pos++;
+      continue;
+    }
+    const uint16_t seg_len = read_be16(data + pos + 2);
+    if (seg_len < 2 || pos + 2 + seg_len > len)
+      return false;
+    const uint8_t *p = data + pos + 4;
+    const size_t n = seg_len - 2;
+
+    switch (marker) {
+      case 0xDB: {  // DQT
+        size_t i = 0;
+        while (i < n) {
+          const bool wide = p[i] >> 4;
+          const uint8_t tq = p[i] & 0x03;
+          if (i + 1 + 64 * (wide ? 2 : 1) > n)
+            return false;
+          for (int z = 0; z < 64; z++)
+            this->dequant_[tq][ZIGZAG[z]] = wide ? read_be16(p + i + 1 + 2 * z) : p[i + 1 + z];
+          i += 1 + 64 * (wide ? 2 : 1);
+        }
+        break;
+      }
+      case 0xC4:  // DHT
+        if (!for_each_dht(p, n, [this](uint8_t tc, uint8_t th, const uint8_t *bits, const uint8_t *values) {
+              return build_decode(bits, values, tc == 0 ? &this->dc_[th] : &this->ac_[th]);
+            }))
+          return false;
+        break;
+      case 0xC0:  // SOF0, baseline
+      case 0xC1:  // SOF1, extended sequential, fine with 8 bit samples and two tables per class
+        if (n < 6 || p[0] != 8)
+          return false;
+        this->height_ = read_be16(p + 1);
+        this->width_ = read_be16(p + 3);
+        this->num_components_ = p[5];
+        if ((this->num_components_ != 1 && this->num_components_ != 3) || n < 6 + 3u * this->num_components_ ||
+            this->width_ == 0 || this->height_ == 0)
+          return false;
+        this->hmax_ = 1;
+        this->vmax_ = 1;
+        for (int c = 0; c < this->num_components_; c++) {
+          Component &comp = this->components_[c];
+          comp.id = p[6 + 3 * c];
+          comp.h = p[7 + 3 * c] >> 4;
+          comp.v = p[7 + 3 * c] & 0x0F;
+          comp.tq = p[8 + 3 * c] & 0x03;
+          if (this->num_components_ == 1)
+            comp.h = comp.v = 1;  // a single component scan is not interleaved
+          if (comp.h < 1 || comp.h > 2 || comp.v < 1 || comp.v > 2)
+            return false;
+          if (comp.h > this->hmax_)
+            this->hmax_ = comp.h;
+          if (comp.v > this->vmax_)
+            this->vmax_ = comp.v;
+        }
+        break;
+      case 0xDD:  // DRI
+        if (n < 2)
+          return false;
+        this->restart_interval_ = read_be16(p);
+        break;
+      case 0xDA: {  // SOS
+        if (this->num_components_ == 0 || n < 1 || p[0] != this->num_components_ ||
+            n < 4 + 2u * this->num_components_)
+          return false;  // progressive or non-interleaved scans
+        for (int s = 0; s < this->num_components_; s++) {
+          Component *comp = nullptr;
+          for (int c = 0; c < this->num_components_; c++) {
+            if (this->components_[c].id == p[1 + 2 * s])
+              comp = &this->components_[c];
+          }
+          if (comp == nullptr)
+            return false;
+          comp->td = (p[2 + 2 * s] >> 4) & 0x01;
+          comp->ta = p[2 + 2 * s] & 0x01;
+        }
+        *scan_start = pos + 2 + seg_len;
+        return true;
+      }
+      case 0xC2:  // progressive and arithmetic coded frames are not handled
+      case 0xC3:
+      case 0xC5:
+      case 0xC6:
+      case 0xC7:
+      case 0xC9:
+      case 0xCA:
+      case 0xCB:
+      case 0xCD:
+      case 0xCE:
+      case 0xCF:
+      case 0xD9:
+        return false;
+      default:
+        break;
+    }
+    pos += 2 + seg_len;
+  }
+  return false;
+}
+
+bool JpegDownscaler::alloc_planes_(uint8_t k, uint16_t out_width, uint16_t out_height) {
+  const uint32_t mcux = (this->width_ + 8 * this->hmax_ - 1) / (8 * this->hmax_);
+  const uint32_t mcuy = (this->height_ + 8 * this->vmax_ - 1) / (8 * this->vmax_);
+  const uint32_t out_mcux = (out_width + 8 * this->hmax_ - 1) / (8 * this->hmax_);
+  const uint32_t out_mcuy = (out_height + 8 * this->vmax_ - 1) / (8 * this->vmax_);
+  size_t total = 0;
+  for (int c = 0; c < this->num_components_; c++) {
+    Component &comp = this->components_[c];
+    // large enough for the decoded blocks and for the output MCU grid
+    const uint32_t decoded_w = mcux * comp.h * k;
+    const uint32_t decoded_h = mcuy * comp.v * k;
+    const uint32_t encoded_w = out_mcux * comp.h * 8;
+    const uint32_t encoded_h = out_mcuy * comp.v * 8;
+    comp.stride = decoded_w > encoded_w ? decoded_w : encoded_w;
+    comp.rows = decoded_h > encoded_h ? decoded_h : encoded_h;
+    total += (size_t) comp.stride * comp.rows;
+  }
+  if (total > this->planes_size_) {
+    if (this->planes_ != nullptr)
+      this->free_(this->planes_);
+    this->planes_ = (uint8_t *) this->alloc_(total);
+    this->planes_size_ = this->planes_ != nullptr ? total : 0;
+    if (this->planes_ == nullptr)
+      return false;
+  }
+  uint8_t *plane = this->planes_;
+  for (int c = 0; c < this->num_components_; c++) {
+    this->components_[c].plane = plane;
+    plane += (size_t) this->components_[c].stride * this->components_[c].rows;
+  }
+  return true;
+}
+
+bool JpegDownscaler::decode_scan_(const uint8_t *data, size_t len, size_t scan_start, uint8_t k) {
+  const uint32_t mcux = (this->width_ + 8 * this->hmax_ - 1) / (8 * this->hmax_);
+  const uint32_t mcuy = (this->height_ + 8 * this->vmax_ - 1) / (8 * this->vmax_);
+  BitReader reader{data, len, scan_start};
+  for (int c = 0; c < this->num_components_; c++)
+    this->components_[c].dc_pred = 0;
+
+  uint32_t mcu = 0;
+  int32_t coef[16];
+  for (uint32_t my = 0; my < mcuy; my++) {
+    for (uint32_t mx = 0; mx < mcux; mx++, mcu++) {
+      if (this->restart_interval_ != 0 && mcu != 0 && mcu % this->restart_interval_ == 0) {
+        if (!reader.restart())
+          return false;
+        for (int c = 0; c < this->num_components_; c++)
+          this->components_[c].dc_pred = 0;
+      }
+      for (int c = 0; c < this->num_components_; c++) {
+        Component &comp = this->components_[c];
+        const JpegHuffmanDecode &dc = this->dc_[comp.td];
+        const JpegHuffmanDecode &ac = this->ac_[comp.ta];
+        const uint16_t *dequant = this->dequant_[comp.tq];
+        for (int by = 0; by < comp.v; by++) {
+          for (int bx = 0; bx < comp.h; bx++) {
+            memset(coef, 0, sizeof(coef));
+            const int s = reader.decode(dc);
+            if (s < 0 || s > 11)
+              return false;
+            // a valid frame's DC stays within the largest category, corrupt differences must not run away
+            comp.dc_pred = clamp_abs(comp.dc_pred + reader.receive_extend(s), 2047);
+            coef[0] = clamp_abs(comp.dc_pred * dequant[0], COEF_LIMIT);
+            // every AC coefficient has to be decoded to find the next block, only the k x k corner is kept
+            for (int z = 1; z < 64;) {
+              const int rs = reader.decode(ac);
+              if (rs < 0)
+                return false;
+              const int run = rs >> 4;
+              const int size = rs & 0x0F;
+              if (size == 0) {
+                if (run != 15)
+                  break;  // end of block
+                z += 16;
+                continue;
+              }
+              z += run;
+              if (z > 63)
+                return false;
+              const int32_t value = reader.receive_extend(size);
+              const int n = ZIGZAG[z];
+              if ((n & 7) < k && (n >> 3) < k)
+                coef[(n >> 3) * k + (n & 7)] = clamp_abs(value * dequant[n], COEF_LIMIT);
+              z++;
+            }
+            const uint32_t x = (mx * comp.h + bx) * k;
+            const uint32_t y = (my * comp.v + by) * k;
+            idct_scaled(coef, k, comp.plane + y * comp.stride + x, comp.stride);
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
+
+/* replicate the last valid column and row over the MCU padding */
+void JpegDownscaler::pad_planes_(uint16_t out_width, uint16_t out_height) {
+  for (int c = 0; c < this->num_components_; c++) {
+    Component &comp = this->components_[c];
+    uint32_t valid_w = (out_width * comp.h + this->hmax_ - 1) / this->hmax_;
+    uint32_t valid_h = (out_height * comp.v + this->vmax_ - 1) / this->vmax_;
+    if (valid_w > comp.stride)
+      valid_w = comp.stride;
+    if (valid_h > comp.rows)
+      valid_h = comp.rows;
+    for (uint32_t y = 0; y < valid_h; y++) {
+      uint8_t *row = comp.plane + y * comp.stride;
+      memset(row + valid_w, row[valid_w - 1], comp.stride - valid_w);
+    }
+    for (uint32_t y = valid_h; y < comp.rows; y++)
+      memcpy(comp.plane + y * comp.stride, comp.plane + (valid_h - 1) * comp.stride, comp.stride);
+  }
+}
+
+size_t JpegDownscaler::encode_(uint8_t *out, size_t out_size, uint16_t out_width, uint16_t out_height) {
+  BitWriter writer{out, out_size};
+  const uint8_t nc = this->num_components_;
+  writer.byte(0xFF);
+  writer.byte(0xD8);
+
+  // DQT, luminance and chrominance in zigzag order
+  const int tables = nc == 1 ? 1 : 2;
+  writer.byte(0xFF);
+  writer.byte(0xDB);
+  writer.byte(0);
+  writer.byte(2 + 65 * tables);
+  for (int t = 0; t < tables; t++) {
+    writer.byte(t);
+    for (int z = 0; z < 64; z++)
+      writer.byte(this->quant_[t][ZIGZAG[z]]);
+  }
+
+  // SOF0 with the source sampling
+  writer.byte(0xFF);
+  writer.byte(0xC0);
+  writer.byte(0);
+  writer.byte(8 + 3 * nc);
+  writer.byte(8);
+  writer.byte(out_height >> 8);
+  writer.byte(out_height & 0xFF);
+  writer.byte(out_width >> 8);
+  writer.byte(out_width & 0xFF);
+  writer.byte(nc);
+  for (int c = 0; c < nc; c++) {
+    writer.byte(this->components_[c].id);
+    writer.byte((this->components_[c].h << 4) | this->components_[c].v);
+    writer.byte(c == 0 ? 0 : 1);
+  }
+
+  for (size_t i = 0; i < JPEG_STANDARD_DHT_SIZE; i++)
+    writer.byte(JPEG_STANDARD_DHT[i]);
+
+  writer.byte(0xFF);
+  writer.byte(0xDA);
+  writer.byte(0);
+  writer.byte(6 + 2 * nc);
+  writer.byte(nc);
+  for (int c = 0; c < nc; c++) {
+    writer.byte(this->components_[c].id);
+    writer.byte(c == 0 ? 0x00 : 0x11);
+  }
+  writer.byte(0);
+  writer.byte(63);
+  writer.byte(0);
+
+  const uint32_t mcux = (out_width + 8 * this->hmax_ - 1) / (8 * this->hmax_);
+  const uint32_t mcuy = (out_height + 8 * this->vmax_ - 1) / (8 * this->vmax_);
+  int pred[3] = {0, 0, 0};
+  int16_t zz[64];
+  for (uint32_t my = 0; my < mcuy; my++) {
+    for (uint32_t mx = 0; mx < mcux; mx++) {
+      for (int c = 0; c < nc; c++) {
+        const Component &comp = this->components_[c];
+        const int t = c == 0 ? 0 : 1;
+        for (int by = 0; by < comp.v; by++) {
+          for (int bx = 0; bx < comp.h; bx++) {
+            const uint32_t x = (mx * comp.h + bx) * 8;
+            const uint32_t y = (my * comp.v + by) * 8;
+            fdct_quantize(comp.plane + y * comp.stride + x, comp.stride, this->quant_[t], zz);
+            encode_block(writer, zz, &pred[c], this->dc_encode_[t], this->ac_encode_[t]);
+          }
+        }
+      }
+      if (writer.overflow())
+        return 0;
+    }
+  }
+  writer.flush();
+  writer.byte(0xFF);
+  writer.byte(0xD9);
+  return writer.overflow() ? 0 : writer.pos;
+}
+
+size_t JpegDownscaler::scale(const uint8_t *data, size_t len, uint8_t shift, uint8_t *out, size_t out_size,
+                             uint16_t *width, uint16_t *height) {
+  if (shift < 1 || shift > 3)
+    return 0;
+  size_t scan_start;
+  if (!this->parse_headers_(data, len, &scan_start))
+    return 0;
+  const uint8_t k = 8 >> shift;
+  const uint16_t out_width = (this->width_ + (1 << shift) - 1) >> shift;
+  const uint16_t out_height = (this->height_ + (1 << shift) - 1) >> shift;
+  if (!this->alloc_planes_(k, out_width, out_height))
+    return 0;
+  if (!this->decode_scan_(data, len, scan_start, k))
+    return 0;
+  this->pad_planes_(out_width, out_height);
+  const size_t written = this->encode_(out, out_size, out_width, out_height);
+  if (written != 0) {
+    *width = out_width;
+    *height = out_height;
+  }
+  return written;
+}
+
+const uint8_t *JpegDownscaler::decode_luma(const uint8_t *data, size_t len, uint16_t *width, uint16_t *height,
+                                           uint32_t *stride) {
+  size_t scan_start;
+  if (!this->parse_headers_(data, len, &scan_start))
+    return nullptr;
+  const uint16_t out_width = (this->width_ + 7) >> 3;
+  const uint16_t out_height = (this->height_ + 7) >> 3;
+  if (!this->alloc_planes_(1, out_width, out_height))
+    return nullptr;
+  if (!this->decode_scan_(data, len, scan_start, 1))
+    return nullptr;
+  *width = out_width;
+  *height = out_height;
+  *stride = this->components_[0].stride;
+  return this->components_[0].plane;
+}
+
+}  // namespace esphome::usb_webcam
@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome::usb_webcam {
+
+/* Huffman tables of one class (DC or AC) and destination */
+struct JpegHuffmanDecode {
+  static const int LOOKAHEAD = 8;
+  uint16_t lookup[1 << LOOKAHEAD];  // (length << 8) | value for codes up to LOOKAHEAD bits, 0 otherwise
+  int32_t maxcode[18];              // largest code of each length, -1 if none
+  int32_t valoffset[17];            // value index = code + valoffset[length]
+  uint8_t values[256];
+  int32_t count;                    // of values
+};
+
+struct JpegHuffmanEncode {
+  uint16_t code[256];
+  uint8_t size[256];
+};
+
+/* ---------------- JpegDownscaler class ----------------
+ * Reduces an MJPEG frame to 1/2, 1/4 or 1/8 of its width and height in the
+ * DCT domain: all coefficients are entropy decoded, but only the low k x k
+ * ones each output block depends on are dequantized and transformed back
+ * (k = 4, 2 or 1, DC only). The reduced planes keep the source sampling, so
+ * they are encoded again as is with the standard Huffman tables.
+ * Baseline 8-bit frames with one or three components. Plain C++ working on
+ * fixed-size arrays, the same code runs on the host. */
+class JpegDownscaler {
+ public:
+  using AllocFn = void *(*) (size_t);
+  using FreeFn = void (*)(void *);
+
+  JpegDownscaler();
+  ~JpegDownscaler();
+
+  /* the planes can get large, e.g. put them in PSRAM on the device */
+  void set_allocator(AllocFn alloc, FreeFn free);
+  void set_quality(uint8_t quality);
+  /* bytes of the planes, they only grow */
+  size_t get_buffer_size() const { return this->planes_size_; }
+
+  /* Scale by 1 / (1 << shift), shift 1..3. Returns the length of the JPEG
+   * written to out, 0 if the frame can't be scaled or out is too small. */
+  size_t scale(const uint8_t *data, size_t len, uint8_t shift, uint8_t *out, size_t out_size, uint16_t *width,
+               uint16_t *height);
+  /* Decode only the DC coefficients and return the 1/8 scale luma plane, one
+   * byte per 8x8 block, or nullptr. Valid until the next call. */
+  const uint8_t *decode_luma(const uint8_t *data, size_t len, uint16_t *width, uint16_t *height, uint32_t *stride);
+
+ protected:
+  struct Component {
+    uint8_t id;
+    uint8_t h, v;
+    uint8_t tq;
+    uint8_t td, ta;
+    int dc_pred;
+    uint8_t *plane;
+    uint32_t stride, rows;
+  };
+
+  bool parse_headers_(const uint8_t *data, size_t len, size_t *scan_start);
+  bool decode_scan_(const uint8_t *data, size_t len, size_t scan_start, uint8_t k);
+  bool alloc_planes_(uint8_t k, uint16_t out_width, uint16_t out_height);
+  void pad_planes_(uint16_t out_width, uint16_t out_height);
+  size_t encode_(uint8_t *out, size_t out_size, uint16_t out_width, uint16_t out_height);
+
+  AllocFn alloc_;
+  FreeFn free_;
+  uint8_t *planes_{nullptr};
+  size_t planes_size_{0};
+
+  /* source frame */
+  uint16_t width_{0};
+  uint16_t height_{0};
+  uint8_t num_components_{0};
+  uint8_t hmax_{1};
+  uint8_t vmax_{1};
+  uint16_t restart_interval_{0};
+  Component components_[3];
+  uint16_t dequant_[4][64];  // natural order
+  JpegHuffmanDecode dc_[2];
+  JpegHuffmanDecode ac_[2];
+
+  /* output */
+  uint8_t quality_{0};
+  uint8_t quant_[2][64];  // natural order, luminance and chrominance
+  JpegHuffmanEncode dc_encode_[2];
+  JpegHuffmanEncode ac_encode_[2];
+};
+
+}  // namespace esphome::usb_webcam
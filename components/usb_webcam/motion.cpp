@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "motion.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace esphome::usb_webcam {
+
+MotionDetector::MotionDetector() : alloc_(malloc), free_(free) {}
+
+MotionDetector::~MotionDetector() {
+  if (this->background_ != nullptr)
+    this->free_(this->background_);
+}
+
+void MotionDetector::set_allocator(AllocFn alloc, FreeFn free) {
+  if (this->background_ != nullptr) {
+    this->free_(this->background_);
+    this->background_ = nullptr;
+    this->capacity_ = 0;
+  }
+  this->alloc_ = alloc;
+  this->free_ = free;
+  this->reset();
+}
+
+uint16_t MotionDetector::update(const uint8_t *luma, uint16_t width, uint16_t height, uint32_t stride) {
+  const size_t cells = (size_t) width * height;
+  if (cells == 0)
+    return 0;
+  if (width != this->width_ || height != this->height_) {
+    if (cells > this->capacity_) {
+      if (this->background_ != nullptr)
+        this->free_(this->background_);
+      this->background_ = (uint16_t *) this->alloc_(cells * sizeof(uint16_t));
+      this->capacity_ = this->background_ != nullptr ? cells : 0;
+      if (this->background_ == nullptr) {
+        this->width_ = this->height_ = 0;
+        return 0;
+      }
+    }
+    for (uint16_t y = 0; y < height; y++) {
+      for (uint16_t x = 0; x < width; x++)
+        this->background_[y * width + x] = luma[y * stride + x] << 8;
+    }
+    this->width_ = width;
+    this->height_ = height;
+    return 0;
+  }
+
+  // brightness shift of the whole frame, e.g. auto exposure
+  int32_t sum = 0;
+  for (uint16_t y = 0; y < height; y++) {
+    const uint8_t *row = luma + y * stride;
+    const uint16_t *background = this->background_ + y * width;
+    for (uint16_t x = 0; x < width; x++)
+      sum += row[x] - (background[x] >> 8);
+  }
+  const int32_t offset = sum / (int32_t) cells;
+
+  uint32_t changed = 0;
+  for (uint16_t y = 0; y < height; y++) {
+    const uint8_t *row = luma + y * stride;
+    uint16_t *background = this->background_ + y * width;
+    for (uint16_t x = 0; x < width; x++) {
+      const int32_t diff = row[x] - (background[x] >> 8) - offset;
+      if (diff > this->threshold_ || diff < -this->threshold_)
+        changed++;
+      background[x] += (((int32_t) row[x] << 8) - background[x]) >> this->background_shift_;
+    }
+  }
+  return changed * 1000 / cells;
+}
+
+void frame_signature(const uint8_t *luma, uint16_t width, uint16_t height, uint32_t stride, FrameSignature *signature) {
+  const int grid = FrameSignature::GRID;
+  signature->valid = width != 0 && height != 0;
+  if (!signature->valid)
+    return;
+  for (int cy = 0; cy < grid; cy++) {
+    const uint32_t y0 = cy * height / grid;
+    const uint32_t y1 = std::max<uint32_t>(y0 + 1, (cy + 1) * height / grid);
+    for (int cx = 0; cx < grid; cx++) {
+      const uint32_t x0 = cx * width / grid;
+      const uint32_t x1 = std::max<uint32_t>(x0 + 1, (cx + 1) * width / grid);
+      uint32_t sum = 0;
+      for (uint32_t y = y0; y < y1; y++) {
+        for (uint32_t x = x0; x < x1; x++)
+          sum += luma[y * stride + x];
+      }
+      signature->cells[cy * grid + cx] = sum / ((y1 - y0) * (x1 - x0));
+    }
+  }
+}
+
+uint8_t frame_signature_distance(const FrameSignature &a, const FrameSignature &b) {
+  if (!a.valid || !b.valid)
+    return 255;
+  uint8_t distance = 0;
+  for (int i = 0; i < FrameSignature::GRID * FrameSignature::GRID; i++) {
+    const uint8_t diff = a.cells[i] > b.cells[i] ? a.cells[i] - b.cells[i] : b.cells[i] - a.cells[i];
+    if (diff > distance)
+      distance = diff;
+  }
+  return distance;
+}
+
+}  // namespace esphome::usb_webcam
@@ -0,0 +1,64 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome::usb_webcam {
+
+/* Coarse layout of a frame: the mean luma of a 16x16 grid of cells. Sensor
+ * noise averages out, so near-identical frames get near-identical
+ * signatures even though their MJPEG bytes differ. */
+struct FrameSignature {
+  static const int GRID = 16;
+  uint8_t cells[GRID * GRID];
+  bool valid;
+};
+
+void frame_signature(const uint8_t *luma, uint16_t width, uint16_t height, uint32_t stride, FrameSignature *signature);
+/* largest difference of any cell, 255 if either signature is invalid */
+uint8_t frame_signature_distance(const FrameSignature &a, const FrameSignature &b);
+
+/* ---------------- MotionDetector class ----------------
+ * Compares the 1/8 scale luma of a frame, one value per 8x8 block as given
+ * by the DC coefficients, against a running average background. A block
+ * counts as changed when it is further from the background than the
+ * threshold, after taking out the global brightness shift auto exposure
+ * causes. */
+class MotionDetector {
+ public:
+  using AllocFn = void *(*) (size_t);
+  using FreeFn = void (*)(void *);
+
+  MotionDetector();
+  ~MotionDetector();
+
+  void set_allocator(AllocFn alloc, FreeFn free);
+  void set_threshold(uint8_t threshold) { this->threshold_ = threshold; }
+  void set_min_area(uint16_t permille) { this->min_area_ = permille; }
+  /* the background follows each frame by 1 / (1 << shift) */
+  void set_background_shift(uint8_t shift) { this->background_shift_ = shift; }
+
+  /* Feed the luma of the next frame; returns the share of changed blocks in
+   * permille. The first frame, or one with other dimensions, only seeds the
+   * background. */
+  uint16_t update(const uint8_t *luma, uint16_t width, uint16_t height, uint32_t stride);
+  uint8_t get_threshold() const { return this->threshold_; }
+  size_t get_buffer_size() const { return this->capacity_ * sizeof(uint16_t); }
+  bool is_motion(uint16_t score) const { return score >= this->min_area_; }
+  void reset() { this->width_ = this->height_ = 0; }
+
+ protected:
+  AllocFn alloc_;
+  FreeFn free_;
+  uint16_t *background_{nullptr};  // 8.8 fixed point
+  size_t capacity_{0};
+  uint16_t width_{0};
+  uint16_t height_{0};
+  uint8_t threshold_{12};
+  uint16_t min_area_{20};
+  uint8_t background_shift_{4};
+};
+
+}  // namespace esphome::usb_webcam
@@ -0,0 +1,222 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "recorder.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <unistd.h>
+
+namespace esphome::usb_webcam {
+
+/* flushed and synced to the card at least this often, so a power loss costs at most that much */
+static const uint32_t RECORDER_SYNC_BYTES = 1024 * 1024;
+
+void Recorder::init(uint8_t *arena, size_t size, size_t block_size) {
+  this->block_size_ = block_size;
+  this->block_count_ = block_size != 0 ? std::min(size / block_size, RECORDER_MAX_BLOCKS) : 0;
+  // one block to write while others fill, one kept back to close a segment
+  this->arena_ = this->block_count_ >= 3 ? arena : nullptr;
+}
+
+/* ---------------- producer side ---------------- */
+bool Recorder::start() {
+  if (!this->is_enabled())
+    return false;
+  if (this->recording_)
+    return true;
+  if (this->has_failed()) {
+    // the writer skips what is left after a failure, try again once it is through
+    if (this->written_.load(std::memory_order_acquire) != this->committed_.load(std::memory_order_relaxed))
+      return false;
+    this->failed_.store(false, std::memory_order_relaxed);
+  }
+  this->recording_ = true;
+  return true;
+}
+
+void Recorder::stop() {
+  if (!this->recording_)
+    return;
+  this->recording_ = false;
+  if (this->segment_bytes_ != 0)
+    this->end_segment_();
+}
+
+void Recorder::commit_block_(bool closes_segment) {
+  const uint32_t committed = this->committed_.load(std::memory_order_relaxed);
+  Block &block = this->blocks_[committed % this->block_count_];
+  block.used = this->fill_;
+  block.closes_segment = closes_segment;
+  this->committed_.store(committed + 1, std::memory_order_release);
+  this->fill_ = 0;
+}
+
+void Recorder::end_segment_() {
+  this->commit_block_(true);
+  this->segment_++;
+  this->segment_bytes_ = 0;
+}
+
+bool Recorder::append(const camera_fb_t &fb) {
+  if (!this->recording_)
+    return false;
+  if (this->has_failed()) {
+    // close the segment so the writer gets through the rest
+    this->stop();
+    return false;
+  }
+  if (this->segment_bytes_ != 0 && this->segment_bytes_ + fb.len > this->segment_size_)
+    this->end_segment_();
+
+  const uint32_t in_flight =
+      this->committed_.load(std::memory_order_relaxed) - this->written_.load(std::memory_order_acquire);
+  const size_t free_blocks = this->block_count_ - 1 > in_flight ? this->block_count_ - 1 - in_flight : 0;
+  if (fb.len == 0 || fb.len > free_blocks * this->block_size_ - this->fill_ || this->entries_.full()) {
+    this->dropped_++;
+    return false;
+  }
+
+  PendingEntry pending{};
+  pending.entry.offset = this->segment_bytes_;
+  pending.entry.length = fb.len;
+  pending.entry.eof_us = fb.eof_us;
+  pending.entry.sequence = fb.sequence;
+  pending.entry.width = fb.width;
+  pending.entry.height = fb.height;
+  pending.segment = this->segment_;
+
+  // frames run on across blocks, full ones go to the writer right away
+  const uint8_t *src = fb.buf;
+  size_t left = fb.len;
+  while (left != 0) {
+    const uint32_t slot = this->committed_.load(std::memory_order_relaxed) % this->block_count_;
+    const size_t n = std::min(left, this->block_size_ - this->fill_);
+    memcpy(this->arena_ + slot * this->block_size_ + this->fill_, src, n);
+    this->fill_ += n;
+    src += n;
+    left -= n;
+    if (this->fill_ == this->block_size_)
+      this->commit_block_(false);
+  }
+  this->segment_bytes_ += fb.len;
+  this->entries_.push(pending);
+  return true;
+}
+
+/* ---------------- writer side ---------------- */
+void Recorder::fail_(const char *what) {
+  this->close_files_();
+  this->numbered_ = false;  // the card may come back as another one
+  this->number_ = 0;
+  this->error_ = what;
+  this->failed_.store(true, std::memory_order_release);
+}
+
+/* numbering goes on after the highest NNNNNNNN.mjp in the directory */
+bool Recorder::open_segment_() {
+  if (!this->numbered_) {
+    DIR *dir = opendir(this->path_.c_str());
+    if (dir == nullptr) {
+      this->fail_("directory not found");
+      return false;
+    }
+    while (struct dirent *entry = readdir(dir)) {
+      char *end;
+      const unsigned long number = strtoul(entry->d_name, &end, 10);
+      if (end == entry->d_name + 8 && strcasecmp(end, ".mjp") == 0 && number >= this->number_)
+        this->number_ = number + 1;
+    }
+    closedir(dir);
+    this->numbered_ = true;
+  }
+
+  char name[16];
+  snprintf(name, sizeof(name), "/%08u.mjp", (unsigned) this->number_);
+  this->data_ = fopen((this->path_ + name).c_str(), "wb");
+  snprintf(name, sizeof(name), "/%08u.idx", (unsigned) this->number_);
+  this->index_ = fopen((this->path_ + name).c_str(), "wb");
+  if (this->data_ == nullptr || this->index_ == nullptr) {
+    this->fail_("can't create segment files");
+    return false;
+  }
+  this->number_++;
+  // blocks go to the file system as they are, entries are small and buffered
+  setvbuf(this->data_, nullptr, _IONBF, 0);
+  if (fwrite(RECORDER_INDEX_MAGIC, sizeof(RECORDER_INDEX_MAGIC), 1, this->index_) != 1) {
+    this->fail_("index write failed");
+    return false;
+  }
+  this->segment_written_ = 0;
+  this->last_sync_ = 0;
+  return true;
+}
+
+void Recorder::close_files_() {
+  if (this->data_ != nullptr)
+    fclose(this->data_);
+  if (this->index_ != nullptr)
+    fclose(this->index_);
+  this->data_ = nullptr;
+  this->index_ = nullptr;
+}
+
+/* entries go out once the data they point to is written */
+void Recorder::write_entries_(bool closing) {
+  while (true) {
+    if (!this->held_valid_) {
+      if (!this->entries_.pop(&this->held_))
+        return;
+      this->held_valid_ = true;
+    }
+    if (this->held_.segment != this->writer_segment_)
+      return;  // next segment
+    if (!closing && this->held_.entry.offset + this->held_.entry.length > this->segment_written_)
+      return;
+    if (this->index_ != nullptr && !this->has_failed()) {
+      if (fwrite(&this->held_.entry, sizeof(RecorderIndexEntry), 1, this->index_) != 1) {
+        this->fail_("index write failed");
+      } else {
+        this->frames_.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    this->held_valid_ = false;
+  }
+}
+
+bool Recorder::drain() {
+  const uint32_t committed = this->committed_.load(std::memory_order_acquire);
+  uint32_t written = this->written_.load(std::memory_order_relaxed);
+  if (written == committed)
+    return false;
+  for (; written != committed; written++) {
+    const uint32_t slot = written % this->block_count_;
+    const Block &block = this->blocks_[slot];
+    if (!this->has_failed() && block.used != 0 && (this->data_ != nullptr || this->open_segment_())) {
+      if (fwrite(this->arena_ + slot * this->block_size_, 1, block.used, this->data_) != block.used) {
+        this->fail_("data write failed");
+      } else {
+        this->segment_written_ += block.used;
+        this->bytes_written_.fetch_add(block.used, std::memory_order_relaxed);
+      }
+    }
+    this->write_entries_(block.closes_segment);
+    if (block.closes_segment) {
+      if (this->data_ != nullptr)
+        this->segments_.fetch_add(1, std::memory_order_relaxed);
+      this->close_files_();
+      this->writer_segment_++;
+    } else if (this->data_ != nullptr && this->segment_written_ - this->last_sync_ >= RECORDER_SYNC_BYTES) {
+      // FAT only updates the file size on sync, without it a power loss costs the whole segment
+      fflush(this->index_);
+      fsync(fileno(this->index_));
+      fsync(fileno(this->data_));
+      this->last_sync_ = this->segment_written_;
+    }
+    this->written_.store(written + 1, std::memory_order_release);
+  }
+  return true;
+}
+
+}  // namespace esphome::usb_webcam
@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "frame_pool.h"
+#include "spsc_ring.h"
+
+namespace esphome::usb_webcam {
+
+static const size_t RECORDER_MAX_BLOCKS = 64;
+static const size_t RECORDER_MAX_PENDING_FRAMES = 128;
+
+/* One frame in the index file of a segment, little endian. The index file
+ * starts with RECORDER_INDEX_MAGIC, entry i follows at 8 + 24 * i. */
+struct RecorderIndexEntry {
+  uint32_t offset;  // in the data file of the segment
+  uint32_t length;
+  int64_t eof_us;
+  uint32_t sequence;
+  uint16_t width;
+  uint16_t height;
+};
+static_assert(sizeof(RecorderIndexEntry) == 24, "index entries are written as is");
+
+static const char RECORDER_INDEX_MAGIC[8] = {'U', 'W', 'C', 'I', 'D', 'X', '0', '1'};
+
+/* ---------------- Recorder class ----------------
+ * Records frames into numbered segments on a mounted filesystem, e.g. an
+ * SD card: NNNNNNNN.mjp holds the JPEGs back to back, playable as a raw
+ * MJPEG stream, and NNNNNNNN.idx the entries to seek in it without
+ * scanning. Frames are copied into a write-behind ring of equal blocks and
+ * a writer task writes whole blocks, so writes are large and only the last
+ * one of a segment ends off a block boundary. One block is kept back so a
+ * segment can always be closed. Numbering goes on from the highest segment
+ * already in the directory.
+ * start(), stop() and append() belong to one task, drain() to another. */
+class Recorder {
+ public:
+  void set_path(const std::string &path) { this->path_ = path; }
+  const std::string &get_path() const { return this->path_; }
+  void set_segment_size(uint32_t size) { this->segment_size_ = size; }
+  /* arena must outlive the recorder, block_size is the size of the writes */
+  void init(uint8_t *arena, size_t size, size_t block_size);
+  bool is_enabled() const { return this->arena_ != nullptr; }
+
+  /* producer side */
+  bool start();
+  void stop();
+  bool is_recording() const { return this->recording_; }
+  /* copy a frame in; fails when the ring is full or writing failed */
+  bool append(const camera_fb_t &fb);
+  uint32_t get_dropped() const { return this->dropped_; }
+
+  /* writer side, returns whether there was anything to write */
+  bool drain();
+
+  bool has_failed() const { return this->failed_.load(std::memory_order_acquire); }
+  /* what failed, once has_failed() */
+  const char *get_error() const { return this->error_; }
+  uint32_t get_frames() const { return this->frames_.load(std::memory_order_relaxed); }
+  uint32_t get_segments() const { return this->segments_.load(std::memory_order_relaxed); }
+  uint64_t get_bytes_written() const { return this->bytes_written_.load(std::memory_order_relaxed); }
+
+ protected:
+  struct Block {
+    uint32_t used;  // bytes, block_size_ except maybe for the last block of a segment
+    bool closes_segment;
+  };
+  struct PendingEntry {
+    RecorderIndexEntry entry;
+    uint32_t segment;  // producer count, to match the writer's
+  };
+
+  void commit_block_(bool closes_segment);
+  void end_segment_();
+  bool open_segment_();
+  void close_files_();
+  void write_entries_(bool closing);
+  void fail_(const char *what);
+
+  std::string path_;
+  uint32_t segment_size_{64 * 1024 * 1024};
+  uint8_t *arena_{nullptr};
+  size_t block_size_{0};
+  size_t block_count_{0};
+  Block blocks_[RECORDER_MAX_BLOCKS]{};
+  std::atomic<uint32_t> committed_{0};  // blocks handed to the writer
+  std::atomic<uint32_t> written_{0};    // blocks the writer is done with
+  SPSCRing<PendingEntry, RECORDER_MAX_PENDING_FRAMES> entries_;
+  std::atomic<bool> failed_{false};
+  const char *error_{nullptr};
+
+  /* producer */
+  bool recording_{false};
+  size_t fill_{0};  // bytes in the block being filled
+  uint32_t segment_{0};
+  uint32_t segment_bytes_{0};
+  uint32_t dropped_{0};
+
+  /* writer */
+  FILE *data_{nullptr};
+  FILE *index_{nullptr};
+  uint32_t writer_segment_{0};
+  uint32_t segment_written_{0};
+  uint32_t last_sync_{0};
+  uint32_t number_{0};  // of the next segment file
+  bool numbered_{false};
+  PendingEntry held_{};  // popped, waiting for its data to be written
+  bool held_valid_{false};
+  std::atomic<uint32_t> frames_{0};
+  std::atomic<uint32_t> segments_{0};
+  std::atomic<uint64_t> bytes_written_{0};
+};
+
+}  // namespace esphome::usb_webcam
@@ -0,0 +1,170 @@
+# SPDX-License-Identifier: GPL-3.0-only
+
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components import sensor
+from esphome.const import (
+    CONF_UPDATE_INTERVAL,
+    DEVICE_CLASS_DATA_RATE,
+    ENTITY_CATEGORY_DIAGNOSTIC,
+    STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
+)
+
+from . import CONF_USB_WEBCAM_ID, USBWebCam, usb_webcam_ns
+
+DEPENDENCIES = ["usb_webcam"]
+
+UNIT_FRAMES = "frames"
+UNIT_BYTES = "B"
+UNIT_BYTES_PER_SECOND = "B/s"
+UNIT_MICROSECOND = "µs"
+UNIT_PERMILLE = "‰"
+UNIT_FPS = "fps"
+UNIT_MILLISECOND = "ms"
+UNIT_RECONNECTS = "reconnects"
+UNIT_RESTARTS = "restarts"
+
+USBWebCamTelemetry = usb_webcam_ns.enum("USBWebCamTelemetry")
+
+# config key: (enum value, unit, state class)
+TELEMETRY = {
+    "frames_received": (
+        USBWebCamTelemetry.USB_WEBCAM_FRAMES_RECEIVED,
+        UNIT_FRAMES,
+        STATE_CLASS_TOTAL_INCREASING,
+    ),
+    "frames_lost": (
+        USBWebCamTelemetry.USB_WEBCAM_FRAMES_LOST,
+        UNIT_FRAMES,
+        STATE_CLASS_TOTAL_INCREASING,
+    ),
+    "frames_dropped_small": (
+        USBWebCamTelemetry.USB_WEBCAM_FRAMES_DROPPED_SMALL,
+        UNIT_FRAMES,
+        STATE_CLASS_TOTAL_INCREASING,
+    ),
+    "frames_dropped_overflow": (
+        USBWebCamTelemetry.USB_WEBCAM_FRAMES_DROPPED_OVERFLOW,
+        UNIT_FRAMES,
+        STATE_CLASS_TOTAL_INCREASING,
+    ),
+    "frames_dropped_invalid": (
+        USBWebCamTelemetry.USB_WEBCAM_FRAMES_DROPPED_INVALID,
+        UNIT_FRAMES,
+        STATE_CLASS_TOTAL_INCREASING,
+    ),
+    "frames_dropped_busy": (
+        USBWebCamTelemetry.USB_WEBCAM_FRAMES_DROPPED_BUSY,
+        UNIT_FRAMES,
+        STATE_CLASS_TOTAL_INCREASING,
+    ),
+    "frames_delivered_api": (
+        USBWebCamTelemetry.USB_WEBCAM_FRAMES_DELIVERED_API,
+        UNIT_FRAMES,
+        STATE_CLASS_TOTAL_INCREASING,
+    ),
+    "frames_delivered_web": (
+        USBWebCamTelemetry.USB_WEBCAM_FRAMES_DELIVERED_WEB,
+        UNIT_FRAMES,
+        STATE_CLASS_TOTAL_INCREASING,
+    ),
+    "bandwidth": (
+        USBWebCamTelemetry.USB_WEBCAM_BYTES_PER_SECOND,
+        UNIT_BYTES_PER_SECOND,
+        STATE_CLASS_MEASUREMENT,
+    ),
+    "frame_rate": (
+        USBWebCamTelemetry.USB_WEBCAM_FRAME_RATE,
+        UNIT_FPS,
+        STATE_CLASS_MEASUREMENT,
+    ),
+    "frame_jitter": (
+        USBWebCamTelemetry.USB_WEBCAM_FRAME_JITTER,
+        UNIT_MICROSECOND,
+        STATE_CLASS_MEASUREMENT,
+    ),
+    "loop_latency": (
+        USBWebCamTelemetry.USB_WEBCAM_LOOP_LATENCY_P99,
+        UNIT_MICROSECOND,
+        STATE_CLASS_MEASUREMENT,
+    ),
+    "release_latency": (
+        USBWebCamTelemetry.USB_WEBCAM_RELEASE_LATENCY_P99,
+        UNIT_MICROSECOND,
+        STATE_CLASS_MEASUREMENT,
+    ),
+    "motion_score": (
+        USBWebCamTelemetry.USB_WEBCAM_MOTION_SCORE,
+        UNIT_PERMILLE,
+        STATE_CLASS_MEASUREMENT,
+    ),
+    "frames_suppressed": (
+        USBWebCamTelemetry.USB_WEBCAM_FRAMES_SUPPRESSED,
+        UNIT_FRAMES,
+        STATE_CLASS_TOTAL_INCREASING,
+    ),
+    "suppression_ratio": (
+        USBWebCamTelemetry.USB_WEBCAM_SUPPRESSION_RATIO,
+        UNIT_PERMILLE,
+        STATE_CLASS_MEASUREMENT,
+    ),
+    "reconnects": (
+        USBWebCamTelemetry.USB_WEBCAM_RECONNECTS,
+        UNIT_RECONNECTS,
+        STATE_CLASS_TOTAL_INCREASING,
+    ),
+    "stream_restarts": (
+        USBWebCamTelemetry.USB_WEBCAM_STREAM_RESTARTS,
+        UNIT_RESTARTS,
+        STATE_CLASS_TOTAL_INCREASING,
+    ),
+    "reconnect_time": (
+        USBWebCamTelemetry.USB_WEBCAM_RECONNECT_TIME,
+        UNIT_MILLISECOND,
+        STATE_CLASS_MEASUREMENT,
+    ),
+    "buffer_memory": (
+        USBWebCamTelemetry.USB_WEBCAM_BUFFER_BYTES,
+        UNIT_BYTES,
+        STATE_CLASS_MEASUREMENT,
+    ),
+    "resume_time": (
+        USBWebCamTelemetry.USB_WEBCAM_RESUME_TIME,
+        UNIT_MILLISECOND,
+        STATE_CLASS_MEASUREMENT,
+    ),
+}
+
+
+def _telemetry_schema(key):
+    _, unit, state_class = TELEMETRY[key]
+    kwargs = {
+        "unit_of_measurement": unit,
+        "accuracy_decimals": 2 if unit == UNIT_FPS else 0,
+        "state_class": state_class,
+        "entity_category": ENTITY_CATEGORY_DIAGNOSTIC,
+    }
+    if unit == UNIT_BYTES_PER_SECOND:
+        kwargs["device_class"] = DEVICE_CLASS_DATA_RATE
+    return sensor.sensor_schema(**kwargs)
+
+
+CONFIG_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(CONF_USB_WEBCAM_ID): cv.use_id(USBWebCam),
+        cv.Optional(
+            CONF_UPDATE_INTERVAL, default="10s"
+        ): cv.positive_time_period_milliseconds,
+        **{cv.Optional(key): _telemetry_schema(key) for key in TELEMETRY},
+    }
+)
+
+
+async def to_code(config):
+    parent = await cg.get_variable(config[CONF_USB_WEBCAM_ID])
+    cg.add(parent.set_telemetry_interval(config[CONF_UPDATE_INTERVAL]))
+    for key, (telemetry, _, _) in TELEMETRY.items():
+        if key in config:
+            sens = await sensor.new_sensor(config[key])
+            cg.add(parent.set_telemetry_sensor(telemetry, sens))
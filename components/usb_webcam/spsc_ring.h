@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome::usb_webcam {
+
+/* ---------------- SPSCRing class ----------------
+ * Bounded lock-free ring for exactly one producer and one consumer.
+ * Each index is written by one side only, so a release store paired
+ * with an acquire load is all the synchronization needed. */
+template<typename T, size_t N> class SPSCRing {
+  static_assert(N != 0 && (N & (N - 1)) == 0, "SPSCRing size must be a power of two");
+
+ public:
+  /* producer side */
+  bool push(const T &item) {
+    const uint32_t head = this->head_.load(std::memory_order_relaxed);
+    if (head - this->tail_.load(std::memory_order_acquire) == N)
+      return false;
+    this->items_[head & (N - 1)] = item;
+    this->head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool full() const {
+    return this->head_.load(std::memory_order_relaxed) - this->tail_.load(std::memory_order_acquire) == N;
+  }
+
+  /* consumer side */
+  bool pop(T *item) {
+    const uint32_t tail = this->tail_.load(std::memory_order_relaxed);
+    if (this->head_.load(std::memory_order_acquire) == tail)
+      return false;
+    *item = this->items_[tail & (N - 1)];
+    this->tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const {
+    return this->head_.load(std::memory_order_acquire) == this->tail_.load(std::memory_order_acquire);
+  }
+  static constexpr size_t capacity() { return N; }
+
+ protected:
+  std::array<T, N> items_{};
+  std::atomic<uint32_t> head_{0};
+  std::atomic<uint32_t> tail_{0};
+};
+
+}  // namespace esphome::usb_webcam
@@ -7,67 +7,142 @@
 #include "esphome/components/camera/camera.h"
 #include "usb_stream.h"
 #include "esp_timer.h"
+#include "mjpeg.h"
+#include "uvc_format.h"
 #ifdef CONFIG_ESP32_S3_USB_OTG
 #include "bsp/esp-bsp.h"
 #endif
 
+#include "esphome/core/application.h"
 #include "esphome/core/log.h"
+#include "esphome/core/preferences.h"
 
-#include <freertos/event_groups.h>
-#include <freertos/task.h>
-
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstring>
+#include <vector>
 
 static const char *const TAG = "usb_webcam";
-#define UVC_XFER_BUFFER_SIZE (46 * 1024) // requires PSRAM
-
-#define BIT0_FRAME_START     (0x01 << 0)
-#define BIT1_NEW_FRAME_START (0x01 << 1)
-#define BIT2_NEW_FRAME_END   (0x01 << 2)
+/* bounds of the automatically sized transfer/frame buffers */
+#define UVC_XFER_BUFFER_MIN_SIZE (16 * 1024)
+#define UVC_XFER_BUFFER_MAX_SIZE (512 * 1024)
+/* how often the link to the camera is checked for stalled streams */
+#define UVC_LINK_CHECK_INTERVAL 1000
+/* names usb_stream gives its tasks, configured through sdkconfig */
+#define UVC_USB_TASK_NAME "usb_proc"
+#define UVC_FRAMES_TASK_NAME "sample_proc"
+/* headers and tables of a scaled frame, on top of its share of the frame buffer */
+#define UVC_SCALE_HEADER_SIZE 1024
+/* larger steps of the usb_stream sequence are a restarted counter, not lost frames */
+#define UVC_SEQUENCE_MAX_GAP 1000
 
 namespace esphome::usb_webcam {
 
-static EventGroupHandle_t s_evt_handle;
-static uint32_t s_drop_frame_size = 0;
-static camera_fb_t s_fb;
-
-camera_fb_t *esp_camera_fb_get()
+/* never blocks, returns nullptr if no new frame arrived since the last call */
+camera_fb_t *esp_camera_fb_get(USBWebCamStream *stream)
 {
-    xEventGroupSetBits(s_evt_handle, BIT0_FRAME_START);
-    xEventGroupWaitBits(s_evt_handle, BIT1_NEW_FRAME_START, true, true, portMAX_DELAY);
-    return &s_fb;
+    return stream->frame_pool.acquire();
 }
 
-void esp_camera_fb_return(camera_fb_t *fb)
+void esp_camera_fb_return(USBWebCamStream *stream, camera_fb_t *fb)
 {
-    xEventGroupSetBits(s_evt_handle, BIT2_NEW_FRAME_END);
+    stream->frame_pool.release(fb);
     return;
 }
 
-static void camera_frame_cb(uvc_frame_t *frame, void *ptr)
+/* Number the frame in our own sequence and update the interval jitter,
+ * J += (|D| - J) / 16 over the change D of the time between frames as in
+ * RFC 3550. Gaps in the usb_stream sequence are frames lost before the
+ * callback; frames dropped here later are counted by reason instead. */
+static uint32_t track_frame_timing(USBWebCamStream *stream, uint32_t device_sequence, int64_t eof_us)
 {
-    if (!(xEventGroupGetBits(s_evt_handle) & BIT0_FRAME_START)) {
-        return;
+    if (stream->timing_restart.exchange(false)) {
+        stream->sequence++;
+        stream->last_period_us = 0;
+    } else {
+        const uint32_t step = device_sequence - stream->device_sequence;
+        if (step > 1 && step < UVC_SEQUENCE_MAX_GAP) {
+            stream->lost_frames.fetch_add(step - 1, std::memory_order_relaxed);
+            stream->last_gap_sequence.store(stream->sequence + 1, std::memory_order_relaxed);
+            ESP_LOGD(TAG, "Lost %u frames after frame %u", step - 1, stream->sequence);
+            stream->sequence += step;
+        } else {
+            stream->sequence++;
+        }
+        const int64_t period = eof_us - stream->last_eof_us;
+        if (stream->last_period_us != 0) {
+            const int64_t change = period > stream->last_period_us ? period - stream->last_period_us : stream->last_period_us - period;
+            stream->jitter16 += change - (stream->jitter16 >> 4);
+            stream->jitter_us.store(stream->jitter16 >> 4, std::memory_order_relaxed);
+        }
+        stream->last_period_us = period;
     }
+    stream->device_sequence = device_sequence;
+    stream->last_eof_us = eof_us;
+    return stream->sequence;
+}
+
+static void camera_frame_cb(uvc_frame_t *frame, void *ptr)
+{
+    USBWebCamStream *stream = (USBWebCamStream *) ptr;
     ESP_LOGV(TAG, "uvc frame format = %d, seq = %u, width = %u, height = %u, length = %u",
              frame->frame_format, frame->sequence, frame->width, frame->height, frame->data_bytes);
 
-    if(frame->data_bytes < s_drop_frame_size) {
-      ESP_LOGV(TAG, "Dropping frame size %u < %u", frame->data_bytes, s_drop_frame_size);
+    const int64_t eof_us = esp_timer_get_time();
+    const uint32_t sequence = track_frame_timing(stream, frame->sequence, eof_us);
+    stream->received_frames.fetch_add(1, std::memory_order_relaxed);
+    stream->received_bytes.fetch_add(frame->data_bytes, std::memory_order_relaxed);
+
+    /* CONFIG_UVC_DROP_OVERFLOW_FRAME is off, overflowing frames arrive truncated to the buffer */
+    if(frame->data_bytes >= stream->frame_buffer_size) {
+      stream->overflow_frames.fetch_add(1, std::memory_order_relaxed);
+      ESP_LOGV(TAG, "Dropping overflowed frame = %u", frame->sequence);
       return;
     }
+    if(frame->data_bytes > stream->max_frame_bytes.load(std::memory_order_relaxed)) {
+      stream->max_frame_bytes.store(frame->data_bytes, std::memory_order_relaxed);
+    }
+
+    if(frame->data_bytes < stream->drop_frame_size) {
+      stream->small_frames.fetch_add(1, std::memory_order_relaxed);
+      ESP_LOGV(TAG, "Dropping frame size %u < %u", frame->data_bytes, stream->drop_frame_size);
+      return;
+    }
+
+    /* usb_stream only reports finished frames, the first packet came at least the bus time of the frame earlier */
+    int64_t sof_us = eof_us;
+    if (stream->transfer_bytes_per_second != 0)
+        sof_us -= (int64_t) frame->data_bytes * 1000000 / stream->transfer_bytes_per_second;
 
     switch (frame->frame_format) {
     case UVC_FRAME_FORMAT_MJPEG:
-        s_fb.buf = (uint8_t*)frame->data;
-        s_fb.len = frame->data_bytes;
-        s_fb.width = frame->width;
-        s_fb.height = frame->height;
-        s_fb.format = PIXFORMAT_JPEG;
-        s_fb.timestamp.tv_sec = frame->sequence;
-        xEventGroupSetBits(s_evt_handle, BIT1_NEW_FRAME_START);
+        if (stream->frame_validation != USB_WEBCAM_VALIDATION_NONE) {
+            const JpegCheckResult result = check_jpeg((const uint8_t *)frame->data, frame->data_bytes, stream->frame_validation);
+            if (result != JPEG_OK) {
+                stream->invalid_frames[result].fetch_add(1, std::memory_order_relaxed);
+                ESP_LOGV(TAG, "Dropping invalid frame = %u: %s", frame->sequence, jpeg_check_result_to_string(result));
+                break;
+            }
+        }
+        /* auto exposure is still settling after a resume */
+        if (stream->warmup_frames.load(std::memory_order_relaxed) != 0) {
+            stream->warmup_frames.fetch_sub(1, std::memory_order_relaxed);
+            ESP_LOGV(TAG, "Dropping warm-up frame = %u", frame->sequence);
+            break;
+        }
+        /* copy the frame out so usb_stream can reuse its buffer right away */
+        if (!stream->frame_pool.push((const uint8_t *)frame->data, frame->data_bytes,
+                               frame->width, frame->height, sequence, sof_us, eof_us)) {
+            ESP_LOGV(TAG, "No free frame slot, dropping frame = %u", frame->sequence);
+            break;
+        }
         ESP_LOGV(TAG, "send frame = %u", frame->sequence);
-        xEventGroupWaitBits(s_evt_handle, BIT2_NEW_FRAME_END, true, true, portMAX_DELAY);
-        ESP_LOGV(TAG, "send frame done = %u", frame->sequence);
+        /* usb_stream task context, wake the component loop */
+        stream->parent->enable_loop_soon_any_context();
+#ifdef USE_WAKE_LOOP_THREADSAFE
+        App.wake_loop_threadsafe();
+#endif
         break;
     default:
         ESP_LOGW(TAG, "Format not supported");
@@ -78,6 +153,7 @@ static void camera_frame_cb(uvc_frame_t *frame, void *ptr)
 
 static void stream_state_changed_cb(usb_stream_state_t event, void *arg)
 {
+    USBWebCamStream *stream = (USBWebCamStream *) arg;
     switch (event) {
     case STREAM_CONNECTED: {
         size_t frame_size = 0;
@@ -87,18 +163,36 @@ static void stream_state_changed_cb(usb_stream_state_t event, void *arg)
             ESP_LOGI(TAG, "UVC: get frame list size = %u, current = %u", frame_size, frame_index);
             uvc_frame_size_t *uvc_frame_list = (uvc_frame_size_t *)malloc(frame_size * sizeof(uvc_frame_size_t));
             uvc_frame_size_list_get(uvc_frame_list, NULL, NULL);
+            stream->frame_list.resize(frame_size);
             for (size_t i = 0; i < frame_size; i++) {
-                ESP_LOGI(TAG, "\tframe[%u] = %ux%u", i, uvc_frame_list[i].width, uvc_frame_list[i].height);
+                ESP_LOGI(TAG, "\tframe[%u] = %ux%u, interval %u..%u step %u", i, uvc_frame_list[i].width, uvc_frame_list[i].height,
+                         uvc_frame_list[i].interval_min, uvc_frame_list[i].interval_max, uvc_frame_list[i].interval_step);
+                stream->frame_list[i] = UVCFrameInfo{uvc_frame_list[i].width, uvc_frame_list[i].height, uvc_frame_list[i].interval,
+                                                     uvc_frame_list[i].interval_min, uvc_frame_list[i].interval_max,
+                                                     uvc_frame_list[i].interval_step};
             }
             free(uvc_frame_list);
         } else {
             ESP_LOGW(TAG, "UVC: get frame list size = %u", frame_size);
         }
         ESP_LOGI(TAG, "Device connected");
+        /* stream settings are negotiated from the component loop */
+        stream->connected = true;
+        stream->connected_event = true;
+        stream->timing_restart = true;
+        stream->parent->enable_loop_soon_any_context();
         break;
     }
     case STREAM_DISCONNECTED:
         ESP_LOGI(TAG, "Device disconnected");
+        /* buffers and stream settings stay, usb_stream brings the device back up as is */
+        stream->connected = false;
+        stream->disconnected_event = true;
+        stream->timing_restart = true;
+        stream->parent->enable_loop_soon_any_context();
+#ifdef USE_WAKE_LOOP_THREADSAFE
+        App.wake_loop_threadsafe();
+#endif
         break;
     default:
         ESP_LOGE(TAG, "Unknown event");
@@ -106,67 +200,85 @@ static void stream_state_changed_cb(usb_stream_state_t event, void *arg)
     }
 }
 
-esp_err_t esp_camera_init(USBWebCamFrameSize fs, uint32_t fps) {
+/* change resolution/interval of a running stream, usb_stream requires it suspended */
+static esp_err_t uvc_stream_reset(USBWebCamStream *stream, uint16_t width, uint16_t height, uint32_t interval)
+{
+    esp_err_t ret = usb_streaming_control(STREAM_UVC, CTRL_SUSPEND, NULL);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    ret = uvc_frame_size_reset(width, height, interval);
+    stream->timing_restart = true;
+    if (ret == ESP_OK) {
+        stream->frame_width = width;
+        stream->frame_height = height;
+        stream->frame_interval = interval;
+    }
+    esp_err_t resume = usb_streaming_control(STREAM_UVC, CTRL_RESUME, NULL);
+    return ret != ESP_OK ? ret : resume;
+}
+
+/* restart a connected stream that stopped sending frames, same buffers and settings */
+static esp_err_t uvc_stream_restart(USBWebCamStream *stream)
+{
+    esp_err_t ret = usb_streaming_control(STREAM_UVC, CTRL_SUSPEND, NULL);
+    stream->timing_restart = true;
+    esp_err_t resume = usb_streaming_control(STREAM_UVC, CTRL_RESUME, NULL);
+    return ret != ESP_OK ? ret : resume;
+}
+
+/* stop or restart the transfers of a stream, buffers and settings stay */
+static esp_err_t uvc_stream_suspend(USBWebCamStream *stream, bool suspend)
+{
+    if (!suspend)
+        stream->timing_restart = true;  // the pause is no gap
+    return usb_streaming_control(STREAM_UVC, suspend ? CTRL_SUSPEND : CTRL_RESUME, NULL);
+}
+
+esp_err_t esp_camera_init(USBWebCamStream *stream, uint16_t width, uint16_t height, uint32_t frame_interval, const UVCTransferConfig &xfer,
+                          uint32_t buffer_size) {
 #ifdef CONFIG_ESP32_S3_USB_OTG
   bsp_usb_mode_select_host();
   bsp_usb_host_power_mode(BSP_USB_HOST_POWER_MODE_USB_DEV, true);
 #endif  
-  memset(&s_fb, 0, sizeof(camera_fb_t));
-  s_evt_handle = xEventGroupCreate();
-  if (s_evt_handle == NULL) {
-      ESP_LOGE(TAG, "Event group create failed");
-      assert(0);
-  }
+  stream->frame_buffer_size = buffer_size;
+  stream->transfer_bytes_per_second = transfer_bytes_per_second(xfer);
   /* malloc double buffer for usb payload, xfer_buffer_size >= frame_buffer_size*/
-  uint8_t *xfer_buffer_a = (uint8_t *)heap_caps_malloc_prefer(UVC_XFER_BUFFER_SIZE, 2, MALLOC_CAP_SPIRAM, 0);
-  uint8_t *xfer_buffer_b = (uint8_t *)heap_caps_malloc_prefer(UVC_XFER_BUFFER_SIZE, 2, MALLOC_CAP_SPIRAM, 0);
-  uint8_t *frame_buffer  = (uint8_t *)heap_caps_malloc_prefer(UVC_XFER_BUFFER_SIZE, 2, MALLOC_CAP_SPIRAM, 0);
-  if (!frame_buffer || !xfer_buffer_a || !xfer_buffer_b) {
+  uint8_t *xfer_buffer_a = (uint8_t *)heap_caps_malloc_prefer(buffer_size, 2, MALLOC_CAP_SPIRAM, 0);
+  uint8_t *xfer_buffer_b = (uint8_t *)heap_caps_malloc_prefer(buffer_size, 2, MALLOC_CAP_SPIRAM, 0);
+  uint8_t *frame_buffer  = (uint8_t *)heap_caps_malloc_prefer(buffer_size, 2, MALLOC_CAP_SPIRAM, 0);
+  /* frame pool slots the finished frames are copied into */
+  uint8_t *frame_pool    = (uint8_t *)heap_caps_malloc_prefer(stream->frame_pool.get_slot_count() * buffer_size, 2, MALLOC_CAP_SPIRAM, 0);
+  if (!frame_buffer || !xfer_buffer_a || !xfer_buffer_b || !frame_pool) {
       ESP_LOGE(TAG, "Not enough memory");
       return ESP_ERR_NO_MEM;
   }
+  stream->frame_pool.init(frame_pool, buffer_size);
+  stream->buffer_bytes = (3 + stream->frame_pool.get_slot_count()) * buffer_size;
   uvc_config_t uvc_config = {
-      .frame_width = 0,
-      .frame_height = 0,
-      .frame_interval = FPS2INTERVAL(5), // fps will be here, but more than 5 is unstable anyway, also it cannot be arbitrary, only 5, 10, 15,...
-      .xfer_buffer_size = UVC_XFER_BUFFER_SIZE,
+      .frame_width = width,
+      .frame_height = height,
+      .frame_interval = frame_interval, // adjusted to what the device supports once it is connected
+      .xfer_buffer_size = buffer_size,
       .xfer_buffer_a = xfer_buffer_a,
       .xfer_buffer_b = xfer_buffer_b,
-      .frame_buffer_size = UVC_XFER_BUFFER_SIZE,
+      .frame_buffer_size = buffer_size,
       .frame_buffer = frame_buffer,
       .frame_cb = &camera_frame_cb,
-      .frame_cb_arg = NULL,
-      .xfer_type = UVC_XFER_ISOC,
+      .frame_cb_arg = stream,
+      .xfer_type = xfer.bulk ? UVC_XFER_BULK : UVC_XFER_ISOC,
       .format_index = 0,
       .frame_index = 0,
-      .interface = 1,
-      .interface_alt = 1,
-      .ep_addr = 0x83,
-      .ep_mps = 512,
+      .interface = xfer.interface,
+      .interface_alt = xfer.alt_setting,
+      .ep_addr = xfer.ep_addr,
+      .ep_mps = xfer.mps,
       .flags = 0
   };
 
-  switch (fs) {
-    case USB_WEBCAM_SIZE_160X120:   uvc_config.frame_width = 160;  uvc_config.frame_height = 120; break;
-    case USB_WEBCAM_SIZE_176X144:   uvc_config.frame_width = 176;  uvc_config.frame_height = 144; break;
-    case USB_WEBCAM_SIZE_240X176:   uvc_config.frame_width = 240;  uvc_config.frame_height = 176; break;
-    case USB_WEBCAM_SIZE_320X240:   uvc_config.frame_width = 320;  uvc_config.frame_height = 240; break;
-    case USB_WEBCAM_SIZE_400X296:   uvc_config.frame_width = 400;  uvc_config.frame_height = 296; break;
-    case USB_WEBCAM_SIZE_640X480:   uvc_config.frame_width = 640;  uvc_config.frame_height = 480; break;
-    case USB_WEBCAM_SIZE_800X600:   uvc_config.frame_width = 800;  uvc_config.frame_height = 600; break;
-    case USB_WEBCAM_SIZE_1024X768:  uvc_config.frame_width = 1024; uvc_config.frame_height = 768; break;
-    case USB_WEBCAM_SIZE_1280X1024: uvc_config.frame_width = 1280; uvc_config.frame_height = 1024; break;
-    case USB_WEBCAM_SIZE_1600X1200: uvc_config.frame_width = 1600; uvc_config.frame_height = 1200; break;
-    case USB_WEBCAM_SIZE_1920X1080: uvc_config.frame_width = 1920; uvc_config.frame_height = 1080; break;
-    case USB_WEBCAM_SIZE_720X1280:  uvc_config.frame_width = 720;  uvc_config.frame_height = 1280; break;
-    case USB_WEBCAM_SIZE_864X1536:  uvc_config.frame_width = 864;  uvc_config.frame_height = 1536; break;
-    case USB_WEBCAM_SIZE_2048X1536: uvc_config.frame_width = 2048; uvc_config.frame_height = 1536; break;
-    case USB_WEBCAM_SIZE_2560X1440: uvc_config.frame_width = 2560; uvc_config.frame_height = 1440; break;
-    case USB_WEBCAM_SIZE_2560X1600: uvc_config.frame_width = 2560; uvc_config.frame_height = 1600; break;
-    case USB_WEBCAM_SIZE_1080X1920: uvc_config.frame_width = 1080; uvc_config.frame_height = 1920; break;
-    case USB_WEBCAM_SIZE_2560X1920: uvc_config.frame_width = 2560; uvc_config.frame_height = 1920; break;
-    default: return ESP_ERR_INVALID_ARG;
-  }
+  stream->frame_width = uvc_config.frame_width;
+  stream->frame_height = uvc_config.frame_height;
+  stream->frame_interval = uvc_config.frame_interval;
   /* config to enable uvc function */
   esp_err_t ret = uvc_streaming_config(&uvc_config);
   if (ret != ESP_OK) {
@@ -176,7 +288,7 @@ esp_err_t esp_camera_init(USBWebCamFrameSize fs, uint32_t fps) {
   /* register the state callback to get connect/disconnect event 
   * in the callback, we can get the frame list of current device
   */
-  ret = usb_streaming_state_register(&stream_state_changed_cb, NULL);
+  ret = usb_streaming_state_register(&stream_state_changed_cb, stream);
   if (ret != ESP_OK) return ret;
   /* start usb streaming, UVC and UAC MIC will start streaming because SUSPEND_AFTER_START flags not set */
   ret = usb_streaming_start();
@@ -190,13 +302,60 @@ esp_err_t esp_camera_init(USBWebCamFrameSize fs, uint32_t fps) {
 /* ---------------- public API (derivated) ---------------- */
 void USBWebCam::setup() {
   //esp_log_level_set(TAG, ESP_LOG_DEBUG);
-  global_usb_webcam = this;
 
   /* initialize time to now */
-  this->last_update_ = esp_timer_get_time();
+  for (auto &channel : this->channels_)
+    channel.last_update = esp_timer_get_time();
+
+  /* periodic idle snapshots */
+  if (this->idle_update_interval_ != 0) {
+    this->set_interval("idle", this->idle_update_interval_, [this]() { this->request_image(IDLE); });
+  }
+  this->last_telemetry_ = esp_timer_get_time();
+  this->set_interval("telemetry", this->telemetry_interval_, [this]() { this->sample_telemetry_(); });
+  this->set_interval("link", UVC_LINK_CHECK_INTERVAL, [this]() { this->check_link_(); });
+  if (this->task_report_interval_ != 0)
+    this->set_interval("tasks", this->task_report_interval_, [this]() { this->report_tasks_(); });
+
+  /* start with what the device settled on last time to avoid failed probes */
+  uint16_t width = this->frame_width_;
+  uint16_t height = this->frame_height_;
+  uint32_t interval = this->requested_frame_interval_();
+  this->stream_pref_ = global_preferences->make_preference<USBWebCamStreamPref>(this->get_object_id_hash());
+  USBWebCamStreamPref pref;
+  if (this->stream_pref_.load(&pref) && pref.target_width == width && pref.target_height == height &&
+      pref.target_interval == interval) {
+    ESP_LOGD(TAG, "Using cached stream %ux%u, interval %u", pref.width, pref.height, pref.interval);
+    width = pref.width;
+    height = pref.height;
+    interval = pref.interval;
+  }
+
+  /* pick the streaming endpoint from the device descriptor, if we have one */
+  if (!this->config_descriptor_.empty()) {
+    UVCTransferConfig xfer;
+    const uint32_t needed = (uint64_t) width * height / UVC_MJPEG_PIXELS_PER_BYTE * 1000 / this->max_update_interval_;
+    if (!parse_uvc_config_descriptor(this->config_descriptor_.data(), this->config_descriptor_.size(),
+                                     &this->config_desc_)) {
+      ESP_LOGW(TAG, "Configuration descriptor has no video streaming endpoint, using configured transfer");
+    } else if (!select_transfer(this->config_desc_, this->transfer_mode_, needed, this->transfer_.mps, &xfer)) {
+      ESP_LOGW(TAG, "No suitable streaming endpoint in descriptor, using configured transfer");
+    } else {
+      this->transfer_ = xfer;
+      this->transfer_from_descriptor_ = true;
+    }
+    this->config_descriptor_.clear();
+    this->config_descriptor_.shrink_to_fit();
+  }
+
+  /* size buffers for the stream, growing them if frames overflowed before */
+  this->frame_size_pref_ = global_preferences->make_preference<uint32_t>(this->get_object_id_hash() ^ 0x46425346);
+  if (!this->frame_size_pref_.load(&this->learned_max_frame_bytes_))
+    this->learned_max_frame_bytes_ = 0;
+  const uint32_t buffer_size = this->frame_buffer_size_for_(width, height);
 
   /* initialize camera */
-  esp_err_t err = esp_camera_init(this->frame_size, 1000/this->max_update_interval_); // mui=1000/fps. error starts with 60 fps but it is unrealistic already
+  esp_err_t err = esp_camera_init(&this->stream_, width, height, interval, this->transfer_, buffer_size);
   if (err != ESP_OK) {
     ESP_LOGE(TAG, "esp_camera_init failed: %s", esp_err_to_name(err));
     this->init_error_ = err;
@@ -204,83 +363,102 @@ void USBWebCam::setup() {
     return;
   }
 
+  this->setup_worker_(buffer_size);
+  if (this->preroll_size_ != 0) {
+    uint8_t *arena = (uint8_t *) heap_caps_malloc_prefer(this->preroll_size_, 2, MALLOC_CAP_SPIRAM, 0);
+    if (arena == nullptr)
+      ESP_LOGW(TAG, "Can't allocate %u bytes for the pre-roll", this->preroll_size_);
+    this->preroll_.init(arena, this->preroll_size_);
+  }
+  if (this->recording_buffer_size_ != 0)
+    this->setup_recorder_();
+
   /* initialize camera parameters */
   this->update_camera_parameters();
-
-  /* initialize RTOS */
-  this->framebuffer_get_queue_ = xQueueCreate(1, sizeof(camera_fb_t *));
-  this->framebuffer_return_queue_ = xQueueCreate(1, sizeof(camera_fb_t *));
-  xTaskCreate(&USBWebCam::framebuffer_task,
-                          "USBWebCamTsk",      // name
-                          1536,                // stack size
-                          nullptr,             // task pv params
-                          2,                   // priority
-                          nullptr              // handle
-  );
 }
 
 void USBWebCam::dump_config() {
   ESP_LOGCONFIG(TAG, "ESP32 USB WebCamera:");
   ESP_LOGCONFIG(TAG, "  Name: %s", this->name_.c_str());
-  switch (frame_size) {
-    case USB_WEBCAM_SIZE_160X120:
-      ESP_LOGCONFIG(TAG, "  Resolution: 160x120 (QQVGA)");
-      break;
-    case USB_WEBCAM_SIZE_176X144:
-      ESP_LOGCONFIG(TAG, "  Resolution: 176x144 (QCIF)");
-      break;
-    case USB_WEBCAM_SIZE_240X176:
-      ESP_LOGCONFIG(TAG, "  Resolution: 240x176 (HQVGA)");
-      break;
-    case USB_WEBCAM_SIZE_320X240:
-      ESP_LOGCONFIG(TAG, "  Resolution: 320x240 (QVGA)");
-      break;
-    case USB_WEBCAM_SIZE_400X296:
-      ESP_LOGCONFIG(TAG, "  Resolution: 400x296 (CIF)");
-      break;
-    case USB_WEBCAM_SIZE_640X480:
-      ESP_LOGCONFIG(TAG, "  Resolution: 640x480 (VGA)");
-      break;
-    case USB_WEBCAM_SIZE_800X600:
-      ESP_LOGCONFIG(TAG, "  Resolution: 800x600 (SVGA)");
-      break;
-    case USB_WEBCAM_SIZE_1024X768:
-      ESP_LOGCONFIG(TAG, "  Resolution: 1024x768 (XGA)");
-      break;
-    case USB_WEBCAM_SIZE_1280X1024:
-      ESP_LOGCONFIG(TAG, "  Resolution: 1280x1024 (SXGA)");
-      break;
-    case USB_WEBCAM_SIZE_1600X1200:
-      ESP_LOGCONFIG(TAG, "  Resolution: 1600x1200 (UXGA)");
-      break;
-    case USB_WEBCAM_SIZE_1920X1080:
-      ESP_LOGCONFIG(TAG, "  Resolution: 1920x1080 (FHD)");
-      break;
-    case USB_WEBCAM_SIZE_720X1280:
-      ESP_LOGCONFIG(TAG, "  Resolution: 720x1280 (P_HD)");
-      break;
-    case USB_WEBCAM_SIZE_864X1536:
-      ESP_LOGCONFIG(TAG, "  Resolution: 864x1536 (P_3MP)");
-      break;
-    case USB_WEBCAM_SIZE_2048X1536:
-      ESP_LOGCONFIG(TAG, "  Resolution: 2048x1536 (QXGA)");
-      break;
-    case USB_WEBCAM_SIZE_2560X1440:
-      ESP_LOGCONFIG(TAG, "  Resolution: 2560x1440 (QHD)");
-      break;
-    case USB_WEBCAM_SIZE_2560X1600:
-      ESP_LOGCONFIG(TAG, "  Resolution: 2560x1600 (WQXGA)");
-      break;
-    case USB_WEBCAM_SIZE_1080X1920:
-      ESP_LOGCONFIG(TAG, "  Resolution: 1080x1920 (P_FHD)");
-      break;
-    case USB_WEBCAM_SIZE_2560X1920:
-      ESP_LOGCONFIG(TAG, "  Resolution: 2560x1920 (QSXGA)");
-      break;
-  };
+  ESP_LOGCONFIG(TAG, "  Resolution: %ux%u (streaming %ux%u)", this->frame_width_, this->frame_height_, this->stream_.frame_width,
+                this->stream_.frame_height);
   ESP_LOGCONFIG(TAG, "  Update interval: %u", this->max_update_interval_);
   ESP_LOGCONFIG(TAG, "  Idle interval: %u", this->idle_update_interval_);
-  ESP_LOGCONFIG(TAG, "  Drop frame size: %u", s_drop_frame_size);
+  ESP_LOGCONFIG(TAG, "  API/web update interval: %u/%u",
+                std::max(this->channels_[USB_WEBCAM_CHANNEL_API].update_interval, this->max_update_interval_),
+                std::max(this->channels_[USB_WEBCAM_CHANNEL_WEB].update_interval, this->max_update_interval_));
+  for (const auto &channel : this->channels_) {
+    if (channel.scale_shift != 0)
+      ESP_LOGCONFIG(TAG, "  %s scale: 1/%u, quality %u (%u frames sent full size)",
+                    &channel == &this->channels_[USB_WEBCAM_CHANNEL_API] ? "API" : "Web", 1U << channel.scale_shift,
+                    this->scale_quality_, this->downscale_failures_);
+  }
+  if (this->motion_interval_ != 0)
+    ESP_LOGCONFIG(TAG, "  Motion: every %ums, threshold %u, timeout %ums%s", this->motion_interval_,
+                  this->motion_detector_.get_threshold(), this->motion_timeout_,
+                  this->motion_gate_ ? ", streams at idle rate until motion" : "");
+  for (const auto &channel : this->channels_) {
+    if (channel.skip_duplicates)
+      ESP_LOGCONFIG(TAG, "  %s skips duplicate frames: threshold %u, %u of %u suppressed",
+                    &channel == &this->channels_[USB_WEBCAM_CHANNEL_API] ? "API" : "Web", this->duplicate_threshold_,
+                    this->suppressed_frames_, this->checked_frames_);
+  }
+  if (this->preroll_.is_enabled())
+    ESP_LOGCONFIG(TAG, "  Pre-roll: %u bytes, a frame every %ums (%u frames, %u bytes held, %u skipped)",
+                  this->preroll_.get_size(), this->preroll_interval_, this->preroll_.get_count(),
+                  this->preroll_.get_used(), this->preroll_.get_dropped());
+  if (this->worker_task_handle_ != nullptr)
+    ESP_LOGCONFIG(TAG, "  Worker task: core %u, priority %u, stack %u", this->worker_task_core_,
+                  this->worker_task_priority_, this->worker_task_stack_size_);
+  static const char *const link_names[] = {"waiting", "starting", "streaming", "disconnected", "suspended"};
+  ESP_LOGCONFIG(TAG, "  Link: %s, %u reconnects, %u stream restarts (stall timeout %ums, last recovery %ums)",
+                link_names[this->link_state_], this->reconnects_, this->stream_restarts_, this->stall_timeout_,
+                this->reconnect_time_);
+  if (this->recorder_.is_enabled())
+    ESP_LOGCONFIG(TAG, "  Recording: %s to %s, a frame every %ums (%u frames, %u segments, %llu bytes written, %u skipped)",
+                  this->recorder_.is_recording() ? "on" : "off", this->recorder_.get_path().c_str(),
+                  this->recording_interval_, this->recorder_.get_frames(), this->recorder_.get_segments(),
+                  (unsigned long long) this->recorder_.get_bytes_written(), this->recorder_.get_dropped());
+  if (this->suspend_after_ != 0)
+    ESP_LOGCONFIG(TAG, "  Power save: suspend after %ums, %u warm-up frames (%u suspends, last resume %ums)",
+                  this->suspend_after_, this->warmup_frames_, this->suspends_, this->resume_time_);
+  ESP_LOGCONFIG(TAG, "  USB frame interval: %uus", this->stream_.frame_interval / 10);
+  ESP_LOGCONFIG(TAG, "  USB transfer: %s, interface %u alt %u, endpoint 0x%02X, max packet %u (%s)",
+                this->transfer_.bulk ? "bulk" : "isochronous", this->transfer_.interface, this->transfer_.alt_setting,
+                this->transfer_.ep_addr, this->transfer_.mps,
+                this->transfer_from_descriptor_ ? "from descriptor" : "configured");
+  ESP_LOGCONFIG(TAG, "  Drop frame size: %u", this->stream_.drop_frame_size);
+  static const char *const validation_names[] = {"none", "basic", "strict"};
+  ESP_LOGCONFIG(TAG, "  Frame validation: %s", validation_names[this->stream_.frame_validation]);
+  for (int i = JPEG_OK + 1; i < JPEG_CHECK_RESULTS; i++) {
+    const uint32_t count = this->stream_.invalid_frames[i].load(std::memory_order_relaxed);
+    if (count != 0)
+      ESP_LOGCONFIG(TAG, "    Rejected (%s): %u", jpeg_check_result_to_string((JpegCheckResult) i), count);
+  }
+  ESP_LOGCONFIG(TAG, "  Frame buffers: %u (%s)", this->stream_.frame_pool.get_slot_count(),
+                this->stream_.frame_pool.get_policy() == FRAME_POOL_DROP_OLDEST ? "drop oldest" : "drop newest");
+  ESP_LOGCONFIG(TAG, "  Loop latency: p50 < %uus, p99 < %uus (%u frames)", this->loop_latency_.percentile(50),
+                this->loop_latency_.percentile(99), this->loop_latency_.count());
+  ESP_LOGCONFIG(TAG, "  Release latency: p50 < %uus, p99 < %uus", this->release_latency_.percentile(50),
+                this->release_latency_.percentile(99));
+  ESP_LOGCONFIG(TAG, "  Frame buffer size: %u (largest frame %u, %u overflowed)", this->stream_.frame_buffer_size,
+                this->stream_.max_frame_bytes.load(), this->stream_.overflow_frames.load());
+  ESP_LOGCONFIG(TAG,
+                "  Buffers: %u bytes (usb_stream and frame pool %u, scaled output %u, worker %u, pre-roll %u, "
+                "recording %u)",
+                this->buffer_bytes_(), this->stream_.buffer_bytes, this->downscale_buffer_size_,
+                this->worker_buffer_bytes_, this->preroll_.get_size(),
+                this->recorder_.is_enabled() ? this->recording_buffer_size_ : 0);
+  ESP_LOGCONFIG(TAG, "  Frames: %u received, %u buffered, %u overruns, %u stale, %u oversized",
+                this->stream_.received_frames.load(), this->stream_.frame_pool.get_pushed(), this->stream_.frame_pool.get_overruns(),
+                this->stream_.frame_pool.get_stale(), this->stream_.frame_pool.get_oversized());
+  ESP_LOGCONFIG(TAG, "  Timing: %.2f fps, jitter %uus; %u frames lost (last before frame %u)",
+                this->frame_rate_ / 1000.0f, this->stream_.jitter_us.load(), this->stream_.lost_frames.load(), this->stream_.last_gap_sequence.load());
+  ESP_LOGCONFIG(TAG, "  Dropped: %u small, %u invalid; delivered: %u api, %u web; %u B/s",
+                this->get_telemetry(USB_WEBCAM_FRAMES_DROPPED_SMALL),
+                this->get_telemetry(USB_WEBCAM_FRAMES_DROPPED_INVALID),
+                this->get_telemetry(USB_WEBCAM_FRAMES_DELIVERED_API),
+                this->get_telemetry(USB_WEBCAM_FRAMES_DELIVERED_WEB), this->bytes_per_second_);
 
   if (this->is_failed()) {
     ESP_LOGE(TAG, "  Setup Failed: %s", esp_err_to_name(this->init_error_));
@@ -289,68 +467,225 @@ void USBWebCam::dump_config() {
 }
 
 void USBWebCam::loop() {
-  // check if we can return the image
-  if (this->can_return_image_()) {
-    // return image
-    auto *fb = this->current_image_->get_raw_buffer();
-    xQueueSend(this->framebuffer_return_queue_, &fb, portMAX_DELAY);
-    this->current_image_.reset();
+  // take back images the consumers are done with, a frame returns to the pool with its last image
+  int64_t now = esp_timer_get_time();
+  bool busy = false;
+  for (auto &channel : this->channels_) {
+    if (channel.image && this->can_return_image_(channel)) {
+      this->release_latency_.record(now - channel.last_delivery);
+      channel.image.reset();
+    }
+    busy |= channel.image != nullptr;
   }
+  if (this->worker_state_.load(std::memory_order_acquire) == USB_WEBCAM_WORKER_DONE)
+    this->finish_worker_();
+  if (this->stream_.disconnected_event.exchange(false))
+    this->lose_link_();
+  if (this->stream_.connected_event.exchange(false)) {
+    this->negotiate_stream_();
+    this->link_state_ = USB_WEBCAM_LINK_STARTING;
+    this->last_link_frame_ = now;
+  }
+  if (this->link_state_ == USB_WEBCAM_LINK_STARTING)
+    this->check_link_();
+  this->track_frame_size_();
 
-  // request idle image every idle_update_interval
-  const uint64_t now = esp_timer_get_time() / 1000;
-  if (this->idle_update_interval_ != 0 && now - this->last_idle_request_ > this->idle_update_interval_) {
-    this->last_idle_request_ = now;
-    this->request_image(IDLE);
+  // power save: the stream runs only while somebody wants frames
+  int64_t suspend_wait = INT64_MAX;
+  if (this->suspend_after_ != 0) {
+    if ((this->single_requesters_ | this->stream_requesters_) != 0 || this->recorder_.is_recording()) {
+      this->last_wanted_ = now;
+      if (this->link_state_ == USB_WEBCAM_LINK_SUSPENDED)
+        this->resume_stream_();
+    } else if (this->link_state_ == USB_WEBCAM_LINK_STREAMING) {
+      suspend_wait = this->last_wanted_ + (int64_t) this->suspend_after_ * 1000 - now;
+      if (suspend_wait <= 0) {
+        this->suspend_stream_();
+        suspend_wait = INT64_MAX;
+      }
+    }
   }
 
-  // Check if we should fetch a new image
-  if (!this->has_requested_image_())
-    return;
-  if (this->current_image_.use_count() > 1) {
-    // image is still in use
-    return;
+  // keep only the newest frame so stale ones go back to the pool
+  const bool frame_ready = this->stream_.frame_pool.collect();
+  if (frame_ready && this->resume_started_ != 0) {
+    this->resume_time_ = (now - this->resume_started_) / 1000;
+    this->resume_started_ = 0;
+    ESP_LOGD(TAG, "First frame %ums after resuming", this->resume_time_);
+  }
+
+  // channels wanting a frame now, and how long until the next one does
+  uint8_t due = 0;
+  int64_t next_wait = suspend_wait;
+  for (uint8_t i = 0; i < USB_WEBCAM_CHANNELS; i++) {
+    const USBWebCamChannel &channel = this->channels_[i];
+    if (channel.image || !this->has_requested_image_(channel))
+      continue;  // still held by its consumers, or nothing requested
+    if (channel.scale_shift != 0 && !this->can_downscale_())
+      continue;  // the worker or its output is busy
+    if (channel.skip_duplicates && this->worker_state_.load(std::memory_order_relaxed) != USB_WEBCAM_WORKER_IDLE)
+      continue;  // frames are compared on the worker
+    uint32_t interval = std::max(channel.update_interval, this->max_update_interval_);
+    if (this->motion_gate_ && !this->motion_ && !(this->single_requesters_ & channel.requesters)) {
+      // nothing moving: streams drop to the idle rate, snapshots still go out right away
+      if (this->idle_update_interval_ == 0)
+        continue;
+      interval = std::max(interval, this->idle_update_interval_);
+    }
+    const int64_t wait = channel.last_update + (int64_t) interval * 1000 - now;
+    if (wait <= 0) {
+      due |= 1 << i;
+    } else if (wait < next_wait) {
+      next_wait = wait;
+    }
+  }
+  // motion checks keep their own pace, whether anyone is watching or not
+  bool motion_due = false;
+  if (this->motion_interval_ != 0 &&
+      this->worker_state_.load(std::memory_order_relaxed) == USB_WEBCAM_WORKER_IDLE) {
+    const int64_t wait = this->last_motion_check_ + (int64_t) this->motion_interval_ * 1000 - now;
+    if (wait <= 0) {
+      motion_due = true;
+    } else if (wait < next_wait) {
+      next_wait = wait;
+    }
+  }
+  bool preroll_due = false;
+  if (this->preroll_.is_enabled()) {
+    const int64_t wait = this->last_preroll_ + (int64_t) this->preroll_interval_ * 1000 - now;
+    if (wait <= 0) {
+      preroll_due = true;
+    } else if (wait < next_wait) {
+      next_wait = wait;
+    }
+  }
+  bool recording_due = false;
+  if (this->recorder_.is_recording()) {
+    const int64_t wait = this->last_recording_ + (int64_t) this->recording_interval_ * 1000 - now;
+    if (wait <= 0) {
+      recording_due = true;
+    } else if (wait < next_wait) {
+      next_wait = wait;
+    }
   }
-  if (now - this->last_update_ <= this->max_update_interval_)
+  if (!frame_ready || (due == 0 && !motion_due && !preroll_due && !recording_due)) {
+    if (busy) {
+      // keep polling until consumers let go of their images
+      return;
+    }
+    // sleep until the next frame or request wakes us up, or a channel is due
+    this->disable_loop();
+    if (next_wait != INT64_MAX)
+      this->set_timeout("pace", next_wait / 1000 + 1, [this]() { this->enable_loop(); });
     return;
+  }
 
   // request new image
-  camera_fb_t *fb;
-  if (xQueueReceive(this->framebuffer_get_queue_, &fb, 0L) != pdTRUE) {
+  camera_fb_t *fb = esp_camera_fb_get(&this->stream_);
+  if (fb == nullptr) {
     // no frame ready
     ESP_LOGVV(TAG, "No frame ready");
     return;
   }
+  // read the clock again, the frame may have completed after now was taken
+  this->loop_latency_.record(esp_timer_get_time() - fb->eof_us);
+  std::shared_ptr<camera_fb_t> frame(fb, [this](camera_fb_t *released) {
+    esp_camera_fb_return(&this->stream_, released);
+  });
+  ESP_LOGD(TAG, "Got Image %u: %ux%u %uB", fb->sequence, fb->width, fb->height, fb->len);
 
-  if (fb == nullptr) {
-    ESP_LOGW(TAG, "Got invalid frame from camera!");
-    xQueueSend(this->framebuffer_return_queue_, &fb, portMAX_DELAY);
-    return;
+  if (motion_due) {
+    this->worker_jobs_ |= USB_WEBCAM_JOB_MOTION;
+    this->last_motion_check_ = now;
+  }
+  if (preroll_due) {
+    this->preroll_.append(*fb);
+    this->last_preroll_ = now;
+  }
+  if (recording_due) {
+    if (!this->recorder_.append(*fb) && this->recorder_.has_failed())
+      ESP_LOGE(TAG, "Recording to %s stopped: %s", this->recorder_.get_path().c_str(), this->recorder_.get_error());
+    xTaskNotifyGive(this->recorder_task_handle_);
+    this->last_recording_ = now;
   }
-  this->current_image_ = std::make_shared<USBWebCamImage>(fb, this->single_requesters_ | this->stream_requesters_);
 
-  ESP_LOGD(TAG, "Got Image %u: %ux%u %uB", (unsigned int)fb->timestamp.tv_sec, fb->width, fb->height, fb->len);
-  this->new_image_callback_.call(this->current_image_);
-  this->last_update_ = now;
-  this->single_requesters_ = 0;
+  for (uint8_t i = 0; i < USB_WEBCAM_CHANNELS; i++) {
+    if (!(due & (1 << i)))
+      continue;
+    USBWebCamChannel &channel = this->channels_[i];
+    const uint8_t requesters = (this->single_requesters_ | this->stream_requesters_) & channel.requesters;
+    // snapshots always go out, only pure stream frames may be held back
+    const bool check_duplicate = channel.skip_duplicates && !(this->single_requesters_ & channel.requesters);
+    this->single_requesters_ &= ~channel.requesters;
+    channel.last_update = now;
+    if (check_duplicate) {
+      this->worker_jobs_ |= USB_WEBCAM_JOB_SIGNATURE;
+      this->duplicate_checks_ |= 1 << i;
+    }
+    if (channel.scale_shift != 0) {
+      this->worker_jobs_ |= USB_WEBCAM_JOB_SCALE;
+      this->downscale_shift_ = channel.scale_shift;
+    }
+    if (check_duplicate || channel.scale_shift != 0) {
+      // handed out by finish_worker_() once the worker is done
+      channel.pending_requesters = requesters;
+      continue;
+    }
+    channel.signature.valid = false;
+    this->deliver_(channel, frame, requesters);
+  }
+  if (this->worker_jobs_ != 0)
+    this->start_worker_(std::move(frame));
 }
 
 float USBWebCam::get_setup_priority() const { return setup_priority::DATA; }
 
 /* ---------------- constructors ---------------- */
 USBWebCam::USBWebCam() {
-  frame_size = USB_WEBCAM_SIZE_640X480;
-  global_usb_webcam = this;
+  this->stream_.parent = this;
 }
 
 /* ---------------- setters ---------------- */
 
 /* set image parameters */
-void USBWebCam::set_frame_size(USBWebCamFrameSize size) {
-  this->frame_size = size;
+void USBWebCam::set_frame_size(uint16_t width, uint16_t height) {
+  this->frame_width_ = width;
+  this->frame_height_ = height;
+  /* at runtime, switch the running stream right away */
+  if (this->stream_.connected && this->link_state_ != USB_WEBCAM_LINK_SUSPENDED)
+    this->negotiate_stream_();
+}
+void USBWebCam::set_resolution_match(USBWebCamResolutionMatch match) {
+  this->resolution_match_ = match;
+}
+/* set USB transfer */
+void USBWebCam::set_transfer_mode(USBWebCamTransferMode mode) {
+  this->transfer_mode_ = mode;
+  this->transfer_.bulk = mode == USB_WEBCAM_TRANSFER_BULK;
+}
+void USBWebCam::set_transfer(uint8_t interface, uint8_t alt_setting, uint8_t ep_addr, uint16_t max_packet_size) {
+  this->transfer_.interface = interface;
+  this->transfer_.alt_setting = alt_setting;
+  this->transfer_.ep_addr = ep_addr;
+  this->transfer_.mps = max_packet_size;
+}
+void USBWebCam::set_config_descriptor(const std::vector<uint8_t> &descriptor) {
+  this->config_descriptor_ = descriptor;
 }
 void USBWebCam::set_drop_size(uint32_t drop_size) {
-  s_drop_frame_size = drop_size;
+  this->stream_.drop_frame_size = drop_size;
+}
+void USBWebCam::set_frame_validation(USBWebCamFrameValidation validation) {
+  this->stream_.frame_validation = validation;
+}
+void USBWebCam::set_frame_buffer_size(uint32_t size) {
+  this->frame_buffer_size_ = size;
+}
+void USBWebCam::set_frame_buffer_count(uint8_t count) {
+  this->stream_.frame_pool.set_slot_count(count);
+}
+void USBWebCam::set_frame_buffer_policy(FramePoolPolicy policy) {
+  this->stream_.frame_pool.set_policy(policy);
 }
 /* set fps */
 void USBWebCam::set_max_update_interval(uint32_t max_update_interval) {
@@ -359,6 +694,102 @@ void USBWebCam::set_max_update_interval(uint32_t max_update_interval) {
 void USBWebCam::set_idle_update_interval(uint32_t idle_update_interval) {
   this->idle_update_interval_ = idle_update_interval;
 }
+void USBWebCam::set_requester_update_interval(CameraRequester requester, uint32_t update_interval) {
+  this->channel_for_(requester).update_interval = update_interval;
+}
+void USBWebCam::set_requester_scale(CameraRequester requester, uint8_t shift) {
+  this->channel_for_(requester).scale_shift = shift;
+}
+void USBWebCam::set_scale_quality(uint8_t quality) {
+  this->scale_quality_ = quality;
+}
+void USBWebCam::set_requester_skip_duplicates(CameraRequester requester, bool skip) {
+  this->channel_for_(requester).skip_duplicates = skip;
+}
+void USBWebCam::set_duplicate_threshold(uint8_t threshold) {
+  this->duplicate_threshold_ = threshold;
+}
+void USBWebCam::set_preroll_size(uint32_t size) {
+  this->preroll_size_ = size;
+}
+void USBWebCam::set_preroll_interval(uint32_t interval) {
+  this->preroll_interval_ = interval;
+}
+/* motion detection */
+void USBWebCam::set_motion_interval(uint32_t interval) {
+  this->motion_interval_ = interval;
+}
+void USBWebCam::set_motion_threshold(uint8_t threshold) {
+  this->motion_detector_.set_threshold(threshold);
+}
+void USBWebCam::set_motion_min_area(uint16_t permille) {
+  this->motion_detector_.set_min_area(permille);
+}
+void USBWebCam::set_motion_background_shift(uint8_t shift) {
+  this->motion_detector_.set_background_shift(shift);
+}
+void USBWebCam::set_motion_timeout(uint32_t timeout) {
+  this->motion_timeout_ = timeout;
+}
+void USBWebCam::set_motion_gate(bool gate) {
+  this->motion_gate_ = gate;
+}
+#ifdef USE_BINARY_SENSOR
+void USBWebCam::set_motion_binary_sensor(binary_sensor::BinarySensor *sensor) {
+  this->motion_binary_sensor_ = sensor;
+}
+#endif
+
+void USBWebCam::set_stall_timeout(uint32_t timeout) {
+  this->stall_timeout_ = timeout;
+}
+
+void USBWebCam::set_suspend_after(uint32_t timeout) {
+  this->suspend_after_ = timeout;
+}
+void USBWebCam::set_warmup_frames(uint8_t frames) {
+  this->warmup_frames_ = frames;
+}
+
+void USBWebCam::set_recording_path(const std::string &path) {
+  this->recorder_.set_path(path);
+}
+void USBWebCam::set_recording_segment_size(uint32_t size) {
+  this->recorder_.set_segment_size(size);
+}
+void USBWebCam::set_recording_buffer(uint32_t size, uint32_t block_size) {
+  this->recording_buffer_size_ = size;
+  this->recording_block_size_ = block_size;
+}
+void USBWebCam::set_recording_interval(uint32_t interval) {
+  this->recording_interval_ = interval;
+}
+void USBWebCam::set_recording_autostart(bool autostart) {
+  this->recording_autostart_ = autostart;
+}
+
+void USBWebCam::set_worker_task(uint8_t core, uint8_t priority, uint32_t stack_size) {
+  this->worker_task_core_ = core;
+  this->worker_task_priority_ = priority;
+  this->worker_task_stack_size_ = stack_size;
+}
+void USBWebCam::set_recorder_task(uint8_t core, uint8_t priority, uint32_t stack_size) {
+  this->recorder_task_core_ = core;
+  this->recorder_task_priority_ = priority;
+  this->recorder_task_stack_size_ = stack_size;
+}
+void USBWebCam::set_task_report_interval(uint32_t interval) {
+  this->task_report_interval_ = interval;
+}
+
+void USBWebCam::set_telemetry_interval(uint32_t interval) {
+  this->telemetry_interval_ = interval;
+}
+#ifdef USE_SENSOR
+void USBWebCam::set_telemetry_sensor(USBWebCamTelemetry telemetry, sensor::Sensor *sensor) {
+  this->telemetry_sensors_[telemetry] = sensor;
+}
+#endif
 
 /* ---------------- public API (specific) ---------------- */
 void USBWebCam::add_image_callback(std::function<void(std::shared_ptr<CameraImage>)> &&f) {
@@ -370,58 +801,729 @@ void USBWebCam::add_stream_start_callback(std::function<void()> &&callback) {
 void USBWebCam::add_stream_stop_callback(std::function<void()> &&callback) {
   this->stream_stop_callback_.add(std::move(callback));
 }
+void USBWebCam::add_motion_callback(std::function<void()> &&callback) {
+  this->motion_callback_.add(std::move(callback));
+}
+void USBWebCam::add_preroll_callback(std::function<void(std::shared_ptr<FrameRingSnapshot>)> &&callback) {
+  this->preroll_callback_.add(std::move(callback));
+}
+void USBWebCam::start_recording() {
+  if (!this->recorder_.start()) {
+    ESP_LOGW(TAG, "Can't start recording");
+    return;
+  }
+  ESP_LOGI(TAG, "Recording to %s", this->recorder_.get_path().c_str());
+  this->enable_loop_soon_any_context();
+}
+void USBWebCam::stop_recording() {
+  if (!this->recorder_.is_recording())
+    return;
+  this->recorder_.stop();
+  xTaskNotifyGive(this->recorder_task_handle_);
+  ESP_LOGI(TAG, "Recording stopped");
+}
+
+/* hand the pre-roll to the on_preroll automations, they share one snapshot */
+void USBWebCam::capture_preroll() {
+  std::shared_ptr<FrameRingSnapshot> frames = this->preroll_.snapshot();
+  if (!frames) {
+    ESP_LOGW(TAG, "No pre-roll frames to capture");
+    return;
+  }
+  ESP_LOGD(TAG, "Pre-roll of %u frames captured", frames->size());
+  this->preroll_callback_.call(frames);
+}
+/* requests may come from server tasks, wake the loop in a thread-safe way */
 void USBWebCam::start_stream(CameraRequester requester) {
   this->stream_start_callback_.call();
   this->stream_requesters_ |= (1U << requester);
+  this->enable_loop_soon_any_context();
 }
 void USBWebCam::stop_stream(CameraRequester requester) {
   this->stream_stop_callback_.call();
   this->stream_requesters_ &= ~(1U << requester);
+  this->enable_loop_soon_any_context();
+}
+void USBWebCam::request_image(CameraRequester requester) {
+  this->single_requesters_ |= (1U << requester);
+  this->enable_loop_soon_any_context();
 }
-void USBWebCam::request_image(CameraRequester requester) { this->single_requesters_ |= (1U << requester); }
 camera::CameraImageReader *USBWebCam::create_image_reader() { return new USBWebCamImageReader; }
 void USBWebCam::update_camera_parameters() {}
 
 /* ---------------- Internal methods ---------------- */
-bool USBWebCam::has_requested_image_() const { return this->single_requesters_ || this->stream_requesters_; }
-bool USBWebCam::can_return_image_() const { return this->current_image_.use_count() == 1; }
+bool USBWebCam::has_requested_image_(const USBWebCamChannel &channel) const {
+  return ((this->single_requesters_ | this->stream_requesters_) & channel.requesters) != 0;
+}
+bool USBWebCam::can_return_image_(const USBWebCamChannel &channel) const { return channel.image.use_count() == 1; }
+USBWebCamChannel &USBWebCam::channel_for_(CameraRequester requester) {
+  for (auto &channel : this->channels_) {
+    if (channel.requesters & (1U << requester))
+      return channel;
+  }
+  return this->channels_[USB_WEBCAM_CHANNEL_API];
+}
+void USBWebCam::deliver_(USBWebCamChannel &channel, std::shared_ptr<camera_fb_t> frame, uint8_t requesters) {
+  for (uint8_t requester = 0; requester < 3; requester++) {
+    if (requesters & (1 << requester))
+      this->delivered_[requester]++;
+  }
+  channel.last_delivery = esp_timer_get_time();
+  // channels getting the same frame share its copy with the tables; a live copy keeps its frame held, so
+  // another frame can't be at the same address
+  std::shared_ptr<USBWebCamJpegCopy> jpeg_copy = this->jpeg_copy_.lock();
+  if (!jpeg_copy || jpeg_copy->frame != frame.get() || jpeg_copy->sequence != frame->sequence) {
+    jpeg_copy = std::make_shared<USBWebCamJpegCopy>();
+    jpeg_copy->frame = frame.get();
+    jpeg_copy->sequence = frame->sequence;
+    this->jpeg_copy_ = jpeg_copy;
+  }
+  channel.image = std::make_shared<USBWebCamImage>(std::move(frame), requesters, std::move(jpeg_copy));
+  this->new_image_callback_.call(channel.image);
+}
+/* unchanged since the channel's last image, unless that one is older than the idle interval */
+bool USBWebCam::is_duplicate_(const USBWebCamChannel &channel, int64_t now) const {
+  if (frame_signature_distance(channel.signature, this->worker_signature_) > this->duplicate_threshold_)
+    return false;
+  return this->idle_update_interval_ == 0 || now - channel.last_delivery < (int64_t) this->idle_update_interval_ * 1000;
+}
+uint32_t USBWebCam::requested_frame_interval_() const {
+  const uint64_t interval = (uint64_t) this->max_update_interval_ * (UVC_INTERVAL_UNITS_PER_SECOND / 1000);
+  return interval > UINT32_MAX ? UINT32_MAX : interval;
+}
+
+uint32_t USBWebCam::get_telemetry(USBWebCamTelemetry telemetry) const {
+  switch (telemetry) {
+    case USB_WEBCAM_FRAMES_RECEIVED:
+      return this->stream_.received_frames.load(std::memory_order_relaxed);
+    case USB_WEBCAM_FRAMES_DROPPED_SMALL:
+      return this->stream_.small_frames.load(std::memory_order_relaxed);
+    case USB_WEBCAM_FRAMES_DROPPED_OVERFLOW:
+      return this->stream_.overflow_frames.load(std::memory_order_relaxed) + this->stream_.frame_pool.get_oversized();
+    case USB_WEBCAM_FRAMES_DROPPED_INVALID: {
+      uint32_t invalid = 0;
+      for (const auto &count : this->stream_.invalid_frames)
+        invalid += count.load(std::memory_order_relaxed);
+      return invalid;
+    }
+    case USB_WEBCAM_FRAMES_DROPPED_BUSY:
+      return this->stream_.frame_pool.get_overruns();
+    case USB_WEBCAM_FRAMES_DELIVERED_API:
+      return this->delivered_[API_REQUESTER];
+    case USB_WEBCAM_FRAMES_DELIVERED_WEB:
+      return this->delivered_[WEB_REQUESTER];
+    case USB_WEBCAM_FRAMES_LOST:
+      return this->stream_.lost_frames.load(std::memory_order_relaxed);
+    case USB_WEBCAM_BYTES_PER_SECOND:
+      return this->bytes_per_second_;
+    case USB_WEBCAM_FRAME_RATE:
+      return this->frame_rate_;
+    case USB_WEBCAM_FRAME_JITTER:
+      return this->stream_.jitter_us.load(std::memory_order_relaxed);
+    case USB_WEBCAM_LOOP_LATENCY_P99:
+      return this->loop_latency_.percentile(99);
+    case USB_WEBCAM_RELEASE_LATENCY_P99:
+      return this->release_latency_.percentile(99);
+    case USB_WEBCAM_MOTION_SCORE:
+      return this->motion_score_;
+    case USB_WEBCAM_FRAMES_SUPPRESSED:
+      return this->suppressed_frames_;
+    case USB_WEBCAM_SUPPRESSION_RATIO:
+      return this->checked_frames_ != 0 ? (uint64_t) this->suppressed_frames_ * 1000 / this->checked_frames_ : 0;
+    case USB_WEBCAM_RECONNECTS:
+      return this->reconnects_;
+    case USB_WEBCAM_STREAM_RESTARTS:
+      return this->stream_restarts_;
+    case USB_WEBCAM_RECONNECT_TIME:
+      return this->reconnect_time_;
+    case USB_WEBCAM_BUFFER_BYTES:
+      return this->buffer_bytes_();
+    case USB_WEBCAM_RESUME_TIME:
+      return this->resume_time_;
+    default:
+      return 0;
+  }
+}
+
+/* derive the rates and push everything to the configured sensors */
+void USBWebCam::sample_telemetry_() {
+  const int64_t now = esp_timer_get_time();
+  const uint32_t bytes = this->stream_.received_bytes.load(std::memory_order_relaxed);
+  const uint32_t frames = this->stream_.received_frames.load(std::memory_order_relaxed);
+  if (now > this->last_telemetry_) {
+    this->bytes_per_second_ = (uint64_t) (bytes - this->last_received_bytes_) * 1000000 / (now - this->last_telemetry_);
+    this->frame_rate_ = (uint64_t) (frames - this->last_received_frames_) * 1000000000 / (now - this->last_telemetry_);
+  }
+  this->last_received_bytes_ = bytes;
+  this->last_received_frames_ = frames;
+  this->last_telemetry_ = now;
+#ifdef USE_SENSOR
+  for (int i = 0; i < USB_WEBCAM_TELEMETRY_COUNT; i++) {
+    if (this->telemetry_sensors_[i] == nullptr)
+      continue;
+    float value = this->get_telemetry((USBWebCamTelemetry) i);
+    if (i == USB_WEBCAM_FRAME_RATE)
+      value /= 1000;  // mHz to fps
+    this->telemetry_sensors_[i]->publish_state(value);
+  }
+#endif
+}
+
+/* largest frame expected to get through: a pool slot, and what the endpoint moves per frame interval */
+uint32_t USBWebCam::max_frame_bytes_() const {
+  const uint64_t usb_bytes = (uint64_t) transfer_bytes_per_second(this->transfer_) * this->max_update_interval_ / 1000;
+  return usb_bytes < this->stream_.frame_buffer_size ? usb_bytes : this->stream_.frame_buffer_size;
+}
+
+/* memory the pipeline holds for frames; nothing is freed while running, so this is also the peak */
+uint32_t USBWebCam::buffer_bytes_() const {
+  return this->stream_.buffer_bytes + this->downscale_buffer_size_ + this->worker_buffer_bytes_ +
+         this->preroll_.get_size() + (this->recorder_.is_enabled() ? this->recording_buffer_size_ : 0);
+}
+
+uint32_t USBWebCam::frame_buffer_size_for_(uint16_t width, uint16_t height) const {
+  if (this->frame_buffer_size_ != 0)
+    return this->frame_buffer_size_;
+  // typical MJPEG size with 2x headroom, or what frames needed on previous runs
+  uint32_t size = (uint32_t) width * height / UVC_MJPEG_PIXELS_PER_BYTE * 2;
+  const uint32_t learned = this->learned_max_frame_bytes_ + this->learned_max_frame_bytes_ / 4;
+  if (learned > size)
+    size = learned;
+  // never more than the device says a frame can take
+  for (const UVCFrameDescriptor &frame : this->config_desc_.frames) {
+    if (frame.info.width == width && frame.info.height == height && frame.max_frame_bytes != 0 &&
+        frame.max_frame_bytes < size)
+      size = frame.max_frame_bytes;
+  }
+  size = (size + 4095) & ~4095u;
+  if (size < UVC_XFER_BUFFER_MIN_SIZE)
+    size = UVC_XFER_BUFFER_MIN_SIZE;
+  if (size > UVC_XFER_BUFFER_MAX_SIZE)
+    size = UVC_XFER_BUFFER_MAX_SIZE;
+  return size;
+}
 
+/* remember how large frames get so the next boot sizes buffers for them */
+void USBWebCam::track_frame_size_() {
+  uint32_t needed = this->stream_.max_frame_bytes.load(std::memory_order_relaxed);
+  const uint32_t overflows = this->stream_.overflow_frames.load(std::memory_order_relaxed);
+  if (overflows != this->reported_overflows_) {
+    this->reported_overflows_ = overflows;
+    // the real size is unknown, ask for half again as much
+    needed = this->stream_.frame_buffer_size + this->stream_.frame_buffer_size / 2;
+    ESP_LOGW(TAG, "%u frames overflowed the %u byte buffer, %u bytes recommended", overflows, this->stream_.frame_buffer_size,
+             needed);
+  }
+  if (needed <= this->learned_max_frame_bytes_ + this->learned_max_frame_bytes_ / 8)
+    return;
+  this->learned_max_frame_bytes_ = needed;
+  this->frame_size_pref_.save(&this->learned_max_frame_bytes_);
+}
+
+void USBWebCam::negotiate_stream_() {
+  const int index = select_frame_size(this->stream_.frame_list.data(), this->stream_.frame_list.size(), this->frame_width_,
+                                      this->frame_height_, this->resolution_match_, this->max_frame_bytes_());
+  if (index < 0) {
+    ESP_LOGW(TAG, "Device does not list %ux%u, stream left to the device", this->frame_width_, this->frame_height_);
+    return;
+  }
+  const UVCFrameInfo &frame = this->stream_.frame_list[index];
+  const uint32_t interval = select_frame_interval(frame, this->requested_frame_interval_());
+  if (frame.width != this->stream_.frame_width || frame.height != this->stream_.frame_height || interval != this->stream_.frame_interval) {
+    esp_err_t err = uvc_stream_reset(&this->stream_, frame.width, frame.height, interval);
+    if (err != ESP_OK) {
+      ESP_LOGW(TAG, "Cannot switch to %ux%u, interval %uus: %s", frame.width, frame.height, interval / 10,
+               esp_err_to_name(err));
+      return;
+    }
+    ESP_LOGI(TAG, "Streaming %ux%u at %.2f fps", frame.width, frame.height,
+             (float) UVC_INTERVAL_UNITS_PER_SECOND / interval);
+  }
 
-void USBWebCam::framebuffer_task(void *pv) {
+  /* remember the outcome for the next boot */
+  USBWebCamStreamPref pref{this->frame_width_, this->frame_height_, this->requested_frame_interval_(),
+                           this->stream_.frame_width, this->stream_.frame_height, this->stream_.frame_interval};
+  this->stream_pref_.save(&pref);
+}
+
+/* ---------------- link to the camera ---------------- */
+/* the frame nobody picked up yet is from before the outage, let it go */
+void USBWebCam::lose_link_() {
+  if (this->link_state_ == USB_WEBCAM_LINK_DISCONNECTED)
+    return;
+  ESP_LOGW(TAG, "Camera lost, waiting for it to come back");
+  if (this->link_lost_ == 0)
+    this->link_lost_ = esp_timer_get_time();
+  this->link_state_ = USB_WEBCAM_LINK_DISCONNECTED;
+  this->reconnects_++;
+  this->stream_.frame_pool.flush();
+}
+
+/* Follow the link from frame arrival. A connected camera that sends no
+ * frames for stall_timeout gets its stream restarted, e.g. after a
+ * brown-out the device survived without dropping off the bus. */
+void USBWebCam::check_link_() {
+  const int64_t now = esp_timer_get_time();
+  const uint32_t frames = this->stream_.received_frames.load(std::memory_order_relaxed);
+  if (frames != this->link_frames_) {
+    this->link_frames_ = frames;
+    this->last_link_frame_ = now;
+    if (this->link_state_ == USB_WEBCAM_LINK_STARTING) {
+      this->link_state_ = USB_WEBCAM_LINK_STREAMING;
+      if (this->link_lost_ != 0) {
+        this->reconnect_time_ = (now - this->link_lost_) / 1000;
+        this->link_lost_ = 0;
+        ESP_LOGI(TAG, "Streaming again after %ums", this->reconnect_time_);
+      }
+    }
+    return;
+  }
+  if (this->link_state_ != USB_WEBCAM_LINK_STARTING && this->link_state_ != USB_WEBCAM_LINK_STREAMING)
+    return;
+  if (now - this->last_link_frame_ < (int64_t) this->stall_timeout_ * 1000)
+    return;
+  ESP_LOGW(TAG, "No frames for %ums, restarting the stream", this->stall_timeout_);
+  if (this->link_lost_ == 0)
+    this->link_lost_ = this->last_link_frame_;
+  esp_err_t err = uvc_stream_restart(&this->stream_);
+  if (err != ESP_OK)
+    ESP_LOGW(TAG, "Stream restart failed: %s", esp_err_to_name(err));
+  this->stream_restarts_++;
+  this->link_state_ = USB_WEBCAM_LINK_STARTING;
+  this->last_link_frame_ = now;
+}
+
+void USBWebCam::suspend_stream_() {
+  const int64_t now = esp_timer_get_time();
+  esp_err_t err = uvc_stream_suspend(&this->stream_, true);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Cannot suspend the stream: %s", esp_err_to_name(err));
+    this->last_wanted_ = now;  // try again after another suspend_after
+    return;
+  }
+  ESP_LOGD(TAG, "Nothing requested for %ums, stream suspended", this->suspend_after_);
+  this->link_state_ = USB_WEBCAM_LINK_SUSPENDED;
+  this->suspends_++;
+  this->stream_.frame_pool.flush();
+}
+
+/* frames count as arrived once past warm-up; the stall timeout covers a resume that fails */
+void USBWebCam::resume_stream_() {
+  const int64_t now = esp_timer_get_time();
+  this->stream_.warmup_frames.store(this->warmup_frames_, std::memory_order_relaxed);
+  esp_err_t err = uvc_stream_suspend(&this->stream_, false);
+  if (err != ESP_OK)
+    ESP_LOGW(TAG, "Cannot resume the stream: %s", esp_err_to_name(err));
+  ESP_LOGD(TAG, "Stream resumed");
+  this->link_state_ = USB_WEBCAM_LINK_STARTING;
+  this->last_link_frame_ = now;
+  this->resume_started_ = now;
+  // the frame size may have changed while suspended
+  this->negotiate_stream_();
+}
+
+/* ---------------- task report ---------------- */
+TaskHandle_t USBWebCam::task_handle_(USBWebCamTask task) const {
+  switch (task) {
+    case USB_WEBCAM_TASK_USB:
+      return xTaskGetHandle(UVC_USB_TASK_NAME);
+    case USB_WEBCAM_TASK_FRAMES:
+      return xTaskGetHandle(UVC_FRAMES_TASK_NAME);
+    case USB_WEBCAM_TASK_WORKER:
+      return this->worker_task_handle_;
+    case USB_WEBCAM_TASK_RECORDER:
+      return this->recorder_task_handle_;
+    default:
+      return xTaskGetCurrentTaskHandle();  // reports run in the loop
+  }
+}
+
+/* stack head room of the pipeline tasks and, with FreeRTOS run time stats,
+ * the share of a core each took since the last report */
+void USBWebCam::report_tasks_() {
+  static const char *const task_names[] = {"usb", "frames", "worker", "loop", "recorder"};
+  const int64_t now = esp_timer_get_time();
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+  std::vector<TaskStatus_t> status(uxTaskGetNumberOfTasks() + 2);
+  status.resize(uxTaskGetSystemState(status.data(), status.size(), nullptr));
+#endif
+  for (uint8_t i = 0; i < USB_WEBCAM_TASKS; i++) {
+    TaskHandle_t handle = this->task_handle_((USBWebCamTask) i);
+    if (handle == nullptr)
+      continue;
+    const unsigned priority = uxTaskPriorityGet(handle);
+    const unsigned stack_free = uxTaskGetStackHighWaterMark(handle);  // bytes on ESP-IDF
+    float cpu = -1.0f;
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+    for (const auto &task : status) {
+      if (task.xHandle != handle)
+        continue;
+      // run time counters tick in esp_timer us, differences survive the wrap
+      const uint32_t run_time = task.ulRunTimeCounter;
+      if (this->last_task_report_ != 0 && now > this->last_task_report_)
+        cpu = (uint32_t) (run_time - this->task_run_time_[i]) * 100.0f / (now - this->last_task_report_);
+      this->task_run_time_[i] = run_time;
+    }
+#endif
+    if (cpu >= 0.0f) {
+      ESP_LOGI(TAG, "Task %s (%s): priority %u, %u bytes of stack never used, %.1f%% CPU", task_names[i],
+               pcTaskGetName(handle), priority, stack_free, cpu);
+    } else {
+      ESP_LOGI(TAG, "Task %s (%s): priority %u, %u bytes of stack never used", task_names[i], pcTaskGetName(handle),
+               priority, stack_free);
+    }
+  }
+  this->last_task_report_ = now;
+}
+
+/* ---------------- recorder task ---------------- */
+void USBWebCam::setup_recorder_() {
+  uint8_t *arena = (uint8_t *) heap_caps_malloc_prefer(this->recording_buffer_size_, 2, MALLOC_CAP_SPIRAM, 0);
+  if (arena == nullptr) {
+    ESP_LOGW(TAG, "Can't allocate %u bytes for recording", this->recording_buffer_size_);
+    return;
+  }
+  if (xTaskCreatePinnedToCore(&USBWebCam::recorder_task_, "usb_webcam_rec", this->recorder_task_stack_size_, this,
+                              this->recorder_task_priority_, &this->recorder_task_handle_,
+                              this->recorder_task_core_) != pdPASS) {
+    ESP_LOGW(TAG, "Can't start the recorder task, recording is off");
+    heap_caps_free(arena);
+    return;
+  }
+  this->recorder_.init(arena, this->recording_buffer_size_, this->recording_block_size_);
+  if (this->recording_autostart_)
+    this->start_recording();
+}
+
+void USBWebCam::recorder_task_(void *arg) {
+  USBWebCam *cam = (USBWebCam *) arg;
   while (true) {
-    camera_fb_t *framebuffer = esp_camera_fb_get();
-    xQueueSend(global_usb_webcam->framebuffer_get_queue_, &framebuffer, portMAX_DELAY);
-    xQueueReceive(global_usb_webcam->framebuffer_return_queue_, &framebuffer, portMAX_DELAY);
-    esp_camera_fb_return(framebuffer);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    while (cam->recorder_.drain()) {
+    }
   }
 }
 
-USBWebCam *global_usb_webcam;  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+/* ---------------- worker task ---------------- */
+void USBWebCam::setup_worker_(uint32_t buffer_size) {
+  uint8_t shift = 0;
+  for (const auto &channel : this->channels_) {
+    if (channel.scale_shift != 0 && (shift == 0 || channel.scale_shift < shift))
+      shift = channel.scale_shift;
+  }
+  bool skip_duplicates = false;
+  for (const auto &channel : this->channels_)
+    skip_duplicates |= channel.skip_duplicates;
+  if (shift == 0 && this->motion_interval_ == 0 && !skip_duplicates)
+    return;
+
+  bool ok = true;
+  if (shift != 0) {
+    this->downscale_buffer_size_ = (buffer_size >> shift) + UVC_SCALE_HEADER_SIZE;
+    this->downscale_fb_.buf =
+        (uint8_t *) heap_caps_malloc_prefer(this->downscale_buffer_size_, 2, MALLOC_CAP_SPIRAM, 0);
+    ok = this->downscale_fb_.buf != nullptr;
+  }
+  this->downscaler_ = std::make_unique<JpegDownscaler>();
+  this->downscaler_->set_allocator(
+      [](size_t size) { return heap_caps_malloc_prefer(size, 2, MALLOC_CAP_SPIRAM, 0); }, heap_caps_free);
+  this->downscaler_->set_quality(this->scale_quality_);
+  this->motion_detector_.set_allocator(
+      [](size_t size) { return heap_caps_malloc_prefer(size, 2, MALLOC_CAP_SPIRAM, 0); }, heap_caps_free);
+  if (!ok ||
+      xTaskCreatePinnedToCore(&USBWebCam::worker_task_, "usb_webcam_work", this->worker_task_stack_size_, this,
+                              this->worker_task_priority_, &this->worker_task_handle_,
+                              this->worker_task_core_) != pdPASS) {
+    ESP_LOGW(TAG, "Can't start the worker task, frames stay full size, motion detection and duplicate checks are off");
+    for (auto &channel : this->channels_) {
+      channel.scale_shift = 0;
+      channel.skip_duplicates = false;
+    }
+    this->motion_interval_ = 0;
+    this->downscaler_.reset();
+    heap_caps_free(this->downscale_fb_.buf);
+    this->downscale_fb_.buf = nullptr;
+    this->downscale_buffer_size_ = 0;
+  }
+}
+
+/* one job at a time, and the output buffer must be free: no scaled image still held */
+bool USBWebCam::can_downscale_() const {
+  if (this->worker_state_.load(std::memory_order_relaxed) != USB_WEBCAM_WORKER_IDLE)
+    return false;
+  for (const auto &channel : this->channels_) {
+    if (channel.scale_shift != 0 && channel.image)
+      return false;
+  }
+  return true;
+}
+
+void USBWebCam::start_worker_(std::shared_ptr<camera_fb_t> frame) {
+  this->worker_frame_ = std::move(frame);
+  this->worker_state_.store(USB_WEBCAM_WORKER_BUSY, std::memory_order_release);
+  xTaskNotifyGive(this->worker_task_handle_);
+}
+
+void USBWebCam::finish_worker_() {
+  if (this->worker_jobs_ & USB_WEBCAM_JOB_MOTION)
+    this->finish_motion_();
+  const int64_t now = esp_timer_get_time();
+  for (uint8_t i = 0; i < USB_WEBCAM_CHANNELS; i++) {
+    USBWebCamChannel &channel = this->channels_[i];
+    const uint8_t requesters = channel.pending_requesters;
+    if (requesters == 0)
+      continue;
+    channel.pending_requesters = 0;
+    if (this->duplicate_checks_ & (1 << i)) {
+      this->checked_frames_++;
+      if (this->is_duplicate_(channel, now)) {
+        this->suppressed_frames_++;
+        continue;
+      }
+    }
+    channel.signature = this->worker_signature_;
+    this->deliver_(channel, channel.scale_shift != 0 ? this->finish_downscale_() : this->worker_frame_, requesters);
+  }
+  this->worker_buffer_bytes_ = this->motion_detector_.get_buffer_size() + this->downscaler_->get_buffer_size();
+  this->worker_jobs_ = 0;
+  this->duplicate_checks_ = 0;
+  this->worker_frame_.reset();
+  this->worker_state_.store(USB_WEBCAM_WORKER_IDLE, std::memory_order_relaxed);
+}
+
+std::shared_ptr<camera_fb_t> USBWebCam::finish_downscale_() {
+  if (this->downscale_fb_.len != 0) {
+    // the output buffer belongs to the component, images only borrow it
+    return std::shared_ptr<camera_fb_t>(&this->downscale_fb_, [](camera_fb_t *) {});
+  }
+  ESP_LOGV(TAG, "Can't scale frame, sending it full size");
+  this->downscale_failures_++;
+  return this->worker_frame_;
+}
+
+/* motion starts on the first check above min_area, and ends motion_timeout_ after the last one */
+void USBWebCam::finish_motion_() {
+  const int64_t now = esp_timer_get_time();
+  if (this->motion_detector_.is_motion(this->motion_score_)) {
+    this->last_motion_ = now;
+    if (this->motion_)
+      return;
+    ESP_LOGD(TAG, "Motion started, %u permille changed", this->motion_score_);
+    this->motion_ = true;
+    this->motion_callback_.call();
+  } else if (this->motion_ && now - this->last_motion_ >= (int64_t) this->motion_timeout_ * 1000) {
+    ESP_LOGD(TAG, "Motion stopped");
+    this->motion_ = false;
+  } else {
+    return;
+  }
+#ifdef USE_BINARY_SENSOR
+  if (this->motion_binary_sensor_ != nullptr)
+    this->motion_binary_sensor_->publish_state(this->motion_);
+#endif
+}
+
+void USBWebCam::worker_task_(void *arg) {
+  USBWebCam *cam = (USBWebCam *) arg;
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (cam->worker_state_.load(std::memory_order_acquire) != USB_WEBCAM_WORKER_BUSY)
+      continue;
+    // the loop leaves the job alone until it is marked done
+    const camera_fb_t *src = cam->worker_frame_.get();
+    cam->worker_signature_.valid = false;
+    if (cam->worker_jobs_ & (USB_WEBCAM_JOB_MOTION | USB_WEBCAM_JOB_SIGNATURE)) {
+      // one DC decode serves both
+      uint16_t width, height;
+      uint32_t stride;
+      const uint8_t *luma = cam->downscaler_->decode_luma(src->buf, src->len, &width, &height, &stride);
+      if (cam->worker_jobs_ & USB_WEBCAM_JOB_MOTION)
+        cam->motion_score_ = luma != nullptr ? cam->motion_detector_.update(luma, width, height, stride) : 0;
+      if ((cam->worker_jobs_ & USB_WEBCAM_JOB_SIGNATURE) && luma != nullptr)
+        frame_signature(luma, width, height, stride, &cam->worker_signature_);
+    }
+    if (cam->worker_jobs_ & USB_WEBCAM_JOB_SCALE) {
+      camera_fb_t &dst = cam->downscale_fb_;
+      uint16_t width, height;
+      dst.len = cam->downscaler_->scale(src->buf, src->len, cam->downscale_shift_, dst.buf,
+                                        cam->downscale_buffer_size_, &width, &height);
+      if (dst.len != 0) {
+        dst.width = width;
+        dst.height = height;
+        dst.format = src->format;
+        dst.timestamp = src->timestamp;
+        dst.sof_us = src->sof_us;
+        dst.eof_us = src->eof_us;
+        dst.sequence = src->sequence;
+      }
+    }
+    cam->worker_state_.store(USB_WEBCAM_WORKER_DONE, std::memory_order_release);
+    cam->enable_loop_soon_any_context();
+#ifdef USE_WAKE_LOOP_THREADSAFE
+    App.wake_loop_threadsafe();
+#endif
+  }
+}
 
 /* ---------------- CameraImageReader class ---------------- */
+static const uint8_t PART_TRAILER[] = {'\r', '\n'};
+
 void USBWebCamImageReader::set_image(std::shared_ptr<CameraImage> image) {
   this->image_ = std::static_pointer_cast<USBWebCamImage>(std::move(image));
   this->offset_ = 0;
+  this->part_header_length_ = 0;
+  this->staged_offset_ = SIZE_MAX;
+  if (this->image_ && !this->boundary_.empty()) {
+    const camera_fb_t *fb = this->image_->get_raw_buffer();
+    const int length = snprintf(this->part_header_, sizeof(this->part_header_),
+                                "--%s\r\nContent-Type: image/jpeg\r\nContent-Length: %zu\r\n"
+                                "X-Timestamp: %" PRId64 ".%06" PRId64 "\r\n\r\n",
+                                this->boundary_.c_str(), this->image_->get_jpeg_length(), fb->eof_us / 1000000,
+                                fb->eof_us % 1000000);
+    if (length > 0 && (size_t) length < sizeof(this->part_header_))
+      this->part_header_length_ = length;
+    else
+      ESP_LOGW(TAG, "Multipart boundary too long, sending plain JPEG");
+  }
+}
+/* the image as one stream: part header, JPEG, part trailer */
+const uint8_t *USBWebCamImageReader::span_at_(size_t offset, size_t *length) const {
+  *length = 0;
+  if (!this->image_)
+    return nullptr;
+  if (offset < this->part_header_length_) {
+    *length = this->part_header_length_ - offset;
+    return (const uint8_t *) this->part_header_ + offset;
+  }
+  offset -= this->part_header_length_;
+  const size_t jpeg_length = this->image_->get_jpeg_length();
+  if (offset < jpeg_length)
+    return this->image_->get_jpeg_span(offset, length);
+  offset -= jpeg_length;
+  if (this->part_header_length_ != 0 && offset < sizeof(PART_TRAILER)) {
+    *length = sizeof(PART_TRAILER) - offset;
+    return PART_TRAILER + offset;
+  }
+  return nullptr;
 }
-size_t USBWebCamImageReader::available() const {
+size_t USBWebCamImageReader::available() const { return this->remaining(); }
+size_t USBWebCamImageReader::remaining() const {
   if (!this->image_)
     return 0;
-
-  return this->image_->get_data_length() - this->offset_;
+  const size_t total = this->part_header_length_ + this->image_->get_jpeg_length() +
+                       (this->part_header_length_ != 0 ? sizeof(PART_TRAILER) : 0);
+  return total - this->offset_;
+}
+size_t USBWebCamImageReader::peek_spans(USBWebCamSpan *spans, size_t max_spans) const {
+  size_t count = 0;
+  size_t offset = this->offset_;
+  while (count < max_spans) {
+    size_t length;
+    const uint8_t *data = this->span_at_(offset, &length);
+    if (length == 0)
+      break;
+    spans[count++] = USBWebCamSpan{data, length};
+    offset += length;
+  }
+  return count;
+}
+void USBWebCamImageReader::return_image() {
+  this->image_.reset();
+  this->staged_offset_ = SIZE_MAX;
+}
+void USBWebCamImageReader::consume_data(size_t consumed) { this->offset_ += std::min(consumed, this->remaining()); }
+uint8_t *USBWebCamImageReader::peek_data_buffer() {
+  size_t length;
+  const uint8_t *data = this->span_at_(this->offset_, &length);
+  const size_t wanted = std::min(this->remaining(), USB_WEBCAM_READER_STAGING_SIZE);
+  if (length < wanted) {
+    // the span ends before a chunk does, copy the next bytes across the boundary
+    if (this->staged_offset_ != this->offset_) {
+      size_t staged = 0;
+      while (staged < wanted) {
+        data = this->span_at_(this->offset_ + staged, &length);
+        length = std::min(length, wanted - staged);
+        memcpy(this->staging_ + staged, data, length);
+        staged += length;
+      }
+      this->staged_offset_ = this->offset_;
+    }
+    return this->staging_;
+  }
+  // the API hands out mutable buffers, consumers only read
+  return const_cast<uint8_t *>(data);
 }
-void USBWebCamImageReader::return_image() { this->image_.reset(); }
-void USBWebCamImageReader::consume_data(size_t consumed) { this->offset_ += consumed; }
-uint8_t *USBWebCamImageReader::peek_data_buffer() { return this->image_->get_data_buffer() + this->offset_; }
 
 /* ---------------- CameraImage class ---------------- */
-USBWebCamImage::USBWebCamImage(camera_fb_t *buffer, uint8_t requesters) : buffer_(buffer), requesters_(requesters) {}
+USBWebCamJpegCopy::~USBWebCamJpegCopy() {
+  if (this->data != nullptr)
+    heap_caps_free(this->data);
+}
+
+USBWebCamImage::USBWebCamImage(std::shared_ptr<camera_fb_t> buffer, uint8_t requesters,
+                               std::shared_ptr<USBWebCamJpegCopy> jpeg_copy)
+    : buffer_(std::move(buffer)),
+      requesters_(requesters),
+      dht_offset_(jpeg_dht_insert_offset(this->buffer_->buf, this->buffer_->len)),
+      jpeg_copy_(std::move(jpeg_copy)) {}
 
-camera_fb_t *USBWebCamImage::get_raw_buffer() { return this->buffer_; }
-uint8_t *USBWebCamImage::get_data_buffer() { return this->buffer_->buf; }
-size_t USBWebCamImage::get_data_length() { return this->buffer_->len; }
+camera_fb_t *USBWebCamImage::get_raw_buffer() { return this->buffer_.get(); }
+uint8_t *USBWebCamImage::get_data_buffer() {
+  return this->make_jpeg_copy_() ? this->jpeg_copy_->data : this->buffer_->buf;
+}
+size_t USBWebCamImage::get_data_length() {
+  return this->make_jpeg_copy_() ? this->get_jpeg_length() : this->buffer_->len;
+}
+/* contiguous consumers need the tables in place; false if the frame has them or there is no memory */
+bool USBWebCamImage::make_jpeg_copy_() {
+  if (this->dht_offset_ == 0)
+    return false;
+  if (!this->jpeg_copy_)
+    this->jpeg_copy_ = std::make_shared<USBWebCamJpegCopy>();
+  USBWebCamJpegCopy &copy = *this->jpeg_copy_;
+  if (copy.data != nullptr)
+    return true;
+  if (copy.failed)
+    return false;
+  const size_t length = this->get_jpeg_length();
+  copy.data = (uint8_t *) heap_caps_malloc_prefer(length, 2, MALLOC_CAP_SPIRAM, 0);
+  if (copy.data == nullptr) {
+    ESP_LOGW(TAG, "No memory to insert the Huffman tables, handing out the frame without");
+    copy.failed = true;
+    return false;
+  }
+  size_t offset = 0;
+  while (offset < length) {
+    size_t span;
+    const uint8_t *data = this->get_jpeg_span(offset, &span);
+    memcpy(copy.data + offset, data, span);
+    offset += span;
+  }
+  return true;
+}
 bool USBWebCamImage::was_requested_by(CameraRequester requester) const {
   return (this->requesters_ & (1 << requester)) != 0;
 }
+size_t USBWebCamImage::get_jpeg_length() const {
+  return this->buffer_->len + (this->dht_offset_ != 0 ? JPEG_STANDARD_DHT_SIZE : 0);
+}
+uint8_t *USBWebCamImage::get_jpeg_span(size_t offset, size_t *length) {
+  const size_t dht_offset = this->dht_offset_ != 0 ? this->dht_offset_ : this->buffer_->len;
+  if (offset < dht_offset) {
+    *length = dht_offset - offset;
+    return this->buffer_->buf + offset;
+  }
+  if (this->dht_offset_ != 0) {
+    if (offset < dht_offset + JPEG_STANDARD_DHT_SIZE) {
+      *length = dht_offset + JPEG_STANDARD_DHT_SIZE - offset;
+      // the API hands out mutable buffers, consumers only read
+      return const_cast<uint8_t *>(JPEG_STANDARD_DHT) + (offset - dht_offset);
+    }
+    offset -= JPEG_STANDARD_DHT_SIZE;
+  }
+  *length = offset < this->buffer_->len ? this->buffer_->len - offset : 0;
+  return this->buffer_->buf + offset;
+}
 
 }  // namespace esphome::usb_webcam
 
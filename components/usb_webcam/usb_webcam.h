@@ -10,68 +10,76 @@
 #include "esphome/core/component.h"
 #include "esphome/components/camera/camera.h"
 #include "esphome/core/helpers.h"
+#include "esphome/core/preferences.h"
 #include <freertos/FreeRTOS.h>
-#include <freertos/queue.h>
+#include <freertos/task.h>
+#ifdef USE_SENSOR
+#include "esphome/components/sensor/sensor.h"
+#endif
+#ifdef USE_BINARY_SENSOR
+#include "esphome/components/binary_sensor/binary_sensor.h"
+#endif
+#include "frame_pool.h"
+#include "frame_ring.h"
+#include "latency_histogram.h"
+#include "mjpeg.h"
+#include "mjpeg_scale.h"
+#include "motion.h"
+#include "recorder.h"
+#include "uvc_descriptors.h"
+#include "uvc_format.h"
 
 namespace esphome::usb_webcam {
 using namespace esphome::camera;
 /* ---------------- enum classes ---------------- */
 
-typedef enum {
-    PIXFORMAT_RGB565,    // 2BPP/RGB565
-    PIXFORMAT_YUV422,    // 2BPP/YUV422
-    PIXFORMAT_GRAYSCALE, // 1BPP/GRAYSCALE
-    PIXFORMAT_JPEG,      // JPEG/COMPRESSED
-    PIXFORMAT_RGB888,    // 3BPP/RGB888
-    PIXFORMAT_RAW,       // RAW
-    PIXFORMAT_RGB444,    // 3BP2P/RGB444
-    PIXFORMAT_RGB555,    // 3BP2P/RGB555
-} pixformat_t;
-
-enum USBWebCamFrameSize {
-  USB_WEBCAM_SIZE_160X120,    // QQVGA
-  USB_WEBCAM_SIZE_176X144,    // QCIF
-  USB_WEBCAM_SIZE_240X176,    // HQVGA
-  USB_WEBCAM_SIZE_320X240,    // QVGA
-  USB_WEBCAM_SIZE_400X296,    // CIF
-  USB_WEBCAM_SIZE_640X480,    // VGA
-  USB_WEBCAM_SIZE_800X600,    // SVGA
-  USB_WEBCAM_SIZE_1024X768,   // XGA
-  USB_WEBCAM_SIZE_1280X1024,  // SXGA
-  USB_WEBCAM_SIZE_1600X1200,  // UXGA
-  USB_WEBCAM_SIZE_1920X1080,  // FHD
-  USB_WEBCAM_SIZE_720X1280,   // PHD
-  USB_WEBCAM_SIZE_864X1536,   // P3MP
-  USB_WEBCAM_SIZE_2048X1536,  // QXGA
-  USB_WEBCAM_SIZE_2560X1440,  // QHD
-  USB_WEBCAM_SIZE_2560X1600,  // WQXGA
-  USB_WEBCAM_SIZE_1080X1920,  // PFHD
-  USB_WEBCAM_SIZE_2560X1920,  // QSXGA
+/* stream settings negotiated with the device, cached across reboots */
+struct USBWebCamStreamPref {
+  uint16_t target_width;
+  uint16_t target_height;
+  uint32_t target_interval;
+  uint16_t width;
+  uint16_t height;
+  uint32_t interval;
 };
 
 /* ---------------- CameraImage class ---------------- */
-typedef struct {
-    uint8_t * buf;              // Pointer to the pixel data
-    size_t len;                 // Length of the buffer in bytes
-    size_t width;               // Width of the buffer in pixels
-    size_t height;              // Height of the buffer in pixels
-    pixformat_t format;         // Format of the pixel data
-    struct timeval timestamp;   // Timestamp since boot of the first DMA buffer of the frame
-} camera_fb_t;
-
 class USBWebCam;
 
+/* a frame copied with the standard DHT inserted, made on first use and
+ * shared by the images of all channels that got the frame */
+struct USBWebCamJpegCopy {
+  ~USBWebCamJpegCopy();
+  const camera_fb_t *frame{nullptr};
+  uint32_t sequence{0};
+  uint8_t *data{nullptr};
+  bool failed{false};
+};
+
 class USBWebCamImage : public camera::CameraImage {
  public:
-  USBWebCamImage(camera_fb_t *buffer, uint8_t requester);
+  USBWebCamImage(std::shared_ptr<camera_fb_t> buffer, uint8_t requester,
+                 std::shared_ptr<USBWebCamJpegCopy> jpeg_copy = nullptr);
   camera_fb_t *get_raw_buffer();
+  /* the frame as one decodable JPEG; a frame without DHT is copied with the
+   * standard tables inserted on first use, once for all images of the
+   * frame, the raw frame if that fails */
   uint8_t *get_data_buffer() override;
   size_t get_data_length() override;
   bool was_requested_by(camera::CameraRequester requester) const override;
 
+  /* the frame as a decodable JPEG: headers, standard DHT if the camera left
+   * it out, then the rest of the frame; read span by span without copying */
+  size_t get_jpeg_length() const;
+  uint8_t *get_jpeg_span(size_t offset, size_t *length);
+
  protected:
-  camera_fb_t *buffer_;
+  bool make_jpeg_copy_();
+
+  std::shared_ptr<camera_fb_t> buffer_;  // shared by the images of all channels, back to the pool with the last
   uint8_t requesters_;
+  size_t dht_offset_;  // where the standard DHT goes, 0 if none is needed
+  std::shared_ptr<USBWebCamJpegCopy> jpeg_copy_;  // contiguous decodable frame, for get_data_buffer() only
 };
 
 struct CameraImageData {
@@ -79,7 +87,26 @@ struct CameraImageData {
   size_t length;
 };
 
-/* ---------------- CameraImageReader class ---------------- */
+/* one piece of an image as the reader hands it out, e.g. for writev() */
+struct USBWebCamSpan {
+  const uint8_t *data;
+  size_t length;
+};
+
+/* part header, JPEG headers, standard DHT, scan data, part trailer */
+static const size_t USB_WEBCAM_READER_MAX_SPANS = 5;
+/* contiguous bytes peek_data_buffer() guarantees, above the API's chunk size */
+static const size_t USB_WEBCAM_READER_STAGING_SIZE = 2048;
+
+/* ---------------- CameraImageReader class ----------------
+ * Reads an image as one byte stream made of spans in different buffers:
+ * with a multipart boundary set the part header, then the JPEG with the
+ * standard DHT where the camera left it out, then the part trailer.
+ * available() is everything left. peek_data_buffer() points at least
+ * min(available(), USB_WEBCAM_READER_STAGING_SIZE) contiguous bytes, in the
+ * frame itself unless the current span ends sooner, then stitched across
+ * the span boundary into a staging buffer. peek_spans() hands out the
+ * spans themselves, so the frame goes out in a few large writes. */
 class USBWebCamImageReader : public camera::CameraImageReader {
  public:
   USBWebCamImageReader() {}
@@ -90,9 +117,141 @@ class USBWebCamImageReader : public camera::CameraImageReader {
   void consume_data(size_t consumed) override;
   void return_image() override;
 
+  /* wrap images in multipart parts with this boundary, empty for plain JPEG */
+  void set_multipart_boundary(const std::string &boundary) { this->boundary_ = boundary; }
+  /* bytes not consumed yet, over all spans */
+  size_t remaining() const;
+  /* everything not consumed yet in one call, up to max_spans pieces; returns
+   * how many were filled, consume_data() the total once written */
+  size_t peek_spans(USBWebCamSpan *spans, size_t max_spans) const;
+
  protected:
+  const uint8_t *span_at_(size_t offset, size_t *length) const;
+
   std::shared_ptr<USBWebCamImage> image_;
   size_t offset_{0};
+  std::string boundary_;
+  char part_header_[128];
+  size_t part_header_length_{0};
+  uint8_t staging_[USB_WEBCAM_READER_STAGING_SIZE];
+  size_t staged_offset_{SIZE_MAX};  // offset_ the staging buffer holds, SIZE_MAX if none
+};
+
+/* pipeline counters and rates, see USBWebCam::get_telemetry() */
+enum USBWebCamTelemetry {
+  USB_WEBCAM_FRAMES_RECEIVED,          // every frame usb_stream completed
+  USB_WEBCAM_FRAMES_LOST,              // gaps in the frame sequence, never handed over by usb_stream
+  USB_WEBCAM_FRAMES_DROPPED_SMALL,     // below drop_frame_size
+  USB_WEBCAM_FRAMES_DROPPED_OVERFLOW,  // larger than the frame buffers
+  USB_WEBCAM_FRAMES_DROPPED_INVALID,   // failed frame validation
+  USB_WEBCAM_FRAMES_DROPPED_BUSY,      // no free frame buffer, consumers holding on
+  USB_WEBCAM_FRAMES_DELIVERED_API,
+  USB_WEBCAM_FRAMES_DELIVERED_WEB,
+  USB_WEBCAM_BYTES_PER_SECOND,      // received from the camera, over the last telemetry interval
+  USB_WEBCAM_FRAME_RATE,            // mHz, frames received over the last telemetry interval
+  USB_WEBCAM_FRAME_JITTER,          // us, smoothed variation of the time between frames
+  USB_WEBCAM_LOOP_LATENCY_P99,      // us from USB end of frame to the loop picking it up
+  USB_WEBCAM_RELEASE_LATENCY_P99,   // us from delivery until consumers let go of the image
+  USB_WEBCAM_MOTION_SCORE,          // permille of the frame that changed at the last motion check
+  USB_WEBCAM_FRAMES_SUPPRESSED,     // stream frames not sent, unchanged since the last one
+  USB_WEBCAM_SUPPRESSION_RATIO,     // permille of checked stream frames suppressed
+  USB_WEBCAM_RECONNECTS,            // times the camera dropped off the bus
+  USB_WEBCAM_STREAM_RESTARTS,       // streams restarted after sending no frames for stall_timeout
+  USB_WEBCAM_RECONNECT_TIME,        // ms from losing the camera to its next frame, last time
+  USB_WEBCAM_BUFFER_BYTES,          // frame and work buffers allocated, they only grow
+  USB_WEBCAM_RESUME_TIME,           // ms from resuming a suspended stream to its first frame after warm-up
+  USB_WEBCAM_TELEMETRY_COUNT,
+};
+
+/* Fan-out state of one consumer. Each channel is paced on its own and gets
+ * its own image of a shared frame, so a consumer holding on to its image
+ * only skips frames itself. */
+struct USBWebCamChannel {
+  uint8_t requesters;                     // camera::CameraRequester bits served
+  uint32_t update_interval;               // ms between frames, 0 for max_update_interval
+  uint8_t scale_shift;                    // frames scaled by 1 / (1 << shift), 0 for full size
+  int64_t last_update;                    // esp_timer us of the last frame taken for the channel
+  std::shared_ptr<USBWebCamImage> image;  // last image handed out, busy while consumers hold it
+  bool skip_duplicates{false};            // hold back stream frames unchanged since the last one
+  uint8_t pending_requesters{0};          // frame with the worker, handed out by finish_worker_()
+  int64_t last_delivery{0};               // esp_timer us of the last image handed out
+  FrameSignature signature{};             // of the last image handed out
+};
+
+/* IDLE snapshots refresh the API entity, so they travel with the API channel */
+enum USBWebCamChannelIndex {
+  USB_WEBCAM_CHANNEL_API,
+  USB_WEBCAM_CHANNEL_WEB,
+  USB_WEBCAM_CHANNELS,
+};
+
+/* link to the camera, followed from usb_stream state events and frame arrival */
+enum USBWebCamLinkState : uint8_t {
+  USB_WEBCAM_LINK_WAITING,       // not connected since boot
+  USB_WEBCAM_LINK_STARTING,      // connected or restarted, no frame yet
+  USB_WEBCAM_LINK_STREAMING,
+  USB_WEBCAM_LINK_DISCONNECTED,  // lost, buffers and stream settings kept for its return
+  USB_WEBCAM_LINK_SUSPENDED,     // stream suspended while nobody wants frames
+};
+
+enum USBWebCamWorkerState : uint8_t {
+  USB_WEBCAM_WORKER_IDLE,
+  USB_WEBCAM_WORKER_BUSY,  // worker owns the job
+  USB_WEBCAM_WORKER_DONE,  // results ready for the loop
+};
+
+/* what the worker does with a frame, both can share one */
+enum USBWebCamWorkerJob : uint8_t {
+  USB_WEBCAM_JOB_SCALE = 1 << 0,
+  USB_WEBCAM_JOB_MOTION = 1 << 1,
+  USB_WEBCAM_JOB_SIGNATURE = 1 << 2,
+};
+
+/* State the usb_stream callbacks share with the component, one per camera.
+ * usb_stream hands it back as frame_cb_arg / state callback argument, so
+ * the driver glue needs no globals. Written from the usb_stream task,
+ * counters are atomics read by the loop. */
+struct USBWebCamStream {
+  USBWebCam *parent{nullptr};
+  uint32_t drop_frame_size{0};
+  USBWebCamFrameValidation frame_validation{USB_WEBCAM_VALIDATION_BASIC};
+  std::atomic<uint32_t> invalid_frames[JPEG_CHECK_RESULTS]{};
+  uint32_t frame_buffer_size{0};
+  uint32_t buffer_bytes{0};  // transfer, frame and pool buffers handed to usb_stream
+  FramePool frame_pool;
+  std::atomic<uint32_t> max_frame_bytes{0};
+  std::atomic<uint32_t> overflow_frames{0};
+  std::atomic<uint32_t> received_frames{0};
+  std::atomic<uint32_t> received_bytes{0};  // wraps, only differences are used
+  std::atomic<uint32_t> small_frames{0};
+  uint32_t sequence{0};  // ours, keeps counting across stream restarts
+  uint32_t device_sequence{0};
+  int64_t last_eof_us{0};
+  int64_t last_period_us{0};
+  uint32_t jitter16{0};                     // jitter in 1/16 us
+  std::atomic<bool> timing_restart{true};   // stream (re)started, next frame has no predecessor
+  std::atomic<uint32_t> lost_frames{0};     // sequence gaps, frames usb_stream never handed over
+  std::atomic<uint32_t> last_gap_sequence{0};
+  std::atomic<uint32_t> jitter_us{0};
+  uint32_t transfer_bytes_per_second{0};
+  uint16_t frame_width{0};
+  uint16_t frame_height{0};
+  uint32_t frame_interval{0};
+  std::vector<UVCFrameInfo> frame_list;
+  std::atomic<bool> connected_event{false};
+  std::atomic<bool> disconnected_event{false};
+  std::atomic<bool> connected{false};
+  std::atomic<uint8_t> warmup_frames{0};  // still to discard after a resume
+};
+
+/* tasks of the capture pipeline, in the order frames pass them */
+enum USBWebCamTask {
+  USB_WEBCAM_TASK_USB,       // usb_stream, USB transfers
+  USB_WEBCAM_TASK_FRAMES,    // usb_stream, frame assembly and camera_frame_cb
+  USB_WEBCAM_TASK_WORKER,    // downscaling, motion and duplicate checks
+  USB_WEBCAM_TASK_LOOP,      // ESPHome loop, frame fan-out
+  USB_WEBCAM_TASK_RECORDER,  // writes recorded frames to storage
+  USB_WEBCAM_TASKS,
 };
 
 /* ---------------- USBWebCam class ---------------- */
@@ -102,11 +261,70 @@ class USBWebCam : public camera::Camera {
 
   /* setters */
   /* -- image */
-  void set_frame_size(USBWebCamFrameSize size);
+  void set_frame_size(uint16_t width, uint16_t height);
+  void set_resolution_match(USBWebCamResolutionMatch match);
+  /* -- usb transfer */
+  void set_transfer_mode(USBWebCamTransferMode mode);
+  void set_transfer(uint8_t interface, uint8_t alt_setting, uint8_t ep_addr, uint16_t max_packet_size);
+  void set_config_descriptor(const std::vector<uint8_t> &descriptor);
   void set_drop_size(uint32_t drop_size);
+  void set_frame_validation(USBWebCamFrameValidation validation);
+  void set_frame_buffer_size(uint32_t size);
+  void set_frame_buffer_count(uint8_t count);
+  void set_frame_buffer_policy(FramePoolPolicy policy);
   /* -- framerates */
   void set_max_update_interval(uint32_t max_update_interval);
   void set_idle_update_interval(uint32_t idle_update_interval);
+  void set_requester_update_interval(camera::CameraRequester requester, uint32_t update_interval);
+  /* -- downscaled output */
+  void set_requester_scale(camera::CameraRequester requester, uint8_t shift);
+  void set_scale_quality(uint8_t quality);
+  /* -- duplicate frames */
+  void set_requester_skip_duplicates(camera::CameraRequester requester, bool skip);
+  void set_duplicate_threshold(uint8_t threshold);
+  /* -- pre-roll */
+  void set_preroll_size(uint32_t size);
+  void set_preroll_interval(uint32_t interval);
+  /* -- motion detection */
+  void set_motion_interval(uint32_t interval);
+  void set_motion_threshold(uint8_t threshold);
+  void set_motion_min_area(uint16_t permille);
+  void set_motion_background_shift(uint8_t shift);
+  void set_motion_timeout(uint32_t timeout);
+  void set_motion_gate(bool gate);
+  /* -- reconnect */
+  void set_stall_timeout(uint32_t timeout);
+  /* -- power save */
+  void set_suspend_after(uint32_t timeout);
+  void set_warmup_frames(uint8_t frames);
+#ifdef USE_BINARY_SENSOR
+  void set_motion_binary_sensor(binary_sensor::BinarySensor *sensor);
+#endif
+  /* -- recording */
+  void set_recording_path(const std::string &path);
+  void set_recording_segment_size(uint32_t size);
+  void set_recording_buffer(uint32_t size, uint32_t block_size);
+  void set_recording_interval(uint32_t interval);
+  void set_recording_autostart(bool autostart);
+  /* -- tasks */
+  void set_worker_task(uint8_t core, uint8_t priority, uint32_t stack_size);
+  void set_recorder_task(uint8_t core, uint8_t priority, uint32_t stack_size);
+  void set_task_report_interval(uint32_t interval);
+  /* -- telemetry */
+  void set_telemetry_interval(uint32_t interval);
+#ifdef USE_SENSOR
+  void set_telemetry_sensor(USBWebCamTelemetry telemetry, sensor::Sensor *sensor);
+#endif
+
+  uint32_t get_telemetry(USBWebCamTelemetry telemetry) const;
+  bool is_motion() const { return this->motion_; }
+  /* the recent frames kept for pre-roll, nullptr if there are none; they stay
+   * in place, and new frames skip the ring, until the snapshot is released */
+  std::shared_ptr<FrameRingSnapshot> snapshot_preroll() { return this->preroll_.snapshot(); }
+  void capture_preroll();
+  void start_recording();
+  void stop_recording();
+  bool is_recording() const { return this->recorder_.is_recording(); }
 
   /* public API (derivated) */
   void setup() override;
@@ -117,44 +335,166 @@ class USBWebCam : public camera::Camera {
   void start_stream(camera::CameraRequester requester) override;
   void stop_stream(camera::CameraRequester requester) override;
   void request_image(camera::CameraRequester requester) override;
-  void update_camera_parameters();
+  void update_camera_parameters();  // not implemented: usb_stream has no call for UVC control requests
 
   void add_image_callback(std::function<void(std::shared_ptr<camera::CameraImage>)> &&callback) override;
   void add_stream_start_callback(std::function<void()> &&callback);
   void add_stream_stop_callback(std::function<void()> &&callback);
+  void add_motion_callback(std::function<void()> &&callback);
+  void add_preroll_callback(std::function<void(std::shared_ptr<FrameRingSnapshot>)> &&callback);
   camera::CameraImageReader *create_image_reader() override;
 
  protected:
   /* internal methods */
-  bool has_requested_image_() const;
-  bool can_return_image_() const;
-
-  static void framebuffer_task(void *pv);
+  bool has_requested_image_(const USBWebCamChannel &channel) const;
+  bool can_return_image_(const USBWebCamChannel &channel) const;
+  USBWebCamChannel &channel_for_(camera::CameraRequester requester);
+  uint32_t requested_frame_interval_() const;
+  uint32_t max_frame_bytes_() const;
+  uint32_t buffer_bytes_() const;
+  uint32_t frame_buffer_size_for_(uint16_t width, uint16_t height) const;
+  void track_frame_size_();
+  void negotiate_stream_();
+  void lose_link_();
+  void check_link_();
+  void suspend_stream_();
+  void resume_stream_();
+  void sample_telemetry_();
+  TaskHandle_t task_handle_(USBWebCamTask task) const;
+  void report_tasks_();
+  void deliver_(USBWebCamChannel &channel, std::shared_ptr<camera_fb_t> frame, uint8_t requesters);
+  bool is_duplicate_(const USBWebCamChannel &channel, int64_t now) const;
+  void setup_worker_(uint32_t buffer_size);
+  void start_worker_(std::shared_ptr<camera_fb_t> frame);
+  void finish_worker_();
+  std::shared_ptr<camera_fb_t> finish_downscale_();
+  void finish_motion_();
+  bool can_downscale_() const;
+  static void worker_task_(void *arg);
+  void setup_recorder_();
+  static void recorder_task_(void *arg);
 
   /* attributes */
+  USBWebCamStream stream_;
   /* camera configuration */
-  USBWebCamFrameSize frame_size;
+  uint16_t frame_width_{640};
+  uint16_t frame_height_{480};
+  USBWebCamResolutionMatch resolution_match_{USB_WEBCAM_MATCH_NEAREST_BELOW};
+  /* -- usb transfer */
+  USBWebCamTransferMode transfer_mode_{USB_WEBCAM_TRANSFER_AUTO};
+  UVCTransferConfig transfer_{false, 1, 1, 0x83, 512};
+  bool transfer_from_descriptor_{false};
+  std::vector<uint8_t> config_descriptor_;  // raw, released once parsed
+  UVCConfigDescriptor config_desc_;
   /* -- framerates */
   uint32_t max_update_interval_{1000};
   uint32_t idle_update_interval_{15000};
+  /* -- link to the camera */
+  USBWebCamLinkState link_state_{USB_WEBCAM_LINK_WAITING};
+  uint32_t stall_timeout_{5000};  // ms a connected camera may send no frames
+  uint32_t link_frames_{0};       // frames received at the last check
+  int64_t last_link_frame_{0};    // esp_timer us a new frame was last seen, or the stream (re)started
+  int64_t link_lost_{0};          // esp_timer us the camera was lost, 0 while streaming
+  uint32_t reconnects_{0};
+  uint32_t stream_restarts_{0};
+  uint32_t reconnect_time_{0};  // ms, last time
+  /* -- power save, the stream only runs while somebody wants frames */
+  uint32_t suspend_after_{0};  // ms without requests, 0 when disabled
+  uint8_t warmup_frames_{3};   // auto exposure settles meanwhile
+  int64_t last_wanted_{0};     // esp_timer us frames were last requested
+  int64_t resume_started_{0};  // esp_timer us of a resume still waiting for its first frame
+  uint32_t resume_time_{0};    // ms, last time
+  uint32_t suspends_{0};
 
   esp_err_t init_error_{ESP_OK};
-  std::shared_ptr<USBWebCamImage> current_image_;
+  ESPPreferenceObject stream_pref_;
+  /* -- buffers */
+  uint32_t frame_buffer_size_{0};  // 0 for automatic sizing
+  uint32_t learned_max_frame_bytes_{0};
+  uint32_t reported_overflows_{0};
+  ESPPreferenceObject frame_size_pref_;
+  USBWebCamChannel channels_[USB_WEBCAM_CHANNELS]{
+      {(1U << camera::IDLE) | (1U << camera::API_REQUESTER), 0, 0, 0, nullptr},
+      {1U << camera::WEB_REQUESTER, 0, 0, 0, nullptr},
+  };
+  std::weak_ptr<USBWebCamJpegCopy> jpeg_copy_;  // of the last frame delivered, while an image holds it
   uint8_t single_requesters_{0};
   uint8_t stream_requesters_{0};
-  QueueHandle_t framebuffer_get_queue_;
-  QueueHandle_t framebuffer_return_queue_;
   CallbackManager<void(std::shared_ptr<camera::CameraImage>)> new_image_callback_{};
   CallbackManager<void()> stream_start_callback_{};
   CallbackManager<void()> stream_stop_callback_{};
 
-  uint64_t last_idle_request_{0};
-  uint64_t last_update_{0};
+  /* -- worker task, one job at a time: downscaling and motion detection */
+  std::unique_ptr<JpegDownscaler> downscaler_;
+  TaskHandle_t worker_task_handle_{nullptr};
+  uint8_t worker_task_core_{0};  // away from the core running the component loop
+  uint8_t worker_task_priority_{1};
+  uint32_t worker_task_stack_size_{4096};
+  std::atomic<uint8_t> worker_state_{USB_WEBCAM_WORKER_IDLE};
+  std::shared_ptr<camera_fb_t> worker_frame_;  // frame of the job, kept by the loop
+  uint8_t worker_jobs_{0};                     // USBWebCamWorkerJob bits
+  uint32_t worker_buffer_bytes_{0};            // allocated by the worker, read back once it is done
+  /* -- downscaling */
+  uint8_t scale_quality_{80};
+  uint8_t downscale_shift_{0};
+  camera_fb_t downscale_fb_{};  // output, reused once the channel image is released
+  size_t downscale_buffer_size_{0};
+  uint32_t downscale_failures_{0};  // frames sent full size because they couldn't be scaled
+  /* -- motion detection, on the 1/8 luma of a frame every motion_interval_ */
+  MotionDetector motion_detector_;
+  uint32_t motion_interval_{0};  // ms, 0 when disabled
+  uint32_t motion_timeout_{5000};
+  bool motion_gate_{false};  // streams at idle rate until motion
+  bool motion_{false};
+  int64_t last_motion_check_{0};
+  int64_t last_motion_{0};
+  uint16_t motion_score_{0};  // written by the worker
+  /* -- duplicate frames, compared by the signature of the source frame */
+  uint8_t duplicate_threshold_{4};
+  FrameSignature worker_signature_{};  // written by the worker
+  uint8_t duplicate_checks_{0};        // channels of the job to hand out only if the frame changed
+  uint32_t checked_frames_{0};
+  uint32_t suppressed_frames_{0};
+  /* -- pre-roll, a copy of a frame every preroll_interval_ */
+  FrameRing preroll_;
+  uint32_t preroll_size_{0};  // bytes, 0 when disabled
+  uint32_t preroll_interval_{500};
+  int64_t last_preroll_{0};
+  CallbackManager<void(std::shared_ptr<FrameRingSnapshot>)> preroll_callback_{};
+  /* -- recording, written behind by the recorder task */
+  Recorder recorder_;
+  uint32_t recording_buffer_size_{0};  // bytes, 0 when disabled
+  uint32_t recording_block_size_{32768};
+  uint32_t recording_interval_{200};
+  bool recording_autostart_{false};
+  int64_t last_recording_{0};
+  TaskHandle_t recorder_task_handle_{nullptr};
+  uint8_t recorder_task_core_{0};
+  uint8_t recorder_task_priority_{1};
+  uint32_t recorder_task_stack_size_{4096};
+  CallbackManager<void()> motion_callback_{};
+#ifdef USE_BINARY_SENSOR
+  binary_sensor::BinarySensor *motion_binary_sensor_{nullptr};
+#endif
+  /* -- telemetry */
+  uint32_t telemetry_interval_{10000};
+  uint32_t delivered_[3]{};  // per camera::CameraRequester
+  uint32_t last_received_bytes_{0};
+  int64_t last_telemetry_{0};
+  uint32_t bytes_per_second_{0};
+  uint32_t last_received_frames_{0};
+  uint32_t frame_rate_{0};  // mHz
+  LatencyHistogram loop_latency_;     // USB EOF -> loop picks the frame up
+  LatencyHistogram release_latency_;  // delivery -> all consumers released the image
+#ifdef USE_SENSOR
+  sensor::Sensor *telemetry_sensors_[USB_WEBCAM_TELEMETRY_COUNT]{};
+#endif
+  /* -- task report */
+  uint32_t task_report_interval_{0};  // ms, 0 when disabled
+  int64_t last_task_report_{0};
+  uint32_t task_run_time_[USB_WEBCAM_TASKS]{};  // run time counters at the last report
 };
 
-// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
-extern USBWebCam *global_usb_webcam;
-
 class USBWebCamStreamStartTrigger : public Trigger<> {
  public:
   explicit USBWebCamStreamStartTrigger(USBWebCam *parent) {
@@ -171,6 +511,37 @@ class USBWebCamStreamStopTrigger : public Trigger<> {
 
  protected:
 };
+class USBWebCamMotionTrigger : public Trigger<> {
+ public:
+  explicit USBWebCamMotionTrigger(USBWebCam *parent) {
+    parent->add_motion_callback([this]() { this->trigger(); });
+  }
+
+ protected:
+};
+class USBWebCamPrerollTrigger : public Trigger<std::shared_ptr<FrameRingSnapshot>> {
+ public:
+  explicit USBWebCamPrerollTrigger(USBWebCam *parent) {
+    parent->add_preroll_callback([this](std::shared_ptr<FrameRingSnapshot> frames) { this->trigger(frames); });
+  }
+
+ protected:
+};
+
+template<typename... Ts> class USBWebCamCapturePrerollAction : public Action<Ts...>, public Parented<USBWebCam> {
+ public:
+  void play(Ts... x) override { this->parent_->capture_preroll(); }
+};
+
+template<typename... Ts> class USBWebCamStartRecordingAction : public Action<Ts...>, public Parented<USBWebCam> {
+ public:
+  void play(Ts... x) override { this->parent_->start_recording(); }
+};
+
+template<typename... Ts> class USBWebCamStopRecordingAction : public Action<Ts...>, public Parented<USBWebCam> {
+ public:
+  void play(Ts... x) override { this->parent_->stop_recording(); }
+};
 
 }  // namespace esphome::usb_webcam
 
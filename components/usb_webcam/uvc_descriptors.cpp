@@ -0,0 +1,159 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "uvc_descriptors.h"
+
+namespace esphome::usb_webcam {
+
+/* descriptor types and UVC 1.1 subtypes */
+static const uint8_t USB_DESC_INTERFACE = 0x04;
+static const uint8_t USB_DESC_ENDPOINT = 0x05;
+static const uint8_t USB_DESC_CS_INTERFACE = 0x24;
+static const uint8_t USB_CLASS_VIDEO = 0x0E;
+static const uint8_t UVC_SC_VIDEOSTREAMING = 0x02;
+static const uint8_t UVC_VS_FORMAT_MJPEG = 0x06;
+static const uint8_t UVC_VS_FRAME_MJPEG = 0x07;
+static const uint8_t USB_EP_XFER_ISOC = 0x01;
+static const uint8_t USB_EP_XFER_BULK = 0x02;
+
+/* full-speed bus: one isochronous packet per 1 ms frame, at most ~19 bulk packets */
+static const uint32_t USB_FS_FRAMES_PER_SECOND = 1000;
+static const uint32_t USB_FS_BULK_PACKETS_PER_FRAME = 19;
+
+static inline uint16_t read_le16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static inline uint32_t read_le32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static bool parse_mjpeg_frame(const uint8_t *d, uint8_t format_index, UVCFrameDescriptor *frame) {
+  const uint8_t len = d[0];
+  if (len < 26)
+    return false;
+  frame->format_index = format_index;
+  frame->frame_index = d[3];
+  frame->info.width = read_le16(d + 5);
+  frame->info.height = read_le16(d + 7);
+  frame->max_frame_bytes = read_le32(d + 17);
+  frame->info.interval = read_le32(d + 21);
+  const uint8_t interval_type = d[25];
+  if (interval_type == 0) {
+    if (len < 38)
+      return false;
+    frame->info.interval_min = read_le32(d + 26);
+    frame->info.interval_max = read_le32(d + 30);
+    frame->info.interval_step = read_le32(d + 34);
+    return true;
+  }
+  if (len < 26 + 4 * interval_type)
+    return false;
+  frame->info.interval_min = UINT32_MAX;
+  frame->info.interval_max = 0;
+  frame->info.interval_step = 0;
+  for (uint8_t i = 0; i < interval_type; i++) {
+    const uint32_t interval = read_le32(d + 26 + 4 * i);
+    if (interval < frame->info.interval_min)
+      frame->info.interval_min = interval;
+    if (interval > frame->info.interval_max)
+      frame->info.interval_max = interval;
+  }
+  return true;
+}
+
+bool parse_uvc_config_descriptor(const uint8_t *data, size_t len, UVCConfigDescriptor *out) {
+  out->alts.clear();
+  out->frames.clear();
+  bool in_streaming = false;
+  uint8_t interface = 0;
+  uint8_t alt_setting = 0;
+  int mjpeg_format = -1;  // bFormatIndex of the MJPEG format being walked, -1 for other formats
+
+  size_t pos = 0;
+  while (pos + 2 <= len) {
+    const uint8_t *d = data + pos;
+    const uint8_t desc_len = d[0];
+    if (desc_len < 2 || pos + desc_len > len)
+      return false;
+    const uint8_t type = d[1];
+
+    if (type == USB_DESC_INTERFACE && desc_len >= 9) {
+      interface = d[2];
+      alt_setting = d[3];
+      in_streaming = d[5] == USB_CLASS_VIDEO && d[6] == UVC_SC_VIDEOSTREAMING;
+    } else if (in_streaming && type == USB_DESC_ENDPOINT && desc_len >= 7) {
+      const uint8_t ep_addr = d[2];
+      const uint8_t xfer = d[3] & 0x03;
+      const uint16_t max_packet = read_le16(d + 4);
+      if ((ep_addr & 0x80) && (xfer == USB_EP_XFER_ISOC || xfer == USB_EP_XFER_BULK)) {
+        UVCStreamingAlt alt;
+        alt.interface = interface;
+        alt.alt_setting = alt_setting;
+        alt.ep_addr = ep_addr;
+        alt.bulk = xfer == USB_EP_XFER_BULK;
+        alt.mps = (max_packet & 0x7FF) * (1 + ((max_packet >> 11) & 0x03));
+        out->alts.push_back(alt);
+      }
+    } else if (in_streaming && type == USB_DESC_CS_INTERFACE && desc_len >= 4) {
+      const uint8_t subtype = d[2];
+      if (subtype == UVC_VS_FORMAT_MJPEG) {
+        mjpeg_format = d[3];
+      } else if (subtype == UVC_VS_FRAME_MJPEG) {
+        UVCFrameDescriptor frame;
+        if (mjpeg_format >= 0 && parse_mjpeg_frame(d, mjpeg_format, &frame))
+          out->frames.push_back(frame);
+      } else if (subtype == 0x04 || subtype == 0x10 || subtype == 0x0C || subtype == 0x12) {
+        // uncompressed, frame based, stream based or DV format: not ours
+        mjpeg_format = -1;
+      }
+    }
+    pos += desc_len;
+  }
+  return !out->alts.empty();
+}
+
+uint32_t transfer_bytes_per_second(const UVCTransferConfig &config) {
+  if (config.bulk)
+    return (uint32_t) config.mps * USB_FS_BULK_PACKETS_PER_FRAME * USB_FS_FRAMES_PER_SECOND;
+  return (uint32_t) config.mps * USB_FS_FRAMES_PER_SECOND;
+}
+
+bool select_transfer(const UVCConfigDescriptor &desc, USBWebCamTransferMode mode, uint32_t bytes_per_second,
+                     uint16_t max_mps, UVCTransferConfig *out) {
+  const UVCStreamingAlt *fitting = nullptr;  // smallest isoc alt carrying the stream
+  const UVCStreamingAlt *largest = nullptr;  // largest isoc alt within max_mps
+  const UVCStreamingAlt *bulk = nullptr;
+  for (const UVCStreamingAlt &alt : desc.alts) {
+    if (alt.bulk) {
+      if (bulk == nullptr)
+        bulk = &alt;
+      continue;
+    }
+    if (alt.mps > max_mps)
+      continue;
+    if (largest == nullptr || alt.mps > largest->mps)
+      largest = &alt;
+    if ((uint32_t) alt.mps * USB_FS_FRAMES_PER_SECOND >= bytes_per_second && (fitting == nullptr || alt.mps < fitting->mps))
+      fitting = &alt;
+  }
+
+  const UVCStreamingAlt *chosen = nullptr;
+  switch (mode) {
+    case USB_WEBCAM_TRANSFER_ISOC:
+      chosen = fitting != nullptr ? fitting : largest;
+      break;
+    case USB_WEBCAM_TRANSFER_BULK:
+      chosen = bulk;
+      break;
+    case USB_WEBCAM_TRANSFER_AUTO:
+      chosen = fitting != nullptr ? fitting : (bulk != nullptr ? bulk : largest);
+      break;
+  }
+  if (chosen == nullptr)
+    return false;
+  out->bulk = chosen->bulk;
+  out->interface = chosen->interface;
+  out->alt_setting = chosen->alt_setting;
+  out->ep_addr = chosen->ep_addr;
+  out->mps = chosen->mps;
+  return true;
+}
+
+}  // namespace esphome::usb_webcam
@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "uvc_format.h"
+
+namespace esphome::usb_webcam {
+
+enum USBWebCamTransferMode {
+  USB_WEBCAM_TRANSFER_AUTO,  // isochronous alt setting that fits, bulk if none does
+  USB_WEBCAM_TRANSFER_ISOC,
+  USB_WEBCAM_TRANSFER_BULK,
+};
+
+/* what usb_stream needs to open the video streaming endpoint */
+struct UVCTransferConfig {
+  bool bulk;
+  uint8_t interface;
+  uint8_t alt_setting;
+  uint8_t ep_addr;
+  uint16_t mps;
+};
+
+/* one alternate setting of a VideoStreaming interface with its data endpoint */
+struct UVCStreamingAlt {
+  uint8_t interface;
+  uint8_t alt_setting;
+  uint8_t ep_addr;
+  bool bulk;
+  uint16_t mps;  // bytes per (micro)frame, high-bandwidth multiplier applied
+};
+
+/* MJPEG frame descriptor of the VideoStreaming interface */
+struct UVCFrameDescriptor {
+  uint8_t format_index;
+  uint8_t frame_index;
+  uint32_t max_frame_bytes;  // dwMaxVideoFrameBufferSize
+  UVCFrameInfo info;
+};
+
+struct UVCConfigDescriptor {
+  std::vector<UVCStreamingAlt> alts;
+  std::vector<UVCFrameDescriptor> frames;
+};
+
+/* Walk a raw configuration descriptor (as returned by GET_DESCRIPTOR) and
+ * collect the VideoStreaming endpoints and MJPEG frames. Returns false if
+ * the blob is malformed or describes no video streaming endpoint. */
+bool parse_uvc_config_descriptor(const uint8_t *data, size_t len, UVCConfigDescriptor *out);
+
+/* full-speed throughput of a transfer configuration in bytes per second */
+uint32_t transfer_bytes_per_second(const UVCTransferConfig &config);
+
+/* Pick the endpoint for a stream needing bytes_per_second: the isochronous
+ * alt setting with the smallest packet size that still fits (up to max_mps),
+ * or a bulk endpoint when requested or when no isochronous one is enough.
+ * Returns false if the descriptor offers nothing usable for the mode. */
+bool select_transfer(const UVCConfigDescriptor &desc, USBWebCamTransferMode mode, uint32_t bytes_per_second,
+                     uint16_t max_mps, UVCTransferConfig *out);
+
+}  // namespace esphome::usb_webcam
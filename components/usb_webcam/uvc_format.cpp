@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "uvc_format.h"
+
+namespace esphome::usb_webcam {
+
+uint32_t select_frame_interval(const UVCFrameInfo &frame, uint32_t max_interval) {
+  uint32_t min = frame.interval_min != 0 ? frame.interval_min : frame.interval;
+  uint32_t max = frame.interval_max != 0 ? frame.interval_max : frame.interval;
+  if (min == 0 || max == 0)
+    return max_interval;  // device did not tell, let it negotiate
+  if (min > max) {
+    uint32_t tmp = min;
+    min = max;
+    max = tmp;
+  }
+
+  if (max_interval >= max)
+    return max;
+  if (max_interval <= min)
+    return min;
+  if (frame.interval_step != 0)
+    return min + (max_interval - min) / frame.interval_step * frame.interval_step;
+  // discrete: only min, default and max are known
+  if (frame.interval != 0 && frame.interval <= max_interval && frame.interval > min)
+    return frame.interval;
+  return min;
+}
+
+int select_frame_size(const UVCFrameInfo *frames, size_t count, uint16_t width, uint16_t height,
+                      USBWebCamResolutionMatch match, uint32_t max_frame_bytes) {
+  int best = -1;
+  int smallest = -1;
+  for (size_t i = 0; i < count; i++) {
+    const UVCFrameInfo &frame = frames[i];
+    const uint32_t area = (uint32_t) frame.width * frame.height;
+    if (frame.width == width && frame.height == height && match != USB_WEBCAM_MATCH_BANDWIDTH)
+      return i;
+    if (smallest < 0 || area < (uint32_t) frames[smallest].width * frames[smallest].height)
+      smallest = i;
+    if (match == USB_WEBCAM_MATCH_EXACT || frame.width > width || frame.height > height)
+      continue;
+    if (match == USB_WEBCAM_MATCH_BANDWIDTH && area / UVC_MJPEG_PIXELS_PER_BYTE > max_frame_bytes)
+      continue;
+    if (best < 0 || area > (uint32_t) frames[best].width * frames[best].height)
+      best = i;
+  }
+  if (match == USB_WEBCAM_MATCH_EXACT)
+    return -1;
+  return best >= 0 ? best : smallest;
+}
+
+}  // namespace esphome::usb_webcam
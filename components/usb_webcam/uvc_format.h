@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome::usb_webcam {
+
+/* UVC frame intervals are expressed in 100 ns units */
+static const uint32_t UVC_INTERVAL_UNITS_PER_SECOND = 10000000;
+
+/* one entry of the device frame list, mirrors uvc_frame_size_t of usb_stream */
+struct UVCFrameInfo {
+  uint16_t width;
+  uint16_t height;
+  uint32_t interval;       // default interval
+  uint32_t interval_min;   // fastest supported interval, 0 if not advertised
+  uint32_t interval_max;   // slowest supported interval, 0 if not advertised
+  uint32_t interval_step;  // 0 for discrete intervals
+};
+
+enum USBWebCamResolutionMatch {
+  USB_WEBCAM_MATCH_EXACT,          // only the configured resolution
+  USB_WEBCAM_MATCH_NEAREST_BELOW,  // largest listed resolution not exceeding the configured one
+  USB_WEBCAM_MATCH_BANDWIDTH,      // largest one not exceeding it whose frames are expected to fit max_frame_bytes
+};
+
+/* rough MJPEG size of a typical scene, used to rank resolutions by bandwidth */
+static const uint32_t UVC_MJPEG_PIXELS_PER_BYTE = 10;
+
+/* Pick the slowest interval the device supports that still reaches
+ * max_interval (i.e. fps >= requested). Falls back to the fastest one the
+ * device can do, or to max_interval itself if nothing is advertised. */
+uint32_t select_frame_interval(const UVCFrameInfo &frame, uint32_t max_interval);
+
+/* Pick the frame list entry for a width x height target, or -1 if the
+ * device lists nothing acceptable. When nothing is small enough the
+ * non-exact matches fall back to the smallest listed resolution. */
+int select_frame_size(const UVCFrameInfo *frames, size_t count, uint16_t width, uint16_t height,
+                      USBWebCamResolutionMatch match, uint32_t max_frame_bytes);
+
+}  // namespace esphome::usb_webcam
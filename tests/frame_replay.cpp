@@ -0,0 +1,361 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Replays MJPEG frames through USBWebCam on the host: a simulated camera
+// completes frames at a rate with jitter, drops off the bus or stalls on
+// cue, and the main loop runs at the ESPHome pace, woken by frame arrival.
+// Time is simulated, so a run is repeatable and takes well under its
+// duration. Reports what the pipeline delivered and dropped, the hand-off
+// latency from end of frame to the image callback and the memory it held.
+//
+//   frame_replay [options] [file.jpg | segment.mjp ...]
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "esphome/core/application.h"
+#include "esphome/core/log.h"
+#include "host.h"
+#include "jpeg_fixture.h"
+#include "usb_webcam.h"
+
+using namespace esphome;
+using namespace esphome::usb_webcam;
+
+/* the stream state the report needs, which the component keeps to itself */
+class ReplayCamera : public USBWebCam {
+ public:
+  const USBWebCamStream &stream() const { return this->stream_; }
+};
+
+struct ReplayOptions {
+  double duration{10.0};  // s
+  double fps{15.0};
+  uint32_t jitter{0};  // us, uniform either way
+  uint16_t width{640};
+  uint16_t height{480};
+  bool strip_dht{false};
+  uint32_t corrupt{0};  // permille of frames cut short
+  std::vector<std::pair<uint32_t, uint32_t>> disconnects;  // ms at, ms for
+  std::vector<uint32_t> stalls;                             // ms at, until the stream is restarted
+  uint32_t update_interval{100};
+  uint8_t buffers{3};
+  FramePoolPolicy policy{FRAME_POOL_DROP_OLDEST};
+  camera::CameraRequester consumer{camera::WEB_REQUESTER};
+  uint32_t consumer_rate{2000000};  // bytes/s the consumer reads
+  uint8_t scale{0};
+  uint32_t loop_interval{16};  // ms
+  uint32_t loop_busy{500};     // us other components take per pass
+  bool wake{true};
+  uint32_t seed{1};
+  uint32_t min_delivered{0};
+  std::vector<std::string> files;
+};
+
+static void usage() {
+  fprintf(stderr,
+          "usage: frame_replay [options] [file.jpg | segment.mjp ...]\n"
+          "  --duration S           simulated time (10)\n"
+          "  --fps F                camera frame rate (15)\n"
+          "  --jitter US            frame completion jitter, uniform +-US (0)\n"
+          "  --size WxH             synthetic frames when no files are given (640x480)\n"
+          "  --strip-dht            synthetic frames without DHT, like most UVC cameras\n"
+          "  --corrupt PERMILLE     frames cut short (0)\n"
+          "  --disconnect AT:FOR    camera off the bus at AT ms for FOR ms, repeatable\n"
+          "  --stall AT             camera stops sending at AT ms until the stream restarts, repeatable\n"
+          "  --update-interval MS   max_update_interval of the component (100)\n"
+          "  --buffers N            frame buffer count (3)\n"
+          "  --policy oldest|newest frame buffer policy (oldest)\n"
+          "  --consumer api|web     requester streaming the frames (web)\n"
+          "  --consumer-rate BPS    bytes/s the consumer reads, holding the image meanwhile (2000000)\n"
+          "  --scale SHIFT          consumer frames scaled by 1 / (1 << SHIFT) (0)\n"
+          "  --loop-interval MS     main loop period (16)\n"
+          "  --loop-busy US         time the other components take per loop pass (500)\n"
+          "  --no-wake              frame arrival does not wake the main loop\n"
+          "  --seed N               jitter and corruption (1)\n"
+          "  --min-delivered N      exit 1 if fewer frames were delivered\n"
+          "  -v                     component log\n");
+  exit(2);
+}
+
+static ReplayOptions parse_options(int argc, char **argv) {
+  ReplayOptions options;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    auto value = [&]() -> const char * {
+      if (i + 1 >= argc)
+        usage();
+      return argv[++i];
+    };
+    if (arg == "--duration") {
+      options.duration = atof(value());
+    } else if (arg == "--fps") {
+      options.fps = atof(value());
+    } else if (arg == "--jitter") {
+      options.jitter = atoi(value());
+    } else if (arg == "--size") {
+      unsigned width, height;
+      if (sscanf(value(), "%ux%u", &width, &height) != 2)
+        usage();
+      options.width = width;
+      options.height = height;
+    } else if (arg == "--strip-dht") {
+      options.strip_dht = true;
+    } else if (arg == "--corrupt") {
+      options.corrupt = atoi(value());
+    } else if (arg == "--disconnect") {
+      unsigned at, duration;
+      if (sscanf(value(), "%u:%u", &at, &duration) != 2)
+        usage();
+      options.disconnects.emplace_back(at, duration);
+    } else if (arg == "--stall") {
+      options.stalls.push_back(atoi(value()));
+    } else if (arg == "--update-interval") {
+      options.update_interval = atoi(value());
+    } else if (arg == "--buffers") {
+      options.buffers = atoi(value());
+    } else if (arg == "--policy") {
+      const std::string policy = value();
+      options.policy = policy == "newest" ? FRAME_POOL_DROP_NEWEST : FRAME_POOL_DROP_OLDEST;
+    } else if (arg == "--consumer") {
+      const std::string consumer = value();
+      options.consumer = consumer == "api" ? camera::API_REQUESTER : camera::WEB_REQUESTER;
+    } else if (arg == "--consumer-rate") {
+      options.consumer_rate = atoi(value());
+    } else if (arg == "--scale") {
+      options.scale = atoi(value());
+    } else if (arg == "--loop-interval") {
+      options.loop_interval = atoi(value());
+    } else if (arg == "--loop-busy") {
+      options.loop_busy = atoi(value());
+    } else if (arg == "--no-wake") {
+      options.wake = false;
+    } else if (arg == "--seed") {
+      options.seed = atoi(value());
+    } else if (arg == "--min-delivered") {
+      options.min_delivered = atoi(value());
+    } else if (arg == "-v") {
+      host::set_log_level(HOST_LOG_DEBUG);
+    } else if (arg[0] == '-') {
+      usage();
+    } else {
+      options.files.push_back(arg);
+    }
+  }
+  if (options.fps <= 0 || options.duration <= 0 || options.buffers == 0)
+    usage();
+  return options;
+}
+
+static std::vector<std::vector<uint8_t>> load_frames(ReplayOptions &options) {
+  std::vector<std::vector<uint8_t>> frames;
+  for (const auto &path : options.files) {
+    auto loaded = load_mjpeg_frames(path);
+    if (loaded.empty())
+      fprintf(stderr, "%s: no JPEG frames\n", path.c_str());
+    frames.insert(frames.end(), loaded.begin(), loaded.end());
+  }
+  if (!options.files.empty()) {
+    if (frames.empty() || !read_test_jpeg_size(frames[0].data(), frames[0].size(), &options.width, &options.height)) {
+      fprintf(stderr, "nothing to replay\n");
+      exit(2);
+    }
+    return frames;
+  }
+  // a second of a moving square
+  for (uint32_t i = 0; i < std::max<uint32_t>(1, options.fps); i++) {
+    auto jpeg = make_test_jpeg(options.width, options.height, i);
+    frames.push_back(options.strip_dht ? strip_jpeg_dht(jpeg) : jpeg);
+  }
+  return frames;
+}
+
+/* the consumer takes the image at the callback and gives it back once it
+ * read all of it at its rate, through the reader like the API does */
+struct ReplayConsumer {
+  std::shared_ptr<camera::CameraImage> image;
+  std::unique_ptr<camera::CameraImageReader> reader;
+  int64_t release_at{INT64_MAX};
+  uint32_t images{0};
+  uint64_t bytes{0};
+  int64_t held_us{0};
+};
+
+static uint32_t percentile(std::vector<int64_t> values, uint32_t pct) {
+  if (values.empty())
+    return 0;
+  std::sort(values.begin(), values.end());
+  const size_t rank = (values.size() * pct + 99) / 100;
+  return values[rank != 0 ? rank - 1 : 0];
+}
+
+int main(int argc, char **argv) {
+  ReplayOptions options = parse_options(argc, argv);
+  std::vector<std::vector<uint8_t>> frames = load_frames(options);
+  std::mt19937 random(options.seed);
+
+  host::reset();
+  const uint32_t interval = UVC_INTERVAL_UNITS_PER_SECOND / options.fps;
+  host::usb_set_frame_list({{options.width, options.height, interval, interval, UVC_INTERVAL_UNITS_PER_SECOND, 0}});
+
+  ReplayCamera cam;
+  cam.set_frame_size(options.width, options.height);
+  cam.set_max_update_interval(options.update_interval);
+  cam.set_frame_buffer_count(options.buffers);
+  cam.set_frame_buffer_policy(options.policy);
+  cam.set_idle_update_interval(0);
+  if (options.scale != 0)
+    cam.set_requester_scale(options.consumer, options.scale);
+
+  ReplayConsumer consumer;
+  consumer.reader.reset(cam.create_image_reader());
+  std::set<uint32_t> delivered;
+  std::vector<int64_t> latencies;
+  cam.add_image_callback([&](std::shared_ptr<camera::CameraImage> image) {
+    auto *usb_image = static_cast<USBWebCamImage *>(image.get());
+    const camera_fb_t *fb = usb_image->get_raw_buffer();
+    latencies.push_back(host::now() - fb->eof_us);
+    delivered.insert(fb->sequence);
+    if (!image->was_requested_by(options.consumer) || consumer.image)
+      return;
+    consumer.image = image;
+    consumer.reader->set_image(image);
+    const int64_t hold = (int64_t) usb_image->get_jpeg_length() * 1000000 / options.consumer_rate;
+    consumer.release_at = host::now() + hold;
+    consumer.held_us += hold;
+  });
+
+  cam.setup();
+  if (cam.is_failed()) {
+    fprintf(stderr, "setup failed\n");
+    return 1;
+  }
+  host::usb_connect();
+  cam.start_stream(options.consumer);
+
+  const int64_t end = (int64_t) (options.duration * 1000000);
+  const int64_t period = 1000000 / options.fps;
+  std::uniform_int_distribution<int32_t> jitter(-(int32_t) options.jitter, options.jitter);
+  std::uniform_int_distribution<uint32_t> permille(0, 999);
+  int64_t next_frame = period;
+  uint32_t frame_index = 0;
+  uint32_t produced = 0;
+  uint32_t not_sent = 0;
+  uint32_t corrupted = 0;
+  int64_t next_pass = 0;
+  int64_t pass_end = 0;
+  size_t next_disconnect = 0;
+  std::sort(options.disconnects.begin(), options.disconnects.end());
+  std::sort(options.stalls.begin(), options.stalls.end());
+  size_t next_stall = 0;
+  bool stalled = false;
+  uint32_t stall_resumes = 0;
+  int64_t reconnect_at = INT64_MAX;
+
+  while (true) {
+    const int64_t disconnect_at = next_disconnect < options.disconnects.size()
+                                      ? (int64_t) options.disconnects[next_disconnect].first * 1000
+                                      : INT64_MAX;
+    const int64_t now =
+        std::min({next_frame, next_pass, consumer.release_at, disconnect_at, reconnect_at});
+    if (now >= end)
+      break;
+    host::set_time(now);
+
+    if (now == disconnect_at) {
+      host::usb_disconnect();
+      reconnect_at = now + (int64_t) options.disconnects[next_disconnect].second * 1000;
+      next_disconnect++;
+    } else if (now == reconnect_at) {
+      host::usb_connect();
+      reconnect_at = INT64_MAX;
+    } else if (now == consumer.release_at) {
+      // the API sender: chunks of what is left, the image goes back after the last one
+      while (true) {
+        const size_t available = consumer.reader->available();
+        const size_t chunk = std::min<size_t>(1390, available);
+        consumer.reader->peek_data_buffer();
+        consumer.bytes += chunk;
+        consumer.reader->consume_data(chunk);
+        if (chunk == available)
+          break;
+      }
+      consumer.reader->return_image();
+      consumer.image.reset();
+      consumer.images++;
+      consumer.release_at = INT64_MAX;
+    } else if (now == next_frame) {
+      if (next_stall < options.stalls.size() && now >= (int64_t) options.stalls[next_stall] * 1000) {
+        stalled = true;
+        stall_resumes = host::usb_state().resumes;
+        next_stall++;
+      }
+      if (stalled && host::usb_state().resumes != stall_resumes)
+        stalled = false;  // the component restarted the stream
+      std::vector<uint8_t> frame = frames[frame_index++ % frames.size()];
+      if (options.corrupt != 0 && permille(random) < options.corrupt) {
+        frame.resize(frame.size() / 2);
+        corrupted++;
+      }
+      if (!stalled && host::usb_send_frame(frame.data(), frame.size())) {
+        produced++;
+      } else {
+        not_sent++;
+      }
+      next_frame = std::max(now + 1, (int64_t) (frame_index + 1) * period + jitter(random));
+      // the frame callback woke the loop, it runs once the pass under way is over
+      if (options.wake && App.take_wake())
+        next_pass = std::min(next_pass, std::max(now, pass_end));
+    } else {
+      host::loop_once(&cam);
+      App.take_wake();
+      pass_end = now + options.loop_busy;
+      next_pass = std::max<int64_t>(pass_end, std::min<int64_t>(now + options.loop_interval * 1000, host::next_timer()));
+    }
+  }
+
+  const USBWebCamStream &stream = cam.stream();
+  const uint32_t received = cam.get_telemetry(USB_WEBCAM_FRAMES_RECEIVED);
+  const uint32_t small = cam.get_telemetry(USB_WEBCAM_FRAMES_DROPPED_SMALL);
+  const uint32_t overflow = cam.get_telemetry(USB_WEBCAM_FRAMES_DROPPED_OVERFLOW);
+  const uint32_t invalid = cam.get_telemetry(USB_WEBCAM_FRAMES_DROPPED_INVALID);
+  const uint32_t busy = cam.get_telemetry(USB_WEBCAM_FRAMES_DROPPED_BUSY);
+  const uint32_t stale = stream.frame_pool.get_stale();
+  const uint32_t dropped = small + overflow + invalid + busy + stale;
+  const uint32_t others = received - std::min(received, dropped + (uint32_t) delivered.size());
+
+  printf("frames produced       %8u  (%.1f fps for %.1f s)\n", produced, options.fps, options.duration);
+  printf("frames not sent       %8u  (camera off the bus, stalled or suspended)\n", not_sent);
+  printf("frames received       %8u\n", received);
+  printf("  dropped small       %8u\n", small);
+  printf("  dropped overflow    %8u\n", overflow);
+  printf("  dropped invalid     %8u  (%u cut short by the replay)\n", invalid, corrupted);
+  printf("  dropped busy        %8u  (no free frame buffer)\n", busy);
+  printf("  replaced unread     %8u  (newer frame arrived before the loop took it)\n", stale);
+  printf("  not due             %8u  (paced out by the update interval, or in flight at reconnect)\n", others);
+  printf("frames delivered      %8zu  (%.1f%% of produced)\n", delivered.size(),
+         produced != 0 ? delivered.size() * 100.0 / produced : 0.0);
+  printf("hand-off latency us   p50 %u  p90 %u  p99 %u  max %u  (EOF to image callback)\n",
+         percentile(latencies, 50), percentile(latencies, 90), percentile(latencies, 99), percentile(latencies, 100));
+  printf("loop latency us       p99 < %u  (component histogram)\n", cam.get_telemetry(USB_WEBCAM_LOOP_LATENCY_P99));
+  printf("consumer              %8u images, %" PRIu64 " bytes, busy %.1f%% of the time\n", consumer.images,
+         consumer.bytes, consumer.held_us * 100.0 / end);
+  printf("link                  %8u reconnects, %u stream restarts, last recovery %u ms\n",
+         cam.get_telemetry(USB_WEBCAM_RECONNECTS), cam.get_telemetry(USB_WEBCAM_STREAM_RESTARTS),
+         cam.get_telemetry(USB_WEBCAM_RECONNECT_TIME));
+  printf("peak buffer memory    %8zu bytes  (component reports %u)\n", host::heap_peak(),
+         cam.get_telemetry(USB_WEBCAM_BUFFER_BYTES));
+
+  if (delivered.size() < options.min_delivered) {
+    fprintf(stderr, "delivered %zu frames, expected at least %u\n", delivered.size(), options.min_delivered);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,283 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Hand-off of finished frames from the usb_stream frame callback to the
+// component loop, on real threads and the real clock. Runs the descriptor
+// ring usb_webcam uses against the chain it replaced: an event group bit
+// waking a frame buffer task that passes the frame to loop() through one
+// queue and gets it back through another. FreeRTOS primitives are modeled
+// with a mutex and a condition variable each; both variants wake the loop
+// the same way, so what differs is the hand-off itself. Reports the latency
+// from the end of frame to loop() holding it and the context switches per
+// frame over all threads involved.
+//
+//   handoff_bench [--frames N] [--period US] [--size BYTES]
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frame_pool.h"
+
+using namespace esphome::usb_webcam;
+using Clock = std::chrono::steady_clock;
+
+static int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+/* voluntary and involuntary context switches of the calling thread */
+static uint64_t thread_switches() {
+  rusage usage;
+  getrusage(RUSAGE_THREAD, &usage);
+  return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+/* ---------------- FreeRTOS models ---------------- */
+/* xEventGroupSetBits / xEventGroupWaitBits with clear on exit */
+class EventGroup {
+ public:
+  void set_bits(uint32_t bits) {
+    {
+      std::lock_guard<std::mutex> lock(this->mutex_);
+      this->bits_ |= bits;
+    }
+    this->cv_.notify_all();
+  }
+  uint32_t wait_bits(uint32_t bits) {
+    std::unique_lock<std::mutex> lock(this->mutex_);
+    this->cv_.wait(lock, [&]() { return (this->bits_ & bits) != 0; });
+    const uint32_t set = this->bits_ & bits;
+    this->bits_ &= ~bits;
+    return set;
+  }
+
+ protected:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  uint32_t bits_{0};
+};
+
+/* xQueueCreate(1, sizeof(camera_fb_t *)) */
+class PointerQueue {
+ public:
+  void send(camera_fb_t *item) {
+    std::unique_lock<std::mutex> lock(this->mutex_);
+    this->cv_.wait(lock, [&]() { return !this->full_; });
+    this->item_ = item;
+    this->full_ = true;
+    this->cv_.notify_all();
+  }
+  /* block for ever, or only check with wait false */
+  bool receive(camera_fb_t **item, bool wait) {
+    std::unique_lock<std::mutex> lock(this->mutex_);
+    if (wait)
+      this->cv_.wait(lock, [&]() { return this->full_; });
+    if (!this->full_)
+      return false;
+    *item = this->item_;
+    this->full_ = false;
+    this->cv_.notify_all();
+    return true;
+  }
+
+ protected:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  camera_fb_t *item_{nullptr};
+  bool full_{false};
+};
+
+/* App.wake_loop_threadsafe() against the loop sleeping out its period */
+class LoopWake {
+ public:
+  void wake() {
+    {
+      std::lock_guard<std::mutex> lock(this->mutex_);
+      this->pending_ = true;
+    }
+    this->cv_.notify_one();
+  }
+  void sleep(std::chrono::milliseconds period) {
+    std::unique_lock<std::mutex> lock(this->mutex_);
+    this->cv_.wait_for(lock, period, [&]() { return this->pending_; });
+    this->pending_ = false;
+  }
+
+ protected:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool pending_{false};
+};
+
+/* ---------------- benchmark ---------------- */
+struct BenchOptions {
+  uint32_t frames{5000};
+  uint32_t period{1000};  // us between frames
+  uint32_t size{40000};   // bytes per frame
+};
+
+struct BenchResult {
+  std::vector<int64_t> latency_ns;
+  std::atomic<uint64_t> switches{0};
+};
+
+static const uint32_t FRAME_READY = 1 << 0;
+static const uint32_t STOP = 1 << 1;
+static const std::chrono::milliseconds LOOP_PERIOD(16);
+
+/* the usb_stream side: a frame every period, copied into the pool */
+template<typename Signal> static void produce(const BenchOptions &options, FramePool &pool, BenchResult &result,
+                                              Signal signal) {
+  std::vector<uint8_t> frame(options.size, 0xA5);
+  auto next = Clock::now();
+  for (uint32_t sequence = 1; sequence <= options.frames; sequence++) {
+    next += std::chrono::microseconds(options.period);
+    std::this_thread::sleep_until(next);
+    if (pool.push(frame.data(), frame.size(), 640, 480, sequence, 0, now_ns()))
+      signal();
+  }
+  result.switches += thread_switches();
+}
+
+static void init_pool(FramePool &pool, std::vector<uint8_t> &arena, const BenchOptions &options) {
+  pool.set_slot_count(3);
+  arena.resize(pool.get_slot_count() * options.size);
+  pool.init(arena.data(), options.size);
+}
+
+static void run_ring(const BenchOptions &options, BenchResult &result) {
+  FramePool pool;
+  std::vector<uint8_t> arena;
+  init_pool(pool, arena, options);
+  LoopWake wake;
+  std::atomic<bool> done{false};
+
+  std::thread loop([&]() {
+    while (true) {
+      const bool finished = done.load();
+      wake.sleep(LOOP_PERIOD);
+      camera_fb_t *fb = pool.acquire();
+      if (fb != nullptr) {
+        result.latency_ns.push_back(now_ns() - fb->eof_us);
+        pool.release(fb);
+      } else if (finished) {
+        break;
+      }
+    }
+    result.switches += thread_switches();
+  });
+  produce(options, pool, result, [&]() { wake.wake(); });
+  done.store(true);
+  wake.wake();
+  loop.join();
+}
+
+static void run_event_chain(const BenchOptions &options, BenchResult &result) {
+  FramePool pool;
+  std::vector<uint8_t> arena;
+  init_pool(pool, arena, options);
+  EventGroup events;
+  PointerQueue get_queue;
+  PointerQueue return_queue;
+  LoopWake wake;
+  std::atomic<bool> task_done{false};
+
+  // framebuffer_task: esp_camera_fb_get(), hand to loop(), wait for it back
+  std::thread framebuffer_task([&]() {
+    while (true) {
+      camera_fb_t *fb = pool.acquire();
+      if (fb == nullptr) {
+        if (events.wait_bits(FRAME_READY | STOP) & STOP)
+          break;
+        continue;
+      }
+      get_queue.send(fb);
+      wake.wake();
+      return_queue.receive(&fb, true);
+      pool.release(fb);
+    }
+    result.switches += thread_switches();
+    task_done.store(true);
+  });
+  // loop() runs until the task is gone, it may still wait for its frame back
+  std::thread loop([&]() {
+    while (true) {
+      const bool finished = task_done.load();
+      wake.sleep(LOOP_PERIOD);
+      camera_fb_t *fb;
+      if (get_queue.receive(&fb, false)) {
+        result.latency_ns.push_back(now_ns() - fb->eof_us);
+        return_queue.send(fb);
+      } else if (finished) {
+        break;
+      }
+    }
+    result.switches += thread_switches();
+  });
+  produce(options, pool, result, [&]() { events.set_bits(FRAME_READY); });
+  events.set_bits(STOP);
+  framebuffer_task.join();
+  wake.wake();
+  loop.join();
+}
+
+static void report(const char *name, const BenchOptions &options, BenchResult &result) {
+  std::vector<int64_t> &latency = result.latency_ns;
+  std::sort(latency.begin(), latency.end());
+  auto percentile = [&](uint32_t p) -> double {
+    if (latency.empty())
+      return 0.0;
+    return latency[std::min(latency.size() - 1, latency.size() * p / 100)] / 1000.0;
+  };
+  printf("%-20s %8u %9zu %9.1f %9.1f %9.1f %9.2f\n", name, options.frames, latency.size(), percentile(50),
+         percentile(99), latency.empty() ? 0.0 : latency.back() / 1000.0,
+         (double) result.switches / options.frames);
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: handoff_bench [options]\n"
+          "  --frames N     frames per variant (5000)\n"
+          "  --period US    time between frames (1000)\n"
+          "  --size BYTES   frame size (40000)\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  BenchOptions options;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (i + 1 >= argc)
+      usage();
+    if (arg == "--frames") {
+      options.frames = atoi(argv[++i]);
+    } else if (arg == "--period") {
+      options.period = atoi(argv[++i]);
+    } else if (arg == "--size") {
+      options.size = atoi(argv[++i]);
+    } else {
+      usage();
+    }
+  }
+  if (options.frames == 0 || options.size == 0)
+    usage();
+
+  printf("%-20s %8s %9s %9s %9s %9s %9s\n", "hand-off", "frames", "delivered", "p50 us", "p99 us", "max us",
+         "ctxsw/fr");
+  BenchResult ring;
+  run_ring(options, ring);
+  report("descriptor ring", options, ring);
+  BenchResult chain;
+  run_event_chain(options, chain);
+  report("event group+queues", options, chain);
+  return ring.latency_ns.empty() ? 1 : 0;
+}
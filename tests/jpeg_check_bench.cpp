@@ -0,0 +1,195 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Cost of check_jpeg() on the frame callback path. Runs both validation
+// levels over a corpus of good frames and the same frames damaged the ways
+// USB transfers damage them: cut short, bytes lost or flipped in the scan,
+// headers overwritten. Reports the time per frame against the frame period
+// and what each level caught, by reason.
+//
+//   jpeg_check_bench [--size WxH] [--frames N] [--fps F] [file.jpg | segment.mjp ...]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "jpeg_fixture.h"
+#include "mjpeg.h"
+
+using namespace esphome::usb_webcam;
+using Clock = std::chrono::steady_clock;
+
+enum Damage {
+  DAMAGE_NONE,
+  DAMAGE_CUT,      // transfer ended early
+  DAMAGE_HOLE,     // a packet lost in the scan
+  DAMAGE_FLIP,     // corrupted bytes in the scan
+  DAMAGE_HEADER,   // corrupted bytes in the headers
+  DAMAGES,
+};
+static const char *const DAMAGE_NAMES[DAMAGES] = {"good", "cut short", "packet lost", "bytes flipped",
+                                                  "header garbled"};
+
+static size_t scan_start(const std::vector<uint8_t> &jpeg) {
+  size_t pos = 2;
+  while (pos + 4 <= jpeg.size() && jpeg[pos] == 0xFF) {
+    const uint8_t marker = jpeg[pos + 1];
+    pos += 2 + (jpeg[pos + 2] << 8 | jpeg[pos + 3]);
+    if (marker == 0xDA)
+      break;
+  }
+  return std::min(pos, jpeg.size());
+}
+
+static std::vector<uint8_t> damage(const std::vector<uint8_t> &jpeg, Damage kind, std::mt19937 &random) {
+  std::vector<uint8_t> out = jpeg;
+  const size_t scan = scan_start(jpeg);
+  auto in_range = [&](size_t from, size_t to) {
+    return std::uniform_int_distribution<size_t>(from, std::max(from, to - 1))(random);
+  };
+  switch (kind) {
+    case DAMAGE_CUT:
+      out.resize(in_range(2, jpeg.size() - 2));
+      break;
+    case DAMAGE_HOLE: {
+      const size_t at = in_range(scan, jpeg.size() - 600);
+      out.erase(out.begin() + at, out.begin() + at + 512);
+      break;
+    }
+    case DAMAGE_FLIP:
+      for (int i = 0; i < 8; i++)
+        out[in_range(scan, jpeg.size() - 2)] ^= 1 << (random() % 8);
+      break;
+    case DAMAGE_HEADER:
+      for (int i = 0; i < 4; i++)
+        out[in_range(2, scan)] = random();
+      break;
+    default:
+      break;
+  }
+  return out;
+}
+
+struct LevelStats {
+  double total_us{0};
+  double max_us{0};
+  uint32_t results[DAMAGES][JPEG_CHECK_RESULTS]{};
+};
+
+static void usage() {
+  fprintf(stderr,
+          "usage: jpeg_check_bench [options] [file.jpg | segment.mjp ...]\n"
+          "  --size WxH    synthetic frames when no files are given (1280x720)\n"
+          "  --frames N    synthetic frames (20)\n"
+          "  --fps F       frame rate the cost is compared to (30)\n"
+          "  --rounds N    passes over the corpus (20)\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  uint16_t width = 1280;
+  uint16_t height = 720;
+  uint32_t frame_count = 20;
+  double fps = 30.0;
+  uint32_t rounds = 20;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    auto value = [&]() -> const char * {
+      if (i + 1 >= argc)
+        usage();
+      return argv[++i];
+    };
+    if (arg == "--size") {
+      unsigned w, h;
+      if (sscanf(value(), "%ux%u", &w, &h) != 2)
+        usage();
+      width = w;
+      height = h;
+    } else if (arg == "--frames") {
+      frame_count = atoi(value());
+    } else if (arg == "--fps") {
+      fps = atof(value());
+    } else if (arg == "--rounds") {
+      rounds = atoi(value());
+    } else if (arg[0] == '-') {
+      usage();
+    } else {
+      files.push_back(arg);
+    }
+  }
+
+  std::vector<std::vector<uint8_t>> good;
+  for (const std::string &file : files) {
+    for (auto &frame : load_mjpeg_frames(file))
+      good.push_back(std::move(frame));
+  }
+  for (uint32_t i = 0; files.empty() && i < frame_count; i++) {
+    // every other frame with restart markers, and most without DHT like UVC cameras send them
+    const std::vector<uint8_t> jpeg = encode_test_jpeg(make_test_image(width, height, i), 80, i % 2 ? 8 : 0);
+    good.push_back(i % 4 ? strip_jpeg_dht(jpeg) : jpeg);
+  }
+  if (good.empty()) {
+    fprintf(stderr, "no frames\n");
+    return 1;
+  }
+
+  std::mt19937 random(1);
+  std::vector<std::pair<Damage, std::vector<uint8_t>>> corpus;
+  size_t bytes = 0;
+  for (const auto &frame : good) {
+    for (int kind = 0; kind < DAMAGES; kind++) {
+      corpus.emplace_back((Damage) kind, damage(frame, (Damage) kind, random));
+      bytes += corpus.back().second.size();
+    }
+  }
+
+  const USBWebCamFrameValidation levels[] = {USB_WEBCAM_VALIDATION_BASIC, USB_WEBCAM_VALIDATION_STRICT};
+  LevelStats stats[2];
+  for (int l = 0; l < 2; l++) {
+    for (uint32_t round = 0; round < rounds; round++) {
+      for (const auto &[kind, frame] : corpus) {
+        const auto start = Clock::now();
+        const JpegCheckResult result = check_jpeg(frame.data(), frame.size(), levels[l]);
+        const double us = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+        stats[l].total_us += us;
+        stats[l].max_us = std::max(stats[l].max_us, us);
+        if (round == 0)
+          stats[l].results[kind][result]++;
+      }
+    }
+  }
+
+  const double period_us = 1e6 / fps;
+  printf("corpus: %zu good frames, %zu total, %.0f kB average\n", good.size(), corpus.size(),
+         bytes / 1024.0 / corpus.size());
+  printf("%-8s %10s %10s %12s\n", "level", "mean us", "max us", "of period");
+  for (int l = 0; l < 2; l++) {
+    const double mean = stats[l].total_us / (corpus.size() * rounds);
+    printf("%-8s %10.1f %10.1f %11.3f%%\n", l == 0 ? "basic" : "strict", mean, stats[l].max_us,
+           100.0 * stats[l].max_us / period_us);
+  }
+  for (int l = 0; l < 2; l++) {
+    printf("\n%s: frames rejected by reason\n", l == 0 ? "basic" : "strict");
+    for (int kind = 0; kind < DAMAGES; kind++) {
+      uint32_t rejected = 0;
+      std::string reasons;
+      for (int r = 1; r < JPEG_CHECK_RESULTS; r++) {
+        const uint32_t count = stats[l].results[kind][r];
+        if (count == 0)
+          continue;
+        rejected += count;
+        reasons += std::string(reasons.empty() ? "" : ", ") + jpeg_check_result_to_string((JpegCheckResult) r) +
+                   " " + std::to_string(count);
+      }
+      printf("  %-15s %3u/%-3zu %s\n", DAMAGE_NAMES[kind], rejected, good.size(), reasons.c_str());
+    }
+  }
+  // good frames must pass, and no check may take a frame period
+  const bool ok = stats[0].results[DAMAGE_NONE][JPEG_OK] == good.size() &&
+                  stats[1].results[DAMAGE_NONE][JPEG_OK] == good.size() && stats[1].max_us < period_us;
+  return ok ? 0 : 1;
+}
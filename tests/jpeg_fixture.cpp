@@ -0,0 +1,197 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "jpeg_fixture.h"
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <random>
+
+#include <jpeglib.h>
+
+namespace esphome::usb_webcam {
+
+TestImage make_test_image(uint16_t width, uint16_t height, uint32_t index, uint8_t components) {
+  TestImage image{width, height, components, std::vector<uint8_t>((size_t) width * height * components)};
+  const uint32_t side = std::max(8, std::min<int>(width, height) / 4);
+  const uint32_t x0 = (index * 13) % std::max<uint32_t>(1, width - side);
+  const uint32_t y0 = (index * 7) % std::max<uint32_t>(1, height - side);
+  for (uint32_t y = 0; y < height; y++) {
+    for (uint32_t x = 0; x < width; x++) {
+      uint8_t *pixel = &image.pixels[((size_t) y * width + x) * components];
+      const bool square = x >= x0 && x < x0 + side && y >= y0 && y < y0 + side;
+      pixel[0] = square ? 240 : (x * 200 / width + y * 40 / height);
+      if (components == 3) {
+        pixel[1] = square ? 230 : (y * 180 / height + 20);
+        pixel[2] = square ? 40 : ((x ^ y) & 0x3F) + 96;
+      }
+    }
+  }
+  return image;
+}
+
+void add_sensor_noise(TestImage *image, int amplitude, int offset, uint32_t seed) {
+  std::mt19937 random(seed);
+  std::uniform_int_distribution<int> noise(-amplitude, amplitude);
+  for (uint8_t &sample : image->pixels)
+    sample = std::clamp(sample + offset + noise(random), 0, 255);
+}
+
+std::vector<uint8_t> encode_test_jpeg(const TestImage &image, int quality, int restart_interval) {
+  jpeg_compress_struct cinfo;
+  jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_compress(&cinfo);
+  unsigned char *out = nullptr;
+  unsigned long out_size = 0;
+  jpeg_mem_dest(&cinfo, &out, &out_size);
+  cinfo.image_width = image.width;
+  cinfo.image_height = image.height;
+  cinfo.input_components = image.components;
+  cinfo.in_color_space = image.components == 3 ? JCS_RGB : JCS_GRAYSCALE;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, quality, TRUE);
+  cinfo.restart_interval = restart_interval;
+  jpeg_start_compress(&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height) {
+    JSAMPROW row = const_cast<JSAMPROW>(&image.pixels[(size_t) cinfo.next_scanline * image.width * image.components]);
+    jpeg_write_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  std::vector<uint8_t> jpeg(out, out + out_size);
+  free(out);
+  return jpeg;
+}
+
+std::vector<uint8_t> make_test_jpeg(uint16_t width, uint16_t height, uint32_t index, int quality) {
+  return encode_test_jpeg(make_test_image(width, height, index), quality);
+}
+
+std::vector<uint8_t> strip_jpeg_dht(const std::vector<uint8_t> &jpeg) {
+  std::vector<uint8_t> out(jpeg.begin(), jpeg.begin() + 2);
+  size_t pos = 2;
+  while (pos + 4 <= jpeg.size() && jpeg[pos] == 0xFF) {
+    const uint8_t marker = jpeg[pos + 1];
+    const size_t length = jpeg[pos + 2] << 8 | jpeg[pos + 3];
+    if (marker == 0xDA)
+      break;  // scan data and the rest stay as they are
+    if (marker != 0xC4)
+      out.insert(out.end(), jpeg.begin() + pos, jpeg.begin() + pos + 2 + length);
+    pos += 2 + length;
+  }
+  out.insert(out.end(), jpeg.begin() + pos, jpeg.end());
+  return out;
+}
+
+struct DecodeError {
+  jpeg_error_mgr mgr;
+  jmp_buf jump;
+  int warnings;
+};
+
+static void decode_error_exit(j_common_ptr cinfo) { longjmp(((DecodeError *) cinfo->err)->jump, 1); }
+static void decode_emit_message(j_common_ptr cinfo, int level) {
+  if (level < 0)
+    ((DecodeError *) cinfo->err)->warnings++;  // e.g. premature end of data, filled with gray
+}
+
+bool decode_test_jpeg(const uint8_t *data, size_t len, TestImage *image, int scale_denom) {
+  jpeg_decompress_struct cinfo;
+  DecodeError error;
+  cinfo.err = jpeg_std_error(&error.mgr);
+  error.mgr.error_exit = decode_error_exit;
+  error.mgr.emit_message = decode_emit_message;
+  error.warnings = 0;
+  if (setjmp(error.jump)) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, data, len);
+  jpeg_read_header(&cinfo, TRUE);
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = scale_denom;
+  jpeg_start_decompress(&cinfo);
+  image->width = cinfo.output_width;
+  image->height = cinfo.output_height;
+  image->components = cinfo.output_components;
+  image->pixels.resize((size_t) image->width * image->height * image->components);
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW row = &image->pixels[(size_t) cinfo.output_scanline * image->width * image->components];
+    jpeg_read_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  return error.warnings == 0;
+}
+
+bool read_test_jpeg_size(const uint8_t *data, size_t len, uint16_t *width, uint16_t *height) {
+  jpeg_decompress_struct cinfo;
+  DecodeError error;
+  cinfo.err = jpeg_std_error(&error.mgr);
+  error.mgr.error_exit = decode_error_exit;
+  if (setjmp(error.jump)) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, data, len);
+  jpeg_read_header(&cinfo, TRUE);
+  *width = cinfo.image_width;
+  *height = cinfo.image_height;
+  jpeg_destroy_decompress(&cinfo);
+  return true;
+}
+
+double image_difference(const TestImage &a, const TestImage &b) {
+  if (a.pixels.size() != b.pixels.size() || a.pixels.empty())
+    return 255.0;
+  uint64_t sum = 0;
+  for (size_t i = 0; i < a.pixels.size(); i++)
+    sum += std::abs(a.pixels[i] - b.pixels[i]);
+  return (double) sum / a.pixels.size();
+}
+
+/* end of the JPEG starting at pos: header segments by their lengths, then
+ * the scan up to a marker that is neither stuffing nor a restart */
+static size_t jpeg_end(const std::vector<uint8_t> &data, size_t pos) {
+  pos += 2;
+  while (pos + 4 <= data.size() && data[pos] == 0xFF) {
+    const uint8_t marker = data[pos + 1];
+    pos += 2 + (data[pos + 2] << 8 | data[pos + 3]);
+    if (marker != 0xDA)
+      continue;
+    while (pos + 1 < data.size()) {
+      if (data[pos] == 0xFF && data[pos + 1] != 0x00 && !(data[pos + 1] >= 0xD0 && data[pos + 1] <= 0xD7)) {
+        if (data[pos + 1] == 0xD9)
+          return pos + 2;
+        break;  // another scan of a progressive frame
+      }
+      pos++;
+    }
+  }
+  return pos >= data.size() ? data.size() : pos;
+}
+
+std::vector<std::vector<uint8_t>> load_mjpeg_frames(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  const std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  std::vector<std::vector<uint8_t>> frames;
+  size_t pos = 0;
+  while (pos + 1 < data.size()) {
+    if (data[pos] != 0xFF || data[pos + 1] != 0xD8) {
+      pos++;
+      continue;
+    }
+    const size_t end = jpeg_end(data, pos);
+    frames.emplace_back(data.begin() + pos, data.begin() + end);
+    pos = end;
+  }
+  return frames;
+}
+
+}  // namespace esphome::usb_webcam
@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Frames for the host tests and the replay harness, made and checked with
+ * libjpeg so the component's own JPEG code is never its own reference. */
+namespace esphome::usb_webcam {
+
+struct TestImage {
+  uint16_t width;
+  uint16_t height;
+  uint8_t components;
+  std::vector<uint8_t> pixels;  // interleaved, components bytes per pixel
+};
+
+/* A scene the codecs have some work with: gradients and a bright square
+ * that moves with index. Dimensions need not be multiples of 16. */
+TestImage make_test_image(uint16_t width, uint16_t height, uint32_t index, uint8_t components = 3);
+
+/* what a sensor adds to a still scene: noise of up to +-amplitude per
+ * sample, and an exposure shift of the whole frame by offset */
+void add_sensor_noise(TestImage *image, int amplitude, int offset, uint32_t seed);
+
+/* baseline JPEG, 4:2:0 for colour, with the standard tables libjpeg writes */
+std::vector<uint8_t> encode_test_jpeg(const TestImage &image, int quality = 80, int restart_interval = 0);
+std::vector<uint8_t> make_test_jpeg(uint16_t width, uint16_t height, uint32_t index, int quality = 80);
+
+/* the frame without its DHT segments, as most UVC cameras send MJPEG */
+std::vector<uint8_t> strip_jpeg_dht(const std::vector<uint8_t> &jpeg);
+
+/* decode with libjpeg, scaled by 1 / scale_denom (1, 2, 4 or 8); false if it
+ * reports an error or the image is cut short */
+bool decode_test_jpeg(const uint8_t *data, size_t len, TestImage *image, int scale_denom = 1);
+bool read_test_jpeg_size(const uint8_t *data, size_t len, uint16_t *width, uint16_t *height);
+
+/* mean absolute difference per sample, images of equal size and layout */
+double image_difference(const TestImage &a, const TestImage &b);
+
+/* a JPEG file, or a raw MJPEG stream such as a recorded .mjp segment, split into frames */
+std::vector<std::vector<uint8_t>> load_mjpeg_frames(const std::string &path);
+
+}  // namespace esphome::usb_webcam
@@ -0,0 +1,195 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Cost and effect of motion detection on a sequence of frames. Every
+// motion_interval the worker decodes the DC luma of a frame and updates the
+// background; this times both against the frame period, and replays the
+// motion state with its timeout to count what gate_streams would send:
+// every frame while there is motion, one per idle interval otherwise.
+// Recorded .mjp segments give the real thing; without files a made up
+// scene is still with sensor noise and exposure drift, has the square
+// moving through it for a while, then is still again; for it the bench
+// also counts missed checks and false alarms, and how long motion outlasts
+// the movement.
+//
+//   motion_bench [--size WxH] [--seconds S] [--fps F] [--interval MS] [--timeout MS] [--idle MS] [segment.mjp ...]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "jpeg_fixture.h"
+#include "mjpeg_scale.h"
+#include "motion.h"
+
+using namespace esphome::usb_webcam;
+using Clock = std::chrono::steady_clock;
+
+struct Frame {
+  std::vector<uint8_t> jpeg;
+  bool moving;  // ground truth of the made up scene
+};
+
+static void usage() {
+  fprintf(stderr,
+          "usage: motion_bench [options] [file.jpg | segment.mjp ...]\n"
+          "  --size WxH       made up frames when no files are given (1280x720)\n"
+          "  --seconds S      of made up frames: still, moving, still thirds (12)\n"
+          "  --fps F          frame rate of the sequence (30)\n"
+          "  --interval MS    motion_interval (100)\n"
+          "  --timeout MS     motion timeout (1000)\n"
+          "  --idle MS        idle update interval with gate_streams (10000)\n"
+          "  --threshold N    threshold per block (12)\n"
+          "  --min-area N     permille of blocks (20)\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  uint16_t width = 1280;
+  uint16_t height = 720;
+  double seconds = 12;
+  double fps = 30.0;
+  uint32_t interval = 100;
+  uint32_t timeout = 1000;
+  uint32_t idle = 10000;
+  int threshold = 12;
+  int min_area = 20;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    auto value = [&]() -> const char * {
+      if (i + 1 >= argc)
+        usage();
+      return argv[++i];
+    };
+    if (arg == "--size") {
+      unsigned w, h;
+      if (sscanf(value(), "%ux%u", &w, &h) != 2)
+        usage();
+      width = w;
+      height = h;
+    } else if (arg == "--seconds") {
+      seconds = atof(value());
+    } else if (arg == "--fps") {
+      fps = atof(value());
+    } else if (arg == "--interval") {
+      interval = atoi(value());
+    } else if (arg == "--timeout") {
+      timeout = atoi(value());
+    } else if (arg == "--idle") {
+      idle = atoi(value());
+    } else if (arg == "--threshold") {
+      threshold = atoi(value());
+    } else if (arg == "--min-area") {
+      min_area = atoi(value());
+    } else if (arg[0] == '-') {
+      usage();
+    } else {
+      files.push_back(arg);
+    }
+  }
+
+  std::vector<Frame> frames;
+  for (const std::string &file : files) {
+    for (auto &jpeg : load_mjpeg_frames(file))
+      frames.push_back({std::move(jpeg), false});
+  }
+  const uint32_t count = files.empty() ? (uint32_t) (seconds * fps) : 0;
+  for (uint32_t i = 0, position = 0; i < count; i++) {
+    const bool moving = i >= count / 3 && i < count * 2 / 3;
+    if (moving)
+      position++;
+    TestImage image = make_test_image(width, height, position);
+    add_sensor_noise(&image, 4, (int) (i / fps) % 4 * 3, i);  // exposure drifts by a few steps a second
+    frames.push_back({strip_jpeg_dht(encode_test_jpeg(image, 80)), moving});
+  }
+  if (frames.empty()) {
+    fprintf(stderr, "no frames\n");
+    return 1;
+  }
+
+  JpegDownscaler decoder;
+  MotionDetector detector;
+  detector.set_threshold(threshold);
+  detector.set_min_area(min_area);
+  const int64_t frame_us = (int64_t) (1e6 / fps);
+  int64_t last_check = -INT64_MAX / 2, last_motion = 0, last_sent = -INT64_MAX / 2;
+  bool motion = false;
+  uint32_t checks = 0, failed = 0, motion_starts = 0;
+  // made up scene only: false alarms before anything moved, and how long motion lasts after it stopped
+  uint32_t missed = 0, false_alarms = 0, moving_checks = 0;
+  int64_t stopped_moving = -1, motion_ended = -1;
+  double total_us = 0, max_us = 0;
+  size_t all_bytes = 0, gated_bytes = 0;
+  uint32_t gated_frames = 0;
+  for (size_t i = 0; i < frames.size(); i++) {
+    const int64_t now = i * frame_us;
+    const Frame &frame = frames[i];
+    if (i != 0 && frames[i - 1].moving && !frame.moving)
+      stopped_moving = now;
+    all_bytes += frame.jpeg.size();
+    if (now - last_check >= (int64_t) interval * 1000) {
+      last_check = now;
+      const auto start = Clock::now();
+      uint16_t luma_width, luma_height;
+      uint32_t stride;
+      const uint8_t *luma =
+          decoder.decode_luma(frame.jpeg.data(), frame.jpeg.size(), &luma_width, &luma_height, &stride);
+      const uint16_t score = luma != nullptr ? detector.update(luma, luma_width, luma_height, stride) : 0;
+      const double us = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+      total_us += us;
+      max_us = std::max(max_us, us);
+      checks++;
+      failed += luma == nullptr;
+      // as USBWebCam::finish_motion_()
+      if (detector.is_motion(score)) {
+        last_motion = now;
+        motion_starts += !motion;
+        motion = true;
+      } else if (motion && now - last_motion >= (int64_t) timeout * 1000) {
+        motion = false;
+        if (stopped_moving >= 0 && motion_ended < 0)
+          motion_ended = now;
+      }
+      if (files.empty()) {
+        moving_checks += frame.moving;
+        missed += frame.moving && !detector.is_motion(score);
+        false_alarms += moving_checks == 0 && detector.is_motion(score);
+      }
+    }
+    if (motion || now - last_sent >= (int64_t) idle * 1000) {
+      last_sent = now;
+      gated_bytes += frame.jpeg.size();
+      gated_frames++;
+    }
+  }
+
+  const double period_us = 1e6 / fps;
+  uint16_t frame_width = width, frame_height = height;
+  read_test_jpeg_size(frames[0].jpeg.data(), frames[0].jpeg.size(), &frame_width, &frame_height);
+  printf("%zu frames of %ux%u at %.0f fps, a check every %u ms\n", frames.size(), frame_width, frame_height, fps,
+         interval);
+  printf("check (DC decode + background): mean %.2f ms, max %.2f ms, %.1f%% of a frame period\n",
+         total_us / checks / 1000, max_us / 1000, 100.0 * max_us / period_us);
+  printf("checks %u, motion started %u times", checks, motion_starts);
+  if (files.empty()) {
+    printf(", missed %u of %u while moving, %u false alarms\n", missed, moving_checks, false_alarms);
+    // the background takes in where the square was one check at a time, then the timeout runs
+    if (motion_ended >= 0) {
+      printf("motion ended %.1f s after the scene stopped moving\n", (motion_ended - stopped_moving) / 1e6);
+    } else {
+      printf("motion had not ended %.1f s after the scene stopped moving\n",
+             ((int64_t) frames.size() * frame_us - stopped_moving) / 1e6);
+    }
+  } else {
+    printf("\n");
+  }
+  printf("gate_streams: %u of %zu frames, %.1f of %.1f MB (%.0f%%)\n", gated_frames, frames.size(),
+         gated_bytes / 1e6, all_bytes / 1e6, 100.0 * gated_bytes / all_bytes);
+  // every check within a frame period, and on the made up scene no false alarms and the movement seen
+  const bool ok = failed == 0 && max_us < period_us &&
+                  (!files.empty() || (false_alarms == 0 && motion_starts == 1 && missed < moving_checks / 4));
+  return ok ? 0 : 1;
+}
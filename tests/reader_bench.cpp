@@ -0,0 +1,208 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Reader calls and socket writes it takes to send one frame as a
+// multipart/x-mixed-replace part. Before: the reader the component started
+// with, over one contiguous buffer, read in chunks through the virtual
+// CameraImageReader interface, the part header and trailer written on their
+// own. Now: USBWebCamImageReader with the boundary set, read in the same
+// chunks, and read with peek_spans() into one writev() per frame. Writes go
+// into a sink buffer, so the time includes the copy a socket send would
+// make. Reports calls and writes per frame, bytes per write and us per frame.
+//
+//   reader_bench [--size WxH] [--frames N] [--chunk BYTES] [--rounds N]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "jpeg_fixture.h"
+#include "usb_webcam.h"
+
+using namespace esphome;
+using namespace esphome::usb_webcam;
+using Clock = std::chrono::steady_clock;
+
+/* the reader as it was: the whole image in one buffer, offset into it */
+class ContiguousReader : public camera::CameraImageReader {
+ public:
+  void set_image(std::shared_ptr<camera::CameraImage> image) override {
+    this->image_ = std::move(image);
+    this->offset_ = 0;
+  }
+  size_t available() const override { return this->image_ ? this->image_->get_data_length() - this->offset_ : 0; }
+  uint8_t *peek_data_buffer() override { return this->image_->get_data_buffer() + this->offset_; }
+  void consume_data(size_t consumed) override { this->offset_ += consumed; }
+  void return_image() override { this->image_.reset(); }
+
+ protected:
+  std::shared_ptr<camera::CameraImage> image_;
+  size_t offset_{0};
+};
+
+/* counts what crosses the virtual interface, and the writes to the socket */
+struct Sink {
+  std::vector<uint8_t> buffer;
+  size_t used{0};
+  uint64_t writes{0};
+  uint64_t calls{0};
+  uint64_t bytes{0};
+
+  void write(const void *data, size_t length) {
+    memcpy(this->buffer.data() + this->used, data, length);
+    this->used += length;
+    this->bytes += length;
+    this->writes++;
+  }
+};
+
+/* the web server's loop: header, then chunks of what the reader has, then the trailer */
+static void send_chunked(camera::CameraImageReader *reader, size_t chunk, Sink &sink, const char *header) {
+  if (header != nullptr)
+    sink.write(header, strlen(header));
+  while (true) {
+    const size_t available = reader->available();
+    const size_t length = std::min(chunk, available);
+    sink.write(reader->peek_data_buffer(), length);
+    reader->consume_data(length);
+    sink.calls += 3;
+    if (length == available)
+      break;
+  }
+  if (header != nullptr)
+    sink.write("\r\n", 2);
+  reader->return_image();
+  sink.calls++;
+}
+
+static void send_spans(USBWebCamImageReader *reader, Sink &sink) {
+  USBWebCamSpan spans[USB_WEBCAM_READER_MAX_SPANS];
+  const size_t count = reader->peek_spans(spans, USB_WEBCAM_READER_MAX_SPANS);
+  size_t total = 0;
+  // one writev(): the kernel copies every span in one call
+  for (size_t i = 0; i < count; i++) {
+    memcpy(sink.buffer.data() + sink.used + total, spans[i].data, spans[i].length);
+    total += spans[i].length;
+  }
+  sink.used += total;
+  sink.bytes += total;
+  sink.writes++;
+  reader->consume_data(total);
+  reader->return_image();
+  sink.calls += 3;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: reader_bench [options]\n"
+          "  --size WxH      frames (1280x720)\n"
+          "  --frames N      distinct frames (10)\n"
+          "  --chunk BYTES   chunk the web server reads (1024)\n"
+          "  --rounds N      passes over the frames (200)\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  uint16_t width = 1280;
+  uint16_t height = 720;
+  uint32_t frame_count = 10;
+  size_t chunk = 1024;
+  uint32_t rounds = 200;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    auto value = [&]() -> const char * {
+      if (i + 1 >= argc)
+        usage();
+      return argv[++i];
+    };
+    if (arg == "--size") {
+      unsigned w, h;
+      if (sscanf(value(), "%ux%u", &w, &h) != 2)
+        usage();
+      width = w;
+      height = h;
+    } else if (arg == "--frames") {
+      frame_count = atoi(value());
+    } else if (arg == "--chunk") {
+      chunk = atoi(value());
+    } else if (arg == "--rounds") {
+      rounds = atoi(value());
+    } else {
+      usage();
+    }
+  }
+  if (frame_count == 0 || rounds == 0 || chunk == 0)
+    usage();
+
+  // the same frames with the tables for the contiguous reader, without as UVC cameras send them for ours
+  std::vector<std::vector<uint8_t>> jpegs;
+  std::vector<std::shared_ptr<camera_fb_t>> with_tables, without_tables;
+  size_t largest = 0;
+  for (uint32_t i = 0; i < frame_count; i++) {
+    jpegs.push_back(make_test_jpeg(width, height, i));
+    jpegs.push_back(strip_jpeg_dht(jpegs.back()));
+    largest = std::max(largest, jpegs[jpegs.size() - 2].size());
+  }
+  for (size_t i = 0; i < jpegs.size(); i++) {
+    auto fb = std::make_shared<camera_fb_t>();
+    fb->buf = jpegs[i].data();
+    fb->len = jpegs[i].size();
+    fb->width = width;
+    fb->height = height;
+    fb->eof_us = 1000000 + i * 33333;
+    (i % 2 == 0 ? with_tables : without_tables).push_back(fb);
+  }
+
+  struct Mode {
+    const char *name;
+    Sink sink;
+    double us{0};
+  } modes[3] = {{"chunked, before", {}}, {"chunked, now", {}}, {"spans, now", {}}};
+  for (auto &mode : modes)
+    mode.sink.buffer.resize(largest + 256);
+
+  ContiguousReader before;
+  USBWebCamImageReader now;
+  now.set_multipart_boundary("frame");
+  char header[128];
+  for (uint32_t round = 0; round < rounds; round++) {
+    for (uint32_t i = 0; i < frame_count; i++) {
+      for (int m = 0; m < 3; m++) {
+        Sink &sink = modes[m].sink;
+        sink.used = 0;
+        const auto start = Clock::now();
+        if (m == 0) {
+          auto image = std::make_shared<USBWebCamImage>(with_tables[i], 1);
+          snprintf(header, sizeof(header), "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: %zu\r\n\r\n",
+                   with_tables[i]->len);
+          before.set_image(image);
+          send_chunked(&before, chunk, sink, header);
+        } else {
+          now.set_image(std::make_shared<USBWebCamImage>(without_tables[i], 1));
+          if (m == 1) {
+            send_chunked(&now, chunk, sink, nullptr);
+          } else {
+            send_spans(&now, sink);
+          }
+        }
+        modes[m].us += std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+      }
+    }
+  }
+
+  const double frames = (double) frame_count * rounds;
+  printf("%u frames of %ux%u, %.0f kB average without tables, chunks of %zu bytes\n", frame_count, width, height,
+         jpegs[1].size() / 1024.0, chunk);
+  printf("%-16s %12s %12s %12s %10s\n", "reader", "calls/frame", "writes/frame", "bytes/write", "us/frame");
+  for (const auto &mode : modes) {
+    printf("%-16s %12.1f %12.1f %12.0f %10.2f\n", mode.name, mode.sink.calls / frames, mode.sink.writes / frames,
+           (double) mode.sink.bytes / mode.sink.writes, mode.us / frames);
+  }
+  // both readers of ours must send the same bytes
+  const bool ok = modes[1].sink.bytes == modes[2].sink.bytes;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Write throughput of the Recorder into a directory, with the frame task
+// appending at a frame rate, or as fast as the ring takes frames, and the
+// writer on a thread of its own as the recorder task is on the device. Point
+// it at a mounted card to see what that card sustains. Reports MB/s, the
+// write() calls it took and their mean size, from /proc/self/io, frames the
+// ring had no room for, and checks the segments against what was appended.
+//
+//   recorder_bench [--dir PATH] [--megabytes N] [--frame-size BYTES] [--fps F] [--buffer BYTES] [--block BYTES]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "recorder.h"
+
+using namespace esphome::usb_webcam;
+using Clock = std::chrono::steady_clock;
+namespace fs = std::filesystem;
+
+/* write() calls and bytes of this process so far */
+static bool read_io(uint64_t *calls, uint64_t *bytes) {
+  FILE *io = fopen("/proc/self/io", "r");
+  if (io == nullptr)
+    return false;
+  char line[64];
+  unsigned long long value;
+  while (fgets(line, sizeof(line), io) != nullptr) {
+    if (sscanf(line, "syscw: %llu", &value) == 1)
+      *calls = value;
+    if (sscanf(line, "wchar: %llu", &value) == 1)
+      *bytes = value;
+  }
+  fclose(io);
+  return true;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: recorder_bench [options]\n"
+          "  --dir PATH          directory to record into, emptied first (a temporary one)\n"
+          "  --megabytes N       to record (64)\n"
+          "  --frame-size BYTES  mean frame size, frames vary by a half around it (60000)\n"
+          "  --fps F             frame rate, 0 for as fast as the ring takes them (0)\n"
+          "  --buffer BYTES      recording buffer_size (262144)\n"
+          "  --block BYTES       recording block_size (32768)\n"
+          "  --segment BYTES     segment_size (16777216)\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  std::string dir;
+  double megabytes = 64;
+  size_t frame_size = 60000;
+  double fps = 0;
+  size_t buffer = 256 * 1024;
+  size_t block = 32 * 1024;
+  uint32_t segment = 16 * 1024 * 1024;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    auto value = [&]() -> const char * {
+      if (i + 1 >= argc)
+        usage();
+      return argv[++i];
+    };
+    if (arg == "--dir") {
+      dir = value();
+    } else if (arg == "--megabytes") {
+      megabytes = atof(value());
+    } else if (arg == "--frame-size") {
+      frame_size = atoi(value());
+    } else if (arg == "--fps") {
+      fps = atof(value());
+    } else if (arg == "--buffer") {
+      buffer = atoi(value());
+    } else if (arg == "--block") {
+      block = atoi(value());
+    } else if (arg == "--segment") {
+      segment = atoi(value());
+    } else {
+      usage();
+    }
+  }
+  if (frame_size < 2 || megabytes <= 0 || block == 0)
+    usage();
+  const bool temporary = dir.empty();
+  if (temporary)
+    dir = (fs::temp_directory_path() / ("recorder_bench." + std::to_string(getpid()))).string();
+  fs::remove_all(dir);
+  fs::create_directories(dir);
+
+  std::vector<uint8_t> arena(buffer);
+  Recorder recorder;
+  recorder.set_path(dir);
+  recorder.set_segment_size(segment);
+  recorder.init(arena.data(), arena.size(), block);
+  if (!recorder.is_enabled()) {
+    fprintf(stderr, "buffer of %zu bytes holds fewer than 3 blocks of %zu\n", buffer, block);
+    return 1;
+  }
+
+  std::atomic<bool> done{false};
+  std::thread writer([&] {
+    while (!done.load()) {
+      if (!recorder.drain())
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    while (recorder.drain()) {
+    }
+  });
+
+  std::vector<uint8_t> frame(frame_size * 3 / 2);
+  for (size_t i = 0; i < frame.size(); i++)
+    frame[i] = (uint8_t) (i * 7 + i / 4096);
+  uint64_t calls_before = 0, bytes_before = 0, calls_after = 0, bytes_after = 0;
+  const bool have_io = read_io(&calls_before, &bytes_before);
+  const auto start = Clock::now();
+  recorder.start();
+  uint64_t appended = 0, frames = 0, ticks = 0;
+  while (appended < megabytes * 1e6 && !recorder.has_failed()) {
+    camera_fb_t fb{};
+    fb.buf = frame.data();
+    fb.len = frame_size / 2 + (ticks * 7919) % frame_size;
+    fb.sequence = frames;
+    fb.eof_us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+    if (fps > 0) {
+      std::this_thread::sleep_until(start + std::chrono::microseconds((int64_t) (ticks++ * 1e6 / fps)));
+      if (!recorder.append(fb))
+        continue;  // skipped, as the component does
+    } else {
+      // as fast as the writer keeps up: wait for room
+      ticks++;
+      while (!recorder.append(fb) && !recorder.has_failed())
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+    appended += fb.len;
+    frames++;
+  }
+  recorder.stop();
+  done.store(true);
+  writer.join();
+  const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  read_io(&calls_after, &bytes_after);
+
+  // every frame where its index entry says
+  uint64_t checked = 0;
+  for (uint32_t number = 0; number < recorder.get_segments(); number++) {
+    char name[16];
+    snprintf(name, sizeof(name), "/%08u.mjp", number);
+    const uintmax_t data_size = fs::file_size(dir + name);
+    snprintf(name, sizeof(name), "/%08u.idx", number);
+    FILE *index = fopen((dir + name).c_str(), "rb");
+    char magic[sizeof(RECORDER_INDEX_MAGIC)];
+    if (index == nullptr || fread(magic, sizeof(magic), 1, index) != 1 ||
+        memcmp(magic, RECORDER_INDEX_MAGIC, sizeof(magic)) != 0)
+      break;
+    RecorderIndexEntry entry;
+    uint32_t offset = 0;
+    while (fread(&entry, sizeof(entry), 1, index) == 1 && entry.offset == offset) {
+      offset += entry.length;
+      checked++;
+    }
+    fclose(index);
+    if (offset != data_size)
+      break;
+  }
+
+  printf("%.1f MB in %llu frames of %zu bytes mean into %s, blocks of %zu in a %zu byte buffer\n", appended / 1e6,
+         (unsigned long long) frames, frame_size, dir.c_str(), block, buffer);
+  printf("%.1f MB/s, %u segments, %u frames skipped%s\n", appended / 1e6 / seconds, recorder.get_segments(),
+         fps > 0 ? recorder.get_dropped() : 0, fps > 0 ? "" : " (writer paced)");
+  if (have_io) {
+    const uint64_t calls = calls_after - calls_before;
+    printf("%llu write() calls, %.0f bytes each\n", (unsigned long long) calls,
+           calls != 0 ? (double) (bytes_after - bytes_before) / calls : 0.0);
+  }
+  if (recorder.has_failed())
+    printf("failed: %s\n", recorder.get_error());
+  if (temporary)
+    fs::remove_all(dir);
+  const bool ok = !recorder.has_failed() && recorder.get_bytes_written() == appended && checked == frames;
+  return ok ? 0 : 1;
+}
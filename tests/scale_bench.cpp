@@ -0,0 +1,171 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Cost of JpegDownscaler per frame at each scale, next to libjpeg doing the
+// same job: decode at the scale with its own scaled IDCT, encode again at
+// the same quality. Also times decode_luma(), the 1/8 luma motion detection
+// works on. Reports ms per frame, the share of the frame period, output size
+// and the mean error per sample against libjpeg's scaled decode, for both.
+//
+//   scale_bench [--size WxH] [--frames N] [--fps F] [--quality Q] [file.jpg | segment.mjp ...]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "jpeg_fixture.h"
+#include "mjpeg_scale.h"
+
+using namespace esphome::usb_webcam;
+using Clock = std::chrono::steady_clock;
+
+struct ScaleStats {
+  double total_ms{0};
+  double max_ms{0};
+  size_t bytes{0};
+  double error{0};
+  uint32_t failed{0};
+};
+
+static void usage() {
+  fprintf(stderr,
+          "usage: scale_bench [options] [file.jpg | segment.mjp ...]\n"
+          "  --size WxH    synthetic frames when no files are given (1280x720)\n"
+          "  --frames N    synthetic frames (10)\n"
+          "  --fps F       frame rate the cost is compared to (30)\n"
+          "  --quality Q   JPEG quality of the scaled frames (80)\n"
+          "  --rounds N    passes over the frames (5)\n");
+  exit(2);
+}
+
+static double ms_since(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void add(ScaleStats &stats, double ms) {
+  stats.total_ms += ms;
+  stats.max_ms = std::max(stats.max_ms, ms);
+}
+
+int main(int argc, char **argv) {
+  uint16_t width = 1280;
+  uint16_t height = 720;
+  uint32_t frame_count = 10;
+  double fps = 30.0;
+  int quality = 80;
+  uint32_t rounds = 5;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    auto value = [&]() -> const char * {
+      if (i + 1 >= argc)
+        usage();
+      return argv[++i];
+    };
+    if (arg == "--size") {
+      unsigned w, h;
+      if (sscanf(value(), "%ux%u", &w, &h) != 2)
+        usage();
+      width = w;
+      height = h;
+    } else if (arg == "--frames") {
+      frame_count = atoi(value());
+    } else if (arg == "--fps") {
+      fps = atof(value());
+    } else if (arg == "--quality") {
+      quality = atoi(value());
+    } else if (arg == "--rounds") {
+      rounds = atoi(value());
+    } else if (arg[0] == '-') {
+      usage();
+    } else {
+      files.push_back(arg);
+    }
+  }
+
+  std::vector<std::vector<uint8_t>> frames;
+  for (const std::string &file : files) {
+    for (auto &frame : load_mjpeg_frames(file))
+      frames.push_back(std::move(frame));
+  }
+  for (uint32_t i = 0; files.empty() && i < frame_count; i++)
+    frames.push_back(strip_jpeg_dht(make_test_jpeg(width, height, i)));  // as UVC cameras send them
+  if (frames.empty() || rounds == 0) {
+    fprintf(stderr, "no frames\n");
+    return 1;
+  }
+  size_t bytes = 0;
+  for (const auto &frame : frames)
+    bytes += frame.size();
+
+  JpegDownscaler scaler;
+  scaler.set_quality(quality);
+  std::vector<uint8_t> out;
+  ScaleStats ours[4], libjpeg[4], luma;
+  for (uint8_t shift = 1; shift <= 3; shift++) {
+    for (uint32_t round = 0; round < rounds; round++) {
+      for (const auto &frame : frames) {
+        out.resize(frame.size() + 4096);
+        uint16_t out_width, out_height;
+        auto start = Clock::now();
+        const size_t len =
+            scaler.scale(frame.data(), frame.size(), shift, out.data(), out.size(), &out_width, &out_height);
+        add(ours[shift], ms_since(start));
+
+        TestImage reference;
+        start = Clock::now();
+        const bool decoded = decode_test_jpeg(frame.data(), frame.size(), &reference, 1 << shift);
+        const std::vector<uint8_t> encoded = encode_test_jpeg(reference, quality);
+        add(libjpeg[shift], ms_since(start));
+        if (round != 0)
+          continue;
+        TestImage scaled;
+        if (len == 0 || !decoded || !decode_test_jpeg(out.data(), len, &scaled)) {
+          ours[shift].failed++;
+          continue;
+        }
+        TestImage round_trip;
+        decode_test_jpeg(encoded.data(), encoded.size(), &round_trip);
+        ours[shift].bytes += len;
+        ours[shift].error += image_difference(scaled, reference);
+        libjpeg[shift].bytes += encoded.size();
+        libjpeg[shift].error += image_difference(round_trip, reference);
+      }
+    }
+  }
+  for (uint32_t round = 0; round < rounds; round++) {
+    for (const auto &frame : frames) {
+      uint16_t luma_width, luma_height;
+      uint32_t stride;
+      const auto start = Clock::now();
+      if (scaler.decode_luma(frame.data(), frame.size(), &luma_width, &luma_height, &stride) == nullptr)
+        luma.failed++;
+      add(luma, ms_since(start));
+    }
+  }
+
+  const double period_ms = 1e3 / fps;
+  const size_t runs = frames.size() * rounds;
+  uint16_t frame_width = width, frame_height = height;
+  read_test_jpeg_size(frames[0].data(), frames[0].size(), &frame_width, &frame_height);
+  printf("%zu frames of %ux%u, %.0f kB average, quality %d, %.0f ms frame period\n", frames.size(), frame_width,
+         frame_height, bytes / 1024.0 / frames.size(), quality, period_ms);
+  printf("%-6s %8s %8s %10s %8s %8s | %-20s\n", "scale", "mean ms", "max ms", "of period", "kB out", "error",
+         "libjpeg ms, kB, error");
+  bool ok = true;
+  for (uint8_t shift = 1; shift <= 3; shift++) {
+    const size_t scaled = frames.size() - ours[shift].failed;
+    const double n = std::max<size_t>(scaled, 1);
+    printf("1/%-4u %8.2f %8.2f %9.1f%% %8.1f %8.2f | %6.2f %6.1f %6.2f\n", 1U << shift, ours[shift].total_ms / runs,
+           ours[shift].max_ms, 100.0 * ours[shift].max_ms / period_ms, ours[shift].bytes / 1024.0 / n,
+           ours[shift].error / n, libjpeg[shift].total_ms / runs, libjpeg[shift].bytes / 1024.0 / n,
+           libjpeg[shift].error / n);
+    ok &= ours[shift].failed == 0;
+  }
+  printf("luma   %8.2f %8.2f %9.1f%%   decode_luma(), for motion detection\n", luma.total_ms / runs, luma.max_ms,
+         100.0 * luma.max_ms / period_ms);
+  ok &= luma.failed == 0;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,8 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Host shim of esp_timer, reads the simulated clock of host.h
+
+#pragma once
+
+#include <cstdint>
+
+int64_t esp_timer_get_time();
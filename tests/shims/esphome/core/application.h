@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Host shim of the ESPHome application, only the loop wake-up
+
+#pragma once
+
+#include <atomic>
+
+namespace esphome {
+
+class Application {
+ public:
+  /* safe from any task, ends the main loop's sleep */
+  void wake_loop_threadsafe() { this->woken_.store(true, std::memory_order_release); }
+  /* host only: whether a wake-up came since the last call */
+  bool take_wake() { return this->woken_.exchange(false, std::memory_order_acquire); }
+
+ protected:
+  std::atomic<bool> woken_{false};
+};
+
+extern Application App;
+
+}  // namespace esphome
@@ -0,0 +1,36 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Host shim of the ESPHome automation classes the component declares
+
+#pragma once
+
+#include <vector>
+
+namespace esphome {
+
+template<typename... Ts> class Trigger {
+ public:
+  void trigger(Ts...) { this->fired_++; }
+  unsigned get_fired() const { return this->fired_; }
+
+ protected:
+  unsigned fired_{0};
+};
+
+template<typename... Ts> class Action {
+ public:
+  virtual ~Action() = default;
+  virtual void play(Ts... x) = 0;
+};
+
+template<typename T> class Parented {
+ public:
+  Parented() {}
+  Parented(T *parent) : parent_(parent) {}
+  T *get_parent() const { return this->parent_; }
+  void set_parent(T *parent) { this->parent_ = parent; }
+
+ protected:
+  T *parent_{nullptr};
+};
+
+}  // namespace esphome
@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Host shim of the ESPHome component base. Timers go to the scheduler of
+// host.h, which also runs loop() while the component keeps it enabled.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace esphome {
+
+namespace setup_priority {
+static const float DATA = 600.0f;
+}
+
+class Component {
+ public:
+  virtual ~Component();
+  virtual void setup() {}
+  virtual void loop() {}
+  virtual void dump_config() {}
+  virtual float get_setup_priority() const { return 0.0f; }
+
+  void mark_failed() { this->failed_ = true; }
+  bool is_failed() const { return this->failed_; }
+  void status_set_warning() {}
+  void status_clear_warning() {}
+
+  void enable_loop() { this->loop_enabled_ = true; }
+  void disable_loop() { this->loop_enabled_ = false; }
+  /* safe from any task, takes effect when the main loop next looks */
+  void enable_loop_soon_any_context() { this->loop_pending_.store(true, std::memory_order_release); }
+
+  /* host only: what the main loop does before it calls loop() */
+  bool is_loop_enabled() {
+    if (this->loop_pending_.exchange(false, std::memory_order_acquire))
+      this->loop_enabled_ = true;
+    return this->loop_enabled_;
+  }
+
+  void set_interval(const std::string &name, uint32_t interval, std::function<void()> &&f);
+  void set_timeout(const std::string &name, uint32_t timeout, std::function<void()> &&f);
+  bool cancel_interval(const std::string &name);
+  bool cancel_timeout(const std::string &name);
+
+ protected:
+  bool failed_{false};
+  bool loop_enabled_{true};
+  std::atomic<bool> loop_pending_{false};
+};
+
+class PollingComponent : public Component {};
+
+class EntityBase {
+ public:
+  const std::string &get_name() const { return this->name_; }
+  void set_name(const std::string &name) { this->name_ = name; }
+  uint32_t get_object_id_hash() const { return 0x5745424DUL; }
+
+ protected:
+  std::string name_;
+};
+
+}  // namespace esphome
@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Host shim of the ESPHome logger, prints up to the level set with host.h
+
+#pragma once
+
+namespace esphome {
+
+enum HostLogLevel {
+  HOST_LOG_NONE,
+  HOST_LOG_ERROR,
+  HOST_LOG_WARN,
+  HOST_LOG_INFO,
+  HOST_LOG_CONFIG,
+  HOST_LOG_DEBUG,
+  HOST_LOG_VERBOSE,
+  HOST_LOG_VERY_VERBOSE,
+};
+
+void host_log(int level, const char *tag, const char *format, ...);
+
+}  // namespace esphome
+
+#define ESP_LOGE(tag, ...) ::esphome::host_log(::esphome::HOST_LOG_ERROR, tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...) ::esphome::host_log(::esphome::HOST_LOG_WARN, tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...) ::esphome::host_log(::esphome::HOST_LOG_INFO, tag, __VA_ARGS__)
+#define ESP_LOGCONFIG(tag, ...) ::esphome::host_log(::esphome::HOST_LOG_CONFIG, tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...) ::esphome::host_log(::esphome::HOST_LOG_DEBUG, tag, __VA_ARGS__)
+#define ESP_LOGV(tag, ...) ::esphome::host_log(::esphome::HOST_LOG_VERBOSE, tag, __VA_ARGS__)
+#define ESP_LOGVV(tag, ...) ::esphome::host_log(::esphome::HOST_LOG_VERY_VERBOSE, tag, __VA_ARGS__)
+#define YESNO(b) ((b) ? "YES" : "NO")
@@ -0,0 +1,36 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Host shim of ESPHome preferences, kept in memory by host.h so a second
+// component instance sees what the first one saved, like after a reboot
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+
+bool host_preference_save(uint32_t key, const void *data, size_t length);
+bool host_preference_load(uint32_t key, void *data, size_t length);
+
+class ESPPreferenceObject {
+ public:
+  ESPPreferenceObject() {}
+  explicit ESPPreferenceObject(uint32_t key) : key_(key), valid_(true) {}
+  template<typename T> bool save(const T *src) { return this->valid_ && host_preference_save(this->key_, src, sizeof(T)); }
+  template<typename T> bool load(T *dest) { return this->valid_ && host_preference_load(this->key_, dest, sizeof(T)); }
+
+ protected:
+  uint32_t key_{0};
+  bool valid_{false};
+};
+
+class ESPPreferences {
+ public:
+  template<typename T> ESPPreferenceObject make_preference(uint32_t type, bool = false) {
+    return ESPPreferenceObject(type);
+  }
+};
+
+extern ESPPreferences *global_preferences;
+
+}  // namespace esphome
@@ -0,0 +1,24 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Host shim of the FreeRTOS types and constants the component uses. Like
+// the ESP-IDF port it brings esp_err.h along.
+
+#pragma once
+
+#include <cstdint>
+
+#include "esp_err.h"
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL 0
+#define pdPASS 1
+#define portMAX_DELAY ((TickType_t) 0xFFFFFFFF)
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t) (ms))
+
+#define configUSE_TRACE_FACILITY 0
+#define configGENERATE_RUN_TIME_STATS 0
@@ -0,0 +1,442 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "host.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esphome/components/camera/camera.h"
+#include "esphome/core/application.h"
+#include "esphome/core/log.h"
+#include "esphome/core/preferences.h"
+#include "freertos/task.h"
+
+namespace esphome {
+
+Application App;
+static ESPPreferences host_preferences;
+ESPPreferences *global_preferences = &host_preferences;
+camera::Camera *camera::Camera::global_camera = nullptr;
+
+/* ---------------- clock ---------------- */
+static std::atomic<int64_t> clock_us{0};
+
+int64_t host::now() { return clock_us.load(std::memory_order_relaxed); }
+void host::set_time(int64_t us) { clock_us.store(us, std::memory_order_relaxed); }
+void host::advance(int64_t us) { clock_us.fetch_add(us, std::memory_order_relaxed); }
+
+/* ---------------- heap ---------------- */
+/* every block starts with its size, keeps malloc's 16 byte alignment */
+struct alignas(16) HeapHeader {
+  size_t size;
+};
+static std::atomic<size_t> heap_used{0};
+static std::atomic<size_t> heap_max{0};
+static std::atomic<size_t> heap_limit{0};
+
+size_t host::heap_in_use() { return heap_used.load(); }
+size_t host::heap_peak() { return heap_max.load(); }
+void host::set_heap_limit(size_t bytes) { heap_limit.store(bytes); }
+
+static void *heap_alloc(size_t size) {
+  const size_t limit = heap_limit.load();
+  if (limit != 0 && heap_used.load() + size > limit)
+    return nullptr;
+  auto *header = (HeapHeader *) malloc(sizeof(HeapHeader) + size);
+  if (header == nullptr)
+    return nullptr;
+  header->size = size;
+  const size_t used = heap_used.fetch_add(size) + size;
+  size_t peak = heap_max.load();
+  while (used > peak && !heap_max.compare_exchange_weak(peak, used)) {
+  }
+  return header + 1;
+}
+
+/* ---------------- log ---------------- */
+static int log_level = HOST_LOG_NONE;
+
+void host::set_log_level(int level) { log_level = level; }
+
+void host_log(int level, const char *tag, const char *format, ...) {
+  if (level > log_level)
+    return;
+  static const char *const letters = "-EWICDVV";
+  va_list args;
+  va_start(args, format);
+  fprintf(stderr, "[%c][%s] ", letters[level], tag);
+  vfprintf(stderr, format, args);
+  fputc('\n', stderr);
+  va_end(args);
+}
+
+/* ---------------- preferences ---------------- */
+static std::map<uint32_t, std::vector<uint8_t>> preferences;
+
+bool host_preference_save(uint32_t key, const void *data, size_t length) {
+  const auto *bytes = (const uint8_t *) data;
+  preferences[key].assign(bytes, bytes + length);
+  return true;
+}
+
+bool host_preference_load(uint32_t key, void *data, size_t length) {
+  auto it = preferences.find(key);
+  if (it == preferences.end() || it->second.size() != length)
+    return false;
+  memcpy(data, it->second.data(), length);
+  return true;
+}
+
+/* ---------------- scheduler ---------------- */
+struct HostTimer {
+  Component *component;
+  std::string name;
+  bool interval;
+  uint32_t period;
+  int64_t due;
+  std::function<void()> callback;
+};
+static std::vector<std::shared_ptr<HostTimer>> timers;
+
+static bool cancel_timer(Component *component, const std::string &name, bool interval) {
+  const auto it = std::find_if(timers.begin(), timers.end(), [&](const std::shared_ptr<HostTimer> &timer) {
+    return timer->component == component && timer->interval == interval && timer->name == name;
+  });
+  if (it == timers.end())
+    return false;
+  timers.erase(it);
+  return true;
+}
+
+static void add_timer(Component *component, const std::string &name, bool interval, uint32_t period,
+                      std::function<void()> &&callback) {
+  cancel_timer(component, name, interval);
+  timers.push_back(std::make_shared<HostTimer>(
+      HostTimer{component, name, interval, period, host::now() + (int64_t) period * 1000, std::move(callback)}));
+}
+
+Component::~Component() {
+  timers.erase(std::remove_if(timers.begin(), timers.end(),
+                              [this](const std::shared_ptr<HostTimer> &timer) { return timer->component == this; }),
+               timers.end());
+}
+
+void Component::set_interval(const std::string &name, uint32_t interval, std::function<void()> &&f) {
+  add_timer(this, name, true, interval, std::move(f));
+}
+void Component::set_timeout(const std::string &name, uint32_t timeout, std::function<void()> &&f) {
+  add_timer(this, name, false, timeout, std::move(f));
+}
+bool Component::cancel_interval(const std::string &name) { return cancel_timer(this, name, true); }
+bool Component::cancel_timeout(const std::string &name) { return cancel_timer(this, name, false); }
+
+size_t host::run_timers() {
+  size_t ran = 0;
+  const int64_t time = now();
+  while (true) {
+    // earliest first; callbacks may add or cancel timers
+    std::shared_ptr<HostTimer> timer;
+    for (const auto &candidate : timers) {
+      if (candidate->due <= time && (!timer || candidate->due < timer->due))
+        timer = candidate;
+    }
+    if (!timer)
+      return ran;
+    if (timer->interval) {
+      timer->due = time + std::max<int64_t>(1000, (int64_t) timer->period * 1000);
+    } else {
+      timers.erase(std::find(timers.begin(), timers.end(), timer));
+    }
+    timer->callback();
+    ran++;
+  }
+}
+
+int64_t host::next_timer() {
+  int64_t due = INT64_MAX;
+  for (const auto &timer : timers)
+    due = std::min(due, timer->due);
+  return due;
+}
+
+void host::loop_once(Component *component) {
+  run_timers();
+  if (component->is_loop_enabled())
+    component->loop();
+  wait_tasks_idle();
+}
+
+/* ---------------- usb_stream ---------------- */
+static host::UsbStreamState usb{};
+static std::vector<uvc_frame_size_t> usb_frames;
+static state_callback_t usb_state_cb = nullptr;
+static void *usb_state_arg = nullptr;
+
+const host::UsbStreamState &host::usb_state() { return usb; }
+void host::usb_set_frame_list(const std::vector<uvc_frame_size_t> &frames) { usb_frames = frames; }
+
+bool host::usb_connect() {
+  if (!usb.started || usb.connected)
+    return false;
+  usb.connected = true;
+  usb.suspended = false;
+  if (usb_state_cb != nullptr)
+    usb_state_cb(STREAM_CONNECTED, usb_state_arg);
+  return true;
+}
+
+bool host::usb_disconnect() {
+  if (!usb.connected)
+    return false;
+  usb.connected = false;
+  if (usb_state_cb != nullptr)
+    usb_state_cb(STREAM_DISCONNECTED, usb_state_arg);
+  return true;
+}
+
+bool host::usb_send_frame(const uint8_t *data, size_t len, uint32_t skipped) {
+  if (!usb.started || !usb.connected || usb.suspended)
+    return false;
+  const uvc_config_t &config = usb.config;
+  const size_t copied = std::min<size_t>(len, config.frame_buffer_size);
+  memcpy(config.frame_buffer, data, copied);
+  usb.device_sequence += 1 + skipped;
+  uvc_frame_t frame{};
+  frame.data = config.frame_buffer;
+  frame.data_bytes = copied;
+  frame.width = usb.width;
+  frame.height = usb.height;
+  frame.frame_format = UVC_FRAME_FORMAT_MJPEG;
+  frame.sequence = usb.device_sequence;
+  config.frame_cb(&frame, config.frame_cb_arg);
+  return true;
+}
+
+}  // namespace esphome
+
+/* ---------------- usb_stream API ---------------- */
+using esphome::usb;
+using esphome::usb_frames;
+
+esp_err_t uvc_streaming_config(const uvc_config_t *config) {
+  if (config->frame_cb == nullptr || config->frame_buffer == nullptr)
+    return ESP_ERR_INVALID_ARG;
+  usb.config = *config;
+  usb.configured = true;
+  usb.width = config->frame_width;
+  usb.height = config->frame_height;
+  usb.interval = config->frame_interval;
+  return ESP_OK;
+}
+
+esp_err_t usb_streaming_state_register(state_callback_t cb, void *user_ptr) {
+  esphome::usb_state_cb = cb;
+  esphome::usb_state_arg = user_ptr;
+  return ESP_OK;
+}
+
+esp_err_t usb_streaming_start() {
+  if (!usb.configured)
+    return ESP_ERR_INVALID_STATE;
+  usb.started = true;
+  return ESP_OK;
+}
+
+esp_err_t usb_streaming_stop() {
+  usb.started = false;
+  usb.connected = false;
+  return ESP_OK;
+}
+
+esp_err_t usb_streaming_connect_wait(size_t) { return usb.connected ? ESP_OK : ESP_ERR_TIMEOUT; }
+
+esp_err_t uvc_frame_size_list_get(uvc_frame_size_t *frame_list, size_t *list_size, size_t *cur_index) {
+  if (!usb.connected)
+    return ESP_ERR_INVALID_STATE;
+  if (list_size != nullptr)
+    *list_size = usb_frames.size();
+  if (cur_index != nullptr) {
+    *cur_index = 0;
+    for (size_t i = 0; i < usb_frames.size(); i++) {
+      if (usb_frames[i].width == usb.width && usb_frames[i].height == usb.height)
+        *cur_index = i;
+    }
+  }
+  if (frame_list != nullptr)
+    std::copy(usb_frames.begin(), usb_frames.end(), frame_list);
+  return ESP_OK;
+}
+
+esp_err_t uvc_frame_size_reset(uint16_t frame_width, uint16_t frame_height, uint32_t frame_interval) {
+  if (!usb.suspended)
+    return ESP_ERR_INVALID_STATE;
+  const bool listed = std::any_of(usb_frames.begin(), usb_frames.end(), [&](const uvc_frame_size_t &frame) {
+    return frame.width == frame_width && frame.height == frame_height;
+  });
+  if (!listed)
+    return ESP_ERR_INVALID_ARG;
+  usb.width = frame_width;
+  usb.height = frame_height;
+  usb.interval = frame_interval;
+  usb.resets++;
+  return ESP_OK;
+}
+
+esp_err_t usb_streaming_control(usb_stream_t stream, stream_ctrl_t ctrl_type, void *) {
+  if (stream != STREAM_UVC || !usb.started)
+    return ESP_ERR_INVALID_STATE;
+  switch (ctrl_type) {
+    case CTRL_SUSPEND:
+      usb.suspended = true;
+      usb.suspends++;
+      return ESP_OK;
+    case CTRL_RESUME:
+      usb.suspended = false;
+      usb.resumes++;
+      return ESP_OK;
+    default:
+      return ESP_ERR_INVALID_ARG;
+  }
+}
+
+/* ---------------- tasks ---------------- */
+struct HostTask {
+  std::string name;
+  TaskFunction_t function;
+  void *arg;
+  UBaseType_t priority;
+  uint32_t stack_depth;
+  uint32_t notifications{0};
+  bool waiting{false};
+};
+
+/* tasks never end, so neither does their shared state */
+static std::mutex &task_mutex = *new std::mutex;
+static std::condition_variable &task_cv = *new std::condition_variable;
+static std::vector<HostTask *> &tasks = *new std::vector<HostTask *>;
+static thread_local HostTask *current_task = nullptr;
+static HostTask main_task{"loopTask", nullptr, nullptr, 1, 8192};
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t) {
+  auto *task = new HostTask{name, function, arg, priority, stack_depth};
+  {
+    std::lock_guard<std::mutex> lock(task_mutex);
+    tasks.push_back(task);
+  }
+  if (handle != nullptr)
+    *handle = task;
+  std::thread([task]() {
+    current_task = task;
+    task->function(task->arg);
+  }).detach();
+  return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  if (task == nullptr)
+    return pdFAIL;
+  std::lock_guard<std::mutex> lock(task_mutex);
+  task->notifications++;
+  task_cv.notify_all();
+  return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t) {
+  HostTask *task = current_task;
+  if (task == nullptr)
+    return 0;
+  std::unique_lock<std::mutex> lock(task_mutex);
+  task->waiting = true;
+  task_cv.notify_all();
+  task_cv.wait(lock, [task]() { return task->notifications != 0; });
+  task->waiting = false;
+  const uint32_t value = task->notifications;
+  task->notifications = clear_on_exit ? 0 : value - 1;
+  return value;
+}
+
+void esphome::host::wait_tasks_idle() {
+  std::unique_lock<std::mutex> lock(task_mutex);
+  task_cv.wait(lock, []() {
+    return std::all_of(tasks.begin(), tasks.end(),
+                       [](const HostTask *task) { return task->waiting && task->notifications == 0; });
+  });
+}
+
+TaskHandle_t xTaskGetHandle(const char *name) {
+  std::lock_guard<std::mutex> lock(task_mutex);
+  for (HostTask *task : tasks) {
+    if (task->name == name)
+      return task;
+  }
+  return nullptr;
+}
+TaskHandle_t xTaskGetCurrentTaskHandle() { return current_task != nullptr ? current_task : &main_task; }
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task) { return task->priority; }
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) { return task->stack_depth; }
+char *pcTaskGetName(TaskHandle_t task) { return const_cast<char *>(task->name.c_str()); }
+
+namespace esphome {
+
+/* ---------------- reset ---------------- */
+void host::reset() {
+  set_time(0);
+  timers.clear();
+  preferences.clear();
+  usb = UsbStreamState{};
+  usb_frames.clear();
+  usb_state_cb = nullptr;
+  usb_state_arg = nullptr;
+  heap_limit.store(0);
+  heap_max.store(heap_used.load());
+  App.take_wake();
+}
+
+}  // namespace esphome
+
+/* ---------------- ESP-IDF ---------------- */
+int64_t esp_timer_get_time() { return esphome::host::now(); }
+
+const char *esp_err_to_name(esp_err_t code) {
+  switch (code) {
+    case ESP_OK:
+      return "ESP_OK";
+    case ESP_FAIL:
+      return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+      return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+      return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+      return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_TIMEOUT:
+      return "ESP_ERR_TIMEOUT";
+    default:
+      return "UNKNOWN ERROR";
+  }
+}
+
+void *heap_caps_malloc(size_t size, uint32_t) { return esphome::heap_alloc(size); }
+
+void *heap_caps_malloc_prefer(size_t size, size_t, ...) { return esphome::heap_alloc(size); }
+
+void heap_caps_free(void *ptr) {
+  if (ptr == nullptr)
+    return;
+  auto *header = (esphome::HeapHeader *) ptr - 1;
+  esphome::heap_used.fetch_sub(header->size);
+  free(header);
+}
@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "esphome/core/component.h"
+#include "usb_stream.h"
+
+/* Control of the host shims: the simulated clock esp_timer reads, the heap
+ * behind heap_caps, the scheduler behind set_interval/set_timeout, the
+ * FreeRTOS tasks, and the camera on the other side of usb_stream. Tests
+ * and the replay harness run the component from one thread and move the
+ * clock themselves, so runs are repeatable. */
+namespace esphome::host {
+
+/* ---------------- clock ---------------- */
+int64_t now();
+void set_time(int64_t us);
+void advance(int64_t us);
+
+/* ---------------- heap ---------------- */
+size_t heap_in_use();
+size_t heap_peak();
+/* allocations fail beyond this many bytes in use, 0 for no limit */
+void set_heap_limit(size_t bytes);
+
+/* ---------------- log ---------------- */
+void set_log_level(int level);  // HostLogLevel, HOST_LOG_NONE by default
+
+/* ---------------- scheduler ---------------- */
+/* run the timers due by now(), returns how many ran */
+size_t run_timers();
+/* when the next timer is due, INT64_MAX if none */
+int64_t next_timer();
+
+/* ---------------- tasks ---------------- */
+/* block until every task waits for a notification and has none pending */
+void wait_tasks_idle();
+
+/* one pass of the main loop: due timers, then loop() if the component keeps
+ * it enabled, then the tasks it handed work to */
+void loop_once(Component *component);
+
+/* ---------------- usb_stream ---------------- */
+struct UsbStreamState {
+  bool configured;
+  bool started;
+  bool connected;
+  bool suspended;
+  uint16_t width;
+  uint16_t height;
+  uint32_t interval;
+  uint32_t device_sequence;
+  uint32_t suspends;
+  uint32_t resumes;
+  uint32_t resets;  // resolution or interval changes
+  uvc_config_t config;
+};
+const UsbStreamState &usb_state();
+/* what the camera lists once connected */
+void usb_set_frame_list(const std::vector<uvc_frame_size_t> &frames);
+/* plug the camera in or pull it, runs the state callback like the usb_stream task would */
+bool usb_connect();
+bool usb_disconnect();
+/* Complete a frame of the current resolution. It goes through the frame
+ * buffer, truncated to its size as usb_stream does without
+ * CONFIG_UVC_DROP_OVERFLOW_FRAME, then to the frame callback. skipped
+ * frames are lost before the callback, a gap in the sequence. Returns false
+ * if nothing streams: not started, not connected or suspended. */
+bool usb_send_frame(const uint8_t *data, size_t len, uint32_t skipped = 0);
+
+/* fresh clock, scheduler, preferences and usb_stream for the next test;
+ * memory still allocated stays counted */
+void reset();
+
+}  // namespace esphome::host
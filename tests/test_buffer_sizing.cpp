@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "webcam_fixture.h"
+
+namespace esphome::usb_webcam {
+namespace {
+
+class BufferSizingTest : public CameraTest {
+ protected:
+  /* the test frame grown to len bytes with comment segments after SOI, still a valid JPEG */
+  std::vector<uint8_t> padded(size_t len) const {
+    std::vector<uint8_t> frame(this->frame_.begin(), this->frame_.begin() + 2);
+    size_t left = len - this->frame_.size();
+    while (left != 0) {
+      const size_t segment = std::min<size_t>(left, 0xFFFF + 2);
+      const size_t payload = segment - 4;
+      frame.insert(frame.end(), {0xFF, 0xFE, (uint8_t) ((payload + 2) >> 8), (uint8_t) (payload + 2)});
+      frame.insert(frame.end(), payload, 0);
+      left -= segment;
+    }
+    frame.insert(frame.end(), this->frame_.begin() + 2, this->frame_.end());
+    return frame;
+  }
+
+  /* a fresh camera with the same configuration, as after a reboot; preferences survive */
+  void reboot() {
+    this->images_.clear();
+    ASSERT_TRUE(host::usb_disconnect());
+    this->cam_ = std::make_unique<TestCamera>();
+    this->cam_->set_frame_size(WIDTH, HEIGHT);
+    this->cam_->set_max_update_interval(1);
+    this->cam_->set_idle_update_interval(0);
+    this->cam_->add_image_callback(
+        [this](std::shared_ptr<camera::CameraImage> image) { this->images_.push_back(std::move(image)); });
+    this->start();
+  }
+
+  uint32_t buffer_size() { return this->cam_->stream().frame_buffer_size; }
+};
+
+TEST_F(BufferSizingTest, SizedFromTheResolution) {
+  this->start();
+  // 640x480 at 10 pixels a byte, twice over: 61440, already a multiple of 4K
+  EXPECT_EQ(this->buffer_size(), 61440u);
+  EXPECT_EQ(host::usb_state().config.frame_buffer_size, 61440u);
+  EXPECT_EQ(host::usb_state().config.xfer_buffer_size, 61440u);
+}
+
+TEST_F(BufferSizingTest, SmallStreamsGetTheMinimum) {
+  this->cam_->set_frame_size(160, 120);
+  this->start();
+  EXPECT_EQ(this->buffer_size(), 16u * 1024);
+}
+
+TEST_F(BufferSizingTest, ConfiguredSizeIsUsedAsIs) {
+  this->cam_->set_frame_buffer_size(100000);
+  this->start();
+  EXPECT_EQ(this->buffer_size(), 100000u);
+}
+
+TEST_F(BufferSizingTest, OverflowingFramesAreCounted) {
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  ASSERT_TRUE(this->send(this->padded(70000)));
+  EXPECT_TRUE(this->images_.empty());
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_FRAMES_DROPPED_OVERFLOW), 1u);
+  // one byte short of the buffer still fits
+  ASSERT_TRUE(this->send(this->padded(this->buffer_size() - 1)));
+  EXPECT_EQ(this->images_.size(), 1u);
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_FRAMES_DROPPED_OVERFLOW), 1u);
+}
+
+TEST_F(BufferSizingTest, OverflowsGrowTheBuffersOnTheNextBoot) {
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  ASSERT_TRUE(this->send(this->padded(70000)));
+  ASSERT_TRUE(this->send());
+  this->reboot();
+  // half again the overflowed 61440, plus a quarter of headroom: 115200, rounded up to 4K
+  EXPECT_EQ(this->buffer_size(), 118784u);
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  ASSERT_TRUE(this->send(this->padded(70000)));
+  EXPECT_EQ(this->images_.size(), 1u);
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_FRAMES_DROPPED_OVERFLOW), 0u);
+}
+
+TEST_F(BufferSizingTest, LargestFrameIsRememberedWithHeadroom) {
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  ASSERT_TRUE(this->send(this->padded(60000)));
+  this->reboot();
+  // 60000 and a quarter: 75000, rounded up to 4K
+  EXPECT_EQ(this->buffer_size(), 77824u);
+}
+
+TEST_F(BufferSizingTest, SmallFramesKeepTheResolutionSize) {
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  ASSERT_TRUE(this->send());
+  this->reboot();
+  EXPECT_EQ(this->buffer_size(), 61440u);
+}
+
+TEST_F(BufferSizingTest, TrackedSizeIsSavedOnlyWhenItGrowsNoticeably) {
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  ASSERT_TRUE(this->send(this->padded(48000)));
+  // less than an eighth above what was saved: not worth a flash write
+  ASSERT_TRUE(this->send(this->padded(53000)));
+  this->reboot();
+  // 48000 and a quarter: 60000, below the 61440 the resolution asks for
+  EXPECT_EQ(this->buffer_size(), 61440u);
+}
+
+}  // namespace
+}  // namespace esphome::usb_webcam
@@ -0,0 +1,116 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <gtest/gtest.h>
+
+#include "webcam_fixture.h"
+
+namespace esphome::usb_webcam {
+namespace {
+
+class FanOutTest : public CameraTest {
+ protected:
+  /* images kept in images_ that went to requester */
+  size_t count(camera::CameraRequester requester) {
+    size_t count = 0;
+    for (const auto &image : this->images_)
+      count += image->was_requested_by(requester);
+    return count;
+  }
+
+  /* one second of frames, each consumer letting go of its image right away */
+  void stream_second(size_t *api, size_t *web) {
+    for (int i = 0; i < 30; i++) {
+      ASSERT_TRUE(this->send());
+      *api += this->count(camera::API_REQUESTER);
+      *web += this->count(camera::WEB_REQUESTER);
+      this->images_.clear();
+    }
+  }
+};
+
+TEST_F(FanOutTest, EachChannelKeepsItsOwnPace) {
+  this->cam_->set_requester_update_interval(camera::API_REQUESTER, 500);
+  this->cam_->set_requester_update_interval(camera::WEB_REQUESTER, 100);
+  this->start();
+  this->cam_->start_stream(camera::API_REQUESTER);
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  size_t api = 0, web = 0;
+  this->stream_second(&api, &web);
+  // the first frame of a period that is due goes out, a frame period late at worst
+  EXPECT_GE(api, 1u);
+  EXPECT_LE(api, 2u);
+  EXPECT_GE(web, 7u);
+  EXPECT_LE(web, 10u);
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_FRAMES_DELIVERED_API), api);
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_FRAMES_DELIVERED_WEB), web);
+}
+
+TEST_F(FanOutTest, MaxUpdateIntervalBoundsEveryChannel) {
+  this->cam_->set_max_update_interval(250);
+  this->cam_->set_requester_update_interval(camera::WEB_REQUESTER, 100);
+  this->start();
+  this->cam_->start_stream(camera::API_REQUESTER);
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  size_t api = 0, web = 0;
+  this->stream_second(&api, &web);
+  EXPECT_GE(api, 3u);
+  EXPECT_LE(api, 4u);
+  EXPECT_EQ(web, api);
+}
+
+TEST_F(FanOutTest, HeldWebImageDoesNotBlockApiSnapshots) {
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  ASSERT_TRUE(this->send());
+  ASSERT_EQ(this->images_.size(), 1u);
+  std::shared_ptr<camera::CameraImage> held = this->images_[0];
+  this->images_.clear();
+
+  // the stream client stalls on its image, snapshots still go out with fresh frames
+  uint32_t last = static_cast<USBWebCamImage *>(held.get())->get_raw_buffer()->sequence;
+  for (int i = 0; i < 3; i++) {
+    this->cam_->request_image(camera::API_REQUESTER);
+    ASSERT_TRUE(this->send());
+    ASSERT_EQ(this->images_.size(), 1u) << i;
+    EXPECT_TRUE(this->image(0)->was_requested_by(camera::API_REQUESTER));
+    EXPECT_FALSE(this->image(0)->was_requested_by(camera::WEB_REQUESTER));
+    EXPECT_GT(this->image(0)->get_raw_buffer()->sequence, last);
+    last = this->image(0)->get_raw_buffer()->sequence;
+    this->images_.clear();
+  }
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_FRAMES_DELIVERED_WEB), 1u);
+
+  // once the client lets go it carries on with the newest frame
+  held.reset();
+  ASSERT_TRUE(this->send());
+  ASSERT_EQ(this->images_.size(), 1u);
+  EXPECT_TRUE(this->image(0)->was_requested_by(camera::WEB_REQUESTER));
+  EXPECT_GT(this->image(0)->get_raw_buffer()->sequence, last);
+}
+
+TEST_F(FanOutTest, ChannelsDueTogetherShareTheFrame) {
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  this->cam_->request_image(camera::API_REQUESTER);
+  ASSERT_TRUE(this->send());
+  ASSERT_EQ(this->images_.size(), 2u);
+  EXPECT_NE(this->image(0), this->image(1));
+  EXPECT_EQ(this->image(0)->get_raw_buffer(), this->image(1)->get_raw_buffer());
+  EXPECT_NE(this->image(0)->was_requested_by(camera::API_REQUESTER),
+            this->image(1)->was_requested_by(camera::API_REQUESTER));
+}
+
+TEST_F(FanOutTest, SnapshotIsTakenOnce) {
+  this->start();
+  this->cam_->request_image(camera::API_REQUESTER);
+  ASSERT_TRUE(this->send());
+  ASSERT_EQ(this->images_.size(), 1u);
+  this->images_.clear();
+  ASSERT_TRUE(this->send());
+  ASSERT_TRUE(this->send());
+  EXPECT_TRUE(this->images_.empty());
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_FRAMES_DELIVERED_API), 1u);
+}
+
+}  // namespace
+}  // namespace esphome::usb_webcam
@@ -0,0 +1,285 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "frame_pool.h"
+#include "webcam_fixture.h"
+
+namespace esphome::usb_webcam {
+namespace {
+
+/* ---------------- FramePool ---------------- */
+class FramePoolTest : public ::testing::Test {
+ protected:
+  static const size_t SLOT_SIZE = 64;
+
+  void init(size_t slots, FramePoolPolicy policy) {
+    this->pool_.set_slot_count(slots);
+    this->pool_.set_policy(policy);
+    this->arena_.assign(this->pool_.get_slot_count() * SLOT_SIZE, 0);
+    this->pool_.init(this->arena_.data(), SLOT_SIZE);
+  }
+
+  /* a frame filled with its sequence number */
+  bool push(uint32_t sequence, size_t len = 16) {
+    std::vector<uint8_t> data(len, (uint8_t) sequence);
+    return this->pool_.push(data.data(), len, 640, 480, sequence, sequence * 1000, sequence * 1000 + 500);
+  }
+
+  FramePool pool_;
+  std::vector<uint8_t> arena_;
+};
+
+TEST_F(FramePoolTest, SlotCountIsClamped) {
+  this->pool_.set_slot_count(0);
+  EXPECT_EQ(this->pool_.get_slot_count(), 1u);
+  this->pool_.set_slot_count(100);
+  EXPECT_EQ(this->pool_.get_slot_count(), FRAME_POOL_MAX_SLOTS);
+}
+
+TEST_F(FramePoolTest, HandsOverTheFrameAsPushed) {
+  this->init(3, FRAME_POOL_DROP_OLDEST);
+  ASSERT_TRUE(this->push(7, 20));
+  camera_fb_t *fb = this->pool_.acquire();
+  ASSERT_NE(fb, nullptr);
+  EXPECT_EQ(fb->sequence, 7u);
+  EXPECT_EQ(fb->len, 20u);
+  EXPECT_EQ(fb->width, 640u);
+  EXPECT_EQ(fb->height, 480u);
+  EXPECT_EQ(fb->format, PIXFORMAT_JPEG);
+  EXPECT_EQ(fb->sof_us, 7000);
+  EXPECT_EQ(fb->eof_us, 7500);
+  EXPECT_EQ(fb->buf[0], 7);
+  EXPECT_EQ(fb->buf[19], 7);
+  this->pool_.release(fb);
+  EXPECT_EQ(this->pool_.acquire(), nullptr);
+  EXPECT_EQ(this->pool_.get_pushed(), 1u);
+  EXPECT_EQ(this->pool_.get_overruns(), 0u);
+}
+
+TEST_F(FramePoolTest, CollectKeepsOnlyTheNewestFrame) {
+  this->init(3, FRAME_POOL_DROP_OLDEST);
+  ASSERT_TRUE(this->push(1));
+  ASSERT_TRUE(this->push(2));
+  ASSERT_TRUE(this->push(3));
+  EXPECT_TRUE(this->pool_.collect());
+  EXPECT_EQ(this->pool_.get_stale(), 2u);
+  camera_fb_t *fb = this->pool_.acquire();
+  ASSERT_NE(fb, nullptr);
+  EXPECT_EQ(fb->sequence, 3u);
+  // the stale slots are free again, so two more fit next to the held one
+  EXPECT_TRUE(this->push(4));
+  EXPECT_TRUE(this->push(5));
+  EXPECT_EQ(this->pool_.get_overruns(), 0u);
+}
+
+TEST_F(FramePoolTest, DropOldestOverwritesUnreadFrames) {
+  this->init(2, FRAME_POOL_DROP_OLDEST);
+  ASSERT_TRUE(this->push(1));
+  ASSERT_TRUE(this->push(2));
+  EXPECT_TRUE(this->push(3));
+  EXPECT_EQ(this->pool_.get_overruns(), 1u);
+  camera_fb_t *fb = this->pool_.acquire();
+  ASSERT_NE(fb, nullptr);
+  EXPECT_EQ(fb->sequence, 3u);
+  EXPECT_EQ(fb->buf[0], 3);
+}
+
+TEST_F(FramePoolTest, DropNewestKeepsUnreadFrames) {
+  this->init(2, FRAME_POOL_DROP_NEWEST);
+  ASSERT_TRUE(this->push(1));
+  ASSERT_TRUE(this->push(2));
+  EXPECT_FALSE(this->push(3));
+  EXPECT_EQ(this->pool_.get_overruns(), 1u);
+  camera_fb_t *fb = this->pool_.acquire();
+  ASSERT_NE(fb, nullptr);
+  EXPECT_EQ(fb->sequence, 2u);
+}
+
+TEST_F(FramePoolTest, HeldFramesAreNeverOverwritten) {
+  this->init(2, FRAME_POOL_DROP_OLDEST);
+  ASSERT_TRUE(this->push(1));
+  camera_fb_t *held = this->pool_.acquire();
+  ASSERT_NE(held, nullptr);
+  ASSERT_TRUE(this->push(2));
+  ASSERT_TRUE(this->push(3));  // overwrites 2, the only unread one
+  camera_fb_t *second = this->pool_.acquire();
+  ASSERT_NE(second, nullptr);
+  EXPECT_EQ(second->sequence, 3u);
+  // both slots held: nothing to overwrite, the frame is dropped
+  EXPECT_FALSE(this->push(4));
+  EXPECT_EQ(this->pool_.get_overruns(), 2u);
+  EXPECT_EQ(held->sequence, 1u);
+  EXPECT_EQ(held->buf[0], 1);
+  this->pool_.release(held);
+  EXPECT_TRUE(this->push(5));
+  this->pool_.release(second);
+}
+
+TEST_F(FramePoolTest, OversizedFramesAreRejected) {
+  this->init(2, FRAME_POOL_DROP_OLDEST);
+  EXPECT_FALSE(this->push(1, SLOT_SIZE + 1));
+  EXPECT_TRUE(this->push(2, SLOT_SIZE));
+  EXPECT_EQ(this->pool_.get_oversized(), 1u);
+  EXPECT_EQ(this->pool_.get_overruns(), 0u);
+  EXPECT_EQ(this->pool_.get_pushed(), 1u);
+}
+
+TEST_F(FramePoolTest, FlushDropsThePendingFrame) {
+  this->init(2, FRAME_POOL_DROP_OLDEST);
+  ASSERT_TRUE(this->push(1));
+  ASSERT_TRUE(this->push(2));
+  this->pool_.flush();
+  EXPECT_EQ(this->pool_.get_stale(), 2u);
+  EXPECT_EQ(this->pool_.acquire(), nullptr);
+  EXPECT_TRUE(this->push(3));
+  EXPECT_TRUE(this->push(4));
+  EXPECT_EQ(this->pool_.get_overruns(), 0u);
+}
+
+TEST_F(FramePoolTest, ReleaseIgnoresForeignBuffers) {
+  this->init(1, FRAME_POOL_DROP_NEWEST);
+  ASSERT_TRUE(this->push(1));
+  camera_fb_t *fb = this->pool_.acquire();
+  camera_fb_t foreign{};
+  this->pool_.release(&foreign);
+  EXPECT_FALSE(this->push(2));
+  this->pool_.release(fb);
+  EXPECT_TRUE(this->push(3));
+}
+
+/* a producer thread at full speed against a slow consumer: every frame the
+ * consumer gets is complete and newer than the last, none is lost unseen */
+void run_concurrent(FramePoolPolicy policy) {
+  static const uint32_t FRAMES = 200000;
+  FramePool pool;
+  pool.set_slot_count(3);
+  pool.set_policy(policy);
+  std::vector<uint8_t> arena(3 * 256);
+  pool.init(arena.data(), 256);
+
+  std::atomic<bool> done{false};
+  uint32_t rejected = 0;
+  std::thread producer([&]() {
+    uint8_t data[256];
+    for (uint32_t sequence = 1; sequence <= FRAMES; sequence++) {
+      const size_t len = 64 + sequence % 192;
+      memset(data, (uint8_t) sequence, len);
+      if (!pool.push(data, len, 0, 0, sequence, 0, 0))
+        rejected++;
+    }
+    done.store(true);
+  });
+
+  uint32_t last = 0;
+  uint32_t acquired = 0;
+  while (true) {
+    const bool finished = done.load();
+    camera_fb_t *fb = pool.acquire();
+    if (fb == nullptr) {
+      if (finished && !pool.collect())
+        break;
+      continue;
+    }
+    ASSERT_GT(fb->sequence, last);
+    ASSERT_EQ(fb->len, 64 + fb->sequence % 192);
+    for (size_t i = 0; i < fb->len; i++)
+      ASSERT_EQ(fb->buf[i], (uint8_t) fb->sequence) << "torn frame " << fb->sequence;
+    last = fb->sequence;
+    acquired++;
+    pool.release(fb);
+  }
+  producer.join();
+
+  EXPECT_GT(acquired, 0u);
+  EXPECT_EQ(pool.get_pushed() + rejected, FRAMES);
+  EXPECT_GE(pool.get_overruns(), rejected);  // drop-oldest also counts the frames it overwrote
+  // pushed frames were handed over, found stale or overwritten before collect saw them
+  EXPECT_LE(acquired + pool.get_stale(), pool.get_pushed());
+}
+
+TEST(FramePoolConcurrency, DropOldest) { run_concurrent(FRAME_POOL_DROP_OLDEST); }
+TEST(FramePoolConcurrency, DropNewest) { run_concurrent(FRAME_POOL_DROP_NEWEST); }
+
+/* ---------------- USBWebCam at a fixed frame rate ---------------- */
+/* usb_stream completes frames at 30 fps whatever the loop and the
+ * consumers do; the frame callback must return every time */
+class FixedRateTest : public CameraTest {
+ protected:
+  void SetUp() override {
+    CameraTest::SetUp();
+    for (uint32_t i = 0; i < 12; i++)
+      this->frames_.push_back(make_test_jpeg(WIDTH, HEIGHT, i));
+  }
+
+  /* frames completed while the loop does not run */
+  void send_without_loop(size_t count) {
+    for (size_t i = 0; i < count; i++) {
+      host::advance(FRAME_US);
+      ASSERT_TRUE(host::usb_send_frame(this->frames_[i].data(), this->frames_[i].size()));
+    }
+  }
+
+  std::vector<std::vector<uint8_t>> frames_;
+};
+
+TEST_F(FixedRateTest, ConsumerHoldingAnImageDoesNotStallTheCamera) {
+  this->cam_->set_frame_buffer_count(3);
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  ASSERT_TRUE(this->send(this->frames_[0]));
+  ASSERT_EQ(this->images_.size(), 1u);
+  const uint32_t first = this->image(0)->get_raw_buffer()->sequence;
+
+  // the consumer keeps its image while the camera goes on
+  for (size_t i = 1; i < this->frames_.size(); i++)
+    ASSERT_TRUE(this->send(this->frames_[i]));
+  EXPECT_EQ(this->images_.size(), 1u);
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_FRAMES_RECEIVED), this->frames_.size());
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_FRAMES_DROPPED_BUSY), 0u);
+  USBWebCamImage *held = this->image(0);
+  ASSERT_EQ(held->get_data_length(), this->frames_[0].size());
+  EXPECT_EQ(memcmp(held->get_data_buffer(), this->frames_[0].data(), this->frames_[0].size()), 0);
+
+  // once it lets go, the newest frame waiting in the pool goes out
+  this->images_.clear();
+  this->loop();
+  ASSERT_EQ(this->images_.size(), 1u);
+  EXPECT_EQ(this->image(0)->get_raw_buffer()->sequence, first + this->frames_.size() - 1);
+}
+
+TEST_F(FixedRateTest, StalledLoopDropsOldestFrames) {
+  this->cam_->set_frame_buffer_count(3);
+  this->cam_->set_frame_buffer_policy(FRAME_POOL_DROP_OLDEST);
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  this->send_without_loop(10);
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_FRAMES_DROPPED_BUSY), 7u);
+  this->loop();
+  ASSERT_EQ(this->images_.size(), 1u);
+  const std::vector<uint8_t> &newest = this->frames_[9];
+  ASSERT_EQ(this->image(0)->get_data_length(), newest.size());
+  EXPECT_EQ(memcmp(this->image(0)->get_data_buffer(), newest.data(), newest.size()), 0);
+}
+
+TEST_F(FixedRateTest, StalledLoopDropsNewestFrames) {
+  this->cam_->set_frame_buffer_count(3);
+  this->cam_->set_frame_buffer_policy(FRAME_POOL_DROP_NEWEST);
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  this->send_without_loop(10);
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_FRAMES_DROPPED_BUSY), 7u);
+  this->loop();
+  ASSERT_EQ(this->images_.size(), 1u);
+  const std::vector<uint8_t> &kept = this->frames_[2];
+  ASSERT_EQ(this->image(0)->get_data_length(), kept.size());
+  EXPECT_EQ(memcmp(this->image(0)->get_data_buffer(), kept.data(), kept.size()), 0);
+}
+
+}  // namespace
+}  // namespace esphome::usb_webcam
@@ -0,0 +1,167 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "frame_ring.h"
+
+namespace esphome::usb_webcam {
+namespace {
+
+/* a ring whose frame sequence starts anywhere, to get it past the wrap */
+class OffsetFrameRing : public FrameRing {
+ public:
+  explicit OffsetFrameRing(uint32_t start) { this->next_sequence_ = start; }
+};
+
+class FrameRingTest : public ::testing::Test {
+ protected:
+  static constexpr size_t ARENA = 1000;
+
+  void SetUp() override { this->ring_.init(this->arena_.data(), this->arena_.size()); }
+
+  /* a frame of len bytes, all of them tag */
+  bool append(size_t len, uint8_t tag, FrameRing *ring = nullptr) {
+    std::vector<uint8_t> data(len, tag);
+    camera_fb_t fb{};
+    fb.buf = data.data();
+    fb.len = len;
+    fb.sequence = tag;
+    return (ring != nullptr ? ring : &this->ring_)->append(fb);
+  }
+
+  /* the tags of the frames a snapshot holds, oldest first; each frame must hold its tag throughout */
+  static std::vector<uint8_t> tags(const FrameRingSnapshot &snapshot) {
+    std::vector<uint8_t> out;
+    for (size_t i = 0; i < snapshot.size(); i++) {
+      const camera_fb_t &fb = snapshot.get_frame(i);
+      for (size_t j = 0; j < fb.len; j++) {
+        if (fb.buf[j] != fb.sequence) {
+          ADD_FAILURE() << "frame " << fb.sequence << " overwritten at " << j;
+          break;
+        }
+      }
+      out.push_back(fb.sequence);
+    }
+    return out;
+  }
+
+  std::vector<uint8_t> arena_ = std::vector<uint8_t>(ARENA);
+  FrameRing ring_;
+};
+
+TEST_F(FrameRingTest, EmptyRingHasNoSnapshot) {
+  EXPECT_TRUE(this->ring_.is_enabled());
+  EXPECT_EQ(this->ring_.snapshot(), nullptr);
+  FrameRing disabled;
+  disabled.init(nullptr, ARENA);
+  EXPECT_FALSE(disabled.is_enabled());
+  EXPECT_FALSE(this->append(10, 1, &disabled));
+}
+
+TEST_F(FrameRingTest, OversizedAndEmptyFramesAreDropped) {
+  EXPECT_FALSE(this->append(ARENA + 1, 1));
+  EXPECT_FALSE(this->append(0, 2));
+  EXPECT_EQ(this->ring_.get_dropped(), 2u);
+  EXPECT_TRUE(this->append(ARENA, 3));
+  EXPECT_EQ(this->ring_.get_used(), ARENA);
+}
+
+TEST_F(FrameRingTest, WrapsAroundEvictingTheOldest) {
+  for (uint8_t tag = 1; tag <= 3; tag++)
+    ASSERT_TRUE(this->append(300, tag));
+  EXPECT_EQ(this->ring_.get_count(), 3u);
+  EXPECT_EQ(this->ring_.get_used(), 900u);
+  // 100 bytes left at the end: the fourth frame starts over at 0 in place of the first
+  ASSERT_TRUE(this->append(300, 4));
+  EXPECT_EQ(this->ring_.get_count(), 3u);
+  EXPECT_EQ(this->ring_.get_used(), 900u);
+  auto snapshot = this->ring_.snapshot();
+  ASSERT_NE(snapshot, nullptr);
+  EXPECT_EQ(this->tags(*snapshot), (std::vector<uint8_t>{2, 3, 4}));
+  EXPECT_EQ(snapshot->get_frame(2).buf, this->arena_.data());
+  EXPECT_EQ(this->ring_.get_dropped(), 0u);
+}
+
+TEST_F(FrameRingTest, ManyRoundsKeepTheNewestFrames) {
+  for (int i = 0; i < 200; i++) {
+    ASSERT_TRUE(this->append(90 + (i * 37) % 200, (uint8_t) i)) << i;
+    auto snapshot = this->ring_.snapshot();
+    const std::vector<uint8_t> held = this->tags(*snapshot);
+    ASSERT_FALSE(held.empty());
+    EXPECT_EQ(held.back(), (uint8_t) i);
+    for (size_t j = 1; j < held.size(); j++)
+      EXPECT_EQ((uint8_t) (held[j] - held[j - 1]), 1);
+    EXPECT_LE(this->ring_.get_used(), ARENA);
+  }
+}
+
+TEST_F(FrameRingTest, CountIsBounded) {
+  for (int i = 0; i < (int) FRAME_RING_MAX_FRAMES + 10; i++)
+    ASSERT_TRUE(this->append(5, (uint8_t) i));
+  EXPECT_EQ(this->ring_.get_count(), FRAME_RING_MAX_FRAMES);
+  EXPECT_EQ(this->ring_.get_used(), 5 * FRAME_RING_MAX_FRAMES);
+}
+
+TEST_F(FrameRingTest, PinBlocksAppendsThatWouldEvictIt) {
+  ASSERT_TRUE(this->append(400, 1));
+  ASSERT_TRUE(this->append(400, 2));
+  auto snapshot = this->ring_.snapshot();
+  // the next frame needs the room of frame 1
+  EXPECT_FALSE(this->append(400, 3));
+  EXPECT_FALSE(this->append(400, 4));
+  EXPECT_EQ(this->ring_.get_dropped(), 2u);
+  EXPECT_EQ(this->ring_.get_count(), 2u);
+  EXPECT_EQ(this->tags(*snapshot), (std::vector<uint8_t>{1, 2}));
+  // a frame that fits without evicting still goes in
+  EXPECT_TRUE(this->append(200, 5));
+  EXPECT_EQ(this->tags(*snapshot), (std::vector<uint8_t>{1, 2}));
+}
+
+TEST_F(FrameRingTest, FramesAfterThePinAreEvictedOnlyBehindIt) {
+  ASSERT_TRUE(this->append(300, 1));
+  auto snapshot = this->ring_.snapshot();
+  ASSERT_TRUE(this->append(300, 2));
+  ASSERT_TRUE(this->append(300, 3));
+  // wrapping to 0 would evict frame 1 first, which the snapshot holds
+  EXPECT_FALSE(this->append(300, 4));
+  EXPECT_EQ(this->tags(*snapshot), (std::vector<uint8_t>{1}));
+  snapshot.reset();
+  ASSERT_TRUE(this->append(300, 4));
+  EXPECT_EQ(this->tags(*this->ring_.snapshot()), (std::vector<uint8_t>{2, 3, 4}));
+}
+
+TEST_F(FrameRingTest, ReleasingTheLastPinFreesTheRing) {
+  for (uint8_t tag = 1; tag <= 3; tag++)
+    ASSERT_TRUE(this->append(300, tag));
+  auto older = this->ring_.snapshot();
+  auto newer = this->ring_.snapshot();
+  // the older snapshot still holds everything the newer one pinned
+  newer.reset();
+  EXPECT_FALSE(this->append(300, 4));
+  EXPECT_EQ(this->tags(*older), (std::vector<uint8_t>{1, 2, 3}));
+  // pinned_sequence_ stays behind, but without pins nothing is held
+  older.reset();
+  for (uint8_t tag = 4; tag <= 9; tag++)
+    ASSERT_TRUE(this->append(300, tag)) << (int) tag;
+  EXPECT_EQ(this->tags(*this->ring_.snapshot()), (std::vector<uint8_t>{7, 8, 9}));
+}
+
+TEST_F(FrameRingTest, PinHoldsAcrossTheSequenceWrap) {
+  OffsetFrameRing ring(UINT32_MAX - 1);
+  ring.init(this->arena_.data(), this->arena_.size());
+  ASSERT_TRUE(this->append(400, 1, &ring));  // sequence UINT32_MAX - 1
+  ASSERT_TRUE(this->append(400, 2, &ring));  // UINT32_MAX
+  auto snapshot = ring.snapshot();
+  ASSERT_TRUE(this->append(100, 3, &ring));  // 0, newer than the pin
+  EXPECT_FALSE(this->append(400, 4, &ring));
+  EXPECT_EQ(this->tags(*snapshot), (std::vector<uint8_t>{1, 2}));
+  snapshot.reset();
+  EXPECT_TRUE(this->append(400, 4, &ring));
+}
+
+}  // namespace
+}  // namespace esphome::usb_webcam
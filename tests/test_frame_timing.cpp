@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <gtest/gtest.h>
+
+#include "webcam_fixture.h"
+
+namespace esphome::usb_webcam {
+namespace {
+
+class FrameTimingTest : public CameraTest {
+ protected:
+  /* a frame period after the last one, or period_us, with skipped frames lost on the way */
+  const camera_fb_t *next(uint32_t skipped = 0, int64_t period_us = FRAME_US) {
+    this->images_.clear();
+    host::advance(period_us);
+    EXPECT_TRUE(host::usb_send_frame(this->frame_.data(), this->frame_.size(), skipped));
+    this->loop();
+    return this->images_.size() == 1 ? this->image(0)->get_raw_buffer() : nullptr;
+  }
+  uint32_t lost() const { return this->cam_->get_telemetry(USB_WEBCAM_FRAMES_LOST); }
+};
+
+TEST_F(FrameTimingTest, FramesCarryTheirCaptureTimes) {
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  const camera_fb_t *fb = this->next();
+  ASSERT_NE(fb, nullptr);
+  EXPECT_EQ(fb->eof_us, host::now());
+  EXPECT_EQ(fb->timestamp.tv_sec, fb->eof_us / 1000000);
+  EXPECT_EQ(fb->timestamp.tv_usec, fb->eof_us % 1000000);
+  // the first packet came at least the bus time of the frame earlier
+  const uint32_t bytes_per_second = this->cam_->stream().transfer_bytes_per_second;
+  ASSERT_NE(bytes_per_second, 0u);
+  EXPECT_EQ(fb->sof_us, fb->eof_us - (int64_t) this->frame_.size() * 1000000 / bytes_per_second);
+  EXPECT_LT(fb->sof_us, fb->eof_us);
+}
+
+TEST_F(FrameTimingTest, SequenceCountsFramesAndGaps) {
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  const uint32_t first = this->next()->sequence;
+  EXPECT_EQ(this->next()->sequence, first + 1);
+  EXPECT_EQ(this->lost(), 0u);
+  // two frames lost before the callback leave their numbers out
+  EXPECT_EQ(this->next(2)->sequence, first + 4);
+  EXPECT_EQ(this->lost(), 2u);
+  EXPECT_EQ(this->cam_->stream().last_gap_sequence.load(), first + 2);
+  EXPECT_EQ(this->next()->sequence, first + 5);
+  EXPECT_EQ(this->lost(), 2u);
+}
+
+TEST_F(FrameTimingTest, DeviceSequenceJumpIsNoLoss) {
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  const uint32_t first = this->next()->sequence;
+  // too far to be frames lost on the bus, the device numbers anew
+  EXPECT_EQ(this->next(5000)->sequence, first + 1);
+  EXPECT_EQ(this->lost(), 0u);
+}
+
+TEST_F(FrameTimingTest, SequenceCarriesOnAcrossAReconnect) {
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  this->next();
+  const uint32_t last = this->next()->sequence;
+  ASSERT_TRUE(host::usb_disconnect());
+  this->loop();
+  host::advance(2000000);
+  ASSERT_TRUE(host::usb_connect());
+  this->loop();
+  // whatever the device counts from now on, ours goes on from the last frame and the outage is no gap
+  EXPECT_EQ(this->next(3)->sequence, last + 1);
+  EXPECT_EQ(this->next()->sequence, last + 2);
+  EXPECT_EQ(this->lost(), 0u);
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_FRAME_JITTER), 0u);
+}
+
+TEST_F(FrameTimingTest, SequenceCarriesOnAcrossAStallRestart) {
+  this->cam_->set_stall_timeout(5000);
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  const uint32_t last = this->next()->sequence;
+  for (int i = 0; i < 600; i++) {
+    host::advance(10000);
+    this->loop();
+  }
+  ASSERT_EQ(this->cam_->get_telemetry(USB_WEBCAM_STREAM_RESTARTS), 1u);
+  EXPECT_EQ(this->next(7)->sequence, last + 1);
+  EXPECT_EQ(this->lost(), 0u);
+}
+
+TEST_F(FrameTimingTest, JitterFollowsTheFramePeriod) {
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  for (int i = 0; i < 10; i++)
+    this->next();
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_FRAME_JITTER), 0u);
+  // periods alternating 5 ms either side of 33 ms, each one 10 ms off the last
+  for (int i = 0; i < 100; i++)
+    this->next(0, i % 2 == 0 ? 28333 : 38333);
+  EXPECT_NEAR(this->cam_->get_telemetry(USB_WEBCAM_FRAME_JITTER), 10000, 100);
+  // steady again, the estimate decays
+  for (int i = 0; i < 100; i++)
+    this->next();
+  EXPECT_LT(this->cam_->get_telemetry(USB_WEBCAM_FRAME_JITTER), 100u);
+}
+
+}  // namespace
+}  // namespace esphome::usb_webcam
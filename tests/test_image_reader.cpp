@@ -0,0 +1,384 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "mjpeg.h"
+#include "webcam_fixture.h"
+
+namespace esphome::usb_webcam {
+namespace {
+
+/* what the ESPHome API does with a reader: chunks of at most max_chunk,
+ * done once a chunk takes all that is available, then return_image() */
+std::vector<uint8_t> send_like_api(camera::CameraImageReader *reader, size_t max_chunk, size_t *chunks = nullptr) {
+  std::vector<uint8_t> out;
+  while (true) {
+    const size_t available = reader->available();
+    const size_t to_send = std::min(max_chunk, available);
+    const uint8_t *data = reader->peek_data_buffer();
+    out.insert(out.end(), data, data + to_send);
+    reader->consume_data(to_send);
+    if (chunks != nullptr)
+      (*chunks)++;
+    if (available == to_send)
+      break;
+  }
+  reader->return_image();
+  return out;
+}
+
+bool has_segment(const std::vector<uint8_t> &jpeg, uint8_t marker) {
+  size_t pos = 2;
+  while (pos + 4 <= jpeg.size() && jpeg[pos] == 0xFF) {
+    if (jpeg[pos + 1] == marker)
+      return true;
+    if (jpeg[pos + 1] == 0xDA)
+      return false;
+    pos += 2 + (jpeg[pos + 2] << 8 | jpeg[pos + 3]);
+  }
+  return false;
+}
+
+/* Frames the way most UVC cameras send them, without DHT. Decoded with
+ * libjpeg they must come out exactly like the original frame with its
+ * tables, which uses the same standard ones. */
+class DecodableImageTest : public CameraTest {
+ protected:
+  void SetUp() override {
+    CameraTest::SetUp();
+    this->original_ = make_test_jpeg(WIDTH, HEIGHT, 5);
+    this->stripped_ = strip_jpeg_dht(this->original_);
+    ASSERT_LT(this->stripped_.size(), this->original_.size());
+    ASSERT_TRUE(decode_test_jpeg(this->original_.data(), this->original_.size(), &this->expected_));
+  }
+
+  /* hand the camera this frame and get the image it delivers */
+  USBWebCamImage *deliver(const std::vector<uint8_t> &frame) {
+    this->start();
+    this->cam_->request_image(camera::API_REQUESTER);
+    EXPECT_TRUE(this->send(frame));
+    EXPECT_EQ(this->images_.size(), 1u);
+    return this->images_.empty() ? nullptr : this->image(0);
+  }
+
+  void expect_decodes(const std::vector<uint8_t> &jpeg) {
+    EXPECT_TRUE(has_segment(jpeg, 0xC4));
+    TestImage decoded;
+    ASSERT_TRUE(decode_test_jpeg(jpeg.data(), jpeg.size(), &decoded));
+    EXPECT_EQ(decoded.pixels, this->expected_.pixels);
+  }
+
+  std::vector<uint8_t> original_;
+  std::vector<uint8_t> stripped_;
+  TestImage expected_;
+};
+
+TEST_F(DecodableImageTest, DataBufferHasTheTables) {
+  USBWebCamImage *image = this->deliver(this->stripped_);
+  ASSERT_NE(image, nullptr);
+  EXPECT_EQ(image->get_data_length(), this->stripped_.size() + JPEG_STANDARD_DHT_SIZE);
+  EXPECT_EQ(image->get_data_length(), image->get_jpeg_length());
+  const uint8_t *data = image->get_data_buffer();
+  EXPECT_NE(data, image->get_raw_buffer()->buf);
+  this->expect_decodes(std::vector<uint8_t>(data, data + image->get_data_length()));
+  // the raw frame stays as it came
+  EXPECT_EQ(memcmp(image->get_raw_buffer()->buf, this->stripped_.data(), this->stripped_.size()), 0);
+}
+
+TEST_F(DecodableImageTest, FramesWithTablesAreNotCopied) {
+  USBWebCamImage *image = this->deliver(this->original_);
+  ASSERT_NE(image, nullptr);
+  EXPECT_EQ(image->get_data_buffer(), image->get_raw_buffer()->buf);
+  EXPECT_EQ(image->get_data_length(), this->original_.size());
+  EXPECT_EQ(image->get_jpeg_length(), this->original_.size());
+}
+
+TEST_F(DecodableImageTest, NoMemoryForTheCopyGivesTheRawFrame) {
+  USBWebCamImage *image = this->deliver(this->stripped_);
+  ASSERT_NE(image, nullptr);
+  host::set_heap_limit(host::heap_in_use() + 100);
+  EXPECT_EQ(image->get_data_buffer(), image->get_raw_buffer()->buf);
+  EXPECT_EQ(image->get_data_length(), this->stripped_.size());
+  host::set_heap_limit(0);
+  // it does not retry, buffer and length stay consistent
+  EXPECT_EQ(image->get_data_length(), this->stripped_.size());
+}
+
+TEST_F(DecodableImageTest, ChannelsShareTheCopy) {
+  this->start();
+  this->cam_->request_image(camera::API_REQUESTER);
+  this->cam_->request_image(camera::WEB_REQUESTER);
+  ASSERT_TRUE(this->send(this->stripped_));
+  ASSERT_EQ(this->images_.size(), 2u);
+  ASSERT_EQ(this->image(0)->get_raw_buffer(), this->image(1)->get_raw_buffer());
+  const size_t heap = host::heap_in_use();
+  const uint8_t *data = this->image(0)->get_data_buffer();
+  EXPECT_NE(data, this->image(0)->get_raw_buffer()->buf);
+  EXPECT_EQ(this->image(1)->get_data_buffer(), data);
+  EXPECT_EQ(host::heap_in_use(), heap + this->image(0)->get_data_length());
+  this->expect_decodes(std::vector<uint8_t>(data, data + this->image(1)->get_data_length()));
+}
+
+TEST_F(DecodableImageTest, SpansDecode) {
+  USBWebCamImage *image = this->deliver(this->stripped_);
+  ASSERT_NE(image, nullptr);
+  std::vector<uint8_t> jpeg;
+  size_t spans = 0;
+  while (jpeg.size() < image->get_jpeg_length()) {
+    size_t length;
+    const uint8_t *data = image->get_jpeg_span(jpeg.size(), &length);
+    ASSERT_NE(length, 0u);
+    jpeg.insert(jpeg.end(), data, data + length);
+    spans++;
+  }
+  EXPECT_EQ(spans, 3u);  // headers, tables, scan
+  this->expect_decodes(jpeg);
+}
+
+TEST_F(DecodableImageTest, ApiReaderSendsTheWholeFrame) {
+  this->deliver(this->stripped_);
+  ASSERT_EQ(this->images_.size(), 1u);
+  // the API sends 1024 or 1390 bytes a message depending on the version, all within the staging guarantee
+  for (size_t chunk : {512, 1024, 1390}) {
+    std::unique_ptr<camera::CameraImageReader> reader(this->cam_->create_image_reader());
+    reader->set_image(this->images_[0]);
+    size_t chunks = 0;
+    const std::vector<uint8_t> sent = send_like_api(reader.get(), chunk, &chunks);
+    ASSERT_EQ(sent.size(), this->stripped_.size() + JPEG_STANDARD_DHT_SIZE) << "chunk " << chunk;
+    EXPECT_EQ(chunks, (sent.size() + chunk - 1) / chunk);
+    this->expect_decodes(sent);
+  }
+}
+
+/* ---------------- reader contract ---------------- */
+class ImageReaderTest : public DecodableImageTest {
+ protected:
+  void SetUp() override {
+    DecodableImageTest::SetUp();
+    this->deliver(this->stripped_);
+    ASSERT_EQ(this->images_.size(), 1u);
+    this->reader_.set_image(this->images_[0]);
+    const uint8_t *data = this->image(0)->get_data_buffer();
+    this->expected_stream_.assign(data, data + this->image(0)->get_data_length());
+  }
+
+  USBWebCamImageReader reader_;
+  std::vector<uint8_t> expected_stream_;
+};
+
+TEST_F(ImageReaderTest, AvailableIsEverythingLeft) {
+  EXPECT_EQ(this->reader_.available(), this->expected_stream_.size());
+  this->reader_.consume_data(100);
+  EXPECT_EQ(this->reader_.available(), this->expected_stream_.size() - 100);
+  EXPECT_EQ(this->reader_.available(), this->reader_.remaining());
+}
+
+TEST_F(ImageReaderTest, PeekIsContiguousAcrossSpans) {
+  // every chunk size up to the guarantee, starting anywhere
+  std::mt19937 random(9);
+  for (int run = 0; run < 50; run++) {
+    this->reader_.set_image(this->images_[0]);
+    size_t offset = 0;
+    while (this->reader_.available() != 0) {
+      const size_t chunk =
+          std::min(this->reader_.available(),
+                   std::uniform_int_distribution<size_t>(1, USB_WEBCAM_READER_STAGING_SIZE)(random));
+      const uint8_t *data = this->reader_.peek_data_buffer();
+      ASSERT_EQ(memcmp(data, this->expected_stream_.data() + offset, chunk), 0) << "offset " << offset;
+      this->reader_.consume_data(chunk);
+      offset += chunk;
+    }
+    ASSERT_EQ(offset, this->expected_stream_.size());
+  }
+}
+
+TEST_F(ImageReaderTest, PeekAgainGivesTheSameBytes) {
+  // a chunk at the end of the headers is staged; peeking twice must not restage differently
+  size_t length;
+  this->image(0)->get_jpeg_span(0, &length);
+  this->reader_.consume_data(length - 10);
+  const uint8_t *first = this->reader_.peek_data_buffer();
+  std::vector<uint8_t> copy(first, first + 1390);
+  const uint8_t *second = this->reader_.peek_data_buffer();
+  EXPECT_EQ(memcmp(second, copy.data(), copy.size()), 0);
+  EXPECT_EQ(memcmp(second, this->expected_stream_.data() + length - 10, copy.size()), 0);
+}
+
+TEST_F(ImageReaderTest, ConsumingTooMuchEndsTheImage) {
+  this->reader_.consume_data(this->expected_stream_.size() + 100);
+  EXPECT_EQ(this->reader_.available(), 0u);
+  EXPECT_EQ(this->reader_.remaining(), 0u);
+}
+
+TEST_F(ImageReaderTest, NothingWithoutAnImage) {
+  this->reader_.return_image();
+  EXPECT_EQ(this->reader_.available(), 0u);
+  EXPECT_EQ(this->reader_.peek_data_buffer(), nullptr);
+}
+
+/* ---------------- spans ---------------- */
+std::vector<uint8_t> gather(const USBWebCamSpan *spans, size_t count) {
+  std::vector<uint8_t> out;
+  for (size_t i = 0; i < count; i++)
+    out.insert(out.end(), spans[i].data, spans[i].data + spans[i].length);
+  return out;
+}
+
+TEST_F(ImageReaderTest, SpansPointIntoTheFrame) {
+  USBWebCamSpan spans[USB_WEBCAM_READER_MAX_SPANS];
+  ASSERT_EQ(this->reader_.peek_spans(spans, USB_WEBCAM_READER_MAX_SPANS), 3u);
+  const camera_fb_t *fb = this->image(0)->get_raw_buffer();
+  // headers and scan straight from the frame buffer, only the tables come from elsewhere
+  EXPECT_EQ(spans[0].data, fb->buf);
+  EXPECT_EQ(spans[1].length, JPEG_STANDARD_DHT_SIZE);
+  EXPECT_EQ(spans[2].data, fb->buf + spans[0].length);
+  EXPECT_EQ(spans[0].length + spans[2].length, fb->len);
+  EXPECT_EQ(gather(spans, 3), this->expected_stream_);
+}
+
+TEST_F(ImageReaderTest, SpansStartWhereConsumingStopped) {
+  USBWebCamSpan spans[USB_WEBCAM_READER_MAX_SPANS];
+  this->reader_.consume_data(100);
+  size_t count = this->reader_.peek_spans(spans, USB_WEBCAM_READER_MAX_SPANS);
+  const std::vector<uint8_t> rest(this->expected_stream_.begin() + 100, this->expected_stream_.end());
+  EXPECT_EQ(gather(spans, count), rest);
+  // a writev() that only got part of it out
+  this->reader_.consume_data(spans[0].length + 10);
+  count = this->reader_.peek_spans(spans, USB_WEBCAM_READER_MAX_SPANS);
+  EXPECT_EQ(count, 2u);
+  EXPECT_EQ(spans[0].length, JPEG_STANDARD_DHT_SIZE - 10);
+  this->reader_.consume_data(this->reader_.remaining());
+  EXPECT_EQ(this->reader_.peek_spans(spans, USB_WEBCAM_READER_MAX_SPANS), 0u);
+}
+
+TEST_F(ImageReaderTest, SpansUpToTheMax) {
+  USBWebCamSpan spans[USB_WEBCAM_READER_MAX_SPANS];
+  ASSERT_EQ(this->reader_.peek_spans(spans, 2), 2u);
+  const std::vector<uint8_t> first = gather(spans, 2);
+  EXPECT_LT(first.size(), this->expected_stream_.size());
+  EXPECT_TRUE(std::equal(first.begin(), first.end(), this->expected_stream_.begin()));
+}
+
+TEST_F(DecodableImageTest, OneSpanForFramesWithTables) {
+  this->deliver(this->original_);
+  USBWebCamImageReader reader;
+  reader.set_image(this->images_[0]);
+  USBWebCamSpan spans[USB_WEBCAM_READER_MAX_SPANS];
+  ASSERT_EQ(reader.peek_spans(spans, USB_WEBCAM_READER_MAX_SPANS), 1u);
+  EXPECT_EQ(spans[0].data, this->image(0)->get_raw_buffer()->buf);
+  EXPECT_EQ(spans[0].length, this->original_.size());
+}
+
+/* ---------------- multipart ---------------- */
+/* Parts of a multipart/x-mixed-replace stream the way a browser splits
+ * them: boundary line, headers up to the empty line, Content-Length bytes
+ * of body, CRLF. */
+struct Part {
+  std::string headers;
+  std::vector<uint8_t> body;
+};
+
+bool parse_parts(const std::vector<uint8_t> &stream, const std::string &boundary, std::vector<Part> *parts) {
+  const std::string text(stream.begin(), stream.end());
+  size_t pos = 0;
+  while (pos < text.size()) {
+    if (text.compare(pos, boundary.size() + 4, "--" + boundary + "\r\n") != 0)
+      return false;
+    const size_t end = text.find("\r\n\r\n", pos);
+    if (end == std::string::npos)
+      return false;
+    Part part;
+    part.headers = text.substr(pos, end + 4 - pos);
+    const size_t length_at = part.headers.find("Content-Length: ");
+    if (length_at == std::string::npos)
+      return false;
+    const size_t length = strtoul(part.headers.c_str() + length_at + 16, nullptr, 10);
+    if (end + 4 + length + 2 > text.size() || text.compare(end + 4 + length, 2, "\r\n") != 0)
+      return false;
+    part.body.assign(stream.begin() + end + 4, stream.begin() + end + 4 + length);
+    parts->push_back(std::move(part));
+    pos = end + 4 + length + 2;
+  }
+  return true;
+}
+
+class MultipartReaderTest : public DecodableImageTest {
+ protected:
+  void SetUp() override {
+    DecodableImageTest::SetUp();
+    this->reader_.set_multipart_boundary("frame");
+    this->cam_->set_max_update_interval(FRAME_US / 1000);
+    this->start();
+    this->cam_->start_stream(camera::WEB_REQUESTER);
+  }
+
+  USBWebCamImageReader reader_;
+};
+
+TEST_F(MultipartReaderTest, PartsAroundEachImage) {
+  std::vector<uint8_t> stream;
+  for (int i = 0; i < 3; i++) {
+    ASSERT_TRUE(this->send(i == 1 ? this->original_ : this->stripped_));
+    ASSERT_EQ(this->images_.size(), 1u);
+    this->reader_.set_image(this->images_[0]);
+    USBWebCamSpan spans[USB_WEBCAM_READER_MAX_SPANS];
+    const size_t count = this->reader_.peek_spans(spans, USB_WEBCAM_READER_MAX_SPANS);
+    EXPECT_EQ(count, i == 1 ? 3u : 5u);
+    const std::vector<uint8_t> part = gather(spans, count);
+    EXPECT_EQ(part.size(), this->reader_.remaining());
+    stream.insert(stream.end(), part.begin(), part.end());
+    this->reader_.consume_data(part.size());
+    this->reader_.return_image();
+    this->images_.clear();
+  }
+  std::vector<Part> parts;
+  ASSERT_TRUE(parse_parts(stream, "frame", &parts));
+  ASSERT_EQ(parts.size(), 3u);
+  for (const Part &part : parts) {
+    EXPECT_NE(part.headers.find("Content-Type: image/jpeg\r\n"), std::string::npos);
+    EXPECT_NE(part.headers.find("X-Timestamp: "), std::string::npos);
+    this->expect_decodes(part.body);
+  }
+  EXPECT_NE(parts[0].headers, parts[2].headers);  // timestamps move on
+}
+
+TEST_F(MultipartReaderTest, TimestampIsTheEndOfFrame) {
+  ASSERT_TRUE(this->send(this->stripped_));
+  const int64_t eof_us = this->image(0)->get_raw_buffer()->eof_us;
+  this->reader_.set_image(this->images_[0]);
+  const std::vector<uint8_t> part = send_like_api(&this->reader_, 1390);
+  char expected[64];
+  snprintf(expected, sizeof(expected), "X-Timestamp: %lld.%06lld\r\n", (long long) (eof_us / 1000000),
+           (long long) (eof_us % 1000000));
+  EXPECT_NE(std::string(part.begin(), part.end()).find(expected), std::string::npos);
+}
+
+TEST_F(MultipartReaderTest, ChunkedReadsGiveTheSameBytes) {
+  ASSERT_TRUE(this->send(this->stripped_));
+  this->reader_.set_image(this->images_[0]);
+  USBWebCamSpan spans[USB_WEBCAM_READER_MAX_SPANS];
+  const std::vector<uint8_t> whole = gather(spans, this->reader_.peek_spans(spans, USB_WEBCAM_READER_MAX_SPANS));
+  for (size_t chunk : {7, 100, 1024, 1390, 2048}) {
+    this->reader_.set_image(this->images_[0]);
+    EXPECT_EQ(send_like_api(&this->reader_, chunk), whole) << "chunk " << chunk;
+  }
+}
+
+TEST_F(MultipartReaderTest, BoundaryTooLongSendsPlainJpeg) {
+  this->reader_.set_multipart_boundary(std::string(200, 'x'));
+  ASSERT_TRUE(this->send(this->stripped_));
+  this->reader_.set_image(this->images_[0]);
+  EXPECT_EQ(this->reader_.remaining(), this->image(0)->get_jpeg_length());
+}
+
+}  // namespace
+}  // namespace esphome::usb_webcam
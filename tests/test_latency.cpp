@@ -0,0 +1,108 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include "esphome/core/application.h"
+#include "latency_histogram.h"
+#include "webcam_fixture.h"
+
+namespace esphome::usb_webcam {
+namespace {
+
+/* ---------------- LatencyHistogram ---------------- */
+TEST(LatencyHistogramTest, EmptyHasNoPercentile) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(histogram.count(), 0u);
+  EXPECT_EQ(histogram.percentile(99), 0u);
+}
+
+TEST(LatencyHistogramTest, BucketsArePowersOfTwo) {
+  LatencyHistogram histogram;
+  histogram.record(0);
+  histogram.record(1);
+  histogram.record(1023);
+  histogram.record(1024);
+  EXPECT_EQ(histogram.bucket(0), 1u);
+  EXPECT_EQ(histogram.bucket(1), 1u);
+  EXPECT_EQ(histogram.bucket(10), 1u);
+  EXPECT_EQ(histogram.bucket(11), 1u);
+  histogram.record(UINT32_MAX);
+  EXPECT_EQ(histogram.bucket(LatencyHistogram::BUCKETS - 1), 1u);
+}
+
+TEST(LatencyHistogramTest, PercentileIsTheBucketBound) {
+  LatencyHistogram histogram;
+  for (int i = 0; i < 98; i++)
+    histogram.record(100);  // below 128
+  histogram.record(3000);   // below 4096
+  histogram.record(70000);  // below 131072
+  EXPECT_EQ(histogram.percentile(50), 128u);
+  EXPECT_EQ(histogram.percentile(98), 128u);
+  EXPECT_EQ(histogram.percentile(99), 4096u);
+  EXPECT_EQ(histogram.percentile(100), 131072u);
+  histogram.reset();
+  EXPECT_EQ(histogram.count(), 0u);
+}
+
+/* ---------------- USB end of frame to image callback ---------------- */
+class EndToEndLatencyTest : public CameraTest {
+ protected:
+  void SetUp() override {
+    CameraTest::SetUp();
+    this->cam_->add_image_callback([this](std::shared_ptr<camera::CameraImage> image) {
+      const camera_fb_t *fb = static_cast<USBWebCamImage *>(image.get())->get_raw_buffer();
+      ASSERT_GE(host::now(), fb->eof_us);
+      this->callback_latency_.record(host::now() - fb->eof_us);
+    });
+  }
+
+  LatencyHistogram callback_latency_;
+};
+
+TEST_F(EndToEndLatencyTest, FrameArrivalWakesTheLoop) {
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  this->loop();
+  // nothing to deliver: the component sleeps until woken
+  ASSERT_FALSE(this->cam_->is_loop_enabled());
+  App.take_wake();
+
+  host::advance(FRAME_US);
+  ASSERT_TRUE(host::usb_send_frame(this->frame_.data(), this->frame_.size()));
+  EXPECT_TRUE(App.take_wake());
+  EXPECT_TRUE(this->cam_->is_loop_enabled());
+  this->loop();
+  ASSERT_EQ(this->images_.size(), 1u);
+  EXPECT_EQ(this->callback_latency_.percentile(100), 1u);  // same pass, no time passed
+}
+
+TEST_F(EndToEndLatencyTest, HistogramFollowsLoopDelay) {
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  std::mt19937 random(3);
+  std::uniform_int_distribution<uint32_t> delay(0, 6000);
+  uint32_t max_delay = 0;
+  for (int i = 0; i < 200; i++) {
+    host::advance(FRAME_US);
+    ASSERT_TRUE(host::usb_send_frame(this->frame_.data(), this->frame_.size()));
+    // other components hold the main loop before it gets to the camera
+    const uint32_t us = delay(random);
+    max_delay = std::max(max_delay, us);
+    host::advance(us);
+    this->loop();
+    ASSERT_EQ(this->images_.size(), 1u) << "frame " << i;
+    this->images_.clear();
+  }
+  EXPECT_EQ(this->callback_latency_.count(), 200u);
+  EXPECT_LE(this->callback_latency_.percentile(100), 8192u);
+  EXPECT_GT(this->callback_latency_.percentile(100), max_delay);
+  // the component measures the same, up to the loop picking the frame
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_LOOP_LATENCY_P99), this->callback_latency_.percentile(99));
+  EXPECT_EQ(this->cam_->loop_latency().count(), 200u);
+  EXPECT_EQ(this->cam_->loop_latency().bucket(LatencyHistogram::BUCKETS - 1), 0u);
+}
+
+}  // namespace
+}  // namespace esphome::usb_webcam
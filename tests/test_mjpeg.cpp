@@ -0,0 +1,173 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "mjpeg.h"
+#include "webcam_fixture.h"
+
+namespace esphome::usb_webcam {
+namespace {
+
+/* offset of the first header segment with this marker, 0 if there is none */
+size_t find_segment(const std::vector<uint8_t> &jpeg, uint8_t marker) {
+  size_t pos = 2;
+  while (pos + 4 <= jpeg.size() && jpeg[pos] == 0xFF) {
+    if (jpeg[pos + 1] == marker)
+      return pos;
+    if (jpeg[pos + 1] == 0xDA)
+      return 0;
+    pos += 2 + (jpeg[pos + 2] << 8 | jpeg[pos + 3]);
+  }
+  return 0;
+}
+
+/* offset of the first 0xFF marker in the scan data, 0 if none */
+size_t find_scan_marker(const std::vector<uint8_t> &jpeg, uint8_t marker) {
+  const size_t sos = find_segment(jpeg, 0xDA);
+  for (size_t pos = sos + 2 + (jpeg[sos + 2] << 8 | jpeg[sos + 3]); pos + 1 < jpeg.size(); pos++) {
+    if (jpeg[pos] == 0xFF && jpeg[pos + 1] == marker)
+      return pos;
+  }
+  return 0;
+}
+
+void erase_segment(std::vector<uint8_t> &jpeg, uint8_t marker) {
+  const size_t pos = find_segment(jpeg, marker);
+  ASSERT_NE(pos, 0u);
+  jpeg.erase(jpeg.begin() + pos, jpeg.begin() + pos + 2 + (jpeg[pos + 2] << 8 | jpeg[pos + 3]));
+}
+
+JpegCheckResult basic(const std::vector<uint8_t> &jpeg) {
+  return check_jpeg(jpeg.data(), jpeg.size(), USB_WEBCAM_VALIDATION_BASIC);
+}
+JpegCheckResult strict(const std::vector<uint8_t> &jpeg) {
+  return check_jpeg(jpeg.data(), jpeg.size(), USB_WEBCAM_VALIDATION_STRICT);
+}
+
+/* ---------------- check_jpeg ---------------- */
+class CheckJpegTest : public ::testing::Test {
+ protected:
+  std::vector<uint8_t> jpeg_{make_test_jpeg(320, 240, 1)};
+  std::vector<uint8_t> restarts_{encode_test_jpeg(make_test_image(320, 240, 1), 80, 4)};
+};
+
+TEST_F(CheckJpegTest, GoodFramesPass) {
+  EXPECT_EQ(basic(this->jpeg_), JPEG_OK);
+  EXPECT_EQ(strict(this->jpeg_), JPEG_OK);
+  EXPECT_EQ(strict(this->restarts_), JPEG_OK);
+  EXPECT_EQ(strict(strip_jpeg_dht(this->jpeg_)), JPEG_OK);
+}
+
+TEST_F(CheckJpegTest, SmallDarkFramesPass) {
+  TestImage dark{64, 48, 3, std::vector<uint8_t>(64 * 48 * 3, 0)};
+  const std::vector<uint8_t> jpeg = strip_jpeg_dht(encode_test_jpeg(dark, 50));
+  ASSERT_LT(jpeg.size(), 1000u);  // well below the old drop_size heuristic
+  EXPECT_EQ(strict(jpeg), JPEG_OK);
+}
+
+TEST_F(CheckJpegTest, PaddingAfterEndOfImage) {
+  std::vector<uint8_t> padded = this->jpeg_;
+  padded.insert(padded.end(), 100, 0x00);
+  EXPECT_EQ(basic(padded), JPEG_OK);
+  EXPECT_EQ(strict(padded), JPEG_OK);
+}
+
+TEST_F(CheckJpegTest, MissingStartOfImage) {
+  std::vector<uint8_t> jpeg = this->jpeg_;
+  jpeg[1] = 0xD9;
+  EXPECT_EQ(basic(jpeg), JPEG_NO_SOI);
+  EXPECT_EQ(basic(std::vector<uint8_t>{0xFF, 0xD8}), JPEG_NO_SOI);
+  EXPECT_EQ(check_jpeg(nullptr, 0, USB_WEBCAM_VALIDATION_STRICT), JPEG_NO_SOI);
+}
+
+TEST_F(CheckJpegTest, CutInTheHeaders) {
+  const size_t dqt = find_segment(this->jpeg_, 0xDB);
+  ASSERT_NE(dqt, 0u);
+  const std::vector<uint8_t> cut(this->jpeg_.begin(), this->jpeg_.begin() + dqt + 10);
+  EXPECT_EQ(basic(cut), JPEG_TRUNCATED);
+  EXPECT_EQ(strict(cut), JPEG_TRUNCATED);
+}
+
+TEST_F(CheckJpegTest, CutInTheScan) {
+  const std::vector<uint8_t> cut(this->jpeg_.begin(), this->jpeg_.begin() + this->jpeg_.size() * 2 / 3);
+  EXPECT_EQ(basic(cut), JPEG_NO_EOI);
+  EXPECT_EQ(strict(cut), JPEG_NO_EOI);
+}
+
+TEST_F(CheckJpegTest, GarbageBetweenSegments) {
+  std::vector<uint8_t> jpeg = this->jpeg_;
+  jpeg[find_segment(jpeg, 0xDB)] = 0x42;
+  EXPECT_EQ(basic(jpeg), JPEG_BAD_SEGMENT);
+  std::vector<uint8_t> short_length = this->jpeg_;
+  const size_t dqt = find_segment(short_length, 0xDB);
+  short_length[dqt + 2] = 0;
+  short_length[dqt + 3] = 1;
+  EXPECT_EQ(basic(short_length), JPEG_BAD_SEGMENT);
+}
+
+TEST_F(CheckJpegTest, MissingFrameHeader) {
+  std::vector<uint8_t> jpeg = this->jpeg_;
+  erase_segment(jpeg, 0xC0);
+  EXPECT_EQ(basic(jpeg), JPEG_NO_SOF);
+  std::vector<uint8_t> empty = this->jpeg_;
+  const size_t sof = find_segment(empty, 0xC0);
+  empty[sof + 5] = empty[sof + 6] = 0;  // zero lines
+  EXPECT_EQ(basic(empty), JPEG_NO_SOF);
+}
+
+TEST_F(CheckJpegTest, EndOfImageBeforeTheScan) {
+  std::vector<uint8_t> jpeg(this->jpeg_.begin(), this->jpeg_.begin() + find_segment(this->jpeg_, 0xDA));
+  jpeg.push_back(0xFF);
+  jpeg.push_back(0xD9);
+  EXPECT_EQ(basic(jpeg), JPEG_NO_SOS);
+}
+
+TEST_F(CheckJpegTest, RestartMarkersOutOfOrder) {
+  std::vector<uint8_t> jpeg = this->restarts_;
+  const size_t rst = find_scan_marker(jpeg, 0xD1);
+  ASSERT_NE(rst, 0u);
+  jpeg[rst + 1] = 0xD5;
+  EXPECT_EQ(basic(jpeg), JPEG_OK);  // basic does not look into the scan
+  EXPECT_EQ(strict(jpeg), JPEG_BAD_RESTART);
+}
+
+TEST_F(CheckJpegTest, StrayMarkerInTheScan) {
+  std::vector<uint8_t> jpeg = this->jpeg_;
+  const size_t sos = find_segment(jpeg, 0xDA);
+  const size_t middle = (sos + jpeg.size()) / 2;
+  jpeg[middle] = 0xFF;
+  jpeg[middle + 1] = 0xC0;
+  EXPECT_EQ(basic(jpeg), JPEG_OK);
+  EXPECT_EQ(strict(jpeg), JPEG_BAD_RESTART);
+}
+
+TEST(JpegCheckResultTest, EveryResultHasAName) {
+  for (int i = 0; i < JPEG_CHECK_RESULTS; i++)
+    EXPECT_STRNE(jpeg_check_result_to_string((JpegCheckResult) i), "unknown");
+}
+
+/* ---------------- in the frame callback ---------------- */
+class FrameValidationTest : public CameraTest {};
+
+TEST_F(FrameValidationTest, DamagedFramesAreCountedNotDelivered) {
+  this->cam_->set_frame_validation(USB_WEBCAM_VALIDATION_STRICT);
+  this->cam_->set_drop_size(0);
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+
+  std::vector<uint8_t> cut(this->frame_.begin(), this->frame_.begin() + this->frame_.size() / 2);
+  ASSERT_TRUE(this->send(cut));
+  EXPECT_TRUE(this->images_.empty());
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_FRAMES_DROPPED_INVALID), 1u);
+
+  TestImage dark{WIDTH, HEIGHT, 3, std::vector<uint8_t>((size_t) WIDTH * HEIGHT * 3, 0)};
+  ASSERT_TRUE(this->send(encode_test_jpeg(dark, 50)));
+  EXPECT_EQ(this->images_.size(), 1u);
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_FRAMES_DROPPED_INVALID), 1u);
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_FRAMES_DROPPED_SMALL), 0u);
+}
+
+}  // namespace
+}  // namespace esphome::usb_webcam
@@ -0,0 +1,233 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <cstdlib>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "mjpeg_scale.h"
+#include "webcam_fixture.h"
+
+namespace esphome::usb_webcam {
+namespace {
+
+/* JpegDownscaler against libjpeg's own scaled decode of the same frame */
+struct ScaleCase {
+  const char *name;
+  uint16_t width;
+  uint16_t height;
+  uint8_t components;
+  int restart_interval;
+  bool strip_dht;
+};
+
+void PrintTo(const ScaleCase &c, std::ostream *os) { *os << c.name; }
+
+class DownscaleTest : public ::testing::TestWithParam<ScaleCase> {
+ protected:
+  std::vector<uint8_t> frame() const {
+    const ScaleCase &c = GetParam();
+    const std::vector<uint8_t> jpeg =
+        encode_test_jpeg(make_test_image(c.width, c.height, 3, c.components), 85, c.restart_interval);
+    return c.strip_dht ? strip_jpeg_dht(jpeg) : jpeg;
+  }
+
+  /* Scale, decode the result, and compare it with libjpeg decoding the
+   * source at that scale. Returns the mean error per sample, and in
+   * reference_error what libjpeg loses itself encoding its scaled decode
+   * again at the same quality and sampling. */
+  double scale_error(const std::vector<uint8_t> &jpeg, uint8_t shift, double *reference_error) {
+    std::vector<uint8_t> out(jpeg.size() + 4096);
+    uint16_t width = 0, height = 0;
+    const size_t len = this->scaler_.scale(jpeg.data(), jpeg.size(), shift, out.data(), out.size(), &width, &height);
+    EXPECT_NE(len, 0u);
+    TestImage scaled, reference, round_trip;
+    EXPECT_TRUE(decode_test_jpeg(out.data(), len, &scaled));
+    EXPECT_TRUE(decode_test_jpeg(jpeg.data(), jpeg.size(), &reference, 1 << shift));
+    EXPECT_EQ(width, scaled.width);
+    EXPECT_EQ(height, scaled.height);
+    EXPECT_EQ(scaled.width, reference.width);
+    EXPECT_EQ(scaled.height, reference.height);
+    EXPECT_EQ(scaled.components, reference.components);
+    const std::vector<uint8_t> encoded = encode_test_jpeg(reference, QUALITY);
+    EXPECT_TRUE(decode_test_jpeg(encoded.data(), encoded.size(), &round_trip));
+    *reference_error = image_difference(round_trip, reference);
+    return image_difference(scaled, reference);
+  }
+
+  static const uint8_t QUALITY = 80;  // the scaler's default
+  JpegDownscaler scaler_;
+};
+
+TEST_P(DownscaleTest, AsGoodAsLibjpeg) {
+  const std::vector<uint8_t> jpeg = this->frame();
+  // the output is a new 4:2:0 JPEG at the configured quality, so it can't
+  // beat libjpeg doing the same, but shifted or garbled blocks stand out
+  for (uint8_t shift = 1; shift <= 3; shift++) {
+    double reference_error;
+    const double error = this->scale_error(jpeg, shift, &reference_error);
+    EXPECT_LT(error, reference_error * 1.1 + 0.5) << "1/" << (1 << shift);
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(Frames, DownscaleTest,
+                         ::testing::Values(ScaleCase{"hd", 1280, 720, 3, 0, false},
+                                           ScaleCase{"uvc", 640, 480, 3, 0, true},
+                                           ScaleCase{"odd_size", 636, 474, 3, 0, true},
+                                           ScaleCase{"restarts", 640, 480, 3, 5, true},
+                                           ScaleCase{"gray", 320, 240, 1, 0, false}),
+                         [](const auto &info) { return std::string(info.param.name); });
+
+class DownscaleRefusalTest : public ::testing::Test {
+ protected:
+  size_t scale(const std::vector<uint8_t> &jpeg, size_t out_size = 65536) {
+    std::vector<uint8_t> out(out_size);
+    uint16_t width, height;
+    return this->scaler_.scale(jpeg.data(), jpeg.size(), 2, out.data(), out.size(), &width, &height);
+  }
+
+  JpegDownscaler scaler_;
+  std::vector<uint8_t> jpeg_{make_test_jpeg(320, 240, 1)};
+};
+
+TEST_F(DownscaleRefusalTest, ProgressiveFrames) {
+  std::vector<uint8_t> jpeg = this->jpeg_;
+  for (size_t pos = 2; pos + 1 < jpeg.size(); pos++) {
+    if (jpeg[pos] == 0xFF && jpeg[pos + 1] == 0xC0) {
+      jpeg[pos + 1] = 0xC2;
+      break;
+    }
+  }
+  EXPECT_EQ(this->scale(jpeg), 0u);
+}
+
+TEST_F(DownscaleRefusalTest, OutputTooSmall) { EXPECT_EQ(this->scale(this->jpeg_, 200), 0u); }
+
+TEST_F(DownscaleRefusalTest, CutFrames) {
+  EXPECT_EQ(this->scale(std::vector<uint8_t>(this->jpeg_.begin(), this->jpeg_.begin() + 100)), 0u);
+  EXPECT_EQ(this->scale(std::vector<uint8_t>{0xFF, 0xD8, 0xFF}), 0u);
+}
+
+TEST_F(DownscaleRefusalTest, BogusHuffmanTable) {
+  std::vector<uint8_t> jpeg = this->jpeg_;
+  size_t pos = 2;
+  while (pos + 1 < jpeg.size() && !(jpeg[pos] == 0xFF && jpeg[pos + 1] == 0xC4))
+    pos++;
+  ASSERT_LT(pos + 7, jpeg.size());
+  // two 1 bit codes leave no prefix for the longer ones, the value count stays the same
+  uint8_t *bits = &jpeg[pos + 5];
+  ASSERT_GE(bits[2], 2);
+  bits[0] += 2;
+  bits[2] -= 2;
+  EXPECT_EQ(this->scale(jpeg), 0u);
+}
+
+/* a 64x64 gray frame whose every DC difference is +2047, with 16 bit
+ * quantizers of 65535: the DC predictor and its product would overflow */
+TEST_F(DownscaleRefusalTest, RunawayDcStaysInRange) {
+  std::vector<uint8_t> jpeg = {0xFF, 0xD8, 0xFF, 0xDB, 0x00, 0x83, 0x10};
+  jpeg.insert(jpeg.end(), 128, 0xFF);
+  const uint8_t sof[] = {0xFF, 0xC0, 0x00, 0x0B, 0x08, 0x00, 0x40, 0x00, 0x40, 0x01, 0x01, 0x11, 0x00};
+  const uint8_t sos[] = {0xFF, 0xDA, 0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3F, 0x00};
+  jpeg.insert(jpeg.end(), sof, sof + sizeof(sof));
+  jpeg.insert(jpeg.end(), sos, sos + sizeof(sos));
+  // DC category 11 (111111110), 2047 (11111111111), end of block (1010), 0xFF stuffed
+  for (int block = 0; block < 64; block++)
+    jpeg.insert(jpeg.end(), {0xFF, 0x00, 0x7F, 0xFA});
+  jpeg.insert(jpeg.end(), {0xFF, 0xD9});
+
+  std::vector<uint8_t> out(4096);
+  uint16_t width, height;
+  const size_t len = this->scaler_.scale(jpeg.data(), jpeg.size(), 3, out.data(), out.size(), &width, &height);
+  ASSERT_NE(len, 0u);
+  TestImage image;
+  ASSERT_TRUE(decode_test_jpeg(out.data(), len, &image));
+  ASSERT_EQ(image.pixels.size(), 64u);
+  for (uint8_t pixel : image.pixels)
+    EXPECT_GE(pixel, 250);
+}
+
+TEST_F(DownscaleRefusalTest, PlanesUseTheAllocator) {
+  static size_t allocated;
+  allocated = 0;
+  this->scaler_.set_allocator(
+      [](size_t size) {
+        allocated += size;
+        return malloc(size);
+      },
+      free);
+  EXPECT_NE(this->scale(this->jpeg_), 0u);
+  EXPECT_NE(allocated, 0u);
+  EXPECT_EQ(allocated, this->scaler_.get_buffer_size());
+}
+
+TEST(DecodeLumaTest, DcOfEveryBlock) {
+  const TestImage image = make_test_image(636, 474, 2, 1);
+  const std::vector<uint8_t> jpeg = strip_jpeg_dht(encode_test_jpeg(image, 85));
+  TestImage reference;
+  ASSERT_TRUE(decode_test_jpeg(jpeg.data(), jpeg.size(), &reference, 8));
+
+  JpegDownscaler scaler;
+  uint16_t width, height;
+  uint32_t stride;
+  const uint8_t *luma = scaler.decode_luma(jpeg.data(), jpeg.size(), &width, &height, &stride);
+  ASSERT_NE(luma, nullptr);
+  ASSERT_EQ(width, reference.width);
+  ASSERT_EQ(height, reference.height);
+  ASSERT_GE(stride, width);
+  uint32_t worst = 0;
+  for (uint32_t y = 0; y < height; y++) {
+    for (uint32_t x = 0; x < width; x++)
+      worst = std::max<uint32_t>(worst, std::abs(luma[y * stride + x] - reference.pixels[y * width + x]));
+  }
+  EXPECT_LE(worst, 1u);  // rounding only, both take the DC as it is
+}
+
+/* ---------------- API channel ---------------- */
+class ScaledChannelTest : public CameraTest {};
+
+TEST_F(ScaledChannelTest, ApiGetsTheScaledFrame) {
+  this->cam_->set_requester_scale(camera::API_REQUESTER, 2);
+  this->start();
+  this->cam_->request_image(camera::API_REQUESTER);
+  ASSERT_TRUE(this->send());
+  this->loop();  // the worker's result goes out on the next pass
+  ASSERT_EQ(this->images_.size(), 1u);
+  USBWebCamImage *image = this->image(0);
+  EXPECT_TRUE(image->was_requested_by(camera::API_REQUESTER));
+  uint16_t width, height;
+  ASSERT_TRUE(read_test_jpeg_size(image->get_data_buffer(), image->get_data_length(), &width, &height));
+  EXPECT_EQ(width, WIDTH / 4);
+  EXPECT_EQ(height, HEIGHT / 4);
+  TestImage decoded;
+  EXPECT_TRUE(decode_test_jpeg(image->get_data_buffer(), image->get_data_length(), &decoded));
+}
+
+TEST_F(ScaledChannelTest, WebStaysFullSize) {
+  this->cam_->set_requester_scale(camera::API_REQUESTER, 2);
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  ASSERT_TRUE(this->send());
+  ASSERT_EQ(this->images_.size(), 1u);
+  EXPECT_EQ(this->image(0)->get_raw_buffer()->len, this->frame_.size());
+}
+
+TEST_F(ScaledChannelTest, UnscalableFramesGoFullSize) {
+  this->cam_->set_requester_scale(camera::API_REQUESTER, 2);
+  this->start();
+  this->cam_->request_image(camera::API_REQUESTER);
+  std::vector<uint8_t> progressive = this->frame_;
+  for (size_t pos = 2; pos + 1 < progressive.size(); pos++) {
+    if (progressive[pos] == 0xFF && progressive[pos + 1] == 0xC0) {
+      progressive[pos + 1] = 0xC2;
+      break;
+    }
+  }
+  ASSERT_TRUE(this->send(progressive));
+  this->loop();
+  ASSERT_EQ(this->images_.size(), 1u);
+  EXPECT_EQ(this->image(0)->get_raw_buffer()->len, progressive.size());
+}
+
+}  // namespace
+}  // namespace esphome::usb_webcam
@@ -0,0 +1,363 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "mjpeg_scale.h"
+#include "motion.h"
+#include "webcam_fixture.h"
+
+namespace esphome::usb_webcam {
+namespace {
+
+/* ---------------- MotionDetector ---------------- */
+/* a 1/8 scale luma plane as decode_luma() gives it, rows stride apart */
+class MotionDetectorTest : public ::testing::Test {
+ protected:
+  static const uint16_t W = 40;
+  static const uint16_t H = 30;
+  static const uint32_t STRIDE = 48;  // padding the detector must not read as image
+
+  void SetUp() override {
+    this->luma_.assign(STRIDE * H, 0xEE);
+    for (uint16_t y = 0; y < H; y++) {
+      for (uint16_t x = 0; x < W; x++)
+        this->at(x, y) = 60 + x * 2 + y;
+    }
+  }
+
+  uint8_t &at(uint16_t x, uint16_t y) { return this->luma_[y * STRIDE + x]; }
+  void change(uint16_t x0, uint16_t y0, uint16_t w, uint16_t h, int by) {
+    for (uint16_t y = y0; y < y0 + h; y++) {
+      for (uint16_t x = x0; x < x0 + w; x++)
+        this->at(x, y) += by;
+    }
+  }
+  std::vector<uint8_t> noisy(int amplitude) {
+    std::vector<uint8_t> luma = this->luma_;
+    std::uniform_int_distribution<int> noise(-amplitude, amplitude);
+    for (uint8_t &value : luma)
+      value += noise(this->random_);
+    return luma;
+  }
+  uint16_t update(const std::vector<uint8_t> &luma) { return this->detector_.update(luma.data(), W, H, STRIDE); }
+  uint16_t update() { return this->update(this->luma_); }
+
+  MotionDetector detector_;
+  std::vector<uint8_t> luma_;
+  std::mt19937 random_{3};
+};
+
+TEST_F(MotionDetectorTest, FirstFrameSeedsTheBackground) {
+  this->change(0, 0, W, H, 100);
+  EXPECT_EQ(this->update(), 0u);
+  EXPECT_EQ(this->update(), 0u);
+  EXPECT_EQ(this->detector_.get_buffer_size(), W * H * sizeof(uint16_t));
+}
+
+TEST_F(MotionDetectorTest, SensorNoiseIsNotMotion) {
+  this->update();
+  for (int i = 0; i < 50; i++)
+    EXPECT_EQ(this->update(this->noisy(6)), 0u);
+}
+
+TEST_F(MotionDetectorTest, ExposureShiftIsNotMotion) {
+  this->update();
+  this->change(0, 0, W, H, 40);
+  EXPECT_EQ(this->update(), 0u);
+  this->change(0, 0, W, H, -70);
+  EXPECT_EQ(this->update(), 0u);
+}
+
+TEST_F(MotionDetectorTest, ScoreIsTheChangedShareInPermille) {
+  this->update();
+  this->change(5, 5, 10, 12, 50);  // 120 of 1200 blocks, the frame mean moves by 5
+  const uint16_t score = this->update();
+  EXPECT_EQ(score, 100u);
+  EXPECT_TRUE(this->detector_.is_motion(score));
+}
+
+TEST_F(MotionDetectorTest, SmallChangesStayBelowThreshold) {
+  this->detector_.set_threshold(12);
+  this->update();
+  this->change(5, 5, 10, 12, 12);
+  EXPECT_EQ(this->update(), 0u);
+  this->change(5, 5, 10, 12, 2);
+  EXPECT_EQ(this->update(), 100u);
+}
+
+TEST_F(MotionDetectorTest, MinArea) {
+  this->detector_.set_min_area(20);
+  this->update();
+  this->change(0, 0, 4, 5, 80);  // 20 blocks, 16 permille
+  const uint16_t score = this->update();
+  EXPECT_EQ(score, 16u);
+  EXPECT_FALSE(this->detector_.is_motion(score));
+}
+
+TEST_F(MotionDetectorTest, BackgroundTakesInWhatStays) {
+  this->detector_.set_background_shift(4);
+  this->update();
+  this->change(5, 5, 10, 12, 60);
+  int frames = 0;
+  while (this->update() != 0 && frames < 100)
+    frames++;
+  // 60 * (15/16)^n drops below the threshold of 12 after about 25 frames
+  EXPECT_GT(frames, 15);
+  EXPECT_LT(frames, 35);
+}
+
+TEST_F(MotionDetectorTest, OtherSizeSeedsAgain) {
+  this->update();
+  this->change(0, 0, 20, 30, 80);
+  EXPECT_EQ(this->detector_.update(this->luma_.data(), 20, 15, STRIDE), 0u);
+  EXPECT_EQ(this->detector_.update(this->luma_.data(), 20, 15, STRIDE), 0u);
+  this->detector_.reset();
+  EXPECT_EQ(this->update(), 0u);
+}
+
+TEST_F(MotionDetectorTest, NoMemoryNoMotion) {
+  this->detector_.set_allocator([](size_t) -> void * { return nullptr; }, free);
+  this->update();
+  this->change(0, 0, W, H / 2, 80);
+  EXPECT_EQ(this->update(), 0u);
+  EXPECT_EQ(this->detector_.get_buffer_size(), 0u);
+}
+
+/* ---------------- frame signatures ---------------- */
+TEST(FrameSignatureTest, NearIdenticalFramesAreClose) {
+  const TestImage image = make_test_image(320, 240, 1, 1);
+  FrameSignature a, b;
+  frame_signature(image.pixels.data(), 320, 240, 320, &a);
+  TestImage noisy = image;
+  add_sensor_noise(&noisy, 8, 0, 1);
+  frame_signature(noisy.pixels.data(), 320, 240, 320, &b);
+  EXPECT_EQ(frame_signature_distance(a, a), 0u);
+  EXPECT_LE(frame_signature_distance(a, b), 2u);
+}
+
+TEST(FrameSignatureTest, MovedSquareIsFar) {
+  const TestImage first = make_test_image(320, 240, 1, 1);
+  const TestImage moved = make_test_image(320, 240, 6, 1);
+  FrameSignature a, b;
+  frame_signature(first.pixels.data(), 320, 240, 320, &a);
+  frame_signature(moved.pixels.data(), 320, 240, 320, &b);
+  EXPECT_GT(frame_signature_distance(a, b), 40u);
+}
+
+TEST(FrameSignatureTest, InvalidIsFarFromEverything) {
+  const TestImage image = make_test_image(32, 24, 1, 1);
+  FrameSignature valid, invalid;
+  frame_signature(image.pixels.data(), 32, 24, 32, &valid);
+  frame_signature(nullptr, 0, 0, 0, &invalid);
+  EXPECT_FALSE(invalid.valid);
+  EXPECT_EQ(frame_signature_distance(valid, invalid), 255u);
+}
+
+/* ---------------- on MJPEG frames ---------------- */
+/* a still scene with sensor noise and exposure drift, or the square moving */
+std::vector<uint8_t> scene_jpeg(uint16_t width, uint16_t height, uint32_t position, uint32_t seed, int exposure = 0) {
+  TestImage image = make_test_image(width, height, position);
+  add_sensor_noise(&image, 4, exposure, seed);
+  return strip_jpeg_dht(encode_test_jpeg(image, 80));
+}
+
+TEST(MotionOnFramesTest, DcLumaSeesTheSquareMove) {
+  JpegDownscaler decoder;
+  MotionDetector detector;
+  auto score = [&](const std::vector<uint8_t> &jpeg) {
+    uint16_t width, height;
+    uint32_t stride;
+    const uint8_t *luma = decoder.decode_luma(jpeg.data(), jpeg.size(), &width, &height, &stride);
+    EXPECT_NE(luma, nullptr);
+    return detector.update(luma, width, height, stride);
+  };
+  score(scene_jpeg(640, 480, 0, 0));
+  for (uint32_t i = 1; i < 20; i++)
+    EXPECT_FALSE(detector.is_motion(score(scene_jpeg(640, 480, 0, i, (i % 5) * 3)))) << "still frame " << i;
+  for (uint32_t i = 1; i < 5; i++)
+    EXPECT_TRUE(detector.is_motion(score(scene_jpeg(640, 480, i * 5, 100 + i)))) << "moving frame " << i;
+}
+
+/* ---------------- duplicate frames ---------------- */
+class DuplicateTest : public CameraTest {
+ protected:
+  void SetUp() override {
+    CameraTest::SetUp();
+    this->cam_->set_requester_skip_duplicates(camera::WEB_REQUESTER, true);
+    for (uint32_t i = 0; i < 4; i++)
+      this->still_.push_back(scene_jpeg(WIDTH, HEIGHT, 0, i));
+    for (uint32_t i = 0; i < 8; i++)
+      this->moving_.push_back(scene_jpeg(WIDTH, HEIGHT, i * 5, 100 + i));
+  }
+
+  /* frames at 30 fps for this long, consumers letting go of each image at once; the loop runs once more for
+   * the worker's last comparison */
+  void run(int64_t ms, bool moving) {
+    for (int64_t end = host::now() + ms * 1000; host::now() < end; this->frames_++) {
+      const auto &frames = moving ? this->moving_ : this->still_;
+      ASSERT_TRUE(this->send(frames[this->frames_ % frames.size()]));
+      this->images_.clear();
+    }
+    this->loop();
+    this->images_.clear();
+  }
+  uint32_t delivered() const { return this->cam_->get_telemetry(USB_WEBCAM_FRAMES_DELIVERED_WEB); }
+  uint32_t suppressed() const { return this->cam_->get_telemetry(USB_WEBCAM_FRAMES_SUPPRESSED); }
+
+  std::vector<std::vector<uint8_t>> still_;
+  std::vector<std::vector<uint8_t>> moving_;
+  uint32_t frames_{0};
+};
+
+TEST_F(DuplicateTest, StillFramesAreHeldBack) {
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  this->run(1000, false);
+  EXPECT_EQ(this->delivered(), 1u);
+  // the frame after the delivered one finds the channel still holding it, every later one is compared
+  EXPECT_EQ(this->suppressed(), this->frames_ - 2);
+  const uint32_t checked = this->suppressed() + 1;
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_SUPPRESSION_RATIO), this->suppressed() * 1000 / checked);
+}
+
+TEST_F(DuplicateTest, ChangedFramesGoOut) {
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  this->run(1000, true);
+  // a channel busy with its last image skips a frame, none of the ones compared are held back
+  EXPECT_GE(this->delivered(), this->frames_ / 2);
+  EXPECT_EQ(this->suppressed(), 0u);
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_SUPPRESSION_RATIO), 0u);
+  // the scene stops moving: the first still frame differs from the last moving one, the rest are held back
+  const uint32_t moving = this->delivered();
+  this->run(500, false);
+  EXPECT_EQ(this->delivered(), moving + 1);
+  EXPECT_GE(this->suppressed(), 12u);
+}
+
+TEST_F(DuplicateTest, IdleIntervalLetsAFrameThrough) {
+  this->cam_->set_idle_update_interval(1000);
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  this->run(3000, false);
+  EXPECT_GE(this->delivered(), 3u);
+  EXPECT_LE(this->delivered(), 4u);
+}
+
+TEST_F(DuplicateTest, OnlyStreamsOfTheChannelAreHeldBack) {
+  this->cam_->set_requester_skip_duplicates(camera::API_REQUESTER, true);
+  this->start();
+  // snapshots always go out, even unchanged
+  for (int i = 0; i < 5; i++) {
+    this->cam_->request_image(camera::API_REQUESTER);
+    this->run(40, false);
+  }
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_FRAMES_DELIVERED_API), 5u);
+  EXPECT_EQ(this->suppressed(), 0u);
+  // a channel that does not skip gets every frame
+  this->cam_->set_requester_skip_duplicates(camera::API_REQUESTER, false);
+  this->cam_->start_stream(camera::API_REQUESTER);
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  this->run(1000, false);
+  EXPECT_GE(this->cam_->get_telemetry(USB_WEBCAM_FRAMES_DELIVERED_API), 5u + 29);
+  EXPECT_EQ(this->delivered(), 1u);
+}
+
+/* ---------------- in the component ---------------- */
+class MotionTest : public CameraTest {
+ protected:
+  static const uint32_t CHECK_MS = 100;
+
+  void SetUp() override {
+    CameraTest::SetUp();
+    this->cam_->set_motion_interval(CHECK_MS);
+    this->cam_->set_motion_timeout(1000);
+    this->trigger_ = std::make_unique<USBWebCamMotionTrigger>(this->cam_.get());
+    for (uint32_t i = 0; i < 4; i++)
+      this->still_.push_back(scene_jpeg(WIDTH, HEIGHT, 0, i));
+    for (uint32_t i = 0; i < 8; i++)
+      this->moving_.push_back(scene_jpeg(WIDTH, HEIGHT, i * 5, 100 + i));
+  }
+
+  /* frames at 30 fps for this long, each a still one or the next of the square moving */
+  void run(int64_t ms, bool moving) {
+    for (int64_t end = host::now() + ms * 1000; host::now() < end; this->frames_++) {
+      const auto &frames = moving ? this->moving_ : this->still_;
+      ASSERT_TRUE(this->send(frames[this->frames_ % frames.size()]));
+      this->release();
+    }
+  }
+  /* consumers let go of each image at once */
+  void release() {
+    this->delivered_ += this->images_.size();
+    this->images_.clear();
+  }
+
+  std::unique_ptr<USBWebCamMotionTrigger> trigger_;
+  std::vector<std::vector<uint8_t>> still_;
+  std::vector<std::vector<uint8_t>> moving_;
+  uint32_t frames_{0};
+  size_t delivered_{0};
+};
+
+TEST_F(MotionTest, StartsAndEndsAfterTheTimeout) {
+  this->start();
+  this->run(1000, false);
+  EXPECT_FALSE(this->cam_->is_motion());
+  EXPECT_EQ(this->trigger_->get_fired(), 0u);
+
+  this->run(300, true);
+  EXPECT_TRUE(this->cam_->is_motion());
+  EXPECT_EQ(this->trigger_->get_fired(), 1u);
+  EXPECT_GE(this->cam_->get_telemetry(USB_WEBCAM_MOTION_SCORE), 20u);
+  this->run(500, true);
+  EXPECT_EQ(this->trigger_->get_fired(), 1u);  // once per motion, not per check
+
+  this->run(700, false);
+  EXPECT_TRUE(this->cam_->is_motion());
+  // the background takes in where the square was, one check at a time,
+  // then the timeout runs out
+  this->run(5000, false);
+  EXPECT_FALSE(this->cam_->is_motion());
+  this->run(300, true);
+  EXPECT_EQ(this->trigger_->get_fired(), 2u);
+}
+
+TEST_F(MotionTest, ChecksKeepTheirPaceWithoutConsumers) {
+  this->start();
+  this->run(500, false);
+  this->run(300, true);
+  EXPECT_TRUE(this->cam_->is_motion());
+  EXPECT_EQ(this->delivered_, 0u);
+}
+
+TEST_F(MotionTest, GateHoldsStreamsAtTheIdleRate) {
+  this->cam_->set_motion_gate(true);
+  this->cam_->set_idle_update_interval(1000);
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  this->run(3000, false);
+  const size_t idle = this->delivered_;
+  EXPECT_GE(idle, 2u);
+  EXPECT_LE(idle, 4u);
+
+  this->run(1000, true);
+  EXPECT_GE(this->delivered_ - idle, 25u);  // close to every frame once motion starts
+}
+
+TEST_F(MotionTest, GateLetsSnapshotsThrough) {
+  this->cam_->set_motion_gate(true);
+  this->cam_->set_idle_update_interval(1000);
+  this->start();
+  this->run(100, false);
+  this->release();
+  this->cam_->request_image(camera::API_REQUESTER);
+  ASSERT_TRUE(this->send(this->still_[0]));
+  EXPECT_EQ(this->images_.size(), 1u);
+}
+
+}  // namespace
+}  // namespace esphome::usb_webcam
@@ -0,0 +1,330 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <cstring>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "webcam_fixture.h"
+
+namespace esphome::usb_webcam {
+namespace {
+
+/* The camera dropping off the bus and coming back, or staying on it and
+ * going quiet, as the mock usb_stream reports it. */
+class ReconnectTest : public CameraTest {
+ protected:
+  void SetUp() override {
+    CameraTest::SetUp();
+    this->cam_->set_stall_timeout(5000);
+  }
+
+  /* time passes without frames, the loop and its timers run every 10 ms */
+  void idle(int64_t ms) {
+    for (int64_t end = host::now() + ms * 1000; host::now() < end;) {
+      host::advance(10000);
+      this->loop();
+    }
+  }
+
+  /* stream to the web requester and let go of each image at once */
+  void stream(int frames) {
+    for (int i = 0; i < frames; i++) {
+      ASSERT_TRUE(this->send());
+      this->delivered_ += this->images_.size();
+      this->images_.clear();
+    }
+  }
+
+  size_t delivered_{0};
+};
+
+TEST_F(ReconnectTest, StreamsAgainAfterReconnect) {
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  this->stream(10);
+  EXPECT_EQ(this->cam_->link_state(), USB_WEBCAM_LINK_STREAMING);
+  const size_t before = this->delivered_;
+  const size_t heap = host::heap_in_use();
+
+  ASSERT_TRUE(host::usb_disconnect());
+  this->idle(1500);
+  EXPECT_EQ(this->cam_->link_state(), USB_WEBCAM_LINK_DISCONNECTED);
+  EXPECT_FALSE(host::usb_send_frame(this->frame_.data(), this->frame_.size()));
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_RECONNECTS), 1u);
+  EXPECT_EQ(host::heap_in_use(), heap);  // the buffers wait for the camera
+
+  ASSERT_TRUE(host::usb_connect());
+  this->loop();
+  EXPECT_EQ(this->cam_->link_state(), USB_WEBCAM_LINK_STARTING);
+  this->stream(10);
+  EXPECT_EQ(this->cam_->link_state(), USB_WEBCAM_LINK_STREAMING);
+  EXPECT_EQ(this->delivered_ - before, 10u);
+  EXPECT_EQ(host::heap_in_use(), heap);
+  // lost for 1.5 s, then the first frame a frame period after the reconnect
+  EXPECT_NEAR(this->cam_->get_telemetry(USB_WEBCAM_RECONNECT_TIME), 1500 + FRAME_US / 1000, 20);
+}
+
+TEST_F(ReconnectTest, SameCameraKeepsTheStreamSettings) {
+  this->start();
+  const uint32_t resets = host::usb_state().resets;
+  ASSERT_TRUE(host::usb_disconnect());
+  this->loop();
+  ASSERT_TRUE(host::usb_connect());
+  this->loop();
+  EXPECT_EQ(host::usb_state().resets, resets);
+  EXPECT_EQ(host::usb_state().width, WIDTH);
+  EXPECT_EQ(host::usb_state().height, HEIGHT);
+}
+
+TEST_F(ReconnectTest, OtherCameraIsNegotiatedAgain) {
+  this->start();
+  ASSERT_TRUE(host::usb_disconnect());
+  this->loop();
+  // plugged back in is a camera without 640x480
+  host::usb_set_frame_list({{1280, 720, 333333, 333333, 10000000, 0}, {320, 240, 333333, 333333, 10000000, 0}});
+  this->cam_->set_resolution_match(USB_WEBCAM_MATCH_NEAREST_BELOW);
+  ASSERT_TRUE(host::usb_connect());
+  this->loop();
+  EXPECT_EQ(host::usb_state().width, 320);
+  EXPECT_EQ(host::usb_state().height, 240);
+}
+
+TEST_F(ReconnectTest, FrameFromBeforeTheOutageIsDropped) {
+  this->start();
+  this->cam_->request_image(camera::API_REQUESTER);
+  // the frame completes, but the camera is gone before the loop picks it up
+  host::advance(FRAME_US);
+  ASSERT_TRUE(host::usb_send_frame(this->frame_.data(), this->frame_.size()));
+  ASSERT_TRUE(host::usb_disconnect());
+  this->loop();
+  EXPECT_TRUE(this->images_.empty());
+
+  // the snapshot still wanted goes out with the first frame after the reconnect
+  ASSERT_TRUE(host::usb_connect());
+  this->loop();
+  const std::vector<uint8_t> after = make_test_jpeg(WIDTH, HEIGHT, 9);
+  ASSERT_TRUE(this->send(after));
+  ASSERT_EQ(this->images_.size(), 1u);
+  EXPECT_EQ(this->image(0)->get_raw_buffer()->len, after.size());
+}
+
+TEST_F(ReconnectTest, HeldImagesStayValid) {
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  ASSERT_TRUE(this->send());
+  ASSERT_EQ(this->images_.size(), 1u);
+  ASSERT_TRUE(host::usb_disconnect());
+  this->idle(100);
+  USBWebCamImage *image = this->image(0);
+  EXPECT_EQ(memcmp(image->get_raw_buffer()->buf, this->frame_.data(), this->frame_.size()), 0);
+  this->images_.clear();
+  ASSERT_TRUE(host::usb_connect());
+  this->loop();
+  this->stream(3);
+  EXPECT_EQ(this->delivered_, 3u);
+}
+
+TEST_F(ReconnectTest, RepeatedOutagesAreCounted) {
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  for (int i = 0; i < 5; i++) {
+    this->stream(2);
+    ASSERT_TRUE(host::usb_disconnect());
+    this->idle(200);
+    ASSERT_TRUE(host::usb_connect());
+    this->loop();
+  }
+  this->stream(2);
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_RECONNECTS), 5u);
+  EXPECT_EQ(this->delivered_, 12u);
+  EXPECT_EQ(this->cam_->link_state(), USB_WEBCAM_LINK_STREAMING);
+}
+
+/* ---------------- stalls ---------------- */
+TEST_F(ReconnectTest, SilentCameraGetsItsStreamRestarted) {
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  this->stream(5);
+  const uint32_t suspends = host::usb_state().suspends;
+  this->idle(4000);
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_STREAM_RESTARTS), 0u);
+  this->idle(2000);
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_STREAM_RESTARTS), 1u);
+  EXPECT_EQ(host::usb_state().suspends, suspends + 1);
+  EXPECT_EQ(host::usb_state().resumes, host::usb_state().suspends);
+  EXPECT_EQ(this->cam_->link_state(), USB_WEBCAM_LINK_STARTING);
+
+  // still quiet: restarted again a stall timeout later, not on every check
+  this->idle(5500);
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_STREAM_RESTARTS), 2u);
+  this->stream(3);
+  EXPECT_EQ(this->cam_->link_state(), USB_WEBCAM_LINK_STREAMING);
+  EXPECT_EQ(this->delivered_, 8u);
+}
+
+TEST_F(ReconnectTest, CameraThatNeverStartsIsRestarted) {
+  this->start();
+  this->idle(6000);
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_STREAM_RESTARTS), 1u);
+}
+
+TEST_F(ReconnectTest, NoRestartsWhileDisconnected) {
+  this->start();
+  ASSERT_TRUE(host::usb_disconnect());
+  this->idle(20000);
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_STREAM_RESTARTS), 0u);
+}
+
+/* ---------------- power save ----------------
+ * suspend_after 2 s, so a stream suspends before the 5 s stall timeout */
+class PowerSaveTest : public ReconnectTest {
+ protected:
+  void SetUp() override {
+    ReconnectTest::SetUp();
+    this->cam_->set_suspend_after(2000);
+  }
+
+  /* stream for a while, then let nobody want frames until the stream suspends */
+  void suspend() {
+    this->start();
+    this->cam_->start_stream(camera::WEB_REQUESTER);
+    this->stream(3);
+    this->cam_->stop_stream(camera::WEB_REQUESTER);
+    this->idle(2100);
+    this->resumes_ = host::usb_state().resumes;
+    ASSERT_EQ(this->cam_->link_state(), USB_WEBCAM_LINK_SUSPENDED);
+    ASSERT_TRUE(host::usb_state().suspended);
+  }
+
+  /* usb_stream's resume count when suspend() returned */
+  uint32_t resumes_{0};
+};
+
+TEST_F(PowerSaveTest, SuspendsOnceNobodyWantsFrames) {
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  this->stream(3);
+  this->cam_->stop_stream(camera::WEB_REQUESTER);
+  const uint32_t suspends = host::usb_state().suspends;
+  this->idle(1900);
+  EXPECT_EQ(this->cam_->link_state(), USB_WEBCAM_LINK_STREAMING);
+  EXPECT_FALSE(host::usb_state().suspended);
+  this->idle(200);
+  EXPECT_EQ(this->cam_->link_state(), USB_WEBCAM_LINK_SUSPENDED);
+  EXPECT_EQ(host::usb_state().suspends, suspends + 1);
+  EXPECT_FALSE(host::usb_send_frame(this->frame_.data(), this->frame_.size()));
+}
+
+TEST_F(PowerSaveTest, DisabledByDefault) {
+  this->cam_->set_suspend_after(0);
+  this->start();
+  this->send();
+  this->idle(20000);
+  EXPECT_FALSE(host::usb_state().suspended);
+}
+
+TEST_F(PowerSaveTest, RequestResumesAfterWarmup) {
+  this->suspend();
+  this->cam_->set_warmup_frames(3);
+  this->cam_->request_image(camera::API_REQUESTER);
+  this->loop();
+  EXPECT_FALSE(host::usb_state().suspended);
+  EXPECT_EQ(host::usb_state().resumes, this->resumes_ + 1);
+  EXPECT_EQ(this->cam_->link_state(), USB_WEBCAM_LINK_STARTING);
+  // auto exposure settles on the first frames, they go nowhere
+  for (int i = 0; i < 3; i++) {
+    ASSERT_TRUE(this->send());
+    EXPECT_TRUE(this->images_.empty());
+  }
+  ASSERT_TRUE(this->send());
+  EXPECT_EQ(this->images_.size(), 1u);
+  EXPECT_EQ(this->cam_->link_state(), USB_WEBCAM_LINK_STREAMING);
+  EXPECT_NEAR(this->cam_->get_telemetry(USB_WEBCAM_RESUME_TIME), 4 * FRAME_US / 1000, 2);
+}
+
+TEST_F(PowerSaveTest, NoStallRestartsWhileSuspended) {
+  this->suspend();
+  this->idle(20000);
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_STREAM_RESTARTS), 0u);
+  EXPECT_EQ(this->cam_->link_state(), USB_WEBCAM_LINK_SUSPENDED);
+  EXPECT_EQ(host::usb_state().resumes, this->resumes_);
+}
+
+TEST_F(PowerSaveTest, QuietCameraIsSuspendedRatherThanRestarted) {
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  this->stream(3);
+  // the camera goes quiet as the stream stops being wanted, the suspend comes first
+  this->cam_->stop_stream(camera::WEB_REQUESTER);
+  this->idle(6000);
+  EXPECT_EQ(this->cam_->link_state(), USB_WEBCAM_LINK_SUSPENDED);
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_STREAM_RESTARTS), 0u);
+}
+
+TEST_F(PowerSaveTest, ResumeWithoutFramesIsRestarted) {
+  this->suspend();
+  this->cam_->set_warmup_frames(0);
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  this->loop();
+  EXPECT_EQ(this->cam_->link_state(), USB_WEBCAM_LINK_STARTING);
+  // the camera doesn't come back from the resume, the stall timeout covers it
+  this->idle(6000);
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_STREAM_RESTARTS), 1u);
+  EXPECT_FALSE(host::usb_state().suspended);
+  this->stream(2);
+  EXPECT_EQ(this->delivered_, 5u);
+  EXPECT_EQ(this->cam_->link_state(), USB_WEBCAM_LINK_STREAMING);
+}
+
+TEST_F(PowerSaveTest, RestartedStreamSuspendsOnceItStreams) {
+  // nobody wants frames and the camera never starts: restarted, but not suspended while starting
+  this->start();
+  this->idle(6000);
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_STREAM_RESTARTS), 1u);
+  EXPECT_EQ(this->cam_->link_state(), USB_WEBCAM_LINK_STARTING);
+  EXPECT_FALSE(host::usb_state().suspended);
+  ASSERT_TRUE(this->send());
+  this->loop();
+  EXPECT_EQ(this->cam_->link_state(), USB_WEBCAM_LINK_SUSPENDED);
+  EXPECT_TRUE(this->images_.empty());
+}
+
+TEST_F(PowerSaveTest, DisconnectWhileSuspended) {
+  this->suspend();
+  ASSERT_TRUE(host::usb_disconnect());
+  this->loop();
+  EXPECT_EQ(this->cam_->link_state(), USB_WEBCAM_LINK_DISCONNECTED);
+  EXPECT_EQ(this->cam_->get_telemetry(USB_WEBCAM_RECONNECTS), 1u);
+  // a snapshot wanted meanwhile has no stream to resume, it goes out once the camera is back
+  this->cam_->request_image(camera::API_REQUESTER);
+  this->idle(1000);
+  EXPECT_EQ(host::usb_state().resumes, this->resumes_);
+  ASSERT_TRUE(host::usb_connect());
+  this->loop();
+  EXPECT_EQ(this->cam_->link_state(), USB_WEBCAM_LINK_STARTING);
+  ASSERT_TRUE(this->send());
+  EXPECT_EQ(this->images_.size(), 1u);
+  EXPECT_EQ(this->cam_->link_state(), USB_WEBCAM_LINK_STREAMING);
+  // and with nobody wanting frames any more it suspends again
+  this->images_.clear();
+  this->idle(2100);
+  EXPECT_EQ(this->cam_->link_state(), USB_WEBCAM_LINK_SUSPENDED);
+}
+
+TEST_F(PowerSaveTest, CameraBackWhileSuspendedAndUnwanted) {
+  this->suspend();
+  ASSERT_TRUE(host::usb_disconnect());
+  this->idle(500);
+  // it comes back streaming, which nobody wants: suspended at its first frame, suspend_after is long past
+  ASSERT_TRUE(host::usb_connect());
+  this->loop();
+  ASSERT_TRUE(this->send());
+  this->loop();
+  EXPECT_EQ(this->cam_->link_state(), USB_WEBCAM_LINK_SUSPENDED);
+  EXPECT_TRUE(host::usb_state().suspended);
+  EXPECT_TRUE(this->images_.empty());
+}
+
+}  // namespace
+}  // namespace esphome::usb_webcam
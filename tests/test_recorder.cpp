@@ -0,0 +1,296 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "recorder.h"
+
+namespace esphome::usb_webcam {
+namespace {
+
+namespace fs = std::filesystem;
+
+std::vector<uint8_t> read_file(const fs::path &path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+/* A recorder writing into a fresh directory, the writer task drained by
+ * hand. Frame contents follow from the sequence number, so misplaced data
+ * shows. */
+class RecorderTest : public ::testing::Test {
+ protected:
+  static constexpr size_t BLOCK = 4096;
+
+  void SetUp() override {
+    const auto *info = ::testing::UnitTest::GetInstance()->current_test_info();
+    this->dir_ = fs::path(::testing::TempDir()) / (std::string("recorder_") + info->name());
+    fs::remove_all(this->dir_);
+    fs::create_directories(this->dir_);
+    this->recorder_.set_path(this->dir_.string());
+    this->init(8);
+  }
+  void TearDown() override { fs::remove_all(this->dir_); }
+
+  void init(size_t blocks) {
+    this->arena_.assign(blocks * BLOCK, 0);
+    this->recorder_.init(this->arena_.data(), this->arena_.size(), BLOCK);
+  }
+
+  bool append(uint32_t sequence, size_t length) {
+    this->frame_.resize(length);
+    for (size_t i = 0; i < length; i++)
+      this->frame_[i] = (uint8_t) (sequence * 31 + i / 1000);
+    camera_fb_t fb{};
+    fb.buf = this->frame_.data();
+    fb.len = length;
+    fb.width = 640;
+    fb.height = 480;
+    fb.eof_us = 1000000 + sequence * 33333;
+    fb.sequence = sequence;
+    if (!this->recorder_.append(fb))
+      return false;
+    this->sent_.push_back(this->frame_);
+    return true;
+  }
+  /* the writer task keeps up */
+  bool record(uint32_t sequence, size_t length) {
+    const bool appended = this->append(sequence, length);
+    while (this->recorder_.drain()) {
+    }
+    return appended;
+  }
+  void stop() {
+    this->recorder_.stop();
+    while (this->recorder_.drain()) {
+    }
+  }
+
+  fs::path data_file(uint32_t number) const { return this->dir_ / this->name(number, "mjp"); }
+  fs::path index_file(uint32_t number) const { return this->dir_ / this->name(number, "idx"); }
+  static std::string name(uint32_t number, const char *extension) {
+    char name[16];
+    snprintf(name, sizeof(name), "%08u.%s", number, extension);
+    return name;
+  }
+
+  std::vector<RecorderIndexEntry> read_index(uint32_t number) {
+    const std::vector<uint8_t> index = read_file(this->index_file(number));
+    EXPECT_GE(index.size(), sizeof(RECORDER_INDEX_MAGIC));
+    EXPECT_EQ(memcmp(index.data(), RECORDER_INDEX_MAGIC, sizeof(RECORDER_INDEX_MAGIC)), 0);
+    EXPECT_EQ((index.size() - sizeof(RECORDER_INDEX_MAGIC)) % sizeof(RecorderIndexEntry), 0u);
+    std::vector<RecorderIndexEntry> entries((index.size() - sizeof(RECORDER_INDEX_MAGIC)) / sizeof(RecorderIndexEntry));
+    memcpy(entries.data(), index.data() + sizeof(RECORDER_INDEX_MAGIC), entries.size() * sizeof(RecorderIndexEntry));
+    return entries;
+  }
+
+  /* segment number holds the sent frames from first on, back to back, each where its entry says */
+  void expect_segment(uint32_t number, size_t first, size_t count) {
+    const std::vector<uint8_t> data = read_file(this->data_file(number));
+    const std::vector<RecorderIndexEntry> entries = this->read_index(number);
+    ASSERT_EQ(entries.size(), count) << "segment " << number;
+    uint32_t offset = 0;
+    for (size_t i = 0; i < count; i++) {
+      const std::vector<uint8_t> &frame = this->sent_[first + i];
+      const RecorderIndexEntry &entry = entries[i];
+      EXPECT_EQ(entry.offset, offset);
+      ASSERT_EQ(entry.length, frame.size());
+      EXPECT_EQ(entry.width, 640);
+      EXPECT_EQ(entry.height, 480);
+      EXPECT_EQ(entry.eof_us, 1000000 + (int64_t) entry.sequence * 33333);
+      ASSERT_LE(entry.offset + entry.length, data.size());
+      EXPECT_EQ(memcmp(data.data() + entry.offset, frame.data(), frame.size()), 0) << "frame " << entry.sequence;
+      offset += entry.length;
+    }
+    EXPECT_EQ(data.size(), offset);
+  }
+
+  fs::path dir_;
+  std::vector<uint8_t> arena_;
+  std::vector<uint8_t> frame_;
+  std::vector<std::vector<uint8_t>> sent_;
+  Recorder recorder_;
+};
+
+TEST_F(RecorderTest, SegmentHoldsTheFramesAndTheirIndex) {
+  ASSERT_TRUE(this->recorder_.start());
+  const size_t lengths[] = {1000, 5000, 4096, 10000, 17};  // within a block, across blocks, exactly one
+  for (uint32_t i = 0; i < 5; i++)
+    ASSERT_TRUE(this->record(i, lengths[i]));
+  this->stop();
+
+  this->expect_segment(0, 0, 5);
+  const std::vector<RecorderIndexEntry> entries = this->read_index(0);
+  for (uint32_t i = 0; i < 5; i++)
+    EXPECT_EQ(entries[i].sequence, i);
+  EXPECT_EQ(this->recorder_.get_frames(), 5u);
+  EXPECT_EQ(this->recorder_.get_segments(), 1u);
+  EXPECT_EQ(this->recorder_.get_bytes_written(), 1000u + 5000 + 4096 + 10000 + 17);
+  EXPECT_EQ(this->recorder_.get_dropped(), 0u);
+  EXPECT_FALSE(this->recorder_.has_failed());
+}
+
+TEST_F(RecorderTest, WritesWholeBlocks) {
+  ASSERT_TRUE(this->recorder_.start());
+  ASSERT_TRUE(this->record(0, 3000));
+  EXPECT_FALSE(fs::exists(this->data_file(0)));  // nothing until a block is full
+  ASSERT_TRUE(this->append(1, 3000));
+  ASSERT_TRUE(this->recorder_.drain());
+  EXPECT_FALSE(this->recorder_.drain());
+  EXPECT_EQ(fs::file_size(this->data_file(0)), BLOCK);
+  // the second frame is only partly written, so its entry waits
+  EXPECT_EQ(this->recorder_.get_frames(), 1u);
+
+  this->stop();
+  EXPECT_EQ(fs::file_size(this->data_file(0)), 6000u);
+  this->expect_segment(0, 0, 2);
+}
+
+TEST_F(RecorderTest, NumberingGoesOnFromTheHighestSegment) {
+  for (const char *name : {"00000007.mjp", "00000041.MJP", "00000099.idx", "123.mjp", "notes.txt"})
+    std::ofstream(this->dir_ / name).put('x');
+  ASSERT_TRUE(this->recorder_.start());
+  ASSERT_TRUE(this->record(0, 2000));
+  this->stop();
+  ASSERT_TRUE(this->recorder_.start());
+  ASSERT_TRUE(this->record(1, 2000));
+  this->stop();
+  this->expect_segment(42, 0, 1);
+  this->expect_segment(43, 1, 1);
+  EXPECT_EQ(fs::file_size(this->dir_ / "00000041.MJP"), 1u);
+}
+
+TEST_F(RecorderTest, SegmentsRollOverAtTheSegmentSize) {
+  this->recorder_.set_segment_size(10000);
+  ASSERT_TRUE(this->recorder_.start());
+  for (uint32_t i = 0; i < 7; i++)
+    ASSERT_TRUE(this->record(i, 3000));
+  EXPECT_EQ(this->recorder_.get_segments(), 2u);
+  this->stop();
+  EXPECT_EQ(this->recorder_.get_segments(), 3u);
+  this->expect_segment(0, 0, 3);
+  this->expect_segment(1, 3, 3);
+  this->expect_segment(2, 6, 1);
+  EXPECT_FALSE(fs::exists(this->data_file(3)));
+}
+
+TEST_F(RecorderTest, FrameLargerThanTheSegmentGetsOneOfItsOwn) {
+  this->recorder_.set_segment_size(10000);
+  ASSERT_TRUE(this->recorder_.start());
+  ASSERT_TRUE(this->record(0, 2000));
+  ASSERT_TRUE(this->record(1, 15000));
+  ASSERT_TRUE(this->record(2, 2000));
+  this->stop();
+  this->expect_segment(0, 0, 1);
+  this->expect_segment(1, 1, 1);
+  this->expect_segment(2, 2, 1);
+}
+
+TEST_F(RecorderTest, FullRingDropsFrames) {
+  this->init(4);  // 3 blocks to fill, one kept back
+  ASSERT_TRUE(this->recorder_.start());
+  ASSERT_TRUE(this->append(0, 5000));
+  ASSERT_TRUE(this->append(1, 5000));
+  EXPECT_FALSE(this->append(2, 5000));  // the writer fell behind
+  EXPECT_FALSE(this->append(3, 4 * BLOCK));  // never fits
+  EXPECT_EQ(this->recorder_.get_dropped(), 2u);
+  while (this->recorder_.drain()) {
+  }
+  ASSERT_TRUE(this->append(4, 5000));
+  this->stop();
+  this->expect_segment(0, 0, 3);
+  EXPECT_EQ(this->read_index(0)[2].sequence, 4u);
+}
+
+TEST_F(RecorderTest, IndexIsSyncedBeforeTheSegmentCloses) {
+  this->init(64);
+  ASSERT_TRUE(this->recorder_.start());
+  uint32_t sequence = 0;
+  while (this->recorder_.get_bytes_written() < 1024 * 1024 + 64 * 1024)
+    ASSERT_TRUE(this->record(sequence++, 30000));
+  // entries of what is on the card are in the index file, not only in a stdio buffer
+  const uintmax_t index_size = fs::file_size(this->index_file(0));
+  EXPECT_GE((index_size - sizeof(RECORDER_INDEX_MAGIC)) / sizeof(RecorderIndexEntry), 1024u * 1024 / 30000);
+  this->stop();
+  this->expect_segment(0, 0, sequence);
+}
+
+TEST_F(RecorderTest, TooSmallBufferLeavesItDisabled) {
+  this->init(2);
+  EXPECT_FALSE(this->recorder_.is_enabled());
+  EXPECT_FALSE(this->recorder_.start());
+  EXPECT_FALSE(this->recorder_.is_recording());
+}
+
+TEST_F(RecorderTest, MissingDirectoryFailsAndStops) {
+  fs::remove_all(this->dir_);
+  ASSERT_TRUE(this->recorder_.start());
+  ASSERT_TRUE(this->append(0, 5000));
+  while (this->recorder_.drain()) {
+  }
+  ASSERT_TRUE(this->recorder_.has_failed());
+  EXPECT_STREQ(this->recorder_.get_error(), "directory not found");
+  EXPECT_FALSE(this->append(1, 1000));
+  EXPECT_FALSE(this->recorder_.is_recording());
+  EXPECT_EQ(this->recorder_.get_frames(), 0u);
+
+  // the card is back: recording starts again into a new segment
+  while (this->recorder_.drain()) {
+  }
+  fs::create_directories(this->dir_);
+  this->sent_.clear();
+  ASSERT_TRUE(this->recorder_.start());
+  EXPECT_FALSE(this->recorder_.has_failed());
+  ASSERT_TRUE(this->record(2, 5000));
+  this->stop();
+  this->expect_segment(0, 0, 1);
+  EXPECT_EQ(this->recorder_.get_frames(), 1u);
+}
+
+TEST_F(RecorderTest, WriterOnItsOwnThread) {
+  this->init(16);
+  this->recorder_.set_segment_size(256 * 1024);
+  std::atomic<bool> done{false};
+  std::thread writer([this, &done] {
+    while (!done.load()) {
+      if (!this->recorder_.drain())
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    while (this->recorder_.drain()) {
+    }
+  });
+  ASSERT_TRUE(this->recorder_.start());
+  size_t bytes = 0;
+  for (uint32_t i = 0; i < 200; i++) {
+    const size_t length = 3000 + (i * 7919) % 20000;
+    while (!this->append(i, length))
+      std::this_thread::yield();
+    bytes += length;
+  }
+  this->recorder_.stop();
+  done.store(true);
+  writer.join();
+
+  EXPECT_EQ(this->recorder_.get_frames(), 200u);
+  EXPECT_EQ(this->recorder_.get_bytes_written(), bytes);
+  size_t first = 0;
+  for (uint32_t number = 0; number < this->recorder_.get_segments(); number++) {
+    const size_t count = this->read_index(number).size();
+    this->expect_segment(number, first, count);
+    first += count;
+  }
+  EXPECT_EQ(first, 200u);
+}
+
+}  // namespace
+}  // namespace esphome::usb_webcam
@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <cstdint>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "spsc_ring.h"
+
+namespace esphome::usb_webcam {
+namespace {
+
+/* a ring whose indices start anywhere, to get them past the wrap quickly */
+template<typename T, size_t N> class OffsetRing : public SPSCRing<T, N> {
+ public:
+  explicit OffsetRing(uint32_t start) {
+    this->head_.store(start);
+    this->tail_.store(start);
+  }
+};
+
+TEST(SPSCRingTest, StartsEmpty) {
+  SPSCRing<int, 4> ring;
+  int item;
+  EXPECT_TRUE(ring.empty());
+  EXPECT_FALSE(ring.full());
+  EXPECT_FALSE(ring.pop(&item));
+  EXPECT_EQ(ring.capacity(), 4u);
+}
+
+TEST(SPSCRingTest, PopsInPushOrder) {
+  SPSCRing<int, 4> ring;
+  for (int i = 1; i <= 3; i++)
+    ASSERT_TRUE(ring.push(i));
+  int item;
+  for (int i = 1; i <= 3; i++) {
+    ASSERT_TRUE(ring.pop(&item));
+    EXPECT_EQ(item, i);
+  }
+  EXPECT_TRUE(ring.empty());
+}
+
+TEST(SPSCRingTest, HoldsExactlyCapacityItems) {
+  SPSCRing<int, 4> ring;
+  for (int i = 0; i < 4; i++)
+    ASSERT_TRUE(ring.push(i));
+  EXPECT_TRUE(ring.full());
+  EXPECT_FALSE(ring.push(4));
+  int item;
+  ASSERT_TRUE(ring.pop(&item));
+  EXPECT_EQ(item, 0);
+  EXPECT_FALSE(ring.full());
+  EXPECT_TRUE(ring.push(4));
+}
+
+TEST(SPSCRingTest, IndicesWrapAround) {
+  OffsetRing<uint32_t, 8> ring(UINT32_MAX - 5);
+  uint32_t next_push = 0;
+  uint32_t next_pop = 0;
+  for (int round = 0; round < 20; round++) {
+    for (int i = 0; i < 5; i++)
+      ASSERT_TRUE(ring.push(next_push++));
+    uint32_t item;
+    for (int i = 0; i < 5; i++) {
+      ASSERT_TRUE(ring.pop(&item));
+      ASSERT_EQ(item, next_pop++);
+    }
+  }
+  // full and empty still hold on both sides of the wrap
+  for (int i = 0; i < 8; i++)
+    ASSERT_TRUE(ring.push(i));
+  EXPECT_TRUE(ring.full());
+  EXPECT_FALSE(ring.push(8));
+}
+
+TEST(SPSCRingTest, ConcurrentProducerAndConsumer) {
+  static const uint32_t ITEMS = 1000000;
+  SPSCRing<uint64_t, 16> ring;
+  std::thread producer([&]() {
+    for (uint32_t i = 0; i < ITEMS; i++) {
+      // the payload ties both halves to the index, a torn copy shows
+      const uint64_t item = (uint64_t) i << 32 | (~i & 0xFFFFFFFF);
+      while (!ring.push(item))
+        std::this_thread::yield();
+    }
+  });
+  for (uint32_t i = 0; i < ITEMS; i++) {
+    uint64_t item;
+    while (!ring.pop(&item))
+      std::this_thread::yield();
+    ASSERT_EQ(item >> 32, i);
+    ASSERT_EQ(item & 0xFFFFFFFF, ~i & 0xFFFFFFFF);
+  }
+  producer.join();
+  EXPECT_TRUE(ring.empty());
+}
+
+}  // namespace
+}  // namespace esphome::usb_webcam
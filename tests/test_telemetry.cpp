@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <gtest/gtest.h>
+
+#include "webcam_fixture.h"
+
+namespace esphome::usb_webcam {
+namespace {
+
+class TelemetryTest : public CameraTest {
+ protected:
+  uint32_t telemetry(USBWebCamTelemetry telemetry) const { return this->cam_->get_telemetry(telemetry); }
+};
+
+TEST_F(TelemetryTest, NothingCountedBeforeFrames) {
+  this->start();
+  for (int telemetry = 0; telemetry < USB_WEBCAM_TELEMETRY_COUNT; telemetry++) {
+    if (telemetry != USB_WEBCAM_BUFFER_BYTES) {
+      EXPECT_EQ(this->telemetry((USBWebCamTelemetry) telemetry), 0u) << telemetry;
+    }
+  }
+  EXPECT_GT(this->telemetry(USB_WEBCAM_BUFFER_BYTES), 0u);
+}
+
+TEST_F(TelemetryTest, DeliveriesAreCountedPerRequester) {
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  for (int i = 0; i < 3; i++) {
+    ASSERT_TRUE(this->send());
+    this->images_.clear();
+  }
+  this->cam_->request_image(camera::API_REQUESTER);
+  ASSERT_TRUE(this->send());
+  EXPECT_EQ(this->telemetry(USB_WEBCAM_FRAMES_RECEIVED), 4u);
+  EXPECT_EQ(this->telemetry(USB_WEBCAM_FRAMES_DELIVERED_WEB), 4u);
+  EXPECT_EQ(this->telemetry(USB_WEBCAM_FRAMES_DELIVERED_API), 1u);
+}
+
+TEST_F(TelemetryTest, SmallFramesAreDropped) {
+  this->cam_->set_drop_size(this->frame_.size() + 1);
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  ASSERT_TRUE(this->send());
+  ASSERT_TRUE(this->send());
+  EXPECT_TRUE(this->images_.empty());
+  EXPECT_EQ(this->telemetry(USB_WEBCAM_FRAMES_RECEIVED), 2u);
+  EXPECT_EQ(this->telemetry(USB_WEBCAM_FRAMES_DROPPED_SMALL), 2u);
+  EXPECT_EQ(this->telemetry(USB_WEBCAM_FRAMES_DELIVERED_WEB), 0u);
+}
+
+TEST_F(TelemetryTest, EachDropIsCountedOnce) {
+  this->cam_->set_drop_size(100);
+  this->cam_->set_frame_validation(USB_WEBCAM_VALIDATION_BASIC);
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  const std::vector<uint8_t> small(50, 0xFF);
+  std::vector<uint8_t> truncated(this->frame_.begin(), this->frame_.end() - 2);
+  ASSERT_TRUE(this->send(small));
+  ASSERT_TRUE(this->send(truncated));
+  ASSERT_TRUE(this->send());
+  EXPECT_EQ(this->telemetry(USB_WEBCAM_FRAMES_RECEIVED), 3u);
+  EXPECT_EQ(this->telemetry(USB_WEBCAM_FRAMES_DROPPED_SMALL), 1u);
+  EXPECT_EQ(this->telemetry(USB_WEBCAM_FRAMES_DROPPED_INVALID), 1u);
+  EXPECT_EQ(this->telemetry(USB_WEBCAM_FRAMES_DROPPED_OVERFLOW), 0u);
+  EXPECT_EQ(this->telemetry(USB_WEBCAM_FRAMES_DELIVERED_WEB), 1u);
+}
+
+TEST_F(TelemetryTest, RatesCoverTheLastInterval) {
+  this->cam_->set_telemetry_interval(1000);
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  // two seconds at 30 fps, the second sample sees one whole interval
+  for (int i = 0; i < 60; i++) {
+    ASSERT_TRUE(this->send());
+    this->images_.clear();
+  }
+  const uint32_t frame_rate = this->telemetry(USB_WEBCAM_FRAME_RATE);
+  EXPECT_NEAR(frame_rate, 30000, 1000);
+  EXPECT_NEAR(this->telemetry(USB_WEBCAM_BYTES_PER_SECOND), (double) this->frame_.size() * frame_rate / 1000,
+              this->frame_.size());
+  // a whole interval without frames, no rate
+  for (int i = 0; i < 2; i++) {
+    host::advance(1000000);
+    this->loop();
+  }
+  EXPECT_EQ(this->telemetry(USB_WEBCAM_FRAME_RATE), 0u);
+  EXPECT_EQ(this->telemetry(USB_WEBCAM_BYTES_PER_SECOND), 0u);
+}
+
+TEST_F(TelemetryTest, ReleaseLatencyIsHowLongConsumersHoldImages) {
+  this->start();
+  this->cam_->start_stream(camera::WEB_REQUESTER);
+  ASSERT_TRUE(this->send());
+  ASSERT_EQ(this->images_.size(), 1u);
+  host::advance(50000);
+  this->images_.clear();
+  this->loop();
+  EXPECT_EQ(this->telemetry(USB_WEBCAM_RELEASE_LATENCY_P99), 65536u);  // the bucket above 50 ms
+}
+
+}  // namespace
+}  // namespace esphome::usb_webcam
@@ -0,0 +1,290 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <initializer_list>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "uvc_descriptors.h"
+#include "webcam_fixture.h"
+
+namespace esphome::usb_webcam {
+namespace {
+
+/* ---------------- canned descriptors ---------------- */
+/* Builds a configuration descriptor one descriptor at a time; each starts
+ * with its length, filled in when it is closed. */
+class DescriptorBlob {
+ public:
+  DescriptorBlob &begin(uint8_t type) {
+    this->start_ = this->data_.size();
+    this->data_.push_back(0);
+    this->data_.push_back(type);
+    return *this;
+  }
+  DescriptorBlob &u8(std::initializer_list<uint8_t> bytes) {
+    this->data_.insert(this->data_.end(), bytes);
+    return *this;
+  }
+  DescriptorBlob &u16(uint16_t value) { return this->u8({(uint8_t) value, (uint8_t) (value >> 8)}); }
+  DescriptorBlob &u32(uint32_t value) {
+    return this->u8({(uint8_t) value, (uint8_t) (value >> 8), (uint8_t) (value >> 16), (uint8_t) (value >> 24)});
+  }
+  DescriptorBlob &end() {
+    this->data_[this->start_] = this->data_.size() - this->start_;
+    return *this;
+  }
+
+  DescriptorBlob &interface(uint8_t number, uint8_t alt, uint8_t subclass) {
+    return this->begin(0x04).u8({number, alt, 0, 0x0E, subclass, 0, 0}).end();
+  }
+  DescriptorBlob &endpoint(uint8_t address, uint8_t attributes, uint16_t max_packet) {
+    return this->begin(0x05).u8({address, attributes}).u16(max_packet).u8({1}).end();
+  }
+  DescriptorBlob &mjpeg_format(uint8_t index, uint8_t frames) {
+    return this->begin(0x24).u8({0x06, index, frames, 0, 1, 0, 0, 0, 0}).end();
+  }
+  DescriptorBlob &mjpeg_frame(uint8_t index, uint16_t width, uint16_t height, uint32_t interval,
+                              std::initializer_list<uint32_t> intervals, uint32_t max_frame_bytes = 0) {
+    this->begin(0x24).u8({0x07, index, 0}).u16(width).u16(height);
+    this->u32(width * height * 16).u32(width * height * 16 * 30);
+    this->u32(max_frame_bytes != 0 ? max_frame_bytes : width * height * 2).u32(interval);
+    this->u8({(uint8_t) intervals.size()});
+    for (uint32_t value : intervals)
+      this->u32(value);
+    return this->end();
+  }
+  DescriptorBlob &mjpeg_frame_continuous(uint8_t index, uint16_t width, uint16_t height, uint32_t min, uint32_t max,
+                                         uint32_t step) {
+    this->begin(0x24).u8({0x07, index, 0}).u16(width).u16(height);
+    this->u32(0).u32(0).u32(width * height * 2).u32(min).u8({0});
+    return this->u32(min).u32(max).u32(step).end();
+  }
+
+  const std::vector<uint8_t> &data() const { return this->data_; }
+
+ protected:
+  std::vector<uint8_t> data_;
+  size_t start_{0};
+};
+
+/* VideoControl with a camera terminal and processing unit, then the
+ * streaming interface with an uncompressed and an MJPEG format */
+DescriptorBlob webcam_header() {
+  DescriptorBlob blob;
+  blob.begin(0x02).u16(0).u8({2, 1, 0, 0x80, 250}).end();  // configuration, total length unused by the parser
+  blob.begin(0x0B).u8({0, 2, 0x0E, 0x03, 0, 0}).end();     // interface association
+  blob.interface(0, 0, 0x01);
+  blob.begin(0x24).u8({0x01}).u16(0x0110).u16(0).u32(48000000).u8({1, 1}).end();
+  blob.begin(0x24).u8({0x02, 1}).u16(0x0201).u8({0, 0}).u16(0).u16(0).u16(0).u8({3, 0x0A, 0x00, 0x00}).end();
+  blob.begin(0x24).u8({0x05, 2, 1}).u16(0).u8({2, 0x5B, 0x17, 0}).end();
+  blob.begin(0x24).u8({0x03, 3}).u16(0x0101).u8({0, 2, 0}).end();
+  blob.endpoint(0x87, 0x03, 16);  // interrupt status endpoint of the control interface
+  blob.interface(1, 0, 0x02);
+  blob.begin(0x24).u8({0x01, 2}).u16(0).u8({0x81, 0, 3, 0, 0, 0, 1, 0}).end();
+  blob.begin(0x24).u8({0x04, 1, 1}).u32(0x32595559).u32(0x00100000).u32(0xAA000080).u32(0x719B3800)
+      .u8({16, 1, 0, 0, 0, 0}).end();
+  // a frame misfiled after the uncompressed format is not an MJPEG frame
+  blob.mjpeg_frame(1, 1920, 1080, 333333, {333333});
+  blob.mjpeg_format(2, 2);
+  blob.mjpeg_frame(1, 640, 480, 333333, {333333, 666666, 1000000});
+  blob.mjpeg_frame_continuous(2, 320, 240, 333333, 2000000, 333333);
+  return blob;
+}
+
+/* isochronous camera: three alt settings, the last one high bandwidth */
+std::vector<uint8_t> isoc_webcam() {
+  DescriptorBlob blob = webcam_header();
+  blob.interface(1, 1, 0x02).endpoint(0x81, 0x05, 128);
+  blob.interface(1, 2, 0x02).endpoint(0x81, 0x05, 512);
+  blob.interface(1, 3, 0x02).endpoint(0x81, 0x05, 0x0800 | 1000);
+  blob.interface(1, 4, 0x02).endpoint(0x01, 0x05, 512);  // OUT, not ours
+  return blob.data();
+}
+
+/* bulk camera: the endpoint sits on alt setting 0 */
+std::vector<uint8_t> bulk_webcam() {
+  DescriptorBlob blob = webcam_header();
+  blob.endpoint(0x82, 0x02, 64);
+  return blob.data();
+}
+
+/* both: isochronous alt settings and a bulk endpoint on another interface */
+std::vector<uint8_t> mixed_webcam() {
+  DescriptorBlob blob = webcam_header();
+  blob.interface(1, 1, 0x02).endpoint(0x81, 0x05, 128);
+  blob.interface(1, 2, 0x02).endpoint(0x81, 0x05, 256);
+  blob.interface(2, 0, 0x02).endpoint(0x83, 0x02, 64);
+  return blob.data();
+}
+
+UVCConfigDescriptor parse(const std::vector<uint8_t> &blob) {
+  UVCConfigDescriptor desc;
+  EXPECT_TRUE(parse_uvc_config_descriptor(blob.data(), blob.size(), &desc));
+  return desc;
+}
+
+/* ---------------- parse_uvc_config_descriptor ---------------- */
+TEST(ParseDescriptorTest, StreamingAltSettings) {
+  const UVCConfigDescriptor desc = parse(isoc_webcam());
+  ASSERT_EQ(desc.alts.size(), 3u);
+  EXPECT_EQ(desc.alts[0].interface, 1);
+  EXPECT_EQ(desc.alts[0].alt_setting, 1);
+  EXPECT_EQ(desc.alts[0].ep_addr, 0x81);
+  EXPECT_FALSE(desc.alts[0].bulk);
+  EXPECT_EQ(desc.alts[0].mps, 128);
+  EXPECT_EQ(desc.alts[1].mps, 512);
+  EXPECT_EQ(desc.alts[2].alt_setting, 3);
+  EXPECT_EQ(desc.alts[2].mps, 2000);  // two transactions per microframe
+}
+
+TEST(ParseDescriptorTest, MjpegFramesOnly) {
+  const UVCConfigDescriptor desc = parse(isoc_webcam());
+  ASSERT_EQ(desc.frames.size(), 2u);
+  const UVCFrameDescriptor &discrete = desc.frames[0];
+  EXPECT_EQ(discrete.format_index, 2);
+  EXPECT_EQ(discrete.frame_index, 1);
+  EXPECT_EQ(discrete.info.width, 640);
+  EXPECT_EQ(discrete.info.height, 480);
+  EXPECT_EQ(discrete.max_frame_bytes, 640u * 480 * 2);
+  EXPECT_EQ(discrete.info.interval, 333333u);
+  EXPECT_EQ(discrete.info.interval_min, 333333u);
+  EXPECT_EQ(discrete.info.interval_max, 1000000u);
+  EXPECT_EQ(discrete.info.interval_step, 0u);
+  const UVCFrameDescriptor &continuous = desc.frames[1];
+  EXPECT_EQ(continuous.frame_index, 2);
+  EXPECT_EQ(continuous.info.width, 320);
+  EXPECT_EQ(continuous.info.interval_min, 333333u);
+  EXPECT_EQ(continuous.info.interval_max, 2000000u);
+  EXPECT_EQ(continuous.info.interval_step, 333333u);
+}
+
+TEST(ParseDescriptorTest, BulkEndpoint) {
+  const UVCConfigDescriptor desc = parse(bulk_webcam());
+  ASSERT_EQ(desc.alts.size(), 1u);
+  EXPECT_TRUE(desc.alts[0].bulk);
+  EXPECT_EQ(desc.alts[0].alt_setting, 0);
+  EXPECT_EQ(desc.alts[0].ep_addr, 0x82);
+  EXPECT_EQ(desc.alts[0].mps, 64);
+}
+
+TEST(ParseDescriptorTest, MalformedBlobs) {
+  std::vector<uint8_t> blob = isoc_webcam();
+  UVCConfigDescriptor desc;
+  // cut in the middle of a descriptor
+  EXPECT_FALSE(parse_uvc_config_descriptor(blob.data(), blob.size() - 3, &desc));
+  // a zero length would never advance
+  std::vector<uint8_t> zero = blob;
+  zero[9] = 0;
+  EXPECT_FALSE(parse_uvc_config_descriptor(zero.data(), zero.size(), &desc));
+  EXPECT_FALSE(parse_uvc_config_descriptor(blob.data(), 0, &desc));
+}
+
+TEST(ParseDescriptorTest, NoStreamingEndpoint) {
+  const std::vector<uint8_t> blob = webcam_header().data();
+  UVCConfigDescriptor desc;
+  EXPECT_FALSE(parse_uvc_config_descriptor(blob.data(), blob.size(), &desc));
+}
+
+/* ---------------- select_transfer ---------------- */
+TEST(SelectTransferTest, SmallestIsocAltThatFits) {
+  const UVCConfigDescriptor desc = parse(isoc_webcam());
+  UVCTransferConfig xfer;
+  ASSERT_TRUE(select_transfer(desc, USB_WEBCAM_TRANSFER_AUTO, 100000, 1023, &xfer));
+  EXPECT_EQ(xfer.alt_setting, 1);
+  EXPECT_EQ(xfer.mps, 128);
+  ASSERT_TRUE(select_transfer(desc, USB_WEBCAM_TRANSFER_ISOC, 300000, 1023, &xfer));
+  EXPECT_EQ(xfer.alt_setting, 2);
+  EXPECT_FALSE(xfer.bulk);
+  EXPECT_EQ(xfer.interface, 1);
+  EXPECT_EQ(xfer.ep_addr, 0x81);
+}
+
+TEST(SelectTransferTest, IsocFallsBackToTheLargestAllowed) {
+  const UVCConfigDescriptor desc = parse(isoc_webcam());
+  UVCTransferConfig xfer;
+  // the high bandwidth alt would fit but is beyond max_mps
+  ASSERT_TRUE(select_transfer(desc, USB_WEBCAM_TRANSFER_ISOC, 1500000, 512, &xfer));
+  EXPECT_EQ(xfer.alt_setting, 2);
+  ASSERT_TRUE(select_transfer(desc, USB_WEBCAM_TRANSFER_ISOC, 1500000, 2048, &xfer));
+  EXPECT_EQ(xfer.alt_setting, 3);
+  EXPECT_FALSE(select_transfer(desc, USB_WEBCAM_TRANSFER_ISOC, 1000, 64, &xfer));
+}
+
+TEST(SelectTransferTest, AutoTakesBulkWhenIsocIsTooSmall) {
+  const UVCConfigDescriptor desc = parse(mixed_webcam());
+  UVCTransferConfig xfer;
+  ASSERT_TRUE(select_transfer(desc, USB_WEBCAM_TRANSFER_AUTO, 200000, 512, &xfer));
+  EXPECT_FALSE(xfer.bulk);
+  EXPECT_EQ(xfer.mps, 256);
+  ASSERT_TRUE(select_transfer(desc, USB_WEBCAM_TRANSFER_AUTO, 600000, 512, &xfer));
+  EXPECT_TRUE(xfer.bulk);
+  EXPECT_EQ(xfer.interface, 2);
+  EXPECT_EQ(xfer.ep_addr, 0x83);
+}
+
+TEST(SelectTransferTest, BulkOnlyWhereThereIsBulk) {
+  UVCTransferConfig xfer;
+  EXPECT_FALSE(select_transfer(parse(isoc_webcam()), USB_WEBCAM_TRANSFER_BULK, 100000, 512, &xfer));
+  ASSERT_TRUE(select_transfer(parse(bulk_webcam()), USB_WEBCAM_TRANSFER_BULK, 100000, 512, &xfer));
+  EXPECT_TRUE(xfer.bulk);
+  EXPECT_FALSE(select_transfer(parse(bulk_webcam()), USB_WEBCAM_TRANSFER_ISOC, 100000, 512, &xfer));
+  ASSERT_TRUE(select_transfer(parse(bulk_webcam()), USB_WEBCAM_TRANSFER_AUTO, 100000, 512, &xfer));
+  EXPECT_TRUE(xfer.bulk);
+}
+
+TEST(SelectTransferTest, Throughput) {
+  EXPECT_EQ(transfer_bytes_per_second({false, 1, 1, 0x81, 512}), 512000u);
+  EXPECT_EQ(transfer_bytes_per_second({true, 1, 0, 0x82, 64}), 64u * 19 * 1000);
+}
+
+/* ---------------- chosen by the component ---------------- */
+class TransferSetupTest : public CameraTest {};
+
+TEST_F(TransferSetupTest, OpensTheAltSettingTheStreamNeeds) {
+  // 640x480 at 10 fps is about 307 kB/s
+  this->cam_->set_config_descriptor(isoc_webcam());
+  this->cam_->set_max_update_interval(100);
+  this->start();
+  const uvc_config_t &config = host::usb_state().config;
+  EXPECT_EQ(config.xfer_type, UVC_XFER_ISOC);
+  EXPECT_EQ(config.interface, 1);
+  EXPECT_EQ(config.interface_alt, 2);
+  EXPECT_EQ(config.ep_addr, 0x81);
+  EXPECT_EQ(config.ep_mps, 512u);
+}
+
+TEST_F(TransferSetupTest, BulkCamera) {
+  this->cam_->set_config_descriptor(bulk_webcam());
+  this->start();
+  const uvc_config_t &config = host::usb_state().config;
+  EXPECT_EQ(config.xfer_type, UVC_XFER_BULK);
+  EXPECT_EQ(config.interface_alt, 0);
+  EXPECT_EQ(config.ep_addr, 0x82);
+  EXPECT_EQ(config.ep_mps, 64u);
+}
+
+TEST_F(TransferSetupTest, UnusableDescriptorKeepsTheConfiguredTransfer) {
+  this->cam_->set_config_descriptor(webcam_header().data());
+  this->cam_->set_transfer(1, 5, 0x84, 256);
+  this->start();
+  const uvc_config_t &config = host::usb_state().config;
+  EXPECT_EQ(config.xfer_type, UVC_XFER_ISOC);
+  EXPECT_EQ(config.interface_alt, 5);
+  EXPECT_EQ(config.ep_addr, 0x84);
+  EXPECT_EQ(config.ep_mps, 256u);
+}
+
+TEST_F(TransferSetupTest, FrameBufferNoLargerThanTheDeviceFrames) {
+  DescriptorBlob blob = webcam_header();
+  blob.mjpeg_format(3, 1);
+  blob.mjpeg_frame(1, 640, 480, 333333, {333333}, 40000);  // well under the 61440 the resolution asks for
+  blob.endpoint(0x82, 0x02, 64);
+  this->cam_->set_config_descriptor(blob.data());
+  this->start();
+  EXPECT_EQ(this->cam_->stream().frame_buffer_size, 40960u);
+  EXPECT_EQ(host::usb_state().config.frame_buffer_size, 40960u);
+}
+
+}  // namespace
+}  // namespace esphome::usb_webcam
@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "uvc_format.h"
+#include "webcam_fixture.h"
+
+namespace esphome::usb_webcam {
+namespace {
+
+static const uint32_t FPS30 = 333333;
+static const uint32_t FPS15 = 666666;
+static const uint32_t FPS10 = 1000000;
+static const uint32_t FPS5 = 2000000;
+
+/* ---------------- select_frame_interval ---------------- */
+TEST(SelectFrameIntervalTest, NotAdvertisedLeavesTheRequest) {
+  const UVCFrameInfo frame{640, 480, 0, 0, 0, 0};
+  EXPECT_EQ(select_frame_interval(frame, FPS10), FPS10);
+}
+
+TEST(SelectFrameIntervalTest, SingleIntervalIsAllThereIs) {
+  const UVCFrameInfo frame{640, 480, FPS15, 0, 0, 0};
+  EXPECT_EQ(select_frame_interval(frame, FPS10), FPS15);
+  EXPECT_EQ(select_frame_interval(frame, FPS30), FPS15);
+}
+
+TEST(SelectFrameIntervalTest, DiscreteTakesTheSlowestFastEnough) {
+  const UVCFrameInfo frame{640, 480, FPS15, FPS30, FPS5, 0};
+  EXPECT_EQ(select_frame_interval(frame, FPS10), FPS15);
+  EXPECT_EQ(select_frame_interval(frame, FPS15), FPS15);
+  EXPECT_EQ(select_frame_interval(frame, FPS15 - 1), FPS30);
+  EXPECT_EQ(select_frame_interval(frame, FPS5), FPS5);
+}
+
+TEST(SelectFrameIntervalTest, ContinuousRoundsToAStep) {
+  const UVCFrameInfo frame{640, 480, FPS30, FPS30, FPS5, FPS30};
+  EXPECT_EQ(select_frame_interval(frame, FPS10), 999999u);
+  EXPECT_EQ(select_frame_interval(frame, 999998), FPS15);
+  EXPECT_EQ(select_frame_interval(frame, 1500000), 1333332u);
+}
+
+TEST(SelectFrameIntervalTest, OutOfRangeFallsBackToTheLimits) {
+  const UVCFrameInfo frame{640, 480, FPS15, FPS15, FPS5, 0};
+  EXPECT_EQ(select_frame_interval(frame, FPS30), FPS15);  // faster than the device can do
+  EXPECT_EQ(select_frame_interval(frame, 50000000), FPS5);
+}
+
+TEST(SelectFrameIntervalTest, SwappedLimitsAreAccepted) {
+  const UVCFrameInfo frame{640, 480, FPS15, FPS5, FPS30, 0};
+  EXPECT_EQ(select_frame_interval(frame, FPS10), FPS15);
+  EXPECT_EQ(select_frame_interval(frame, 100000), FPS30);
+}
+
+/* ---------------- select_frame_size ---------------- */
+class SelectFrameSizeTest : public ::testing::Test {
+ protected:
+  int select(uint16_t width, uint16_t height, USBWebCamResolutionMatch match, uint32_t max_frame_bytes = 0) {
+    return select_frame_size(this->frames_.data(), this->frames_.size(), width, height, match, max_frame_bytes);
+  }
+
+  std::vector<UVCFrameInfo> frames_{
+      {1280, 720, FPS30, FPS30, FPS5, 0},
+      {320, 240, FPS30, FPS30, FPS5, 0},
+      {640, 480, FPS30, FPS30, FPS5, 0},
+      {800, 600, FPS15, FPS15, FPS5, 0},
+  };
+};
+
+TEST_F(SelectFrameSizeTest, ExactMatch) {
+  EXPECT_EQ(this->select(640, 480, USB_WEBCAM_MATCH_EXACT), 2);
+  EXPECT_EQ(this->select(640, 480, USB_WEBCAM_MATCH_NEAREST_BELOW), 2);
+  EXPECT_EQ(this->select(1024, 768, USB_WEBCAM_MATCH_EXACT), -1);
+}
+
+TEST_F(SelectFrameSizeTest, NearestBelow) {
+  EXPECT_EQ(this->select(1024, 768, USB_WEBCAM_MATCH_NEAREST_BELOW), 3);
+  EXPECT_EQ(this->select(1280, 600, USB_WEBCAM_MATCH_NEAREST_BELOW), 3);
+  EXPECT_EQ(this->select(700, 500, USB_WEBCAM_MATCH_NEAREST_BELOW), 2);
+}
+
+TEST_F(SelectFrameSizeTest, NothingSmallEnoughTakesTheSmallest) {
+  EXPECT_EQ(this->select(160, 120, USB_WEBCAM_MATCH_NEAREST_BELOW), 1);
+  EXPECT_EQ(this->select(160, 120, USB_WEBCAM_MATCH_BANDWIDTH, 100000), 1);
+}
+
+TEST_F(SelectFrameSizeTest, BandwidthSkipsFramesTooLargeForTheBuffers) {
+  // 1280x720 expected around 92 kB, 800x600 48 kB, 640x480 31 kB
+  EXPECT_EQ(this->select(1280, 720, USB_WEBCAM_MATCH_BANDWIDTH, 100000), 0);
+  EXPECT_EQ(this->select(1280, 720, USB_WEBCAM_MATCH_BANDWIDTH, 50000), 3);
+  EXPECT_EQ(this->select(1280, 720, USB_WEBCAM_MATCH_BANDWIDTH, 40000), 2);
+}
+
+TEST(SelectFrameSizeEmptyTest, NoFramesListed) {
+  EXPECT_EQ(select_frame_size(nullptr, 0, 640, 480, USB_WEBCAM_MATCH_NEAREST_BELOW, 0), -1);
+}
+
+/* ---------------- negotiated with a mock camera ---------------- */
+class NegotiationTest : public CameraTest {};
+
+TEST_F(NegotiationTest, StreamsAtTheMaxFramerate) {
+  host::usb_set_frame_list({{640, 480, FPS30, FPS30, FPS5, FPS30}, {320, 240, FPS30, FPS30, FPS5, FPS30}});
+  this->cam_->set_max_update_interval(100);
+  this->start();
+  EXPECT_EQ(host::usb_state().width, 640);
+  EXPECT_EQ(host::usb_state().height, 480);
+  EXPECT_EQ(host::usb_state().interval, 999999u);
+  EXPECT_TRUE(host::usb_state().started);
+}
+
+TEST_F(NegotiationTest, FallsBackToAListedResolution) {
+  host::usb_set_frame_list({{1280, 720, FPS30, 0, 0, 0}, {640, 480, FPS15, 0, 0, 0}});
+  this->cam_->set_frame_size(800, 600);
+  this->cam_->set_resolution_match(USB_WEBCAM_MATCH_NEAREST_BELOW);
+  this->cam_->set_max_update_interval(33);
+  this->start();
+  EXPECT_EQ(host::usb_state().width, 640);
+  EXPECT_EQ(host::usb_state().height, 480);
+  EXPECT_EQ(host::usb_state().interval, FPS15);  // all it lists
+}
+
+TEST_F(NegotiationTest, ExactMatchMissingLeavesTheStreamAlone) {
+  host::usb_set_frame_list({{1280, 720, FPS30, 0, 0, 0}});
+  this->cam_->set_frame_size(800, 600);
+  this->cam_->set_resolution_match(USB_WEBCAM_MATCH_EXACT);
+  this->start();
+  EXPECT_EQ(host::usb_state().resets, 0u);
+  EXPECT_EQ(host::usb_state().width, 800);
+}
+
+}  // namespace
+}  // namespace esphome::usb_webcam
@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "host.h"
+#include "jpeg_fixture.h"
+#include "usb_webcam.h"
+
+namespace esphome::usb_webcam {
+
+/* USBWebCam with the state the tests look at */
+class TestCamera : public USBWebCam {
+ public:
+  USBWebCamStream &stream() { return this->stream_; }
+  USBWebCamLinkState link_state() const { return this->link_state_; }
+  const LatencyHistogram &loop_latency() const { return this->loop_latency_; }
+};
+
+/* A camera on the host shims. Tests configure cam_, then start() sets it up
+ * and plugs in a camera listing 640x480 at 30 fps; images handed out are
+ * kept in images_ until the test lets them go. */
+class CameraTest : public ::testing::Test {
+ protected:
+  static constexpr uint16_t WIDTH = 640;
+  static constexpr uint16_t HEIGHT = 480;
+  static constexpr uint32_t FRAME_US = 33333;
+
+  void SetUp() override {
+    host::reset();
+    host::usb_set_frame_list({{WIDTH, HEIGHT, 333333, 333333, 10000000, 0}});
+    this->cam_ = std::make_unique<TestCamera>();
+    this->cam_->set_frame_size(WIDTH, HEIGHT);
+    this->cam_->set_max_update_interval(1);
+    this->cam_->set_idle_update_interval(0);
+    this->cam_->add_image_callback(
+        [this](std::shared_ptr<camera::CameraImage> image) { this->images_.push_back(std::move(image)); });
+    this->frame_ = make_test_jpeg(WIDTH, HEIGHT, 0);
+  }
+
+  void start() {
+    this->cam_->setup();
+    ASSERT_FALSE(this->cam_->is_failed());
+    ASSERT_TRUE(host::usb_connect());
+    this->loop();
+  }
+
+  void loop() { host::loop_once(this->cam_.get()); }
+
+  /* one frame period later the camera completes a frame, then the loop runs */
+  bool send(const std::vector<uint8_t> &frame) {
+    host::advance(FRAME_US);
+    const bool sent = host::usb_send_frame(frame.data(), frame.size());
+    this->loop();
+    return sent;
+  }
+  bool send() { return this->send(this->frame_); }
+
+  USBWebCamImage *image(size_t index) { return static_cast<USBWebCamImage *>(this->images_.at(index).get()); }
+
+  std::unique_ptr<TestCamera> cam_;
+  std::vector<std::shared_ptr<camera::CameraImage>> images_;
+  std::vector<uint8_t> frame_;
+};
+
+}  // namespace esphome::usb_webcam